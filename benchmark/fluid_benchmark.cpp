@@ -0,0 +1,758 @@
+// Headless fluid benchmark: replays a scenario for N steps and reports timing and a checksum of the final fields.
+//
+//	xtd_fluid_simulation_benchmark [--scenario file] [--size N] [--steps N] [--threads N]
+//	                               [--simd scalar|avx2|avx512] [--fused on|off] [--precision fp32|fp16|bf16]
+//	                               [--sparse on|off] [--expect-checksum hex] [--trace file.json]
+//	                               [--ensemble K] [--layout members|interleaved]
+//	                               [--load-state file] [--first-step N] [--save-state file] [--record file] [--replay file]
+//	                               [--advection semi-lagrangian|maccormack] [--advection-test N] [--task-graph on|off]
+//	                               [--display WxH] [--volume N] [--tracers N] [--export file.y4m|prefix]
+//
+// Command line values override the scenario's. With --expect-checksum the exit code is 1 when the final
+// fields differ, so a build can be gated on it. Checksums only compare runs on the same SIMD level and
+// thread count of the same build: float results change with kernel width and summation order.
+// Per stage p50/p99 are printed when built with profiling, --trace writes the last Profiler::CAPACITY steps as a Chrome trace.
+// With 16-bit field storage an fp32 twin replays the same inputs (untimed), to report the memory saved and the error against it
+// after the first step (rounding) and the last one. The flow is chaotic, so late errors are compared with how far a second
+// fp32 twin drifts from a 1e-4 velocity nudge: below that floor the storage is not what the error comes from.
+// With --sparse on the twins run on every tile, the same way they give the error of skipping the quiet ones,
+// and the mean fraction of active tiles over the steps is printed.
+// --ensemble K steps K members at once (FluidEnsemble) instead, viscosity and diffusion swept over 4 x 4 doublings
+// of the defaults, and reports the aggregate member steps per second. Member 0 is checked against a lone Fluid.
+// --load-state starts from a checkpoint (Fluid::LoadState) and --first-step N resumes the scenario at step N, so a run
+// saved with --save-state after N steps and resumed continues to the same checksum. --record writes every step's density
+// to a recording (RecordingWriter, waiting for the writer rather than dropping) and --replay plays one back alone,
+// reporting how fast frames decode from the mapped file.
+// --advection-test N measures what each advection scheme costs and keeps instead: a sharp disc carried one turn around
+// the grid center by Fluid::Advect alone, at N / 2, N and 2N, where the exact result is the disc it started as.
+// Quality is compared at matched cost, the time of a whole turn (more steps on a finer grid, same cells per step).
+// --task-graph off runs the Update stages one after another (Fluid::set_task_graph), same checksum as on.
+// --display WxH then times drawing the final density at that view size with each Upscaler filter, what the view costs
+// on its own, whatever the grid size.
+// --volume N steps a Fluid3D of N^3 cells instead, with the scenario's steps, solvers, advection and threads: a dye and
+// velocity sphere emitted near the bottom center every step, rising. It prints the time per step and a density checksum.
+// --tracers N then carries N tracers (TracerSystem) through the final velocity field for a second of steps, with each
+// SIMD level up to the scenario's, and times the integration and the splat into a view (--display's size, 600x600 otherwise).
+// --export renders every step's density (cyan over black as the application draws it, at --display's size with the
+// bicubic filter, one pixel per cell otherwise) to a Y4M file or a numbered PNG sequence (FrameExporter), waiting for
+// the writer rather than dropping: the offline way to make a clip, as fast as the steps and the disk allow, no window.
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+#include <vector>
+#include "frame_exporter.hpp"
+#include "recording.hpp"
+#include "fluid3d.hpp"
+#include "scenario.hpp"
+#include "tracer_system.hpp"
+#include "upscaler.hpp"
+using namespace xtd_fluid_simulation;
+
+namespace {
+	// FNV-1a over the bit patterns of count floats
+	std::uint64_t Checksum(std::uint64_t hash, const float* values, std::size_t count) noexcept
+	{
+		for (std::size_t index = 0; index < count; ++index)
+		{
+			std::uint32_t bits;
+			std::memcpy(&bits, &values[index], sizeof(bits));
+			for (int byte = 0; byte < 4; ++byte)
+			{
+				hash ^= (bits >> (byte * 8)) & 0xffu;
+				hash *= 0x100000001b3ull;
+			}
+		}
+		return hash;
+	}
+
+	bool ParseSimdLevel(const std::string& name, SimdLevel& level) noexcept
+	{
+		if (name == "scalar") level = SimdLevel::Scalar;
+		else if (name == "avx2") level = SimdLevel::Avx2;
+		else if (name == "avx512") level = SimdLevel::Avx512;
+		else return false;
+		return true;
+	}
+
+	// Largest and mean absolute difference of count values
+	struct FieldError {
+		float max = 0.0f;
+		double mean = 0.0;
+	};
+
+	FieldError Compare(const float* values, const float* reference, std::size_t count) noexcept
+	{
+		FieldError error;
+		for (std::size_t index = 0; index < count; ++index)
+		{
+			const float difference = std::fabs(values[index] - reference[index]);
+			error.max = std::max(error.max, difference);
+			error.mean += difference;
+		}
+		error.mean /= std::max<std::size_t>(count, 1);
+		return error;
+	}
+
+	// Percentage of cells drawn with a different alpha, the density to alpha mapping of fluid_renderer
+	double AlphaDifferences(const float* density, const float* reference, std::size_t count) noexcept
+	{
+		const auto alpha = [](float value) { return static_cast<int>(std::min(std::max(value, 0.0f), 255.0f)); };
+		std::size_t differences = 0;
+		for (std::size_t index = 0; index < count; ++index)
+			differences += alpha(density[index]) != alpha(reference[index]);
+		return 100.0 * differences / std::max<std::size_t>(count, 1);
+	}
+
+	struct FluidError {
+		FieldError density, velocityX, velocityY;
+		double alphaDifferences = 0.0;
+	};
+
+	FluidError Compare(const Fluid& fluid, const Fluid& reference)
+	{
+		const std::size_t cells = static_cast<std::size_t>(fluid.get_size()) * fluid.get_size();
+		std::vector<float> density(cells), referenceDensity(cells);
+		fluid.ReadDensity(density.data());
+		reference.ReadDensity(referenceDensity.data());
+
+		FluidError error;
+		error.density = Compare(density.data(), referenceDensity.data(), cells);
+		error.velocityX = Compare(fluid.get_velocity_x(), reference.get_velocity_x(), cells);
+		error.velocityY = Compare(fluid.get_velocity_y(), reference.get_velocity_y(), cells);
+		error.alphaDifferences = AlphaDifferences(density.data(), referenceDensity.data(), cells);
+		return error;
+	}
+
+	void PrintError(const char* name, const FluidError& error)
+	{
+		std::printf("%-12s density %.3g / %.3g, alpha %.2f%%, velocity x %.3g / %.3g, y %.3g / %.3g\n", name,
+			error.density.max, error.density.mean, error.alphaDifferences,
+			error.velocityX.max, error.velocityX.mean, error.velocityY.max, error.velocityY.mean);
+	}
+
+	// Viscosity and diffusion doubled with the member index, 4 steps each, then starting over
+	std::vector<FluidEnsemble::Parameters> SweepParameters(const Scenario& scenario, int members)
+	{
+		std::vector<FluidEnsemble::Parameters> parameters(members);
+		for (int member = 0; member < members; ++member)
+		{
+			parameters[member].viscosity = Fluid::DEFAULT_VISCOSITY * static_cast<float>(1 << (member % 4));
+			parameters[member].diffusion = Fluid::DEFAULT_DIFFUSION * static_cast<float>(1 << (member / 4 % 4));
+			parameters[member].speed = scenario.speed;
+			parameters[member].iterations = scenario.iterations;
+		}
+		return parameters;
+	}
+
+	int RunEnsemble(const Scenario& scenario, int members, FluidEnsemble::Layout layout, SimdLevel simdLevel)
+	{
+		const int size = std::max(scenario.size, Fluid::MIN_SIZE);
+		const int scale = std::max(1, Fluid::DEFAULT_SIZE * Fluid::DEFAULT_SCALE / size);
+		FluidEnsemble ensemble(size, scale, SweepParameters(scenario, members), layout, scenario.threads);
+		if (layout == FluidEnsemble::Layout::PerMember)
+		{
+			for (int member = 0; member < members; ++member)
+			{
+				Fluid& fluid = *ensemble.GetFluid(member);
+				scenario.Configure(fluid);
+				fluid.set_thread_count(1);
+			}
+		}
+		ensemble.set_simd_level(simdLevel);
+
+		// Each member replays the scenario with its own random sequence, only touched by the thread stepping it
+		std::vector<std::default_random_engine> randoms(members, std::default_random_engine(scenario.seed));
+		using clock = std::chrono::steady_clock;
+		const clock::time_point start = clock::now();
+		ensemble.Update(scenario.timestep, scenario.steps, [&](FluidEnsemble::Member member, int step) {
+			scenario.Inject(member, step, randoms[member.get_index()]);
+		});
+		const double milliseconds = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		int stolen = 0;
+		for (const int tasks : ensemble.get_stolen_tasks())
+			stolen += tasks;
+		const double memberSteps = static_cast<double>(members) * scenario.steps;
+		std::printf("size        %d\n", size);
+		std::printf("steps       %d\n", scenario.steps);
+		std::printf("members     %d (%s)\n", members, layout == FluidEnsemble::Layout::PerMember ? "one Fluid each" : "interleaved");
+		std::printf("threads     %d\n", ensemble.get_thread_count());
+		std::printf("stolen      %d tasks\n", stolen);
+		std::printf("ms/step     %.3f (all members)\n", scenario.steps > 0 ? milliseconds / scenario.steps : 0.0);
+		std::printf("steps/sec   %.1f (member steps, aggregate)\n", milliseconds > 0.0 ? 1000.0 * memberSteps / milliseconds : 0.0);
+
+		// Member 0 replayed alone, as the same Fluid would have run it, and a second time nudged once (see the header)
+		std::unique_ptr<Fluid> references[2];
+		for (int index = 0; index < 2; ++index)
+		{
+			std::unique_ptr<Fluid>& reference = references[index];
+			reference.reset(new Fluid(size, scale));
+			scenario.Configure(*reference);
+			reference->set_simd_level(simdLevel);
+			reference->set_viscosity(ensemble.get_parameters(0).viscosity);
+			reference->set_diffusion(ensemble.get_parameters(0).diffusion);
+			if (index == 1)
+				reference->AddVelocity(size / 3, size / 3, 1.0e-4f, 0.0f);
+			std::default_random_engine random(scenario.seed);
+			for (int step = 0; step < scenario.steps; ++step)
+			{
+				scenario.Inject(*reference, step, random);
+				reference->Update(scenario.timestep);
+			}
+		}
+		const std::size_t cells = static_cast<std::size_t>(size) * size;
+		std::vector<float> density(cells), velocityX(cells), velocityY(cells), referenceDensity(cells), nudgedDensity(cells);
+		ensemble.ReadDensity(0, density.data());
+		ensemble.ReadVelocity(0, velocityX.data(), velocityY.data());
+		references[0]->ReadDensity(referenceDensity.data());
+		references[1]->ReadDensity(nudgedDensity.data());
+		std::printf("\nmember 0 against a lone Fluid (max absolute error)\n");
+		std::printf("%-12s density %.3g, velocity x %.3g, y %.3g\n", "final",
+			Compare(density.data(), referenceDensity.data(), cells).max,
+			Compare(velocityX.data(), references[0]->get_velocity_x(), cells).max,
+			Compare(velocityY.data(), references[0]->get_velocity_y(), cells).max);
+		PrintError("fp32 nudged", Compare(*references[1], *references[0]));
+		return 0;
+	}
+
+	// Plays a recording back the way fluid_renderer does, into an alpha frame instead of pixels
+	int RunReplay(const std::string& path)
+	{
+		using clock = std::chrono::steady_clock;
+		const clock::time_point open = clock::now();
+		RecordingReader recording(path);
+		const double openMilliseconds = std::chrono::duration<double, std::milli>(clock::now() - open).count();
+
+		const int frames = recording.get_frame_count();
+		const std::size_t cells = static_cast<std::size_t>(recording.get_size()) * recording.get_size();
+		std::vector<std::uint8_t> alpha(cells);
+		std::size_t changed = 0;
+		const clock::time_point start = clock::now();
+		for (int frame = 0; frame < frames; ++frame)
+		{
+			recording.ForEachRun(frame, [&](std::size_t cell, const std::uint8_t* values, std::size_t count) {
+				std::memcpy(alpha.data() + cell, values, count);
+				changed += count;
+			});
+		}
+		const double milliseconds = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		// The longest seek decodes a whole key frame interval
+		const int seekFrame = std::min(std::max(recording.get_key_interval() - 1, 0), std::max(frames - 1, 0));
+		const clock::time_point seek = clock::now();
+		if (frames > 0)
+			recording.ReadFrame(seekFrame, alpha.data());
+		const double seekMilliseconds = std::chrono::duration<double, std::milli>(clock::now() - seek).count();
+
+		std::printf("size        %d\n", recording.get_size());
+		std::printf("frames      %d (key frame every %d)\n", frames, recording.get_key_interval());
+		std::printf("open        %.3f ms (map and index)\n", openMilliseconds);
+		std::printf("ms/frame    %.4f (in order, %.1f%% of cells written per frame)\n", frames > 0 ? milliseconds / frames : 0.0, frames > 0 ? 100.0 * changed / (static_cast<double>(cells) * frames) : 0.0);
+		std::printf("seek        %.3f ms (frame %d from its key frame)\n", seekMilliseconds, seekFrame);
+		return 0;
+	}
+
+	// Density of a disc of radius cells around (x, y), its edge antialiased over a cell
+	void DrawDisc(int size, float x, float y, float radius, float* density) noexcept
+	{
+		for (int j = 0; j < size; ++j)
+			for (int i = 0; i < size; ++i)
+			{
+				const float distance = std::hypot(i - x, j - y);
+				density[j * size + i] = 255.0f * std::min(std::max(radius - distance + 0.5f, 0.0f), 1.0f);
+			}
+	}
+
+	struct AdvectionResult {
+		Fluid::Advection advection;
+		int size;
+		double msPerStep, msPerTurn;
+		double error; // Sum of absolute differences over the disc's sum, %
+		double peak; // Largest density left, % of the disc's
+	};
+
+	AdvectionResult RunAdvectionTurn(Fluid::Advection advection, int size, SimdLevel simdLevel)
+	{
+		constexpr float PI = 3.14159265358979f;
+		Fluid fluid(size, 1);
+		fluid.set_simd_level(simdLevel);
+		fluid.set_advection(advection);
+
+		// A cell per unit of velocity per step (dt * (N - 2) = 1), under a cell per step at the disc
+		const float dt = 1.0f / (size - 2);
+		const int steps = 2 * size;
+		const float turnRate = 2.0f * PI / steps;
+		const float center = 0.5f * (size - 1);
+		const std::size_t cells = static_cast<std::size_t>(size) * size;
+		std::vector<float> velocityX(cells), velocityY(cells), exact(cells), density(cells), advected(cells);
+		for (int j = 0; j < size; ++j)
+			for (int i = 0; i < size; ++i)
+			{
+				velocityX[j * size + i] = -turnRate * (j - center);
+				velocityY[j * size + i] = turnRate * (i - center);
+			}
+		DrawDisc(size, center + 0.25f * size, center, 0.125f * size, exact.data());
+		density = exact;
+
+		using clock = std::chrono::steady_clock;
+		const clock::time_point start = clock::now();
+		for (int step = 0; step < steps; ++step)
+		{
+			fluid.Advect(0, advected.data(), density.data(), velocityX.data(), velocityY.data(), dt);
+			density.swap(advected);
+		}
+		const double milliseconds = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		double difference = 0.0, total = 0.0;
+		float peak = 0.0f;
+		for (std::size_t cell = 0; cell < cells; ++cell)
+		{
+			difference += std::fabs(density[cell] - exact[cell]);
+			total += exact[cell];
+			peak = std::max(peak, density[cell]);
+		}
+		return { advection, size, milliseconds / steps, milliseconds, 100.0 * difference / total, 100.0 * peak / 255.0 };
+	}
+
+	const char* ToString(Fluid::Advection advection) noexcept
+	{
+		return advection == Fluid::Advection::MacCormack ? "maccormack" : "semi-lagrangian";
+	}
+
+	int RunAdvectionTest(int size, SimdLevel simdLevel)
+	{
+		std::vector<AdvectionResult> results;
+		for (const int resolution : { size / 2, size, 2 * size })
+			for (const Fluid::Advection advection : { Fluid::Advection::SemiLagrangian, Fluid::Advection::MacCormack })
+				results.push_back(RunAdvectionTurn(advection, std::max(resolution, Fluid::MIN_SIZE), simdLevel));
+
+		std::printf("disc carried one turn (2N steps), against the exact disc\n");
+		std::printf("%-16s %6s %9s %9s %9s %7s\n", "advection", "size", "ms/step", "ms/turn", "error", "peak");
+		for (const AdvectionResult& result : results)
+			std::printf("%-16s %6d %9.4f %9.2f %8.1f%% %6.1f%%\n", ToString(result.advection), result.size, result.msPerStep, result.msPerTurn, result.error, result.peak);
+
+		// Each MacCormack run against the semi-Lagrangian one closest in cost
+		std::printf("\nmatched cost (ms/turn)\n");
+		for (const AdvectionResult& result : results)
+		{
+			if (result.advection != Fluid::Advection::MacCormack)
+				continue;
+			const AdvectionResult* match = nullptr;
+			for (const AdvectionResult& other : results)
+				if (other.advection == Fluid::Advection::SemiLagrangian
+					&& (!match || std::fabs(std::log(other.msPerTurn / result.msPerTurn)) < std::fabs(std::log(match->msPerTurn / result.msPerTurn))))
+					match = &other;
+			std::printf("maccormack %d: %.1f%% error in %.2f ms, semi-lagrangian %d: %.1f%% in %.2f ms\n",
+				result.size, result.error, result.msPerTurn, match->size, match->error, match->msPerTurn);
+		}
+		return 0;
+	}
+
+	const char* ToString(Fluid::Solver solver) noexcept
+	{
+		switch (solver)
+		{
+			case Fluid::Solver::RedBlackGaussSeidel: return "red-black";
+			case Fluid::Solver::Jacobi: return "jacobi";
+			default: return "gauss-seidel";
+		}
+	}
+
+	int RunVolume(const Scenario& scenario, int size)
+	{
+		Fluid3D fluid(size);
+		fluid.set_thread_count(scenario.threads);
+		fluid.set_speed(scenario.speed);
+		fluid.set_diffuse_solver(scenario.diffuseSolver);
+		fluid.set_project_solver(scenario.projectSolver);
+		fluid.set_advection(scenario.advection);
+		const int n = fluid.get_size();
+		const float center = 0.5f * n;
+		const Fluid3D::Brush emitter = { center, 0.8f * n, center, std::max(0.05f * n, 1.0f), scenario.emitterDensity, 0.0f, -2.0f, 0.0f };
+
+		using clock = std::chrono::steady_clock;
+		const clock::time_point start = clock::now();
+		for (int step = 0; step < scenario.steps; ++step)
+		{
+			fluid.AddBrush(emitter);
+			fluid.Update(scenario.timestep);
+		}
+		const double milliseconds = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+		const double msPerStep = scenario.steps > 0 ? milliseconds / scenario.steps : 0.0;
+		std::printf("volume      %d^3 (%zu cells)\n", n, fluid.get_cell_count());
+		std::printf("steps       %d\n", scenario.steps);
+		std::printf("threads     %d\n", fluid.get_thread_count());
+		std::printf("solvers     diffuse %s, project %s, %d iterations\n", ToString(fluid.get_diffuse_solver()), ToString(fluid.get_project_solver()), fluid.get_iterations());
+		std::printf("advection   %s\n", ToString(fluid.get_advection()));
+		std::printf("ms/step     %.3f\n", msPerStep);
+		std::printf("Mcells/s    %.1f\n", msPerStep > 0.0 ? fluid.get_cell_count() / (msPerStep * 1.0e3) : 0.0);
+		std::printf("checksum    %016llx\n", static_cast<unsigned long long>(Checksum(0xcbf29ce484222325ull, fluid.get_density(), fluid.get_cell_count())));
+		return 0;
+	}
+
+	const char* ToString(UpscaleFilter filter) noexcept
+	{
+		switch (filter)
+		{
+			case UpscaleFilter::Bilinear: return "bilinear";
+			case UpscaleFilter::Bicubic: return "bicubic";
+			default: return "nearest";
+		}
+	}
+
+	// Resamples density into a width x height view with each filter, through a gray palette, and prints the time per frame
+	void RunDisplayTest(const float* density, int size, int width, int height, int threads)
+	{
+		constexpr int FRAMES = 30;
+		std::uint32_t palette[256];
+		for (std::uint32_t alpha = 0; alpha < 256; ++alpha)
+			palette[alpha] = 0xff000000u | alpha << 16 | alpha << 8 | alpha;
+		std::vector<std::uint32_t> pixels(static_cast<std::size_t>(width) * height);
+		Upscaler upscaler(threads);
+
+		std::printf("\ndisplay %dx%d from %dx%d, %d threads\n", width, height, size, size, upscaler.get_thread_count());
+		std::printf("%-12s %9s %11s\n", "filter", "ms/frame", "Mpixel/s");
+		for (const UpscaleFilter filter : { UpscaleFilter::Nearest, UpscaleFilter::Bilinear, UpscaleFilter::Bicubic })
+		{
+			// The first frame builds the taps
+			upscaler.Resample(density, size, palette, pixels.data(), width, height, filter);
+			const auto start = std::chrono::steady_clock::now();
+			for (int frame = 0; frame < FRAMES; ++frame)
+				upscaler.Resample(density, size, palette, pixels.data(), width, height, filter);
+			const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / FRAMES;
+			std::printf("%-12s %9.3f %11.1f\n", ToString(filter), milliseconds, milliseconds > 0.0 ? pixels.size() / (milliseconds * 1.0e3) : 0.0);
+		}
+	}
+
+	void RunTracerTest(const Fluid& fluid, float motionStep, int count, int width, int height, int threads, SimdLevel simdLevel)
+	{
+		constexpr int STEPS = 60;
+		const int size = fluid.get_size();
+		TracerSystem tracers(count, threads);
+		std::vector<std::uint32_t> pixels(static_cast<std::size_t>(width) * height);
+
+		std::printf("\ntracers %d over %dx%d, splatted at %dx%d, %d threads\n", count, size, size, width, height, tracers.get_thread_count());
+		std::printf("%-12s %9s %9s %12s\n", "simd", "advect ms", "splat ms", "Mtracers/s");
+		for (const SimdLevel level : { SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512 })
+		{
+			if (level > simdLevel)
+				break;
+			// The same tracers for every level, spread over the interior and living for the whole run
+			tracers.Clear();
+			tracers.set_simd_level(level);
+			tracers.Emit(size, size * 0.5f, size * 0.5f, size * 0.5f, count, STEPS + 1);
+			std::chrono::steady_clock::duration advect{}, splat{};
+			for (int step = 0; step < STEPS; ++step)
+			{
+				auto start = std::chrono::steady_clock::now();
+				tracers.Advect(fluid.get_velocity_x(), fluid.get_velocity_y(), size, motionStep);
+				advect += std::chrono::steady_clock::now() - start;
+				std::fill(pixels.begin(), pixels.end(), 0xff000000u);
+				start = std::chrono::steady_clock::now();
+				tracers.Splat(pixels.data(), width, height, size, 0xffffffu);
+				splat += std::chrono::steady_clock::now() - start;
+			}
+			const double advectMilliseconds = std::chrono::duration<double, std::milli>(advect).count() / STEPS;
+			const double splatMilliseconds = std::chrono::duration<double, std::milli>(splat).count() / STEPS;
+			std::printf("%-12s %9.3f %9.3f %12.1f\n", ToString(tracers.get_simd_level()), advectMilliseconds, splatMilliseconds,
+				advectMilliseconds > 0.0 ? count / (advectMilliseconds * 1.0e3) : 0.0);
+		}
+	}
+
+	int Usage(const char* program)
+	{
+		std::fprintf(stderr, "usage: %s [--scenario file] [--size N] [--steps N] [--threads N] [--simd scalar|avx2|avx512] [--fused on|off] [--precision fp32|fp16|bf16] [--sparse on|off] [--expect-checksum hex] [--trace file.json] [--ensemble K] [--layout members|interleaved] [--load-state file] [--first-step N] [--save-state file] [--record file] [--replay file] [--advection semi-lagrangian|maccormack] [--advection-test N] [--task-graph on|off] [--display WxH] [--volume N] [--tracers N] [--export file.y4m|prefix]\n", program);
+		return 2;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		Scenario scenario;
+		SimdLevel simdLevel = DetectSimdLevel();
+		std::string expectedChecksum;
+		std::string tracePath;
+		int ensembleMembers = 0;
+		FluidEnsemble::Layout ensembleLayout = FluidEnsemble::Layout::PerMember;
+		std::string loadStatePath, saveStatePath, recordPath, replayPath, exportPath;
+		int firstStep = 0;
+		int advectionTestSize = 0;
+		int displayWidth = 0, displayHeight = 0;
+		int volumeSize = 0;
+		int tracerCount = 0;
+
+		// Scenario first so the other options override it whatever their order
+		for (int index = 1; index + 1 < argc; ++index)
+			if (std::strcmp(argv[index], "--scenario") == 0)
+				scenario = Scenario::Load(argv[index + 1]);
+
+		for (int index = 1; index < argc; ++index)
+		{
+			const std::string option = argv[index];
+			if (index + 1 >= argc)
+				return Usage(argv[0]);
+			const std::string value = argv[++index];
+			if (option == "--scenario") continue;
+			else if (option == "--size") scenario.size = std::atoi(value.c_str());
+			else if (option == "--steps") scenario.steps = std::atoi(value.c_str());
+			else if (option == "--threads") scenario.threads = std::atoi(value.c_str());
+			else if (option == "--simd") { if (!ParseSimdLevel(value, simdLevel)) return Usage(argv[0]); }
+			else if (option == "--fused") scenario.fusedPasses = value != "off";
+			else if (option == "--precision") scenario.precision = ParseFieldPrecision(value);
+			else if (option == "--sparse") scenario.sparseTiles = value != "off";
+			else if (option == "--expect-checksum") expectedChecksum = value;
+			else if (option == "--trace") tracePath = value;
+			else if (option == "--ensemble") ensembleMembers = std::atoi(value.c_str());
+			else if (option == "--layout") ensembleLayout = value == "interleaved" ? FluidEnsemble::Layout::Interleaved : FluidEnsemble::Layout::PerMember;
+			else if (option == "--load-state") loadStatePath = value;
+			else if (option == "--first-step") firstStep = std::max(std::atoi(value.c_str()), 0);
+			else if (option == "--save-state") saveStatePath = value;
+			else if (option == "--record") recordPath = value;
+			else if (option == "--replay") replayPath = value;
+			else if (option == "--advection") scenario.advection = ParseAdvection(value);
+			else if (option == "--advection-test") advectionTestSize = std::atoi(value.c_str());
+			else if (option == "--task-graph") scenario.taskGraph = value != "off";
+			else if (option == "--display") { if (std::sscanf(value.c_str(), "%dx%d", &displayWidth, &displayHeight) != 2 || displayWidth <= 0 || displayHeight <= 0) return Usage(argv[0]); }
+			else if (option == "--volume") volumeSize = std::atoi(value.c_str());
+			else if (option == "--tracers") tracerCount = std::atoi(value.c_str());
+			else if (option == "--export") exportPath = value;
+			else return Usage(argv[0]);
+		}
+
+		if (!replayPath.empty())
+			return RunReplay(replayPath);
+		if (advectionTestSize > 0)
+			return RunAdvectionTest(advectionTestSize, simdLevel);
+		if (volumeSize > 0)
+			return RunVolume(scenario, volumeSize);
+		if (ensembleMembers > 0)
+			return RunEnsemble(scenario, ensembleMembers, ensembleLayout, simdLevel);
+
+		// Same scale as main_form, the velocity sliders address cells in pixels
+		const int size = std::max(scenario.size, Fluid::MIN_SIZE);
+		const int scale = std::max(1, Fluid::DEFAULT_SIZE * Fluid::DEFAULT_SCALE / size);
+		Fluid fluid(size, scale);
+		scenario.Configure(fluid);
+		fluid.set_simd_level(simdLevel);
+		std::default_random_engine random(scenario.seed);
+		using clock = std::chrono::steady_clock;
+		double loadMilliseconds = 0.0;
+		if (!loadStatePath.empty())
+		{
+			const clock::time_point start = clock::now();
+			fluid.LoadState(loadStatePath);
+			loadMilliseconds = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+		}
+
+		// Dense fp32 twins fed the same inputs (same random sequence), the second one nudged once
+		std::unique_ptr<Fluid> twins[2];
+		std::default_random_engine twinRandom[2] = { std::default_random_engine(scenario.seed), std::default_random_engine(scenario.seed) };
+		FluidError firstStepError;
+		if (scenario.precision != FieldPrecision::Float32 || scenario.sparseTiles)
+		{
+			for (std::unique_ptr<Fluid>& twin : twins)
+			{
+				twin.reset(new Fluid(size, scale));
+				scenario.Configure(*twin);
+				if (!loadStatePath.empty())
+					twin->LoadState(loadStatePath);
+				twin->set_field_precision(FieldPrecision::Float32);
+				twin->set_sparse_tiles(false);
+				twin->set_simd_level(simdLevel);
+			}
+			twins[1]->AddVelocity(size / 3, size / 3, 1.0e-4f, 0.0f);
+		}
+
+		// Resuming at firstStep: the random sequences are where they were, the injections of the skipped steps go to a scratch fluid
+		if (firstStep > 0)
+		{
+			Fluid skipped(size, scale);
+			for (int step = 0; step < firstStep; ++step)
+			{
+				scenario.Inject(skipped, step, random);
+				for (std::default_random_engine& twin : twinRandom)
+					scenario.Inject(skipped, step, twin);
+			}
+		}
+
+		std::unique_ptr<RecordingWriter> recorder;
+		std::vector<float> recordedDensity;
+		if (!recordPath.empty())
+		{
+			recorder.reset(new RecordingWriter(recordPath, size));
+			recordedDensity.resize(static_cast<std::size_t>(size) * size);
+		}
+
+		// Frames rendered like the application's default colors, the palette of fluid_renderer
+		std::unique_ptr<FrameExporter> exporter;
+		std::unique_ptr<Upscaler> exportUpscaler;
+		std::vector<float> exportDensity;
+		std::vector<std::uint32_t> exportPixels;
+		std::uint32_t exportPalette[256];
+		const clock::time_point exportStart = clock::now();
+		if (!exportPath.empty())
+		{
+			const int width = displayWidth > 0 ? displayWidth : size;
+			const int height = displayHeight > 0 ? displayHeight : size;
+			const int frameRate = std::max(static_cast<int>(1.0f / scenario.timestep + 0.5f), 1);
+			exporter.reset(new FrameExporter(exportPath, FrameExporter::FormatFor(exportPath), width, height, frameRate));
+			exportUpscaler.reset(new Upscaler(scenario.threads));
+			exportDensity.resize(static_cast<std::size_t>(size) * size);
+			exportPixels.resize(static_cast<std::size_t>(width) * height);
+			for (std::uint32_t alpha = 0; alpha < 256; ++alpha)
+				exportPalette[alpha] = 0xff000000u | alpha << 8 | alpha;
+		}
+
+		clock::duration elapsed{};
+		Profiler profiler;
+		const int tiles = fluid.get_active_tiles().GetTilesPerRow() * fluid.get_active_tiles().GetTilesPerRow();
+		double activeTiles = 0.0;
+		for (int step = 0; step < scenario.steps; ++step)
+		{
+			scenario.Inject(fluid, firstStep + step, random);
+			const clock::time_point start = clock::now();
+			fluid.Update(scenario.timestep);
+			elapsed += clock::now() - start;
+			if (recorder)
+			{
+				fluid.ReadDensity(recordedDensity.data());
+				recorder->Append(recordedDensity.data(), true);
+			}
+			if (exporter)
+			{
+				fluid.ReadDensity(exportDensity.data());
+				exportUpscaler->Resample(exportDensity.data(), size, exportPalette, exportPixels.data(), exporter->get_width(), exporter->get_height(),
+					displayWidth > 0 ? UpscaleFilter::Bicubic : UpscaleFilter::Nearest);
+				exporter->Append(exportPixels.data(), exporter->get_width(), exporter->get_height(), true);
+			}
+			profiler.Record(fluid.get_frame_sample());
+			activeTiles += static_cast<double>(fluid.get_active_tiles().GetActiveCount()) / tiles;
+			if (twins[0])
+			{
+				for (int twin = 0; twin < 2; ++twin)
+				{
+					scenario.Inject(*twins[twin], firstStep + step, twinRandom[twin]);
+					twins[twin]->Update(scenario.timestep);
+				}
+				if (step == 0)
+					firstStepError = Compare(fluid, *twins[0]);
+			}
+		}
+
+		const std::size_t cells = static_cast<std::size_t>(size) * size;
+		std::vector<float> density(cells);
+		fluid.ReadDensity(density.data());
+		std::uint64_t checksum = 0xcbf29ce484222325ull;
+		checksum = Checksum(checksum, density.data(), cells);
+		checksum = Checksum(checksum, fluid.get_velocity_x(), cells);
+		checksum = Checksum(checksum, fluid.get_velocity_y(), cells);
+
+		const double milliseconds = std::chrono::duration<double, std::milli>(elapsed).count();
+		const double msPerStep = scenario.steps > 0 ? milliseconds / scenario.steps : 0.0;
+		char checksumText[17];
+		std::snprintf(checksumText, sizeof(checksumText), "%016llx", static_cast<unsigned long long>(checksum));
+
+		std::printf("size        %d\n", size);
+		std::printf("steps       %d\n", scenario.steps);
+		std::printf("threads     %d\n", fluid.get_thread_count());
+		std::printf("simd        %s\n", ToString(fluid.get_simd_level()));
+		std::printf("fused       %s\n", scenario.fusedPasses ? "on" : "off");
+		std::printf("task graph  %s\n", fluid.get_task_graph() ? "on" : "off");
+		std::printf("precision   %s\n", ToString(fluid.get_field_precision()));
+		std::printf("advection   %s\n", ToString(fluid.get_advection()));
+		std::printf("fields      %.2f MB\n", fluid.get_field_bytes() / 1.0e6);
+		if (fluid.get_sparse_tiles())
+			std::printf("sparse      %.1f%% of tiles active (mean)\n", scenario.steps > 0 ? 100.0 * activeTiles / scenario.steps : 0.0);
+		if (!fluid.get_obstacles().IsEmpty())
+			std::printf("obstacles   %d solid cells\n", fluid.get_obstacles().GetSolidCount());
+		std::printf("ms/step     %.3f\n", msPerStep);
+		std::printf("steps/sec   %.1f\n", msPerStep > 0.0 ? 1000.0 / msPerStep : 0.0);
+		std::printf("checksum    %s\n", checksumText);
+		if (!loadStatePath.empty())
+			std::printf("loaded      %s in %.3f ms\n", loadStatePath.c_str(), loadMilliseconds);
+		if (!saveStatePath.empty())
+		{
+			const clock::time_point start = clock::now();
+			fluid.SaveState(saveStatePath);
+			std::printf("saved       %s in %.3f ms\n", saveStatePath.c_str(), std::chrono::duration<double, std::milli>(clock::now() - start).count());
+		}
+		if (recorder)
+		{
+			if (!recorder->Close())
+				std::fprintf(stderr, "cannot write %s\n", recordPath.c_str());
+			const double rawBytes = static_cast<double>(cells) * recorder->get_frame_count();
+			std::printf("recorded    %d frames, %.2f MB (%.1f%% of the raw alphas)\n", recorder->get_frame_count(), recorder->get_bytes_written() / 1.0e6,
+				rawBytes > 0.0 ? 100.0 * recorder->get_bytes_written() / rawBytes : 0.0);
+		}
+
+		if (exporter)
+		{
+			if (!exporter->Close())
+				std::fprintf(stderr, "cannot write %s\n", exportPath.c_str());
+			const double seconds = std::chrono::duration<double>(clock::now() - exportStart).count();
+			std::printf("exported    %d frames (%s %dx%d), %.2f MB in %.2f s (%.1f frames/s), %.1f ms waiting for the writer\n",
+				exporter->get_frame_count(), ToString(exporter->get_format()), exporter->get_width(), exporter->get_height(), exporter->get_bytes_written() / 1.0e6,
+				seconds, seconds > 0.0 ? exporter->get_frame_count() / seconds : 0.0, exporter->get_wait_milliseconds());
+		}
+
+		if (twins[0])
+		{
+			const std::size_t referenceBytes = twins[0]->get_field_bytes();
+			const std::size_t saved = referenceBytes - fluid.get_field_bytes();
+			std::printf("\nagainst dense fp32 (max / mean absolute error)\n");
+			if (saved > 0)
+				std::printf("%-12s %.2f MB of %.2f MB (%.1f%%)\n", "saved", saved / 1.0e6, referenceBytes / 1.0e6, 100.0 * saved / referenceBytes);
+			PrintError("step 1", firstStepError);
+			PrintError("final", Compare(fluid, *twins[0]));
+			PrintError("fp32 nudged", Compare(*twins[1], *twins[0]));
+		}
+
+#if FLUID_PROFILING
+		// Iterations and traffic of the last step
+		std::printf("\n%-16s %9s %9s %11s %9s\n", "stage", "p50 ms", "p99 ms", "iterations", "MB");
+		std::int64_t bytes = 0;
+		for (int index = 0; index < STAGE_COUNT; ++index)
+		{
+			const Stage stage = static_cast<Stage>(index);
+			if (profiler.GetCount() == 0 || profiler.GetFrame(0)[stage].nanoseconds < 0)
+				continue;
+			const StageSample& last = profiler.GetFrame(0)[stage];
+			std::printf("%-16s %9.3f %9.3f %11d %9.2f\n", ToString(stage), profiler.Percentile(stage, 0.5f), profiler.Percentile(stage, 0.99f), last.iterations, last.bytes / 1.0e6);
+			bytes += last.bytes;
+		}
+		std::printf("bytes/step  %.2f MB (modeled, see Fluid::get_frame_sample)\n", bytes / 1.0e6);
+		if (!tracePath.empty() && !profiler.WriteChromeTrace(tracePath))
+			std::fprintf(stderr, "cannot write %s\n", tracePath.c_str());
+#else
+		if (!tracePath.empty())
+			std::fprintf(stderr, "built without profiling, no trace written\n");
+#endif
+
+		if (displayWidth > 0)
+			RunDisplayTest(density.data(), size, displayWidth, displayHeight, scenario.threads);
+		if (tracerCount > 0)
+			RunTracerTest(fluid, fluid.get_speed() * scenario.timestep, tracerCount, displayWidth > 0 ? displayWidth : 600, displayHeight > 0 ? displayHeight : 600, scenario.threads, fluid.get_simd_level());
+
+		if (!expectedChecksum.empty() && expectedChecksum != checksumText)
+		{
+			std::fprintf(stderr, "checksum mismatch: expected %s, got %s\n", expectedChecksum.c_str(), checksumText);
+			return 1;
+		}
+		return 0;
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+}
@@ -0,0 +1,498 @@
+// Kernel microbenchmarks: times each Fluid stage on its own (LinearSolve, Project, Advect, SetBoundary) and the whole
+// Update, over grid sizes, solver iterations, solvers, thread counts and SIMD levels.
+//
+//	xtd_fluid_simulation_kernels [--sizes 64,128,256,512,1024] [--iterations 4,16] [--threads 1,N]
+//	                             [--solvers gauss-seidel,red-black,jacobi] [--simd scalar,avx2,avx512]
+//	                             [--kernels linear-solve,project,advect,set-boundary,update] [--min-time ms]
+//	                             [--json file] [--baseline file] [--tolerance percent]
+//
+// Each case builds a Fluid of that size, stirs it for a few steps so the fields are not trivially zero, warms the
+// kernel up, then runs it in batches for at least --min-time milliseconds (200 by default) and keeps the median time
+// per call. Advect and SetBoundary do not depend on the solver or its iterations, they run once per size, threads and
+// SIMD level. --threads defaults to 1 and every hardware thread, --simd to the best level of the CPU.
+//
+// Reported per case: ns per call, ns per interior cell, and the effective bandwidth, the bytes a straightforward
+// streaming implementation of the kernel moves over the time: 3 float streams per relaxation sweep (x read and written,
+// x0 read), 4 + 3 per sweep + 5 for Project (divergence, solve, gradient), 4 for Advect (vx, vy, d0 read, d written),
+// the walls for SetBoundary as Fluid models them, and the modeled traffic of every stage (Fluid::get_frame_sample) for
+// Update. A kernel that keeps its working set in cache (the wavefront Gauss-Seidel) can so exceed the DRAM bandwidth.
+// Where perf_event is available (Linux, see PerfCounters) cycles, instructions, cache and branch misses per cell are
+// reported too, counted on every thread of the case.
+//
+// --json writes the results, one object per line in a "results" array. --baseline reads such a file back and compares
+// every case found in both: ns per cell more than --tolerance percent (10 by default) above the baseline's is a
+// regression, and the exit code is then 1. Baselines are only meaningful on the machine and build that wrote them.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include "aligned_buffer.hpp"
+#include "fluid.hpp"
+#include "perf_counters.hpp"
+using namespace xtd_fluid_simulation;
+
+namespace {
+	enum class Kernel { LinearSolve, Project, Advect, SetBoundary, Update };
+
+	const char* ToString(Kernel kernel) noexcept
+	{
+		switch (kernel)
+		{
+			case Kernel::LinearSolve: return "linear-solve";
+			case Kernel::Project: return "project";
+			case Kernel::Advect: return "advect";
+			case Kernel::SetBoundary: return "set-boundary";
+			case Kernel::Update: return "update";
+			default: return "unknown";
+		}
+	}
+
+	// Names as the scenario files spell them
+	const char* ToString(Fluid::Solver solver) noexcept
+	{
+		switch (solver)
+		{
+			case Fluid::Solver::GaussSeidel: return "gauss-seidel";
+			case Fluid::Solver::RedBlackGaussSeidel: return "red-black";
+			case Fluid::Solver::Jacobi: return "jacobi";
+			default: return "unknown";
+		}
+	}
+
+	bool UsesSolver(Kernel kernel) noexcept
+	{
+		return kernel == Kernel::LinearSolve || kernel == Kernel::Project || kernel == Kernel::Update;
+	}
+
+	template<typename T>
+	T Parse(const std::string& name);
+
+	template<>
+	int Parse<int>(const std::string& name)
+	{
+		char* end = nullptr;
+		const long value = std::strtol(name.c_str(), &end, 10);
+		if (name.empty() || *end != '\0' || value <= 0)
+			throw std::invalid_argument("expected a positive number, got '" + name + "'");
+		return static_cast<int>(value);
+	}
+
+	template<>
+	Kernel Parse<Kernel>(const std::string& name)
+	{
+		for (const Kernel kernel : { Kernel::LinearSolve, Kernel::Project, Kernel::Advect, Kernel::SetBoundary, Kernel::Update })
+			if (name == ToString(kernel))
+				return kernel;
+		throw std::invalid_argument("unknown kernel '" + name + "'");
+	}
+
+	template<>
+	Fluid::Solver Parse<Fluid::Solver>(const std::string& name)
+	{
+		for (const Fluid::Solver solver : { Fluid::Solver::GaussSeidel, Fluid::Solver::RedBlackGaussSeidel, Fluid::Solver::Jacobi })
+			if (name == ToString(solver))
+				return solver;
+		throw std::invalid_argument("unknown solver '" + name + "'");
+	}
+
+	template<>
+	SimdLevel Parse<SimdLevel>(const std::string& name)
+	{
+		if (name == "scalar") return SimdLevel::Scalar;
+		if (name == "avx2") return SimdLevel::Avx2;
+		if (name == "avx512") return SimdLevel::Avx512;
+		throw std::invalid_argument("unknown SIMD level '" + name + "'");
+	}
+
+	// Comma separated values
+	template<typename T>
+	std::vector<T> ParseList(const std::string& list)
+	{
+		std::vector<T> values;
+		std::stringstream in(list);
+		std::string item;
+		while (std::getline(in, item, ','))
+			values.push_back(Parse<T>(item));
+		if (values.empty())
+			throw std::invalid_argument("empty list");
+		return values;
+	}
+
+	struct Case {
+		Kernel kernel;
+		Fluid::Solver solver;
+		int size;
+		int iterations; // 0 for the kernels without a solver
+		int threads;
+		SimdLevel simd;
+
+		// Identifies the case in a baseline
+		std::string Key() const
+		{
+			const bool solved = UsesSolver(kernel);
+			return std::string(ToString(kernel)) + '/' + (solved ? ToString(solver) : "-") + '/' + std::to_string(size) + '/'
+				+ std::to_string(iterations) + '/' + std::to_string(threads) + '/' + xtd_fluid_simulation::ToString(simd);
+		}
+	};
+
+	struct Result {
+		Case test;
+		int calls = 0; // Timed
+		double nsPerCall = 0.0;
+		double nsPerCell = 0.0;
+		double gbPerSecond = -1.0; // -1: no traffic model (Update built without profiling)
+		PerfCounters::Values counters; // Totals over the timed calls, -1 when unavailable
+		double baselineNsPerCell = -1.0; // -1: not in the baseline
+	};
+
+	/**
+	*	Bytes the kernel moves in one call as a plain streaming pass would, see the header comment.
+	*	Fluid counts walls as the top and bottom rows rewritten and a cache line per row on each side.
+	*/
+	double ModeledBytes(const Case& test)
+	{
+		const double n = test.size;
+		const double field = n * n * sizeof(float);
+		const double walls = 2 * 2 * n * sizeof(float) + 2 * n * 64;
+		switch (test.kernel)
+		{
+			case Kernel::LinearSolve: return 3 * test.iterations * field + test.iterations * walls;
+			case Kernel::Project: return (4 + 3 * test.iterations + 5) * field + (4 + test.iterations) * walls;
+			case Kernel::Advect: return 4 * field + walls;
+			case Kernel::SetBoundary: return walls;
+			default: return -1.0;
+		}
+	}
+
+	/**
+	*	Runs one case: run(calls) makes that many calls, the median of the timed batches is kept.
+	*	The counters are only enabled around the timed batches.
+	*/
+	template<typename Run>
+	void Measure(Run&& run, double minMilliseconds, PerfCounters& counters, Result& result)
+	{
+		using clock = std::chrono::steady_clock;
+		const auto time = [&](int calls) {
+			const clock::time_point start = clock::now();
+			run(calls);
+			return std::chrono::duration<double, std::nano>(clock::now() - start).count();
+		};
+
+		// Warm up (first touch, caches, the pool's threads) and size the batches to a tenth of the time each
+		double nanoseconds = time(1);
+		int batch = 1;
+		while (nanoseconds < minMilliseconds * 1.0e5 && batch < (1 << 20))
+		{
+			batch *= 2;
+			nanoseconds = time(batch);
+		}
+
+		std::vector<double> batches;
+		double total = 0.0;
+		counters.Enable();
+		while (batches.size() < 5 || total < minMilliseconds * 1.0e6)
+		{
+			const double elapsed = time(batch);
+			batches.push_back(elapsed / batch);
+			total += elapsed;
+		}
+		counters.Disable();
+
+		std::nth_element(batches.begin(), batches.begin() + batches.size() / 2, batches.end());
+		result.calls = static_cast<int>(batches.size()) * batch;
+		result.nsPerCall = batches[batches.size() / 2];
+	}
+
+	Result RunCase(const Case& test, double minMilliseconds)
+	{
+		Result result;
+		result.test = test;
+		{
+			// Before the fluid: its pool's threads inherit the counters, which are read once they exited
+			PerfCounters counters;
+			{
+				Fluid fluid(test.size, 1, test.threads);
+				fluid.set_simd_level(test.simd);
+				fluid.set_solver(test.solver);
+				fluid.set_iterations(std::max(test.iterations, 1));
+
+				// A few steps of a swirl so the fields hold something
+				const float center = test.size * 0.5f;
+				for (int step = 0; step < 10; ++step)
+				{
+					fluid.AddBrush({ center, center, test.size / 8.0f, 200.0f, 4.0f, step % 2 ? 2.0f : -2.0f });
+					fluid.AddForce(0.0f, -0.5f);
+					fluid.Update(0.1f);
+				}
+
+				// Kernels run on copies, so they can be called over and over on the same input
+				const std::size_t cells = static_cast<std::size_t>(test.size) * test.size;
+				AlignedBuffer<float> velocityX(cells), velocityY(cells), p(cells), div(cells), d(cells), d0(cells);
+				std::copy_n(fluid.get_velocity_x(), cells, velocityX.data());
+				std::copy_n(fluid.get_velocity_y(), cells, velocityY.data());
+				fluid.ReadDensity(d0.data());
+				const float dt = 0.1f * fluid.get_speed();
+				const float a = 1.0f; // A diffusion strength where relaxation has work to do
+				const float c = 1.0f + 4.0f * a;
+
+				switch (test.kernel)
+				{
+					case Kernel::LinearSolve:
+						Measure([&](int calls) { for (int call = 0; call < calls; ++call) fluid.LinearSolve(test.solver, 0, d.data(), d0.data(), a, c); }, minMilliseconds, counters, result);
+						break;
+					case Kernel::Project:
+						Measure([&](int calls) { for (int call = 0; call < calls; ++call) fluid.Project(velocityX.data(), velocityY.data(), p.data(), div.data()); }, minMilliseconds, counters, result);
+						break;
+					case Kernel::Advect:
+						Measure([&](int calls) { for (int call = 0; call < calls; ++call) fluid.Advect(0, d.data(), d0.data(), velocityX.data(), velocityY.data(), dt); }, minMilliseconds, counters, result);
+						break;
+					case Kernel::SetBoundary:
+						Measure([&](int calls) { for (int call = 0; call < calls; ++call) fluid.SetBoundary(1, velocityX.data()); }, minMilliseconds, counters, result);
+						break;
+					case Kernel::Update:
+						Measure([&](int calls) { for (int call = 0; call < calls; ++call) fluid.Update(0.1f); }, minMilliseconds, counters, result);
+						break;
+				}
+
+				double bytes = ModeledBytes(test);
+#if FLUID_PROFILING
+				if (test.kernel == Kernel::Update)
+				{
+					bytes = 0.0;
+					for (int index = 0; index < STAGE_COUNT; ++index)
+					{
+						const StageSample& sample = fluid.get_frame_sample()[static_cast<Stage>(index)];
+						if (sample.nanoseconds >= 0)
+							bytes += static_cast<double>(sample.bytes);
+					}
+				}
+#endif
+				if (bytes >= 0.0)
+					result.gbPerSecond = bytes / result.nsPerCall;
+			}
+			result.counters = counters.Read();
+		}
+		const double interior = static_cast<double>(test.size - 2) * (test.size - 2);
+		result.nsPerCell = result.nsPerCall / interior;
+		return result;
+	}
+
+	// Counter per interior cell and call, -1 when not counted
+	double PerCell(const Result& result, PerfCounters::Counter counter) noexcept
+	{
+		const std::int64_t count = result.counters[counter];
+		if (count < 0 || result.calls == 0)
+			return -1.0;
+		return static_cast<double>(count) / result.calls / (static_cast<double>(result.test.size - 2) * (result.test.size - 2));
+	}
+
+	// Value of "name": in a line of the results, empty when missing
+	std::string Field(const std::string& line, const char* name)
+	{
+		const std::string key = std::string("\"") + name + "\":";
+		std::size_t begin = line.find(key);
+		if (begin == std::string::npos)
+			return {};
+		begin += key.size();
+		while (begin < line.size() && line[begin] == ' ')
+			++begin;
+		if (begin < line.size() && line[begin] == '"')
+		{
+			const std::size_t end = line.find('"', begin + 1);
+			return end == std::string::npos ? std::string() : line.substr(begin + 1, end - begin - 1);
+		}
+		const std::size_t end = line.find_first_of(",}", begin);
+		return line.substr(begin, end == std::string::npos ? std::string::npos : end - begin);
+	}
+
+	// ns per cell by case key, from a file written with --json
+	std::map<std::string, double> LoadBaseline(const std::string& path)
+	{
+		std::ifstream in(path);
+		if (!in)
+			throw std::runtime_error("cannot open " + path);
+		std::map<std::string, double> baseline;
+		std::string line;
+		while (std::getline(in, line))
+		{
+			const std::string kernel = Field(line, "kernel");
+			const std::string nsPerCell = Field(line, "ns_per_cell");
+			if (kernel.empty() || nsPerCell.empty())
+				continue;
+			const std::string key = kernel + '/' + Field(line, "solver") + '/' + Field(line, "size") + '/' + Field(line, "iterations")
+				+ '/' + Field(line, "threads") + '/' + Field(line, "simd");
+			baseline[key] = std::atof(nsPerCell.c_str());
+		}
+		return baseline;
+	}
+
+	bool WriteJson(const std::string& path, const std::vector<Result>& results, bool countersAvailable)
+	{
+		std::FILE* file = std::fopen(path.c_str(), "w");
+		if (!file)
+			return false;
+		const auto number = [](double value) {
+			char text[32];
+			if (value < 0.0)
+				return std::string("null");
+			std::snprintf(text, sizeof(text), "%.6g", value);
+			return std::string(text);
+		};
+		std::fprintf(file, "{\n\"benchmark\": \"xtd_fluid_simulation_kernels\",\n\"hardware_threads\": %u,\n\"simd\": \"%s\",\n\"perf_counters\": %s,\n\"results\": [\n",
+			std::thread::hardware_concurrency(), ToString(DetectSimdLevel()), countersAvailable ? "true" : "false");
+		for (std::size_t index = 0; index < results.size(); ++index)
+		{
+			const Result& result = results[index];
+			const Case& test = result.test;
+			std::fprintf(file, "{\"kernel\": \"%s\", \"solver\": \"%s\", \"size\": %d, \"iterations\": %d, \"threads\": %d, \"simd\": \"%s\", "
+				"\"calls\": %d, \"ns_per_call\": %s, \"ns_per_cell\": %s, \"gb_per_s\": %s",
+				ToString(test.kernel), UsesSolver(test.kernel) ? ToString(test.solver) : "-", test.size, test.iterations, test.threads, ToString(test.simd),
+				result.calls, number(result.nsPerCall).c_str(), number(result.nsPerCell).c_str(), number(result.gbPerSecond).c_str());
+			for (int counter = 0; counter < PerfCounters::COUNTER_COUNT; ++counter)
+				std::fprintf(file, ", \"%s_per_cell\": %s", PerfCounters::ToString(static_cast<PerfCounters::Counter>(counter)),
+					number(PerCell(result, static_cast<PerfCounters::Counter>(counter))).c_str());
+			std::fprintf(file, "}%s\n", index + 1 < results.size() ? "," : "");
+		}
+		std::fprintf(file, "]\n}\n");
+		return std::fclose(file) == 0;
+	}
+
+	int Usage(const char* program)
+	{
+		std::fprintf(stderr,
+			"usage: %s [--sizes 64,128,256,512,1024] [--iterations 4,16] [--threads 1,N]\n"
+			"          [--solvers gauss-seidel,red-black,jacobi] [--simd scalar,avx2,avx512]\n"
+			"          [--kernels linear-solve,project,advect,set-boundary,update] [--min-time ms]\n"
+			"          [--json file] [--baseline file] [--tolerance percent]\n", program);
+		return 2;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	try
+	{
+		std::vector<int> sizes = { 64, 128, 256, 512, 1024 };
+		std::vector<int> iterations = { 4, 16 };
+		std::vector<int> threadCounts = { 1 };
+		if (std::thread::hardware_concurrency() > 1)
+			threadCounts.push_back(static_cast<int>(std::thread::hardware_concurrency()));
+		std::vector<Fluid::Solver> solvers = { Fluid::Solver::GaussSeidel, Fluid::Solver::RedBlackGaussSeidel, Fluid::Solver::Jacobi };
+		std::vector<SimdLevel> simdLevels = { DetectSimdLevel() };
+		std::vector<Kernel> kernels = { Kernel::LinearSolve, Kernel::Project, Kernel::Advect, Kernel::SetBoundary, Kernel::Update };
+		double minMilliseconds = 200.0;
+		std::string jsonPath, baselinePath;
+		double tolerance = 10.0;
+
+		for (int index = 1; index < argc; ++index)
+		{
+			const std::string option = argv[index];
+			if (index + 1 >= argc)
+				return Usage(argv[0]);
+			const std::string value = argv[++index];
+			if (option == "--sizes") sizes = ParseList<int>(value);
+			else if (option == "--iterations") iterations = ParseList<int>(value);
+			else if (option == "--threads") threadCounts = ParseList<int>(value);
+			else if (option == "--solvers") solvers = ParseList<Fluid::Solver>(value);
+			else if (option == "--simd") simdLevels = ParseList<SimdLevel>(value);
+			else if (option == "--kernels") kernels = ParseList<Kernel>(value);
+			else if (option == "--min-time") minMilliseconds = std::max(std::atof(value.c_str()), 1.0);
+			else if (option == "--json") jsonPath = value;
+			else if (option == "--baseline") baselinePath = value;
+			else if (option == "--tolerance") tolerance = std::max(std::atof(value.c_str()), 0.0);
+			else return Usage(argv[0]);
+		}
+
+		std::map<std::string, double> baseline;
+		if (!baselinePath.empty())
+			baseline = LoadBaseline(baselinePath);
+
+		// Levels the CPU lacks would silently run a lower one (Fluid::set_simd_level), under the wrong name
+		simdLevels.erase(std::remove_if(simdLevels.begin(), simdLevels.end(), [](SimdLevel level) { return level > DetectSimdLevel(); }), simdLevels.end());
+		if (simdLevels.empty())
+			simdLevels.push_back(DetectSimdLevel());
+
+		std::vector<Case> cases;
+		for (const Kernel kernel : kernels)
+			for (const int size : sizes)
+				for (const int threads : threadCounts)
+					for (const SimdLevel simd : simdLevels)
+					{
+						if (!UsesSolver(kernel))
+						{
+							cases.push_back({ kernel, Fluid::Solver::GaussSeidel, std::max(size, Fluid::MIN_SIZE), 0, threads, simd });
+							continue;
+						}
+						for (const Fluid::Solver solver : solvers)
+							for (const int count : iterations)
+								cases.push_back({ kernel, solver, std::max(size, Fluid::MIN_SIZE), count, threads, simd });
+					}
+
+		const bool countersAvailable = PerfCounters().IsAvailable();
+		std::printf("%-13s %-13s %5s %5s %7s %7s %12s %9s %8s", "kernel", "solver", "size", "iter", "threads", "simd", "ns/call", "ns/cell", "GB/s");
+		if (countersAvailable)
+			std::printf(" %8s %8s %9s %9s", "cyc/cell", "IPC", "miss/cell", "brm/cell");
+		if (!baseline.empty())
+			std::printf(" %9s", "baseline");
+		std::printf("\n");
+
+		std::vector<Result> results;
+		int regressions = 0;
+		for (const Case& test : cases)
+		{
+			Result result = RunCase(test, minMilliseconds);
+			const auto known = baseline.find(test.Key());
+			if (known != baseline.end())
+				result.baselineNsPerCell = known->second;
+
+			std::printf("%-13s %-13s %5d %5d %7d %7s %12.0f %9.3f ", ToString(test.kernel), UsesSolver(test.kernel) ? ToString(test.solver) : "-",
+				test.size, test.iterations, test.threads, ToString(test.simd), result.nsPerCall, result.nsPerCell);
+			if (result.gbPerSecond >= 0.0)
+				std::printf("%8.2f", result.gbPerSecond);
+			else
+				std::printf("%8s", "-");
+			if (countersAvailable)
+			{
+				const double cycles = PerCell(result, PerfCounters::Cycles);
+				const double instructions = PerCell(result, PerfCounters::Instructions);
+				std::printf(" %8.2f %8.2f %9.4f %9.4f", cycles, cycles > 0.0 ? instructions / cycles : 0.0,
+					PerCell(result, PerfCounters::CacheMisses), PerCell(result, PerfCounters::BranchMisses));
+			}
+			if (result.baselineNsPerCell > 0.0)
+			{
+				const double change = 100.0 * (result.nsPerCell / result.baselineNsPerCell - 1.0);
+				const bool regressed = change > tolerance;
+				regressions += regressed;
+				std::printf(" %+8.1f%%%s", change, regressed ? " REGRESSION" : "");
+			}
+			std::printf("\n");
+			std::fflush(stdout);
+			results.push_back(result);
+		}
+
+		if (!jsonPath.empty() && !WriteJson(jsonPath, results, countersAvailable))
+			std::fprintf(stderr, "cannot write %s\n", jsonPath.c_str());
+		if (!baseline.empty())
+		{
+			const std::size_t compared = std::count_if(results.begin(), results.end(), [](const Result& result) { return result.baselineNsPerCell > 0.0; });
+			std::printf("\n%zu of %zu cases in the baseline, %d slower by more than %.1f%%\n", compared, results.size(), regressions, tolerance);
+		}
+		return regressions > 0 ? 1 : 0;
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "%s\n", e.what());
+		return 2;
+	}
+}
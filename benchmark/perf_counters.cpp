@@ -0,0 +1,101 @@
+#include "perf_counters.hpp"
+
+#if defined(__linux__)
+#include <cstring>	// std::memset
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define FLUID_PERF_EVENT 1
+#endif
+
+using namespace xtd_fluid_simulation;
+
+PerfCounters::PerfCounters() noexcept
+{
+	m_fds.fill(-1);
+#ifdef FLUID_PERF_EVENT
+	constexpr std::uint64_t CONFIGS[COUNTER_COUNT] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+	};
+	for (int counter = 0; counter < COUNTER_COUNT; ++counter)
+	{
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = CONFIGS[counter];
+		attr.disabled = 1;
+		attr.inherit = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		// Each on its own (no group): inherited counters cannot be read as a group
+		m_fds[counter] = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+	}
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef FLUID_PERF_EVENT
+	for (const int fd : m_fds)
+		if (fd >= 0)
+			close(fd);
+#endif
+}
+
+bool PerfCounters::IsAvailable() const noexcept
+{
+	for (const int fd : m_fds)
+		if (fd >= 0)
+			return true;
+	return false;
+}
+
+void PerfCounters::Enable() noexcept
+{
+#ifdef FLUID_PERF_EVENT
+	for (const int fd : m_fds)
+		if (fd >= 0)
+		{
+			ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+			ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+		}
+#endif
+}
+
+void PerfCounters::Disable() noexcept
+{
+#ifdef FLUID_PERF_EVENT
+	for (const int fd : m_fds)
+		if (fd >= 0)
+			ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+#endif
+}
+
+PerfCounters::Values PerfCounters::Read() const noexcept
+{
+	Values values;
+	values.fill(-1);
+#ifdef FLUID_PERF_EVENT
+	for (int counter = 0; counter < COUNTER_COUNT; ++counter)
+	{
+		std::uint64_t count = 0;
+		if (m_fds[counter] >= 0 && read(m_fds[counter], &count, sizeof(count)) == static_cast<ssize_t>(sizeof(count)))
+			values[counter] = static_cast<std::int64_t>(count);
+	}
+#endif
+	return values;
+}
+
+const char* PerfCounters::ToString(Counter counter) noexcept
+{
+	switch (counter)
+	{
+		case Cycles: return "cycles";
+		case Instructions: return "instructions";
+		case CacheMisses: return "cache_misses";
+		case BranchMisses: return "branch_misses";
+		default: return "unknown";
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <array>
+#include <cstdint>
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Hardware counters of this process through perf_event (Linux), user space only so the default
+	*	perf_event_paranoid setting allows them. Elsewhere, or where the kernel or a VM does not expose them, IsAvailable is false.
+	*
+	*	The counters are inherited by the threads created after the constructor, and they are only added to the
+	*	totals when those threads exit. So a measured object owning its threads (a Fluid and its pool) must be built
+	*	after the counters and destroyed before Read.
+	*/
+	class PerfCounters {
+	public:
+		enum Counter { Cycles, Instructions, CacheMisses, BranchMisses, COUNTER_COUNT };
+
+		// Counts, -1 for a counter that could not be opened
+		using Values = std::array<std::int64_t, COUNTER_COUNT>;
+
+	public:
+		// Opened disabled
+		PerfCounters() noexcept;
+		~PerfCounters();
+
+		PerfCounters(const PerfCounters&) = delete;
+		PerfCounters& operator=(const PerfCounters&) = delete;
+
+	public:
+		bool IsAvailable() const noexcept;
+
+		// Start and stop counting, for this thread and its children alike
+		void Enable() noexcept;
+		void Disable() noexcept;
+
+		Values Read() const noexcept;
+
+		static const char* ToString(Counter counter) noexcept;
+
+	private:
+		std::array<int, COUNTER_COUNT> m_fds;
+	};
+}
@@ -0,0 +1,224 @@
+#include "scenario.hpp"
+#include <cstdlib>	// std::atoi
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+using namespace xtd_fluid_simulation;
+
+namespace {
+	Fluid::Solver ParseSolver(const std::string& name)
+	{
+		if (name == "gauss-seidel") return Fluid::Solver::GaussSeidel;
+		if (name == "red-black") return Fluid::Solver::RedBlackGaussSeidel;
+		if (name == "jacobi") return Fluid::Solver::Jacobi;
+		throw std::invalid_argument("unknown solver '" + name + "'");
+	}
+
+	Fluid::PressureSolver ParsePressureSolver(const std::string& name)
+	{
+		if (name == "relaxation") return Fluid::PressureSolver::Relaxation;
+		if (name == "multigrid") return Fluid::PressureSolver::Multigrid;
+		throw std::invalid_argument("unknown pressure solver '" + name + "'");
+	}
+
+	bool ParseSwitch(const std::string& value)
+	{
+		if (value == "on") return true;
+		if (value == "off") return false;
+		throw std::invalid_argument("expected on or off, got '" + value + "'");
+	}
+
+	// Reads the pixels of a binary 8-bit PGM (P5), throws std::invalid_argument otherwise
+	std::vector<std::uint8_t> ReadPgm(const std::string& path, int& width, int& height)
+	{
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			throw std::invalid_argument("cannot open " + path);
+		// Header fields are separated by whitespace, '#' comments may come between them
+		const auto field = [&file]() {
+			std::string word;
+			while (file >> word && word[0] == '#')
+				file.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+			return word;
+		};
+		if (field() != "P5")
+			throw std::invalid_argument(path + ": not a binary PGM (P5)");
+		width = std::atoi(field().c_str());
+		height = std::atoi(field().c_str());
+		const int maxValue = std::atoi(field().c_str());
+		if (width <= 0 || height <= 0 || maxValue <= 0 || maxValue > 255)
+			throw std::invalid_argument(path + ": only 8-bit PGMs are supported");
+		file.get(); // The single whitespace before the pixels
+
+		std::vector<std::uint8_t> pixels(static_cast<std::size_t>(width) * height);
+		if (!file.read(reinterpret_cast<char*>(pixels.data()), pixels.size()))
+			throw std::invalid_argument(path + ": truncated");
+		// As 0-255 luminance
+		for (std::uint8_t& pixel : pixels)
+			pixel = static_cast<std::uint8_t>(pixel * 255 / maxValue);
+		return pixels;
+	}
+}
+
+FieldPrecision xtd_fluid_simulation::ParseFieldPrecision(const std::string& name)
+{
+	for (const FieldPrecision precision : { FieldPrecision::Float32, FieldPrecision::Float16, FieldPrecision::BFloat16 })
+		if (name == ToString(precision))
+			return precision;
+	throw std::invalid_argument("unknown precision '" + name + "'");
+}
+
+Fluid::Advection xtd_fluid_simulation::ParseAdvection(const std::string& name)
+{
+	if (name == "semi-lagrangian") return Fluid::Advection::SemiLagrangian;
+	if (name == "maccormack") return Fluid::Advection::MacCormack;
+	throw std::invalid_argument("unknown advection '" + name + "'");
+}
+
+Scenario Scenario::Load(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error("cannot open scenario " + path);
+
+	Scenario scenario;
+	std::string line;
+	for (int lineNumber = 1; std::getline(file, line); lineNumber++)
+	{
+		line = line.substr(0, line.find('#'));
+		std::istringstream in(line);
+		std::string directive;
+		if (!(in >> directive))
+			continue;
+
+		try
+		{
+			std::string word;
+			if (directive == "size") in >> scenario.size;
+			else if (directive == "steps") in >> scenario.steps;
+			else if (directive == "threads") in >> scenario.threads;
+			else if (directive == "seed") in >> scenario.seed;
+			else if (directive == "timestep") in >> scenario.timestep;
+			else if (directive == "speed") in >> scenario.speed;
+			else if (directive == "iterations") in >> scenario.iterations;
+			else if (directive == "tolerance") in >> scenario.tolerance;
+			else if (directive == "warm-start" && in >> word) scenario.warmStart = ParseSwitch(word);
+			else if (directive == "fused-passes" && in >> word) scenario.fusedPasses = ParseSwitch(word);
+			else if (directive == "precision" && in >> word) scenario.precision = ParseFieldPrecision(word);
+			else if (directive == "sparse-tiles" && in >> word) scenario.sparseTiles = ParseSwitch(word);
+			else if (directive == "advection" && in >> word) scenario.advection = ParseAdvection(word);
+			else if (directive == "task-graph" && in >> word) scenario.taskGraph = ParseSwitch(word);
+			else if (directive == "diffuse-solver" && in >> word) scenario.diffuseSolver = ParseSolver(word);
+			else if (directive == "project-solver" && in >> word) scenario.projectSolver = ParseSolver(word);
+			else if (directive == "pressure-solver" && in >> word) scenario.pressureSolver = ParsePressureSolver(word);
+			else if (directive == "emitter")
+			{
+				scenario.emitter = static_cast<bool>(in >> scenario.emitterDensity);
+				// The cell is optional
+				if (in >> scenario.emitterX && !(in >> scenario.emitterY))
+					throw std::invalid_argument("emitter cell needs x and y");
+				in.clear();
+			}
+			else if (directive == "velocity") in >> scenario.velocityX >> scenario.velocityY;
+			else if (directive == "inject")
+			{
+				Injection injection{};
+				in >> injection.first >> injection.last >> injection.x >> injection.y >> injection.density >> injection.velocityX >> injection.velocityY;
+				// Optional brush radius
+				if (!in.fail() && !(in >> injection.radius))
+				{
+					if (!in.eof())
+						throw std::invalid_argument("malformed brush radius");
+					in.clear();
+				}
+				scenario.injections.push_back(injection);
+			}
+			else if (directive == "obstacle")
+			{
+				Obstacle obstacle{};
+				in >> obstacle.x >> obstacle.y >> obstacle.radius;
+				scenario.obstacles.push_back(obstacle);
+			}
+			else if (directive == "obstacle-image" && in >> word)
+			{
+				const std::size_t slash = path.find_last_of("/\\");
+				const bool relative = word[0] != '/' && slash != std::string::npos;
+				scenario.obstacleImage = ReadPgm(relative ? path.substr(0, slash + 1) + word : word, scenario.obstacleImageWidth, scenario.obstacleImageHeight);
+			}
+			else
+				throw std::invalid_argument("unknown directive '" + directive + "'");
+
+			if (in.fail())
+				throw std::invalid_argument("missing or malformed value");
+		}
+		catch (const std::invalid_argument& e)
+		{
+			throw std::runtime_error(path + ":" + std::to_string(lineNumber) + ": " + directive + ": " + e.what());
+		}
+	}
+	return scenario;
+}
+
+void Scenario::Configure(Fluid& fluid) const
+{
+	fluid.set_thread_count(threads);
+	fluid.set_speed(speed);
+	fluid.set_iterations(iterations);
+	fluid.set_tolerance(tolerance);
+	fluid.set_warm_start(warmStart);
+	fluid.set_fused_passes(fusedPasses);
+	fluid.set_field_precision(precision);
+	fluid.set_sparse_tiles(sparseTiles);
+	fluid.set_advection(advection);
+	fluid.set_task_graph(taskGraph);
+	fluid.set_diffuse_solver(diffuseSolver);
+	fluid.set_project_solver(projectSolver);
+	fluid.set_pressure_solver(pressureSolver);
+
+	if (obstacleImage.empty() && obstacles.empty())
+		return;
+	ObstacleMap map(fluid.get_size());
+	if (!obstacleImage.empty())
+		map.SetFromImage(obstacleImage.data(), obstacleImageWidth, obstacleImageHeight);
+	for (const Obstacle& obstacle : obstacles)
+		map.Paint(obstacle.x, obstacle.y, obstacle.radius, true);
+	fluid.SetObstacles(map);
+}
+
+namespace {
+	// Target is a Fluid or a FluidEnsemble::Member
+	template<typename Target>
+	void InjectInto(const Scenario& scenario, Target& fluid, int step, std::default_random_engine& random)
+	{
+		// The velocity sliders of main_form, first: Fluid::Update applies the force before the brushes
+		if (scenario.velocityX != 0.0f || scenario.velocityY != 0.0f)
+			fluid.AddForce(scenario.velocityX * scenario.timestep, scenario.velocityY * scenario.timestep);
+
+		for (const Scenario::Injection& injection : scenario.injections)
+		{
+			if (step < injection.first || step > injection.last)
+				continue;
+			fluid.AddBrush({ static_cast<float>(injection.x), static_cast<float>(injection.y), injection.radius, injection.density, injection.velocityX, injection.velocityY });
+		}
+
+		if (scenario.emitter)
+		{
+			const int x = scenario.emitterX < 0 ? fluid.get_size() / 2 : scenario.emitterX;
+			const int y = scenario.emitterY < 0 ? fluid.get_size() / 2 : scenario.emitterY;
+			std::uniform_real_distribution<float> velocity(-3.0f, 3.0f);
+			const float velocityX = velocity(random);
+			fluid.AddBrush({ static_cast<float>(x), static_cast<float>(y), 0.0f, scenario.emitterDensity, velocityX, velocity(random) });
+		}
+	}
+}
+
+void Scenario::Inject(Fluid& fluid, int step, std::default_random_engine& random) const
+{
+	InjectInto(*this, fluid, step, random);
+}
+
+void Scenario::Inject(FluidEnsemble::Member member, int step, std::default_random_engine& random) const
+{
+	InjectInto(*this, member, step, random);
+}
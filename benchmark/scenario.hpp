@@ -0,0 +1,99 @@
+#pragma once
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+#include "fluid.hpp"
+#include "fluid_ensemble.hpp"
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Scripted, reproducible replay of what main_form feeds the fluid, for headless runs.
+	*
+	*	Text file, one directive per line, '#' starts a comment:
+	*		size 256                      grid size (N)
+	*		steps 600                     steps to run
+	*		threads 0                     solver threads (0 = every hardware thread)
+	*		seed 42                       seed of the emitter's random velocities
+	*		timestep 0.0166667            seconds per step
+	*		speed 7                       motion speed
+	*		iterations 32                 solver iterations (cap when a tolerance is set)
+	*		tolerance 0.01                residual tolerance (0 = fixed iterations)
+	*		warm-start on|off
+	*		diffuse-solver gauss-seidel|red-black|jacobi
+	*		project-solver gauss-seidel|red-black|jacobi
+	*		pressure-solver relaxation|multigrid
+	*		fused-passes on|off           Fluid::set_fused_passes
+	*		precision fp32|fp16|bf16      Fluid::set_field_precision
+	*		sparse-tiles on|off           Fluid::set_sparse_tiles
+	*		advection semi-lagrangian|maccormack   Fluid::set_advection
+	*		task-graph on|off             Fluid::set_task_graph
+	*		emitter <density> [x y]       automatic density, at the center unless a cell is given, with a random [-3, 3] velocity each step
+	*		velocity <x> <y>              velocity sliders (per second), a uniform force (Fluid::AddForce)
+	*		inject <first> <last> <x> <y> <density> <vx> <vy> [radius]   mouse drag: from step first to last (included),
+	*		                              a brush at cell x, y (Fluid::AddBrush), the single cell without a radius
+	*		obstacle <x> <y> <radius>     solid disc (Fluid::PaintObstacle), the single cell under a radius of 1
+	*		obstacle-image <file.pgm>     solid where a binary PGM (P5) is dark, stretched over the grid (ObstacleMap::SetFromImage),
+	*		                              relative to the scenario file; the discs are painted over it
+	*/
+	struct Scenario {
+		struct Injection {
+			int first, last;
+			int x, y;
+			float density;
+			float velocityX, velocityY;
+			float radius; // Of the brush, 0 for the single cell
+		};
+
+		struct Obstacle {
+			float x, y;
+			float radius;
+		};
+
+		int size = Fluid::DEFAULT_SIZE;
+		int steps = 600;
+		int threads = 0;
+		unsigned int seed = 0;
+		float timestep = 1.0f / 60.0f;
+		int speed = 7;
+		int iterations = 32;
+		float tolerance = 0.0f;
+		bool warmStart = false;
+		bool fusedPasses = true;
+		FieldPrecision precision = FieldPrecision::Float32;
+		bool sparseTiles = false;
+		Fluid::Advection advection = Fluid::Advection::SemiLagrangian;
+		bool taskGraph = true;
+		Fluid::Solver diffuseSolver = Fluid::Solver::GaussSeidel;
+		Fluid::Solver projectSolver = Fluid::Solver::GaussSeidel;
+		Fluid::PressureSolver pressureSolver = Fluid::PressureSolver::Relaxation;
+
+		bool emitter = false;
+		float emitterDensity = 1000.0f;
+		int emitterX = -1, emitterY = -1; // -1: grid center
+
+		float velocityX = 0.0f, velocityY = 0.0f;
+		std::vector<Injection> injections;
+
+		std::vector<Obstacle> obstacles;
+		std::vector<std::uint8_t> obstacleImage; // Luminance, row major, empty without one
+		int obstacleImageWidth = 0, obstacleImageHeight = 0;
+
+		// Reads a scenario file, throws std::runtime_error naming the file and line of any malformed directive
+		static Scenario Load(const std::string& path);
+
+		// Applies the fluid settings and obstacles (not the grid size, fixed at construction)
+		void Configure(Fluid& fluid) const;
+
+		// Feeds the inputs of step (0 based) to fluid, the way main_form::on_animation_update does
+		void Inject(Fluid& fluid, int step, std::default_random_engine& random) const;
+		// Same, to one member of an ensemble (from its FluidEnsemble::Injector)
+		void Inject(FluidEnsemble::Member member, int step, std::default_random_engine& random) const;
+	};
+
+	// fp32, fp16 or bf16 (ToString's names), throws std::invalid_argument otherwise
+	FieldPrecision ParseFieldPrecision(const std::string& name);
+
+	// semi-lagrangian or maccormack, throws std::invalid_argument otherwise
+	Fluid::Advection ParseAdvection(const std::string& name);
+}
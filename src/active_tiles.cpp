@@ -0,0 +1,76 @@
+#include "active_tiles.hpp"
+#include <algorithm>	// std::min, std::max, std::fill, std::count, std::copy_n
+using namespace xtd_fluid_simulation;
+
+ActiveTiles::ActiveTiles(int n)
+	:
+	m_size(n),
+	m_tiles_per_row((n + TILE - 1) / TILE),
+	m_mask(static_cast<std::size_t>(m_tiles_per_row) * m_tiles_per_row, 0),
+	m_dilated(m_mask.size(), 0),
+	m_row_spans(m_tiles_per_row + 1, 0)
+{
+	m_spans.reserve(m_mask.size());
+}
+
+void ActiveTiles::MarkAll()
+{
+	std::fill(m_mask.begin(), m_mask.end(), 1);
+	BuildSpans();
+}
+
+void ActiveTiles::SetMask(const std::uint8_t* mask) noexcept
+{
+	std::copy_n(mask, m_mask.size(), m_mask.begin());
+}
+
+void ActiveTiles::Dilate()
+{
+	const int tiles = m_tiles_per_row;
+	for (int ty = 0; ty < tiles; ty++)
+	{
+		for (int tx = 0; tx < tiles; tx++)
+		{
+			std::uint8_t active = 0;
+			for (int y = std::max(ty - 1, 0); y <= std::min(ty + 1, tiles - 1) && !active; y++)
+				for (int x = std::max(tx - 1, 0); x <= std::min(tx + 1, tiles - 1); x++)
+					active |= m_mask[y * tiles + x];
+			m_dilated[ty * tiles + tx] = active;
+		}
+	}
+	m_mask.swap(m_dilated);
+	BuildSpans();
+}
+
+int ActiveTiles::GetActiveCount() const noexcept
+{
+	return static_cast<int>(std::count(m_mask.begin(), m_mask.end(), 1));
+}
+
+void ActiveTiles::BuildSpans()
+{
+	m_spans.clear();
+	const int tiles = m_tiles_per_row;
+	for (int ty = 0; ty < tiles; ty++)
+	{
+		m_row_spans[ty] = static_cast<int>(m_spans.size());
+		const int rowBegin = std::max(ty * TILE, 1);
+		const int rowEnd = std::min((ty + 1) * TILE, m_size - 1);
+		for (int tx = 0; tx < tiles; )
+		{
+			if (!m_mask[ty * tiles + tx])
+			{
+				tx++;
+				continue;
+			}
+			const int first = tx;
+			while (tx < tiles && m_mask[ty * tiles + tx])
+				tx++;
+			const int colBegin = std::max(first * TILE, 1);
+			const int colEnd = std::min(tx * TILE, m_size - 1);
+			if (rowBegin < rowEnd && colBegin < colEnd)
+				m_spans.push_back({ rowBegin, rowEnd, colBegin, colEnd });
+		}
+	}
+	m_row_spans[tiles] = static_cast<int>(m_spans.size());
+}
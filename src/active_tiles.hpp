@@ -0,0 +1,56 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+namespace xtd_fluid_simulation {
+	// Rectangle of interior cells: rows [rowBegin, rowEnd), columns [colBegin, colEnd)
+	struct TileSpan {
+		int rowBegin, rowEnd;
+		int colBegin, colEnd;
+	};
+
+	/**
+	*	Which TILE x TILE blocks of an n*n grid have anything going on (see Fluid::set_sparse_tiles).
+	*	Kernels walk the spans: each run of adjacent active tiles in a row of tiles, clipped to the interior,
+	*	listed top to bottom then left to right, so a sweep over them keeps the row major order of a full sweep.
+	*/
+	class ActiveTiles {
+	public:
+		inline static constexpr const int TILE = 16;
+
+	public:
+		explicit ActiveTiles(int n);
+
+		// Activates the tile of cell (x, y), which must be on the grid. Spans are updated by the next Dilate
+		void Mark(int x, int y) noexcept { m_mask[(y / TILE) * m_tiles_per_row + x / TILE] = 1; }
+		// Activates every tile, spans included
+		void MarkAll();
+		// Activates the 8 neighbours of every active tile (how far a step may carry anything), then rebuilds the spans
+		void Dilate();
+		void Retire(int tileX, int tileY) noexcept { m_mask[tileY * m_tiles_per_row + tileX] = 0; }
+		// Replaces the whole mask (as GetMask lays it out, from a checkpoint). Spans are updated by the next Dilate
+		void SetMask(const std::uint8_t* mask) noexcept;
+
+		bool IsActive(int tileX, int tileY) const noexcept { return m_mask[tileY * m_tiles_per_row + tileX] != 0; }
+		int GetTilesPerRow() const noexcept { return m_tiles_per_row; }
+		int GetActiveCount() const noexcept;
+		// Row major, one byte per tile, 1 when active
+		const std::vector<std::uint8_t>& GetMask() const noexcept { return m_mask; }
+		// As of the last Dilate or MarkAll
+		const std::vector<TileSpan>& GetSpans() const noexcept { return m_spans; }
+		// The spans covering grid row j are GetSpans()[GetRowSpanBegin(j), GetRowSpanEnd(j))
+		int GetRowSpanBegin(int j) const noexcept { return m_row_spans[j / TILE]; }
+		int GetRowSpanEnd(int j) const noexcept { return m_row_spans[j / TILE + 1]; }
+
+	private:
+		void BuildSpans();
+
+	private:
+		int m_size;
+		int m_tiles_per_row;
+		std::vector<std::uint8_t> m_mask;
+		std::vector<std::uint8_t> m_dilated;
+		std::vector<TileSpan> m_spans;
+		std::vector<int> m_row_spans; // Per row of tiles, index of its first span (plus the end)
+	};
+}
@@ -0,0 +1,69 @@
+#pragma once
+#include <cstddef>	// std::size_t
+#include <new>		// std::align_val_t
+#include <algorithm>	// std::fill_n
+#include <utility>	// std::exchange
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Zero initialized heap array whose storage starts on a cache line boundary,
+	*	so rows of a field can be streamed with aligned SIMD loads and two fields never share a line.
+	*/
+	template<typename T, std::size_t Alignment = 64>
+	class AlignedBuffer {
+	public:
+		inline static constexpr const std::size_t ALIGNMENT = Alignment;
+
+		AlignedBuffer() noexcept = default;
+		explicit AlignedBuffer(std::size_t size)
+			:
+			m_data(size ? static_cast<T*>(::operator new(size * sizeof(T), std::align_val_t{ Alignment })) : nullptr),
+			m_size(size)
+		{
+			std::fill_n(m_data, m_size, T{});
+		}
+		~AlignedBuffer() { Release(); }
+
+		AlignedBuffer(const AlignedBuffer&) = delete;
+		AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+		AlignedBuffer(AlignedBuffer&& other) noexcept
+			:
+			m_data(std::exchange(other.m_data, nullptr)),
+			m_size(std::exchange(other.m_size, 0))
+		{
+		}
+		AlignedBuffer& operator=(AlignedBuffer&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Release();
+				m_data = std::exchange(other.m_data, nullptr);
+				m_size = std::exchange(other.m_size, 0);
+			}
+			return *this;
+		}
+
+	public:
+		T* data() noexcept { return m_data; }
+		const T* data() const noexcept { return m_data; }
+		std::size_t size() const noexcept { return m_size; }
+
+		T& operator[](std::size_t i) noexcept { return m_data[i]; }
+		const T& operator[](std::size_t i) const noexcept { return m_data[i]; }
+
+		// Resets every element to zero
+		void Clear() noexcept { std::fill_n(m_data, m_size, T{}); }
+
+	private:
+		void Release() noexcept
+		{
+			if (m_data)
+				::operator delete(m_data, std::align_val_t{ Alignment });
+		}
+
+	private:
+		T* m_data = nullptr;
+		std::size_t m_size = 0;
+	};
+}
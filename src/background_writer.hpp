@@ -0,0 +1,133 @@
+#pragma once
+#include <algorithm>	// std::max
+#include <atomic>
+#include <chrono>
+#include <cstddef>	// std::size_t
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <utility>	// std::move
+#include <vector>
+#include "spsc_queue.hpp"
+
+namespace xtd_fluid_simulation {
+	/**
+	*	The frame pool and writer thread behind RecordingWriter and FrameExporter, which only bring the encoding.
+	*
+	*	Pool frames of T are allocated once. Append fills a free one on the producer's thread and queues it, the writer
+	*	thread hands each queued frame, in order, to the write function given to Start and returns it to the free queue,
+	*	so the producer never waits on the disk until it is Pool frames ahead. Then Append drops the frame (counted) or,
+	*	asked to wait, sleeps until one is free (the time counted).
+	*/
+	template<typename T, std::size_t Pool>
+	class BackgroundWriter {
+	public:
+		// Frames of frameSize elements, zeroed. No thread runs before Start
+		explicit BackgroundWriter(std::size_t frameSize)
+			:
+			m_frames(Pool, std::vector<T>(frameSize))
+		{
+			for (int frame = 0; frame < static_cast<int>(Pool); ++frame)
+				m_free.TryPush(frame);
+		}
+
+		~BackgroundWriter() { Stop(); }
+
+		BackgroundWriter(const BackgroundWriter&) = delete;
+		BackgroundWriter& operator=(const BackgroundWriter&) = delete;
+
+	public:
+		// Starts the writer thread, which calls write(const T* frame) for every frame queued from now on
+		void Start(std::function<void(const T*)> write)
+		{
+			m_write = std::move(write);
+			m_thread = std::thread(&BackgroundWriter::Run, this);
+		}
+
+		// Writes what is queued and joins the writer thread, Append drops everything afterwards
+		void Stop()
+		{
+			if (!m_thread.joinable())
+				return;
+			m_stop.store(true, std::memory_order_release);
+			m_thread.join();
+		}
+
+		bool IsRunning() const noexcept { return m_thread.joinable(); }
+
+		/**
+		*	Calls fill(T* frame) on a free frame (of the size given to the constructor) and queues it, false when the frame was
+		*	dropped instead: the writer is Pool frames behind (unless wait), or it is not running.
+		*/
+		template<typename Fill>
+		bool Append(Fill&& fill, bool wait) noexcept
+		{
+			if (!IsRunning())
+			{
+				CountDropped();
+				return false;
+			}
+
+			int frame;
+			if (!m_free.TryPop(frame))
+			{
+				if (!wait)
+				{
+					CountDropped();
+					return false;
+				}
+				const auto start = std::chrono::steady_clock::now();
+				while (!m_free.TryPop(frame))
+					std::this_thread::sleep_for(IDLE_WAIT);
+				m_wait_nanoseconds.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count(), std::memory_order_relaxed);
+			}
+			fill(m_frames[frame].data());
+			// The pool holds Pool frames and so does the queue, it cannot be full
+			m_queued.TryPush(frame);
+			m_appended.fetch_add(1, std::memory_order_relaxed);
+			return true;
+		}
+
+		// A frame the caller rejected itself, counted with the ones Append dropped
+		void CountDropped() noexcept { m_dropped.fetch_add(1, std::memory_order_relaxed); }
+
+		int get_appended() const noexcept { return m_appended.load(std::memory_order_relaxed); }
+		int get_dropped() const noexcept { return m_dropped.load(std::memory_order_relaxed); }
+		std::int64_t get_wait_nanoseconds() const noexcept { return m_wait_nanoseconds.load(std::memory_order_relaxed); }
+
+	private:
+		// How long the writer thread (or a waiting Append) sleeps between polls, a frame is 16 ms apart at 60 a second
+		inline static constexpr const auto IDLE_WAIT = std::chrono::milliseconds(1);
+
+		void Run()
+		{
+			while (true)
+			{
+				// Stop is seen before the last drain, so nothing Append queued ahead of it is left behind
+				const bool stopping = m_stop.load(std::memory_order_acquire);
+				int frame;
+				while (m_queued.TryPop(frame))
+				{
+					m_write(m_frames[frame].data());
+					m_free.TryPush(frame);
+				}
+				if (stopping)
+					return;
+				std::this_thread::sleep_for(IDLE_WAIT);
+			}
+		}
+
+	private:
+		// Indices into m_frames: m_free from the writer to the producer, m_queued back
+		std::vector<std::vector<T>> m_frames;
+		SpscQueue<int, Pool> m_queued;
+		SpscQueue<int, Pool> m_free;
+		std::atomic<int> m_appended{ 0 };
+		std::atomic<int> m_dropped{ 0 };
+		std::atomic<std::int64_t> m_wait_nanoseconds{ 0 };
+
+		std::function<void(const T*)> m_write;
+		std::thread m_thread;
+		std::atomic<bool> m_stop{ false };
+	};
+}
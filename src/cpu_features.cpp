@@ -0,0 +1,52 @@
+#include "cpu_features.hpp"
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>	// __cpuidex, _xgetbv
+#endif
+using namespace xtd_fluid_simulation;
+
+namespace {
+	SimdLevel Detect() noexcept
+	{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx512f"))
+			return SimdLevel::Avx512;
+		if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+			return SimdLevel::Avx2;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		int info[4];
+		__cpuidex(info, 1, 0);
+		const bool osxsave = (info[2] & (1 << 27)) != 0;
+		const bool fma = (info[2] & (1 << 12)) != 0;
+		const bool f16c = (info[2] & (1 << 29)) != 0;
+		if (!osxsave)
+			return SimdLevel::Scalar;
+		// The OS has to save the ymm (and zmm) registers on context switches
+		const unsigned long long xcr0 = _xgetbv(0);
+		__cpuidex(info, 7, 0);
+		const bool avx2 = (info[1] & (1 << 5)) != 0;
+		const bool avx512f = (info[1] & (1 << 16)) != 0;
+		if (avx512f && (xcr0 & 0xe6) == 0xe6)
+			return SimdLevel::Avx512;
+		if (avx2 && fma && f16c && (xcr0 & 0x6) == 0x6)
+			return SimdLevel::Avx2;
+#endif
+		return SimdLevel::Scalar;
+	}
+}
+
+SimdLevel xtd_fluid_simulation::DetectSimdLevel() noexcept
+{
+	static const SimdLevel level = Detect();
+	return level;
+}
+
+const char* xtd_fluid_simulation::ToString(SimdLevel level) noexcept
+{
+	switch (level)
+	{
+		case SimdLevel::Avx2: return "AVX2";
+		case SimdLevel::Avx512: return "AVX-512";
+		default: return "Scalar";
+	}
+}
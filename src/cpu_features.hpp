@@ -0,0 +1,15 @@
+#pragma once
+
+namespace xtd_fluid_simulation {
+	// Widest vector instruction set a kernel may use, in increasing order
+	enum class SimdLevel {
+		Scalar,
+		Avx2, // AVX2 + FMA + F16C (every AVX2 CPU has it), 8 floats
+		Avx512, // AVX-512F (which has the 16-bit float conversions), 16 floats
+	};
+
+	// Best level the running CPU (and OS) supports, detected once
+	SimdLevel DetectSimdLevel() noexcept;
+
+	const char* ToString(SimdLevel level) noexcept;
+}
@@ -1,190 +1,1068 @@
 #include "fluid.hpp"
+#include "fluid_kernels.hpp"
+#include "simd_kernels.hpp"
 #include <cmath>	// std::floor
+#include <algorithm>	// std::max, std::copy_n
+#include <cstring>	// std::memcpy, std::memcmp
+#include <fstream>
+#include <stdexcept>
+#include <utility>	// std::move
 using namespace xtd_fluid_simulation;
 
-Fluid::Fluid()
+namespace {
+	constexpr char STATE_MAGIC[8] = { 'X', 'F', 'L', 'U', 'I', 'D', 'S', 'T' };
+
+	// Checkpoint header, followed by the fields in the order Fluid::SaveState writes them
+	struct StateHeader {
+		char magic[8];
+		std::uint32_t version;
+		std::int32_t size;
+		std::uint32_t precision; // FieldPrecision of density and the previous velocities
+		std::int32_t speed;
+		float viscosity;
+		float diffusion;
+		std::int32_t iterations;
+		float tolerance;
+		std::int32_t residualInterval;
+		std::uint32_t warmStart;
+		std::uint32_t diffuseSolver;
+		std::uint32_t projectSolver;
+		float jacobiWeight;
+		std::uint32_t pressureSolver;
+		std::int32_t multigridCycles;
+		std::uint32_t fusedPasses;
+		std::uint32_t sparseTiles;
+		std::uint32_t advection;
+	};
+	static_assert(std::is_trivially_copyable_v<StateHeader> && sizeof(StateHeader) == 80, "StateHeader is written as is");
+}
+
+Fluid::Fluid(int size, int scale, int threads)
 	:
-	m_fluid_particles{ 0.0f },
-	m_density{ 0.0f },
-	m_velocity_x{ 0.0f },
-	m_velocity_y{ 0.0f },
-	m_prev_velocity_x{ 0.0f },
-	m_prev_velocity_y{ 0.0f }
+	m_size(std::max(size, MIN_SIZE)),
+	m_scale(std::max(scale, 1)),
+	m_fluid_particles(static_cast<std::size_t>(m_size) * m_size),
+	m_density(static_cast<std::size_t>(m_size) * m_size),
+	m_velocity_x(static_cast<std::size_t>(m_size) * m_size),
+	m_velocity_y(static_cast<std::size_t>(m_size) * m_size),
+	m_prev_velocity_x(static_cast<std::size_t>(m_size) * m_size),
+	m_prev_velocity_y(static_cast<std::size_t>(m_size) * m_size),
+	m_pressure(static_cast<std::size_t>(m_size) * m_size),
+	m_divergence(static_cast<std::size_t>(m_size) * m_size),
+	m_row_scratch(static_cast<std::size_t>(m_size)),
+	m_jacobi_scratch(static_cast<std::size_t>(m_size) * m_size),
+	m_thread_pool(new ThreadPool(threads)),
+	m_multigrid(new Multigrid(m_size)),
+	m_active_tiles(m_size),
+	m_obstacles(m_size)
+{
+	m_solve_reports.reserve(8);
+	m_brushes.reserve(64);
+	for (int k = 0; k < LANES; k++)
+	{
+		m_lanes[k].index = k;
+		m_lanes[k].solveReports.reserve(4);
+	}
+	m_lanes[0].rowScratch = m_row_scratch.data();
+	AllocateLanes();
+	set_simd_level(DetectSimdLevel());
+}
+
+void Fluid::set_thread_count(const int threads)
+{
+	m_thread_pool.reset(new ThreadPool(threads));
+}
+
+void Fluid::set_task_graph(const bool enabled)
+{
+	m_task_graph_enabled = enabled;
+	AllocateLanes();
+}
+
+void Fluid::AllocateLanes()
 {
-	std::memset(m_fluid_particles.data(), 0, m_fluid_particles.size());
-	std::memset(m_density.data(), 0, m_density.size());
-	std::memset(m_velocity_x.data(), 0, m_velocity_x.size());
-	std::memset(m_velocity_y.data(), 0, m_velocity_y.size());
-	std::memset(m_prev_velocity_x.data(), 0, m_prev_velocity_x.size());
-	std::memset(m_prev_velocity_y.data(), 0, m_prev_velocity_y.size());
+	const std::size_t rows = m_task_graph_enabled ? static_cast<std::size_t>(m_size) : 0;
+	for (int k = 1; k < LANES; k++)
+	{
+		Lane& lane = m_lanes[k];
+		if (lane.ownRowScratch.size() != rows)
+			lane.ownRowScratch = AlignedBuffer<float>(rows);
+		lane.rowScratch = lane.ownRowScratch.data();
+	}
 }
 
 void Fluid::Update(const float dt) noexcept
 {
 	m_motion_speed = m_speed * dt;
-	Diffuse(1, m_prev_velocity_x.data(), m_velocity_x.data(), m_vescosity, m_motion_speed);
-	Diffuse(2, m_prev_velocity_y.data(), m_velocity_y.data(), m_vescosity, m_motion_speed);
+	m_solve_reports.clear();
+	for (std::vector<SolveReport>& reports : m_stage_reports)
+		reports.clear();
+	m_frame_sample = FrameSample{ m_frame_sample.frame + 1 };
+
+	m_sparse_step = m_sparse_tiles && m_pressure_solver == PressureSolver::Relaxation;
+	if (m_sparse_step)
+		m_active_tiles.Dilate();
+	else if (m_sparse_tiles)
+		m_active_tiles.MarkAll();
+	m_active_fraction = m_sparse_step ? static_cast<float>(m_active_tiles.GetActiveCount()) / m_active_tiles.GetMask().size() : 1.0f;
+
+	DispatchSize([this](auto n) {
+		DispatchPrecision([this](auto field) { UpdateN<decltype(n)::value, std::remove_pointer_t<decltype(field)>>(); });
+	});
+	m_sparse_step = false;
+
+	// In the order the stages run one after another
+	for (const std::vector<SolveReport>& reports : m_stage_reports)
+		m_solve_reports.insert(m_solve_reports.end(), reports.begin(), reports.end());
+}
+
+/**
+*	T is the storage type of density and the previous velocities. Stored in 16 bits, every stage reads and writes them
+*	as they are (the kernels are templated on their field types), there are no float copies.
+*
+*	The stages are added in the order they run sequentially (RunInline), each after the stages it reads the output of
+*	or overwrites the input of. Density only meets the velocity again at its advection.
+*/
+template<int NC, typename T>
+void Fluid::UpdateN() noexcept
+{
+	T* prevVx = Field<T>(m_prev_velocity_x, m_prev_velocity_x_16);
+	T* prevVy = Field<T>(m_prev_velocity_y, m_prev_velocity_y_16);
+	T* density = Field<T>(m_density, m_density_16);
+	Lane& velocityLane = GetLane(0);
+	Lane& velocityYLane = GetLane(1);
+	Lane& densityLane = GetLane(2);
+	// The parallel solvers fork/join on the pool themselves
+	const bool diffuseAlone = m_diffuse_solver != Solver::GaussSeidel;
+	const bool projectAlone = m_project_solver != Solver::GaussSeidel;
+
+	TaskGraph& graph = m_task_graph;
+	graph.Clear();
+	int inject = -1;
+	if (!m_brushes.empty() || m_force_x != 0.0f || m_force_y != 0.0f)
+		inject = graph.Add([&] { RunStage(Stage::Inject, velocityLane, [&] { InjectN(density); }); });
+
+	const int diffuseX = graph.Add([&] {
+		RunStage(Stage::DiffuseVelocityX, velocityLane, [&] { DiffuseN<NC>(velocityLane, 1, prevVx, m_velocity_x.data(), m_vescosity, m_motion_speed); });
+	}, { inject }, diffuseAlone);
+	const int diffuseY = graph.Add([&] {
+		RunStage(Stage::DiffuseVelocityY, velocityYLane, [&] { DiffuseN<NC>(velocityYLane, 2, prevVy, m_velocity_y.data(), m_vescosity, m_motion_speed); });
+	}, { inject }, diffuseAlone);
+
+	const int projectDiffused = graph.Add([&] {
+		RunStage(Stage::ProjectDiffused, velocityLane, [&] { ProjectN<NC>(prevVx, prevVy, m_pressure.data(), m_divergence.data(), m_warm_start); });
+	}, { diffuseX, diffuseY }, projectAlone);
+
+	int advectX = -1, advectY = -1;
+	if (m_fused_passes)
+	{
+		advectX = graph.Add([&] {
+			RunStage(Stage::AdvectVelocity, velocityLane, [&] { AdvectVelocityN<NC>(prevVx, prevVy, m_motion_speed); });
+		}, { projectDiffused });
+	}
+	else
+	{
+		advectX = graph.Add([&] {
+			RunStage(Stage::AdvectVelocityX, velocityLane, [&] { AdvectN<NC>(velocityLane, 1, m_velocity_x.data(), prevVx, prevVx, prevVy, m_motion_speed); });
+		}, { projectDiffused });
+		advectY = graph.Add([&] {
+			RunStage(Stage::AdvectVelocityY, velocityYLane, [&] { AdvectN<NC>(velocityYLane, 2, m_velocity_y.data(), prevVy, prevVx, prevVy, m_motion_speed); });
+		}, { projectDiffused });
+	}
+
+	const int projectAdvected = graph.Add([&] {
+		RunStage(Stage::ProjectAdvected, velocityLane, [&] { ProjectN<NC>(m_velocity_x.data(), m_velocity_y.data(), m_pressure.data(), m_divergence.data(), m_warm_start); });
+	}, { advectX, advectY }, projectAlone);
+
+	const int diffuseDensity = graph.Add([&] {
+		RunStage(Stage::DiffuseDensity, densityLane, [&] { DiffuseN<NC>(densityLane, 0, m_fluid_particles.data(), density, m_diffusion, m_motion_speed); });
+	}, { inject }, diffuseAlone);
+	const int advectDensity = graph.Add([&] {
+		RunStage(Stage::AdvectDensity, densityLane, [&] { AdvectN<NC>(densityLane, 0, density, m_fluid_particles.data(), m_velocity_x.data(), m_velocity_y.data(), m_motion_speed); });
+	}, { projectAdvected, diffuseDensity });
+
+	if (m_sparse_step)
+		graph.Add([&] { RunStage(Stage::RetireTiles, velocityLane, [&] { RetireQuietTilesN<NC>(density, prevVx, prevVy); }); }, { advectDensity });
 
-	Project(m_prev_velocity_x.data(), m_prev_velocity_y.data(), m_velocity_x.data(), m_velocity_y.data());
+	if (m_task_graph_enabled)
+		graph.Run(*m_thread_pool);
+	else
+		graph.RunInline();
+}
+
+template<int NC, typename T>
+void Fluid::RetireQuietTilesN(T* density, T* prevVx, T* prevVy) noexcept
+{
+	const int N = Size<NC>();
+	const int tiles = m_active_tiles.GetTilesPerRow();
+	const float* vx = m_velocity_x.data();
+	const float* vy = m_velocity_y.data();
+	// Density and velocity of the active tiles read, a few tiles cleared
+	CountTraffic(N, 3 * m_active_fraction);
+
+	for (int ty = 0; ty < tiles; ty++)
+	{
+		const int rowBegin = ty * ActiveTiles::TILE;
+		const int rowEnd = std::min(rowBegin + ActiveTiles::TILE, N);
+		for (int tx = 0; tx < tiles; tx++)
+		{
+			if (!m_active_tiles.IsActive(tx, ty))
+				continue;
+			const int colBegin = tx * ActiveTiles::TILE;
+			const int colEnd = std::min(colBegin + ActiveTiles::TILE, N);
 
-	Advect(1, m_velocity_x.data(), m_prev_velocity_x.data(), m_prev_velocity_x.data(), m_prev_velocity_y.data(), m_motion_speed);
-	Advect(2, m_velocity_y.data(), m_prev_velocity_y.data(), m_prev_velocity_x.data(), m_prev_velocity_y.data(), m_motion_speed);
+			bool quiet = true;
+			for (int j = rowBegin; j < rowEnd && quiet; j++)
+				for (int i = j * N + colBegin; i < j * N + colEnd; i++)
+					quiet = quiet
+						&& std::fabs(static_cast<float>(density[i])) < TILE_DENSITY_EPSILON
+						&& std::fabs(vx[i]) < TILE_VELOCITY_EPSILON
+						&& std::fabs(vy[i]) < TILE_VELOCITY_EPSILON;
+			if (!quiet)
+				continue;
 
-	Project(m_velocity_x.data(), m_velocity_y.data(), m_prev_velocity_x.data(), m_prev_velocity_y.data());
+			// Every field of a skipped tile is zero, so the kernels of the next steps can read it as is
+			for (int j = rowBegin; j < rowEnd; j++)
+			{
+				const int first = j * N + colBegin;
+				const int count = colEnd - colBegin;
+				std::fill_n(density + first, count, T(0.0f));
+				std::fill_n(prevVx + first, count, T(0.0f));
+				std::fill_n(prevVy + first, count, T(0.0f));
+				std::fill_n(m_fluid_particles.data() + first, count, 0.0f);
+				std::fill_n(m_velocity_x.data() + first, count, 0.0f);
+				std::fill_n(m_velocity_y.data() + first, count, 0.0f);
+				std::fill_n(m_pressure.data() + first, count, 0.0f);
+			}
+			m_active_tiles.Retire(tx, ty);
+		}
+	}
+}
 
-	Diffuse(0, m_fluid_particles.data(), m_density.data(), m_diffusion, m_motion_speed);
-	Advect(0, m_density.data(), m_fluid_particles.data(), m_velocity_x.data(), m_velocity_y.data(), m_motion_speed);
+void Fluid::set_sparse_tiles(const bool sparse)
+{
+	// Nothing is known to be quiet yet, the first step retires what is
+	if (sparse && !m_sparse_tiles)
+		m_active_tiles.MarkAll();
+	m_sparse_tiles = sparse;
 }
 
 void Fluid::AddDensity(int x, int y, float amount) noexcept
 {
-	this->m_density[IX(x, y)] += amount;
+	const int index = IX(x, y);
+	m_active_tiles.Mark(index % m_size, index / m_size);
+	DispatchPrecision([&](auto field) {
+		using T = std::remove_pointer_t<decltype(field)>;
+		T& density = Field<T>(m_density, m_density_16)[index];
+		density = density + amount;
+	});
+}
+
+void Fluid::ReadDensity(float* out) const noexcept
+{
+	const std::size_t cells = static_cast<std::size_t>(m_size) * m_size;
+	switch (m_field_precision)
+	{
+		case FieldPrecision::Float16: DecodeField(reinterpret_cast<const Float16*>(m_density_16.data()), out); break;
+		case FieldPrecision::BFloat16: DecodeField(reinterpret_cast<const BFloat16*>(m_density_16.data()), out); break;
+		default: std::copy_n(m_density.data(), cells, out); break;
+	}
+}
+
+template<typename T>
+void Fluid::DecodeField(const T* in, float* out) const noexcept
+{
+	const std::size_t cells = static_cast<std::size_t>(m_size) * m_size;
+	if (m_decode_kernel)
+		m_decode_kernel(reinterpret_cast<const std::uint16_t*>(in), out, cells);
+	else
+		kernels::ConvertField(in, out, cells);
+}
+
+template<typename T>
+void Fluid::EncodeField(const float* in, T* out) const noexcept
+{
+	const std::size_t cells = static_cast<std::size_t>(m_size) * m_size;
+	if (m_encode_kernel)
+		m_encode_kernel(in, reinterpret_cast<std::uint16_t*>(out), cells);
+	else
+		kernels::ConvertField(in, out, cells);
+}
+
+void Fluid::set_field_precision(const FieldPrecision precision)
+{
+	if (precision == m_field_precision)
+		return;
+
+	// Through float, with the converters of the current precision
+	const std::size_t cells = static_cast<std::size_t>(m_size) * m_size;
+	AlignedBuffer<float> density(cells), prevVx(cells), prevVy(cells);
+	DispatchPrecision([&](auto field) {
+		using T = std::remove_pointer_t<decltype(field)>;
+		if constexpr (std::is_same_v<T, float>) {
+			std::copy_n(m_density.data(), cells, density.data());
+			std::copy_n(m_prev_velocity_x.data(), cells, prevVx.data());
+			std::copy_n(m_prev_velocity_y.data(), cells, prevVy.data());
+		}
+		else {
+			DecodeField(Field<T>(m_density, m_density_16), density.data());
+			DecodeField(Field<T>(m_prev_velocity_x, m_prev_velocity_x_16), prevVx.data());
+			DecodeField(Field<T>(m_prev_velocity_y, m_prev_velocity_y_16), prevVy.data());
+		}
+	});
+
+	m_field_precision = precision;
+	m_decode_kernel = kernels::GetDecodeFieldKernel(m_simd_level, m_field_precision);
+	m_encode_kernel = kernels::GetEncodeFieldKernel(m_simd_level, m_field_precision);
+	if (precision == FieldPrecision::Float32)
+	{
+		m_density = std::move(density);
+		m_prev_velocity_x = std::move(prevVx);
+		m_prev_velocity_y = std::move(prevVy);
+		m_density_16 = {};
+		m_prev_velocity_x_16 = {};
+		m_prev_velocity_y_16 = {};
+		m_jacobi_scratch_16 = {};
+		return;
+	}
+
+	m_density = {};
+	m_prev_velocity_x = {};
+	m_prev_velocity_y = {};
+	m_density_16 = AlignedBuffer<std::uint16_t>(cells);
+	m_prev_velocity_x_16 = AlignedBuffer<std::uint16_t>(cells);
+	m_prev_velocity_y_16 = AlignedBuffer<std::uint16_t>(cells);
+	m_jacobi_scratch_16 = AlignedBuffer<std::uint16_t>(cells);
+	DispatchPrecision([&](auto field) {
+		using T = std::remove_pointer_t<decltype(field)>;
+		if constexpr (!std::is_same_v<T, float>) {
+			EncodeField(density.data(), Field<T>(m_density, m_density_16));
+			EncodeField(prevVx.data(), Field<T>(m_prev_velocity_x, m_prev_velocity_x_16));
+			EncodeField(prevVy.data(), Field<T>(m_prev_velocity_y, m_prev_velocity_y_16));
+		}
+	});
+}
+
+std::size_t Fluid::get_field_bytes() const noexcept
+{
+	const auto bytes = [](const auto& buffer) { return buffer.size() * sizeof(buffer[0]); };
+	return bytes(m_fluid_particles) + bytes(m_density) + bytes(m_velocity_x) + bytes(m_velocity_y)
+		+ bytes(m_prev_velocity_x) + bytes(m_prev_velocity_y) + bytes(m_pressure) + bytes(m_divergence)
+		+ bytes(m_row_scratch) + bytes(m_jacobi_scratch) + bytes(m_advect_scratch_x) + bytes(m_advect_scratch_y)
+		+ bytes(m_density_16) + bytes(m_prev_velocity_x_16) + bytes(m_prev_velocity_y_16) + bytes(m_jacobi_scratch_16)
+		+ bytes(m_lanes[1].ownRowScratch) + bytes(m_lanes[2].ownRowScratch);
+}
+
+void Fluid::SaveState(const std::string& path) const
+{
+	StateHeader header{};
+	std::memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+	header.version = STATE_VERSION;
+	header.size = m_size;
+	header.precision = static_cast<std::uint32_t>(m_field_precision);
+	header.speed = m_speed;
+	header.viscosity = m_vescosity;
+	header.diffusion = m_diffusion;
+	header.iterations = m_iterations;
+	header.tolerance = m_tolerance;
+	header.residualInterval = m_residual_interval;
+	header.warmStart = m_warm_start;
+	header.diffuseSolver = static_cast<std::uint32_t>(m_diffuse_solver);
+	header.projectSolver = static_cast<std::uint32_t>(m_project_solver);
+	header.jacobiWeight = m_jacobi_weight;
+	header.pressureSolver = static_cast<std::uint32_t>(m_pressure_solver);
+	header.multigridCycles = m_multigrid_cycles;
+	header.fusedPasses = m_fused_passes;
+	header.sparseTiles = m_sparse_tiles;
+	header.advection = static_cast<std::uint32_t>(m_advection);
+
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	const auto write = [&file](const auto& buffer) { file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(buffer[0])); };
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	// Everything a step reads before writing it: the solves start from their output field, warm start from the pressure
+	write(m_fluid_particles);
+	write(m_velocity_x);
+	write(m_velocity_y);
+	write(m_pressure);
+	if (m_field_precision == FieldPrecision::Float32) {
+		write(m_density);
+		write(m_prev_velocity_x);
+		write(m_prev_velocity_y);
+	}
+	else {
+		write(m_density_16);
+		write(m_prev_velocity_x_16);
+		write(m_prev_velocity_y_16);
+	}
+	write(m_active_tiles.GetMask());
+	write(m_obstacles.GetBits());
+	file.close();
+	if (!file)
+		throw std::runtime_error("cannot write checkpoint " + path);
+}
+
+void Fluid::LoadState(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		throw std::runtime_error("cannot open checkpoint " + path);
+	const std::streamoff fileBytes = file.tellg();
+	file.seekg(0);
+
+	StateHeader header{};
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, STATE_MAGIC, sizeof(header.magic)) != 0)
+		throw std::runtime_error(path + ": not a checkpoint");
+	if (header.version != STATE_VERSION)
+		throw std::runtime_error(path + ": checkpoint version " + std::to_string(header.version) + ", expected " + std::to_string(STATE_VERSION));
+	if (header.size != m_size)
+		throw std::runtime_error(path + ": grid size " + std::to_string(header.size) + ", expected " + std::to_string(m_size));
+	if (header.precision > static_cast<std::uint32_t>(FieldPrecision::BFloat16))
+		throw std::runtime_error(path + ": unknown field precision");
+	if (header.diffuseSolver > static_cast<std::uint32_t>(Solver::Jacobi) || header.projectSolver > static_cast<std::uint32_t>(Solver::Jacobi)
+		|| header.pressureSolver > static_cast<std::uint32_t>(PressureSolver::Multigrid))
+		throw std::runtime_error(path + ": unknown solver");
+	if (header.advection > static_cast<std::uint32_t>(Advection::MacCormack))
+		throw std::runtime_error(path + ": unknown advection scheme");
+
+	// The whole file is checked before the fluid is touched
+	const std::size_t cells = static_cast<std::size_t>(m_size) * m_size;
+	const std::size_t storedBytes = header.precision == static_cast<std::uint32_t>(FieldPrecision::Float32) ? sizeof(float) : sizeof(std::uint16_t);
+	const std::size_t expectedBytes = sizeof(header) + cells * (4 * sizeof(float) + 3 * storedBytes) + m_active_tiles.GetMask().size()
+		+ m_obstacles.GetBits().size() * sizeof(std::uint64_t);
+	if (fileBytes != static_cast<std::streamoff>(expectedBytes))
+		throw std::runtime_error(path + ": truncated checkpoint");
+
+	// Everything is read into temporaries first, the fluid only changes once the whole checkpoint is in
+	const FieldPrecision precision = static_cast<FieldPrecision>(header.precision);
+	const std::size_t floatCells = precision == FieldPrecision::Float32 ? cells : 0;
+	const std::size_t cells16 = cells - floatCells;
+	AlignedBuffer<float> fluidParticles(cells), velocityX(cells), velocityY(cells), pressure(cells);
+	AlignedBuffer<float> density(floatCells), prevVelocityX(floatCells), prevVelocityY(floatCells);
+	AlignedBuffer<std::uint16_t> density16(cells16), prevVelocityX16(cells16), prevVelocityY16(cells16);
+	std::vector<std::uint8_t> mask(m_active_tiles.GetMask().size());
+	std::vector<std::uint64_t> obstacles(m_obstacles.GetBits().size());
+	const auto read = [&file](auto& buffer) { file.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(buffer[0])); };
+	read(fluidParticles);
+	read(velocityX);
+	read(velocityY);
+	read(pressure);
+	// Only one of the two sets is sized
+	read(density);
+	read(prevVelocityX);
+	read(prevVelocityY);
+	read(density16);
+	read(prevVelocityX16);
+	read(prevVelocityY16);
+	read(mask);
+	read(obstacles);
+	if (!file)
+		throw std::runtime_error("cannot read checkpoint " + path);
+
+	set_field_precision(precision);
+	set_advection(static_cast<Advection>(header.advection));
+	m_fluid_particles = std::move(fluidParticles);
+	m_velocity_x = std::move(velocityX);
+	m_velocity_y = std::move(velocityY);
+	m_pressure = std::move(pressure);
+	if (precision == FieldPrecision::Float32) {
+		m_density = std::move(density);
+		m_prev_velocity_x = std::move(prevVelocityX);
+		m_prev_velocity_y = std::move(prevVelocityY);
+	}
+	else {
+		m_density_16 = std::move(density16);
+		m_prev_velocity_x_16 = std::move(prevVelocityX16);
+		m_prev_velocity_y_16 = std::move(prevVelocityY16);
+	}
+	m_active_tiles.SetMask(mask.data());
+	m_obstacles.SetBits(obstacles.data());
+
+	m_speed = header.speed;
+	set_viscosity(header.viscosity);
+	set_diffusion(header.diffusion);
+	set_iterations(header.iterations);
+	set_tolerance(header.tolerance);
+	set_residual_interval(header.residualInterval);
+	m_warm_start = header.warmStart != 0;
+	m_diffuse_solver = static_cast<Solver>(header.diffuseSolver);
+	m_project_solver = static_cast<Solver>(header.projectSolver);
+	set_jacobi_weight(header.jacobiWeight);
+	m_pressure_solver = static_cast<PressureSolver>(header.pressureSolver);
+	set_multigrid_cycles(header.multigridCycles);
+	m_fused_passes = header.fusedPasses != 0;
+	// Not through set_sparse_tiles, the saved mask is the active set
+	m_sparse_tiles = header.sparseTiles != 0;
 }
 
 void Fluid::AddVelocity(int x, int y, float amountX, float amountY) noexcept
 {
 	const int index = IX(x, y);
+	m_active_tiles.Mark(index % m_size, index / m_size);
 
 	this->m_velocity_x[index] += amountX;
 	this->m_velocity_y[index] += amountY;
 }
 
+void Fluid::AddBrush(const Brush& brush)
+{
+	int rowBegin, rowEnd, colBegin, colEnd;
+	kernels::BrushExtent(m_size, brush.y, brush.radius, rowBegin, rowEnd);
+	kernels::BrushExtent(m_size, brush.x, brush.radius, colBegin, colEnd);
+	// Entirely off the grid, it would paint nothing
+	if (rowBegin >= rowEnd || colBegin >= colEnd)
+		return;
+	// The tiles of the brush's bounding box
+	if (m_sparse_tiles)
+		for (int ty = rowBegin / ActiveTiles::TILE; ty <= (rowEnd - 1) / ActiveTiles::TILE; ty++)
+			for (int tx = colBegin / ActiveTiles::TILE; tx <= (colEnd - 1) / ActiveTiles::TILE; tx++)
+				m_active_tiles.Mark(tx * ActiveTiles::TILE, ty * ActiveTiles::TILE);
+	m_brushes.push_back(brush);
+}
+
+void Fluid::PaintObstacle(float x, float y, float radius, bool solid)
+{
+	m_obstacles.Paint(x, y, radius, solid);
+}
+
+void Fluid::SetObstacles(const ObstacleMap& obstacles)
+{
+	if (obstacles.GetSize() != m_size)
+		throw std::invalid_argument("obstacle map of size " + std::to_string(obstacles.GetSize()) + ", expected " + std::to_string(m_size));
+	m_obstacles.SetBits(obstacles.GetBits().data());
+}
+
+void Fluid::AddForce(float amountX, float amountY)
+{
+	m_force_x += amountX;
+	m_force_y += amountY;
+	// A force reaches every tile
+	if (m_sparse_tiles && (amountX != 0.0f || amountY != 0.0f))
+		m_active_tiles.MarkAll();
+}
+
+// T is the density storage type, the brushes are added per cell in it
+template<typename T>
+void Fluid::InjectN(T* density) noexcept
+{
+	const int N = m_size;
+	const bool force = m_force_x != 0.0f || m_force_y != 0.0f;
+	int rowBegin = force ? 0 : N, rowEnd = force ? N : 0;
+	for (const Brush& brush : m_brushes)
+	{
+		int begin, end;
+		kernels::BrushExtent(N, brush.y, brush.radius, begin, end);
+		rowBegin = std::min(rowBegin, begin);
+		rowEnd = std::max(rowEnd, end);
+	}
+
+	// Row by row, each row's force and splats while it is in cache
+	for (int j = rowBegin; j < rowEnd; j++)
+	{
+		const std::size_t row = static_cast<std::size_t>(j) * N;
+		float* vx = m_velocity_x.data() + row;
+		float* vy = m_velocity_y.data() + row;
+		if (force)
+		{
+			for (int i = 0; i < N; i++)
+			{
+				vx[i] += m_force_x;
+				vy[i] += m_force_y;
+			}
+		}
+		for (const Brush& brush : m_brushes)
+		{
+			int colBegin, colEnd;
+			if (kernels::BrushSpan(N, brush.x, brush.y, brush.radius, j, colBegin, colEnd))
+				kernels::SplatBrushRow(j, colBegin, colEnd, 1, brush.x, brush.y, brush.radius, brush.density, brush.velocityX, brush.velocityY, density + row, vx, vy);
+		}
+	}
+	// Both velocities and, under brushes, the density, over the rows visited
+	const float densityPasses = m_brushes.empty() ? 0.0f : 2.0f * sizeof(T) / sizeof(float);
+	CountTraffic(N, (4.0f + densityPasses) * std::max(rowEnd - rowBegin, 0) / N);
+
+	m_brushes.clear();
+	m_force_x = m_force_y = 0.0f;
+}
+
 void Fluid::Diffuse(int b, float* x, float* x0, float diff, float dt) noexcept
 {
+	DispatchSize([&](auto n) { DiffuseN<decltype(n)::value>(m_lanes[0], b, x, x0, diff, dt); });
+	KeepSolveReports();
+}
+
+// T and S are the types x and x0 are stored as, one of them is 16-bit for the stored fields in the 16-bit formats
+template<int NC, typename T, typename S>
+void Fluid::DiffuseN(Lane& lane, int b, T* x, const S* x0, float diff, float dt) noexcept
+{
+	const int N = Size<NC>();
 	const float a = dt * diff * (N - 2) * (N - 2);
-	LinearSolve(b, x, x0, a, 1.0f + SCALE * a);
+	LinearSolveN<NC>(lane, m_diffuse_solver, b, x, x0, a, 1.0f + DEFAULT_SCALE * a);
 }
 
 void Fluid::LinearSolve(int b, float* x, float* x0, float a, float c) noexcept
 {
-	const float cRecip = 1.0f / c;
-	for (int k = 0; k < m_iterations; k++)
+	LinearSolve(m_diffuse_solver, b, x, x0, a, c);
+}
+
+void Fluid::LinearSolve(Solver solver, int b, float* x, float* x0, float a, float c) noexcept
+{
+	DispatchSize([&](auto n) { LinearSolveN<decltype(n)::value>(m_lanes[0], solver, b, x, x0, a, c); });
+	KeepSolveReports();
+}
+
+template<int NC, typename T, typename S>
+void Fluid::RelaxN(Lane& lane, Solver solver, int n, int b, T* x, const S* x0, float a, float c, int sweeps) noexcept
+{
+	// Per sweep traffic: x read and written, x0 read (twice over for the two colors of red-black)
+	const float sweep = 2 * FieldPass<T>() + FieldPass<S>();
+	// Multigrid's coarse levels (n below the grid size) have no obstacles
+	const ObstacleMap* obstacles = n == m_size ? Obstacles() : nullptr;
+	T* jacobiScratch = Field<T>(m_jacobi_scratch, m_jacobi_scratch_16);
+	const kernels::JacobiRowsOf<T, S> jacobiRows = kernels::GetJacobiKernel<T, S>(m_simd_level);
+	const kernels::GaussSeidelRowOf<T, S> gaussSeidelRow = kernels::GetGaussSeidelRowKernel<T, S>(m_simd_level);
+	if (m_sparse_step)
 	{
-		for (int j = 1; j < N - 1; j++)
+		const std::vector<TileSpan>& spans = m_active_tiles.GetSpans();
+		switch (solver)
 		{
-			for (int i = 1; i < N - 1; i++)
-			{
-				const int index = IX(i, j);
-				x[index] =
-					(x0[index]
-						+ a * (x[IX(i + 1, j)]
-							+ x[IX(i - 1, j)]
-							+ x[IX(i, j + 1)]
-							+ x[IX(i, j - 1)]
-							)) * cRecip;
-			}
+			case Solver::GaussSeidel:
+				if (m_fused_passes)
+				{
+					kernels::GaussSeidelWavefrontSpans<NC>(n, b, x, x0, a, c, sweeps, lane.rowScratch, m_active_tiles, obstacles, gaussSeidelRow);
+					const int depth = kernels::WavefrontDepth(n);
+					CountTraffic(lane, n, sweep * ((sweeps + depth - 1) / depth) * m_active_fraction, 1);
+				}
+				else
+				{
+					kernels::GaussSeidelSpans<NC>(n, b, x, x0, a, c, sweeps, lane.rowScratch, spans, obstacles, gaussSeidelRow);
+					CountTraffic(lane, n, sweep * sweeps * m_active_fraction, sweeps);
+				}
+				break;
+			case Solver::RedBlackGaussSeidel:
+				kernels::RedBlackGaussSeidelSpans<NC>(*m_thread_pool, n, b, x, x0, a, c, sweeps, spans, obstacles);
+				CountTraffic(lane, n, 2 * sweep * sweeps * m_active_fraction, sweeps);
+				break;
+			case Solver::Jacobi:
+				// Plus x copied into the scratch first
+				kernels::JacobiSpans<NC>(*m_thread_pool, n, b, x, x0, a, c, m_jacobi_weight, sweeps, jacobiScratch, jacobiRows, spans, obstacles);
+				CountTraffic(lane, n, (sweep * sweeps + (1 + sweeps % 2) * 2 * FieldPass<T>()) * m_active_fraction, sweeps);
+				break;
 		}
+		return;
+	}
 
-		SetBoundary(b, x);
+	switch (solver)
+	{
+		case Solver::GaussSeidel:
+			if (m_fused_passes)
+			{
+				kernels::GaussSeidelWavefront<NC>(n, b, x, x0, a, c, sweeps, lane.rowScratch, obstacles, gaussSeidelRow);
+				const int depth = kernels::WavefrontDepth(n);
+				CountTraffic(lane, n, sweep * ((sweeps + depth - 1) / depth), 1);
+			}
+			else
+			{
+				kernels::GaussSeidel<NC>(n, b, x, x0, a, c, sweeps, lane.rowScratch, obstacles, gaussSeidelRow);
+				CountTraffic(lane, n, sweep * sweeps, sweeps);
+			}
+			break;
+		case Solver::RedBlackGaussSeidel:
+			kernels::RedBlackGaussSeidel<NC>(*m_thread_pool, n, b, x, x0, a, c, sweeps, obstacles);
+			CountTraffic(lane, n, 2 * sweep * sweeps, sweeps);
+			break;
+		case Solver::Jacobi:
+			kernels::Jacobi<NC>(*m_thread_pool, n, b, x, x0, a, c, m_jacobi_weight, sweeps, jacobiScratch, jacobiRows, obstacles);
+			CountTraffic(lane, n, sweep * sweeps + (sweeps % 2) * 2 * FieldPass<T>(), sweeps);
+			break;
 	}
 }
 
-void Fluid::SetBoundary(int b, float* x) noexcept
+template<int NC, typename T, typename S>
+void Fluid::LinearSolveN(Lane& lane, Solver solver, int b, T* x, const S* x0, float a, float c) noexcept
 {
-	for (int i = 1; i < N - 1; i++)
+	const auto relax = [&](int sweeps) { RelaxN<NC>(lane, solver, m_size, b, x, x0, a, c, sweeps); };
+
+	if (m_tolerance <= 0.0f)
 	{
-		x[IX(i, 0)] = b == 2 ? -x[IX(i, 1)] : x[IX(i, 1)];
-		x[IX(i, N - 1)] = b == 2 ? -x[IX(i, N - 2)] : x[IX(i, N - 2)];
+		relax(m_iterations);
+		lane.solveReports.push_back({ m_iterations, -1.0f });
+		return;
 	}
-	for (int j = 1; j < N - 1; j++)
+
+	// Relax in chunks, stopping once the residual is small enough relative to the right hand side
+	const auto residual = [&] {
+		return m_sparse_step ? kernels::Residual<NC>(m_size, x, x0, a, c, m_active_tiles.GetSpans(), Obstacles()) : kernels::Residual<NC>(m_size, x, x0, a, c, Obstacles());
+	};
+	const float threshold = m_tolerance * (m_sparse_step ? kernels::MaxAbs<NC>(m_size, x0, m_active_tiles.GetSpans(), Obstacles()) : kernels::MaxAbs<NC>(m_size, x0, Obstacles()));
+	SolveReport report{ 0, residual() };
+	CountTraffic(lane, m_size, (FieldPass<T>() + 2 * FieldPass<S>()) * m_active_fraction);
+	while (report.residual > threshold && report.iterations < m_iterations)
 	{
-		x[IX(0, j)] = b == 1 ? -x[IX(1, j)] : x[IX(1, j)];
-		x[IX(N - 1, j)] = b == 1 ? -x[IX(N - 2, j)] : x[IX(N - 2, j)];
+		const int sweeps = std::min(m_residual_interval, m_iterations - report.iterations);
+		relax(sweeps);
+		report.iterations += sweeps;
+		report.residual = residual();
+		CountTraffic(lane, m_size, (FieldPass<T>() + FieldPass<S>()) * m_active_fraction);
 	}
+	lane.solveReports.push_back(report);
+}
 
-	x[IX(0, 0)] = 0.50f * (x[IX(1, 0)] + x[IX(0, 1)]);
-	x[IX(0, N - 1)] = 0.50f * (x[IX(1, N - 1)] + x[IX(0, N - 2)]);
-	x[IX(N - 1, 0)] = 0.50f * (x[IX(N - 2, 0)] + x[IX(N - 1, 1)]);
-	x[IX(N - 1, N - 1)] = 0.50f * (x[IX(N - 2, N - 1)] + x[IX(N - 1, N - 2)]);
+void Fluid::SetBoundary(int b, float* x) noexcept
+{
+	DispatchSize([&](auto n) { SetBoundaryN<decltype(n)::value>(b, x); });
+}
+
+template<int NC, typename T>
+void Fluid::SetBoundaryN(int b, T* x) noexcept
+{
+	kernels::SetWalls<NC>(m_size, b, x, Obstacles());
 }
 
 void Fluid::Project(float* velocX, float* velocY, float* p, float* div) noexcept
 {
-	for (int j = 1; j < N - 1; j++) {
-		for (int i = 1; i < N - 1; i++) {
-			const int index = IX(i, j);
-			div[index] = -0.5f * (
-				velocX[IX(i + 1, j)]
-				- velocX[IX(i - 1, j)]
-				+ velocY[IX(i, j + 1)]
-				- velocY[IX(i, j - 1)]
-				) / N;
-			p[index] = 0;
+	Project(velocX, velocY, p, div, false);
+}
+
+void Fluid::Project(float* velocX, float* velocY, float* p, float* div, bool warmStart) noexcept
+{
+	DispatchSize([&](auto n) { ProjectN<decltype(n)::value>(velocX, velocY, p, div, warmStart); });
+	KeepSolveReports();
+}
+
+// T is the velocity storage type, the 16-bit formats are converted per cell (see set_field_precision)
+template<int NC, typename T>
+void Fluid::ProjectN(T* velocX, T* velocY, float* p, float* div, bool warmStart) noexcept
+{
+	if (m_sparse_step)
+	{
+		ProjectSpansN<NC>(velocX, velocY, p, div, warmStart);
+		return;
+	}
+
+	const int N = Size<NC>();
+	const float velocityPass = sizeof(T) / static_cast<float>(sizeof(float));
+	// A row's walls only take values from that row, so the bands are independent
+	ForRowBands(1, N - 1, [&](int bandBegin, int bandEnd) {
+		for (int j = bandBegin; j < bandEnd; j++) {
+			kernels::Divergence<NC, 2, T>(N, { velocX, velocY }, div, p, warmStart, j, j + 1, 1, N - 1);
+			if (m_fused_passes) {
+				kernels::SetRowBoundary<NC>(N, 0, div, j);
+				kernels::SetRowBoundary<NC>(N, 0, p, j);
+			}
+		}
+	});
+	if (m_fused_passes) {
+		kernels::SetCorners<NC>(N, div);
+		kernels::SetCorners<NC>(N, p);
+		if (const ObstacleMap* obstacles = Obstacles())
+		{
+			obstacles->Apply(0, div, 1, N - 1);
+			obstacles->Apply(0, p, 1, N - 1);
 		}
 	}
+	else {
+		SetBoundaryN<NC>(0, div);
+		SetBoundaryN<NC>(0, p);
+	}
+	// vx, vy read, div written, p cleared unless warm started
+	CountTraffic(N, 2 * velocityPass + (warmStart ? 1 : 2), m_fused_passes ? 0 : 2);
 
-	SetBoundary(0, div);
-	SetBoundary(0, p);
-	LinearSolve(0, p, div, 1, 4);
+	SolvePressureN<NC>(p, div);
 
-	for (int j = 1; j < N - 1; j++) {
-		for (int i = 1; i < N - 1; i++) {
-			const int index = IX(i, j);
-			velocX[index] -= 0.5f * (p[IX(i + 1, j)]
-				- p[IX(i - 1, j)]) * N;
-			velocY[index] -= 0.5f * (p[IX(i, j + 1)]
-				- p[IX(i, j - 1)]) * N;
+	ForRowBands(1, N - 1, [&](int bandBegin, int bandEnd) {
+		for (int j = bandBegin; j < bandEnd; j++) {
+			kernels::SubtractGradient<NC, 2, T>(N, { velocX, velocY }, p, j, j + 1, 1, N - 1);
+			if (m_fused_passes) {
+				kernels::SetRowBoundary<NC>(N, 1, velocX, j);
+				kernels::SetRowBoundary<NC>(N, 2, velocY, j);
+			}
 		}
+	});
+	if (m_fused_passes) {
+		kernels::SetCorners<NC>(N, velocX);
+		kernels::SetCorners<NC>(N, velocY);
+		if (const ObstacleMap* obstacles = Obstacles())
+			obstacles->ApplyVelocity(velocX, velocY, 1, N - 1);
 	}
-	SetBoundary(1, velocX);
-	SetBoundary(2, velocY);
-
+	else {
+		SetBoundaryN<NC>(1, velocX);
+		SetBoundaryN<NC>(2, velocY);
+	}
+	// p read, vx, vy read and written
+	CountTraffic(N, 1 + 4 * velocityPass, m_fused_passes ? 0 : 2);
 }
 
-void Fluid::Advect(int b, float* d, float* d0, float* velocX, float* velocY, float dt) noexcept
+// ProjectN over the active tiles, the pressure around them is zero (ActiveTiles invariant, see set_sparse_tiles)
+template<int NC, typename T>
+void Fluid::ProjectSpansN(T* velocX, T* velocY, float* p, float* div, bool warmStart) noexcept
 {
-	float i0, i1, j0, j1;
+	const int N = Size<NC>();
+	const std::vector<TileSpan>& spans = m_active_tiles.GetSpans();
+	const float velocityPass = sizeof(T) / static_cast<float>(sizeof(float));
+	for (const TileSpan& span : spans)
+		kernels::Divergence<NC, 2, T>(N, { velocX, velocY }, div, p, warmStart, span.rowBegin, span.rowEnd, span.colBegin, span.colEnd);
+	SetBoundaryN<NC>(0, div);
+	SetBoundaryN<NC>(0, p);
+	CountTraffic(N, (2 * velocityPass + (warmStart ? 1 : 2)) * m_active_fraction, 2);
 
-	const float dtx = dt * (N - 2);
-	const float dty = dt * (N - 2);
+	SolvePressureN<NC>(p, div);
 
-	float s0, s1, t0, t1;
-	float tmp1, tmp2, x, y;
-
-	constexpr float Nfloat = static_cast<float>(N);
-	float ifloat, jfloat;
-	int i, j;
+	for (const TileSpan& span : spans)
+		kernels::SubtractGradient<NC, 2, T>(N, { velocX, velocY }, p, span.rowBegin, span.rowEnd, span.colBegin, span.colEnd);
+	SetBoundaryN<NC>(1, velocX);
+	SetBoundaryN<NC>(2, velocY);
+	CountTraffic(N, (1 + 4 * velocityPass) * m_active_fraction, 2);
+}
 
-	for (j = 1, jfloat = 1; j < N - 1; j++, jfloat++)
+template<int NC>
+void Fluid::SolvePressureN(float* p, float* div) noexcept
+{
+	switch (m_pressure_solver)
 	{
-		for (i = 1, ifloat = 1; i < N - 1; i++, ifloat++)
+		case PressureSolver::Relaxation:
+			LinearSolveN<NC>(m_lanes[0], m_project_solver, 0, p, div, 1, 4);
+			break;
+
+		case PressureSolver::Multigrid:
 		{
-			const int index = IX(i, j);
+			const Multigrid::Smoother smooth = [this](int n, float* x, const float* rhs, int sweeps) {
+				// Coarse levels are smaller than the grid, only the finest one has the specialized size
+				if (n == m_size)
+					RelaxN<NC>(m_lanes[0], m_project_solver, n, 0, x, rhs, 1, 4, sweeps);
+				else
+					RelaxN<0>(m_lanes[0], m_project_solver, n, 0, x, rhs, 1, 4, sweeps);
+			};
 
-			tmp1 = dtx * velocX[index];
-			tmp2 = dty * velocY[index];
+			if (m_tolerance <= 0.0f)
+			{
+				m_multigrid->Solve(p, div, m_multigrid_cycles, smooth);
+				m_lanes[0].solveReports.push_back({ m_multigrid_cycles, -1.0f });
+				break;
+			}
 
-			x = ifloat - tmp1;
-			y = jfloat - tmp2;
+			// A V-cycle is worth many sweeps, the residual is checked after every one
+			const float threshold = m_tolerance * kernels::MaxAbs<NC>(m_size, div, Obstacles());
+			SolveReport report{ 0, kernels::Residual<NC>(m_size, p, div, 1, 4, Obstacles()) };
+			CountTraffic(m_size, 3);
+			while (report.residual > threshold && report.iterations < m_multigrid_cycles)
+			{
+				m_multigrid->Cycle(p, div, smooth);
+				report.iterations++;
+				report.residual = kernels::Residual<NC>(m_size, p, div, 1, 4, Obstacles());
+				CountTraffic(m_size, 2);
+			}
+			m_lanes[0].solveReports.push_back(report);
+			break;
+		}
+	}
+}
 
-			if (x < 0.5f) x = 0.5f;
-			if (x > Nfloat + 0.5f) x = Nfloat + 0.5f;
-			i0 = std::floor(x);
-			i1 = i0 + 1.0f;
-			if (y < 0.5f) y = 0.5f;
-			if (y > Nfloat + 0.5f) y = Nfloat + 0.5f;
-			j0 = std::floor(y);
-			j1 = j0 + 1.0f;
+void Fluid::Advect(int b, float* d, float* d0, float* velocX, float* velocY, float dt) noexcept
+{
+	DispatchSize([&](auto n) { AdvectN<decltype(n)::value>(m_lanes[0], b, d, d0, velocX, velocY, dt); });
+}
 
+template<int NC, typename T, typename S, typename V>
+void Fluid::AdvectN(Lane& lane, int b, T* d, const S* d0, const V* velocX, const V* velocY, float dt) noexcept
+{
+	if (m_advection == Advection::MacCormack)
+		return AdvectMacCormackN<NC>(lane, b, d, d0, velocX, velocY, dt);
 
-			s1 = x - i0;
-			s0 = 1.0f - s1;
-			t1 = y - j0;
-			t0 = 1.0f - t1;
+	const int N = Size<NC>();
+	const kernels::AdvectRowsOf<T, S, V> advectKernel = kernels::GetAdvectKernel<T, S, V>(m_simd_level);
+	// vx, vy, d0 read (the taps mostly hit rows read just before), d written
+	const float passes = 2 * FieldPass<V>() + FieldPass<S>() + FieldPass<T>();
+	if (m_sparse_step)
+	{
+		// Cells of the skipped tiles stay zero: their velocity is zero, they would sample themselves
+		for (const TileSpan& span : m_active_tiles.GetSpans())
+		{
+			if (advectKernel)
+				advectKernel(N, d, d0, velocX, velocY, dt, span.rowBegin, span.rowEnd, span.colBegin, span.colEnd);
+			else
+				kernels::Advect<NC>(N, d, d0, velocX, velocY, dt, span.rowBegin, span.rowEnd, span.colBegin, span.colEnd);
+		}
+		SetBoundaryN<NC>(b, d);
+		CountTraffic(lane, N, passes * m_active_fraction, 1);
+		return;
+	}
 
+	CountTraffic(lane, N, passes, m_fused_passes ? 0 : 1);
+	if (!m_fused_passes)
+	{
+		ForRowBands(1, N - 1, [&](int bandBegin, int bandEnd) {
+			if (advectKernel)
+				advectKernel(N, d, d0, velocX, velocY, dt, bandBegin, bandEnd, 1, N - 1);
+			else
+				kernels::Advect<NC>(N, d, d0, velocX, velocY, dt, bandBegin, bandEnd, 1, N - 1);
+		});
+		SetBoundaryN<NC>(b, d);
+		return;
+	}
 
-			const int i0i = static_cast<int>(i0);
-			const int i1i = static_cast<int>(i1);
-			const int j0i = static_cast<int>(j0);
-			const int j1i = static_cast<int>(j1);
+	// Tiles of rows, their walls set before the next tile evicts them
+	const int tileRows = kernels::TileRows(N, 4);
+	ForRowBands(1, N - 1, [&](int bandBegin, int bandEnd) {
+		for (int first = bandBegin; first < bandEnd; first += tileRows)
+		{
+			const int last = std::min(first + tileRows, bandEnd);
+			if (advectKernel)
+				advectKernel(N, d, d0, velocX, velocY, dt, first, last, 1, N - 1);
+			else
+				kernels::Advect<NC>(N, d, d0, velocX, velocY, dt, first, last, 1, N - 1);
+			for (int j = first; j < last; j++)
+				kernels::SetRowBoundary<NC>(N, b, d, j);
+		}
+	});
+	kernels::SetCorners<NC>(N, d);
+	if (const ObstacleMap* obstacles = Obstacles())
+		obstacles->Apply(b, d, 1, N - 1);
+}
 
-			d[index] =
-				s0 * (t0 * d0[IX(i0i, j0i)] + t1 * d0[IX(i0i, j1i)]) +
-				s1 * (t0 * d0[IX(i1i, j0i)] + t1 * d0[IX(i1i, j1i)]);
+// Both velocity components at once: they are advected along the same (previous) velocity, so they share every back-trace
+template<int NC, typename T>
+void Fluid::AdvectVelocityN(const T* prevVx, const T* prevVy, float dt) noexcept
+{
+	if (m_advection == Advection::MacCormack)
+		return AdvectVelocityMacCormackN<NC>(prevVx, prevVy, dt);
 
+	const int N = Size<NC>();
+	float* vx = m_velocity_x.data();
+	float* vy = m_velocity_y.data();
+	const kernels::AdvectPairRowsOf<T> pairKernel = kernels::GetAdvectPairKernel<T>(m_simd_level);
+	// Previous vx, vy read (velocity and advected fields at once), vx, vy written
+	const float passes = 2 * FieldPass<T>() + 2;
+	if (m_sparse_step)
+	{
+		for (const TileSpan& span : m_active_tiles.GetSpans())
+		{
+			if (pairKernel)
+				pairKernel(N, vx, vy, prevVx, prevVy, prevVx, prevVy, dt, span.rowBegin, span.rowEnd, span.colBegin, span.colEnd);
+			else
+				kernels::AdvectPair<NC>(N, vx, vy, prevVx, prevVy, prevVx, prevVy, dt, span.rowBegin, span.rowEnd, span.colBegin, span.colEnd);
 		}
+		SetBoundaryN<NC>(1, vx);
+		SetBoundaryN<NC>(2, vy);
+		CountTraffic(N, passes * m_active_fraction, 2);
+		return;
 	}
-	SetBoundary(b, d);
+
+	CountTraffic(N, passes);
+
+	const int tileRows = kernels::TileRows(N, 4);
+	ForRowBands(1, N - 1, [&](int bandBegin, int bandEnd) {
+		for (int first = bandBegin; first < bandEnd; first += tileRows)
+		{
+			const int last = std::min(first + tileRows, bandEnd);
+			if (pairKernel)
+				pairKernel(N, vx, vy, prevVx, prevVy, prevVx, prevVy, dt, first, last, 1, N - 1);
+			else
+				kernels::AdvectPair<NC>(N, vx, vy, prevVx, prevVy, prevVx, prevVy, dt, first, last, 1, N - 1);
+			for (int j = first; j < last; j++)
+			{
+				kernels::SetRowBoundary<NC>(N, 1, vx, j);
+				kernels::SetRowBoundary<NC>(N, 2, vy, j);
+			}
+		}
+	});
+	kernels::SetCorners<NC>(N, vx);
+	kernels::SetCorners<NC>(N, vy);
+	if (const ObstacleMap* obstacles = Obstacles())
+		obstacles->ApplyVelocity(vx, vy, 1, N - 1);
+}
+
+void Fluid::set_advection(const Advection advection)
+{
+	m_advection = advection;
+	const std::size_t cells = advection == Advection::MacCormack ? static_cast<std::size_t>(m_size) * m_size : 0;
+	if (m_advect_scratch_x.size() != cells)
+	{
+		m_advect_scratch_x = AlignedBuffer<float>(cells);
+		m_advect_scratch_y = AlignedBuffer<float>(cells);
+	}
+}
+
+/**
+*	Two whole passes rather than row tiles: the correction of a row reads the semi-Lagrangian pass wherever its trace lands.
+*	Sparse steps run both passes over the active spans; a trace that leaves them reads a stale scratch cell, which the limiter
+*	bounds by the taps of d0 (the same one tile reach the semi-Lagrangian pass already assumes).
+*/
+template<int NC, typename T, typename S, typename V>
+void Fluid::AdvectMacCormackN(Lane& lane, int b, T* d, const S* d0, const V* velocX, const V* velocY, float dt) noexcept
+{
+	const int N = Size<NC>();
+	const kernels::AdvectRowsOf<float, S, V> advectKernel = kernels::GetAdvectKernel<float, S, V>(m_simd_level);
+	const kernels::MacCormackRowsOf<T, S, V> macCormackKernel = kernels::GetMacCormackKernel<T, S, V>(m_simd_level);
+	// The two velocity components may be advected at once (unfused graph step)
+	float* advected = b == 2 ? m_advect_scratch_y.data() : m_advect_scratch_x.data();
+	const auto forEachSpan = [&](const auto& fn) {
+		if (!m_sparse_step)
+			return ForRowBands(1, N - 1, [&](int rowBegin, int rowEnd) { fn(rowBegin, rowEnd, 1, N - 1); });
+		for (const TileSpan& span : m_active_tiles.GetSpans())
+			fn(span.rowBegin, span.rowEnd, span.colBegin, span.colEnd);
+	};
+
+	forEachSpan([&](int rowBegin, int rowEnd, int colBegin, int colEnd) {
+		if (advectKernel)
+			advectKernel(N, advected, d0, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+		else
+			kernels::Advect<NC>(N, advected, d0, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+	});
+	SetBoundaryN<NC>(b, advected);
+	forEachSpan([&](int rowBegin, int rowEnd, int colBegin, int colEnd) {
+		if (macCormackKernel)
+			macCormackKernel(N, d, d0, advected, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+		else
+			kernels::MacCormack<NC>(N, d, d0, advected, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+	});
+	SetBoundaryN<NC>(b, d);
+	// The semi-Lagrangian pass, then vx, vy, d0 and the scratch read again, d written
+	const float passes = 2 * (2 * FieldPass<V>() + FieldPass<S>() + 1) + FieldPass<T>();
+	CountTraffic(lane, N, passes * (m_sparse_step ? m_active_fraction : 1.0f), 2);
+}
+
+template<int NC, typename T>
+void Fluid::AdvectVelocityMacCormackN(const T* prevVx, const T* prevVy, float dt) noexcept
+{
+	const int N = Size<NC>();
+	float* vx = m_velocity_x.data();
+	float* vy = m_velocity_y.data();
+	float* advectedX = m_advect_scratch_x.data();
+	float* advectedY = m_advect_scratch_y.data();
+	const kernels::AdvectPairRowsOf<T> pairKernel = kernels::GetAdvectPairKernel<T>(m_simd_level);
+	const kernels::MacCormackPairRowsOf<T> macCormackPairKernel = kernels::GetMacCormackPairKernel<T>(m_simd_level);
+	const auto forEachSpan = [&](const auto& fn) {
+		if (!m_sparse_step)
+			return ForRowBands(1, N - 1, [&](int rowBegin, int rowEnd) { fn(rowBegin, rowEnd, 1, N - 1); });
+		for (const TileSpan& span : m_active_tiles.GetSpans())
+			fn(span.rowBegin, span.rowEnd, span.colBegin, span.colEnd);
+	};
+
+	forEachSpan([&](int rowBegin, int rowEnd, int colBegin, int colEnd) {
+		if (pairKernel)
+			pairKernel(N, advectedX, advectedY, prevVx, prevVy, prevVx, prevVy, dt, rowBegin, rowEnd, colBegin, colEnd);
+		else
+			kernels::AdvectPair<NC>(N, advectedX, advectedY, prevVx, prevVy, prevVx, prevVy, dt, rowBegin, rowEnd, colBegin, colEnd);
+	});
+	SetBoundaryN<NC>(1, advectedX);
+	SetBoundaryN<NC>(2, advectedY);
+	forEachSpan([&](int rowBegin, int rowEnd, int colBegin, int colEnd) {
+		if (macCormackPairKernel)
+			macCormackPairKernel(N, vx, vy, prevVx, prevVy, advectedX, advectedY, prevVx, prevVy, dt, rowBegin, rowEnd, colBegin, colEnd);
+		else
+			kernels::MacCormackPair<NC>(N, vx, vy, prevVx, prevVy, advectedX, advectedY, prevVx, prevVy, dt, rowBegin, rowEnd, colBegin, colEnd);
+	});
+	SetBoundaryN<NC>(1, vx);
+	SetBoundaryN<NC>(2, vy);
+	// The pair pass, then previous vx, vy and both scratches read again, vx, vy written
+	CountTraffic(N, (4 * FieldPass<T>() + 6) * (m_sparse_step ? m_active_fraction : 1.0f), 4);
+}
+
+void Fluid::set_simd_level(const SimdLevel level) noexcept
+{
+	m_simd_level = std::min(level, DetectSimdLevel());
+	m_decode_kernel = kernels::GetDecodeFieldKernel(m_simd_level, m_field_precision);
+	m_encode_kernel = kernels::GetEncodeFieldKernel(m_simd_level, m_field_precision);
 }
 
 Fluid::~Fluid() {}
@@ -1,6 +1,21 @@
 #pragma once
-#include <xtd/xtd.h>
+#include <algorithm>	// std::min, std::max
 #include <array>
+#include <cstddef>	// std::size_t
+#include <cstdint>	// std::int64_t, std::uint16_t
+#include <type_traits>	// std::integral_constant, std::is_same_v
+#include <memory>	// std::unique_ptr
+#include <string>
+#include <vector>
+#include "active_tiles.hpp"
+#include "aligned_buffer.hpp"
+#include "thread_pool.hpp"
+#include "multigrid.hpp"
+#include "obstacle_map.hpp"
+#include "cpu_features.hpp"
+#include "half_float.hpp"
+#include "profiler.hpp"
+#include "task_graph.hpp"
 
 namespace xtd_fluid_simulation {
 	/// <summary>
@@ -8,7 +23,34 @@ namespace xtd_fluid_simulation {
 	/// </summary>
 	class Fluid {
 	public:
-		Fluid();
+		// What one LinearSolve (or one multigrid pressure solve) actually did
+		struct SolveReport {
+			int iterations; // Sweeps (V-cycles for multigrid) run
+			float residual; // Largest residual when stopped, -1 when not measured (no tolerance set)
+		};
+
+		// How LinearSolve relaxes the grid
+		enum class Solver {
+			GaussSeidel, // In place, row by row (serial)
+			RedBlackGaussSeidel, // Checkerboard half sweeps, rows split across the thread pool
+			Jacobi, // Weighted Jacobi, ping-pong buffers so whole rows relax with SIMD, rows split across the thread pool
+		};
+
+		// How Project solves for pressure
+		enum class PressureSolver {
+			Relaxation, // LinearSolve, m_iterations sweeps
+			Multigrid, // V-cycles, smoothed with the LinearSolve kernel
+		};
+
+		// How Advect moves a field along the velocity
+		enum class Advection {
+			SemiLagrangian, // One back-trace, bilinear taps: first order, smears what it moves
+			MacCormack, // Semi-Lagrangian, traced back again to correct half the round trip error, clamped to the taps: second order
+		};
+
+	public:
+		// threads as set_thread_count (0 = every hardware thread)
+		explicit Fluid(int size = DEFAULT_SIZE, int scale = DEFAULT_SCALE, int threads = 0);
 		~Fluid();
 
 	public:
@@ -21,6 +63,22 @@ namespace xtd_fluid_simulation {
 		// Adds velocity in a specific location in fluid
 		void AddVelocity(int x, int y, float amountX, float amountY) noexcept;
 
+		// Density and velocity splat, see AddBrush
+		struct Brush {
+			float x, y; // Center, in cells
+			float radius; // In cells, below 1 only the cell (x, y), clamped onto the grid like AddDensity
+			float density;
+			float velocityX, velocityY;
+		};
+
+		/**
+		*	Queued injections, applied by the next Update in one pass over the rows they cover (the Inject stage),
+		*	instead of a clamped call per cell: brushes add their amounts falling off quadratically to 0 at their radius,
+		*	the force is added to the velocity of every cell (forces queued before one Update add up), before the brushes.
+		*/
+		void AddBrush(const Brush& brush);
+		void AddForce(float amountX, float amountY);
+
 		/**
 		*	Diffuse is really simple; it just precalculates a value and passes everything off to LinearSolve.
 		*	So that means, while I know what it does, I don't really know how,
@@ -45,6 +103,8 @@ namespace xtd_fluid_simulation {
 		* It's solving a linear differential equation of some sort, although how and what is not entirely clear to me.
 		*/
 		void LinearSolve(int b, float* x, float* x0, float a, float c) noexcept;
+		// Same with a given solver, the one above uses the Diffuse solver
+		void LinearSolve(Solver solver, int b, float* x, float* x0, float a, float c) noexcept;
 
 		/**
 		*	As noted above, this function sets the boundary cells at the outer edges of the this so they perfectly counteract their neighbors.
@@ -90,6 +150,8 @@ namespace xtd_fluid_simulation {
 		* This operation runs through all the cells and fixes them up so everything is in equilibrium.
 		*/
 		void Project(float* velocX, float* velocY, float* p, float* div) noexcept;
+		// Same, using p as it is as the initial pressure guess instead of zero
+		void Project(float* velocX, float* velocY, float* p, float* div, bool warmStart) noexcept;
 
 		/**
 		*	This function is responsible for actually moving things around.
@@ -130,10 +192,15 @@ namespace xtd_fluid_simulation {
 
 	public:
 		/**
-		* Converts 2D coords into 1D ( x,y into index )
+		* Converts 2D coords into 1D ( x,y into index ), clamped onto the grid.
+		* Only for coords that may fall outside of it (user input, advection taps),
+		* interior kernels index rows directly (x + y * N).
+		* NC is the grid size when known at compile time (0 reads it from the fluid).
 		*/
-		inline static constexpr int IX(int x, int y) noexcept
+		template<int NC = 0>
+		inline int IX(int x, int y) const noexcept
 		{
+			const int N = Size<NC>();
 			// i was using std::clamp, although to optimize things up, minmax clamp is 4.1 times faster than std::clamp -> https://quick-bench.com/q/x7RbIo-YFpEKkvFbbQGqsLREKQQ
 			x = std::min(std::max(x, 0), N - 1);
 			y = std::min(std::max(y, 0), N - 1);
@@ -141,48 +208,393 @@ namespace xtd_fluid_simulation {
 		}
 
 	public:
-		// Get the color of a particle at a specific location in fluid
-		xtd::drawing::color get_color_at(const int i, const int j) noexcept {
-			// Get Density 0 -> 255 alpha (background color)
-			float density = m_density[IX(i, j)];
-			// So that fluid color will not turn into black when adding too much density
-			density = std::min(std::max(density, 0.0f), 255.0f); //std::clamp(density, 0.0f, 255.0f);
-			// Construct color based on density alpha
-			return xtd::drawing::color::from_argb(static_cast<std::uint8_t>(density), m_fluid_color.r(), m_fluid_color.g(), m_fluid_color.b());
-		}
-
-		const xtd::drawing::color& get_color() const noexcept { return m_fluid_color; }
-		void set_color(const xtd::drawing::color& color) noexcept {
-			m_fluid_color = color;
-		}
+		// Copies the density (aka amount of dye) field into out, N*N values, row major (converted to float when stored in 16 bits)
+		void ReadDensity(float* out) const noexcept;
+		// Velocity fields, N*N values, row major
+		const float* get_velocity_x() const noexcept { return m_velocity_x.data(); }
+		const float* get_velocity_y() const noexcept { return m_velocity_y.data(); }
 
 		// Motion speed attr
 		void set_speed(const int speed) noexcept { m_speed = speed; }
 		constexpr int get_speed() const noexcept { return m_speed; }
-		constexpr int get_max_speed() const noexcept { return 20; }
-		constexpr int get_min_speed() const noexcept { return 0; }
+		static constexpr int get_max_speed() noexcept { return 20; }
+		static constexpr int get_min_speed() noexcept { return 0; }
+
+		// Viscosity (of the velocity) and diffusion (of the density) attr, per second
+		void set_viscosity(const float viscosity) noexcept { m_vescosity = std::max(viscosity, 0.0f); }
+		float get_viscosity() const noexcept { return m_vescosity; }
+		void set_diffusion(const float diffusion) noexcept { m_diffusion = std::max(diffusion, 0.0f); }
+		float get_diffusion() const noexcept { return m_diffusion; }
+
+		// Solver attr
+		// Each call site has its own solver, set_solver sets both
+		void set_solver(const Solver solver) noexcept { m_diffuse_solver = m_project_solver = solver; }
+		void set_diffuse_solver(const Solver solver) noexcept { m_diffuse_solver = solver; }
+		Solver get_diffuse_solver() const noexcept { return m_diffuse_solver; }
+		// Project's relaxation, also the multigrid smoother
+		void set_project_solver(const Solver solver) noexcept { m_project_solver = solver; }
+		Solver get_project_solver() const noexcept { return m_project_solver; }
+
+		// Weight of the Jacobi update, below 1 damps the checkerboard error mode plain Jacobi leaves (needed as a multigrid smoother)
+		void set_jacobi_weight(const float weight) noexcept { m_jacobi_weight = std::min(std::max(weight, 0.1f), 1.0f); }
+		float get_jacobi_weight() const noexcept { return m_jacobi_weight; }
+
+		void set_pressure_solver(const PressureSolver solver) noexcept { m_pressure_solver = solver; }
+		PressureSolver get_pressure_solver() const noexcept { return m_pressure_solver; }
+
+		// V-cycles per pressure solve when using PressureSolver::Multigrid
+		void set_multigrid_cycles(const int cycles) noexcept { m_multigrid_cycles = std::max(cycles, 1); }
+		int get_multigrid_cycles() const noexcept { return m_multigrid_cycles; }
+
+		// Iterations attr, the fixed sweep count or the cap when a tolerance is set
+		void set_iterations(const int iterations) noexcept { m_iterations = std::max(iterations, 1); }
+		int get_iterations() const noexcept { return m_iterations; }
+
+		/**
+		*	Solves stop as soon as their largest residual is below tolerance times their largest right hand side value,
+		*	measured every get_residual_interval() sweeps (or V-cycle). 0 always runs every iteration (default).
+		*/
+		void set_tolerance(const float tolerance) noexcept { m_tolerance = std::max(tolerance, 0.0f); }
+		float get_tolerance() const noexcept { return m_tolerance; }
+		void set_residual_interval(const int sweeps) noexcept { m_residual_interval = std::max(sweeps, 1); }
+		int get_residual_interval() const noexcept { return m_residual_interval; }
+
+		// Keep the pressure of the last step as the initial guess of the next pressure solve, instead of zero
+		void set_warm_start(const bool warmStart) noexcept { m_warm_start = warmStart; }
+		bool get_warm_start() const noexcept { return m_warm_start; }
+
+		// Solves run by the last Update, in order: diffuse x, diffuse y, pressure, pressure, diffuse density
+		const std::vector<SolveReport>& get_solve_reports() const noexcept { return m_solve_reports; }
+
+		/**
+		*	Stage timings, iterations and memory traffic of the last Update (all stages -1 when built with FLUID_PROFILING=0).
+		*	Traffic is modeled, not measured: a whole field does not stay cached from one pass to the next (large grids),
+		*	the rows a pass is working on do. Each pass counts the fields it streams and the walls it revisits,
+		*	multigrid transfers between levels are not counted.
+		*/
+		const FrameSample& get_frame_sample() const noexcept { return m_frame_sample; }
+
+		/**
+		*	Fuses passes that stream the same rows so each field goes through memory fewer times per step (default):
+		*	walls set while their row is in cache, Gauss-Seidel sweeps pipelined over an L2 sized window of rows,
+		*	both velocity components advected with one back-trace. Same arithmetic in the same order, so results are
+		*	bit identical, except that fast-math builds (-Ofast) may contract the two code paths differently.
+		*/
+		void set_fused_passes(const bool fused) noexcept { m_fused_passes = fused; }
+		bool get_fused_passes() const noexcept { return m_fused_passes; }
+
+		/**
+		*	Advection scheme of density and velocity (default SemiLagrangian). MacCormack keeps sharp features sharp (about the
+		*	detail of twice the resolution) for about twice the advection cost: a semi-Lagrangian pass into a scratch field,
+		*	then a pass that traces that field back along the velocity (the same back-trace) and corrects the result,
+		*	clamped to the four values it was interpolated from so the correction cannot overshoot.
+		*	The scratch fields are allocated here, not per step.
+		*/
+		void set_advection(const Advection advection);
+		Advection get_advection() const noexcept { return m_advection; }
+
+		/**
+		*	Storage of the density and previous velocity fields (default Float32). The 16-bit formats halve their memory,
+		*	every stage still computes in float: the SIMD rows load and store the 16-bit fields as they are, converting in registers
+		*	(F16C for Float16, a shift for BFloat16), the scalar paths (red-black sweeps, tolerance checks) convert cell by cell.
+		*	So they stream fewer bytes but convert on every access, whether that pays off depends on the grid outgrowing the caches.
+		*	Density only ends up as an 8-bit alpha; velocities lose precision that feeds back. Measure both against Float32
+		*	(the benchmark's --precision) before relying on it.
+		*	Converts the current fields, so it can be switched while running.
+		*/
+		void set_field_precision(const FieldPrecision precision);
+		FieldPrecision get_field_precision() const noexcept { return m_field_precision; }
+
+		// Bytes of field storage (fields and solver scratch, not the multigrid levels)
+		std::size_t get_field_bytes() const noexcept;
+
+		/**
+		*	Only step the tiles (ActiveTiles::TILE cells square) where something happens (default off): tiles are activated by
+		*	AddDensity / AddVelocity, every step first grows the active set by a tile (what advection and diffusion can reach)
+		*	and ends by retiring the tiles whose density and velocity all fell below TILE_DENSITY_EPSILON / TILE_VELOCITY_EPSILON,
+		*	zeroing them, so every skipped cell is exactly zero. Not bit identical to a full step: what diffuses further than a tile
+		*	in one step is dropped, and the pressure solve sees p = 0 around the active set (an open boundary instead of the walls).
+		*	Multigrid's V-cycles couple the whole grid, with PressureSolver::Multigrid every tile stays active.
+		*/
+		void set_sparse_tiles(const bool sparse);
+		bool get_sparse_tiles() const noexcept { return m_sparse_tiles; }
+		const ActiveTiles& get_active_tiles() const noexcept { return m_active_tiles; }
+
+		/**
+		*	Solid cells inside the grid (none by default), walls like the outer ring: every stage that sets the walls sets them
+		*	from their fluid neighbours too (ObstacleMap::Apply, velocities mirrored so nothing flows into them), in the same pass
+		*	where it is fused. The stencils and the SIMD kernels run unchanged over them, so a grid without any costs nothing
+		*	and one with some costs a pass over the solid cells. Multigrid's coarse levels do not see them, its V-cycles
+		*	then converge slower. The density under them is whatever their walls were set to, draw them over it.
+		*/
+		void PaintObstacle(float x, float y, float radius, bool solid);
+		void SetObstacles(const ObstacleMap& obstacles);
+		const ObstacleMap& get_obstacles() const noexcept { return m_obstacles; }
+
+		/**
+		*	Checkpoints: every field as it is stored (16-bit fields stay 16-bit), the active tiles, the obstacles and every setting that changes
+		*	the result of a step (not the thread count or SIMD level, those belong to the machine), so a loaded fluid steps on
+		*	exactly as the saved one would have. One native byte order file (STATE_VERSION), read straight into the fields.
+		*	LoadState needs a checkpoint of the same grid size and leaves the fluid as it was when it cannot load one;
+		*	both throw std::runtime_error naming the file on any failure.
+		*/
+		void SaveState(const std::string& path) const;
+		void LoadState(const std::string& path);
+
+		// Vector instruction set of the SIMD kernels (Advect), capped to what the CPU supports, defaults to the best one
+		void set_simd_level(const SimdLevel level) noexcept;
+		SimdLevel get_simd_level() const noexcept { return m_simd_level; }
+
+		// Threads used by the parallel solvers (0 = every hardware thread)
+		void set_thread_count(const int threads);
+		int get_thread_count() const noexcept { return m_thread_pool->GetThreadCount(); }
+
+		/**
+		*	Runs Update as a graph of its stages over the thread pool (default on): stages that do not depend on each other
+		*	(the three diffusions, the two unfused velocity advections, density diffusion against the velocity stages) run at once,
+		*	and the advections and projections share their rows out to the threads left idle. Stages solved with the parallel
+		*	solvers (red-black, Jacobi) run alone with the whole pool, as they do sequentially. Every stage computes exactly
+		*	what it does in order, so results are bit identical with it off, and with any thread count.
+		*	Off runs the stages one after another on the calling thread (only the parallel solvers use the pool).
+		*/
+		void set_task_graph(const bool enabled);
+		bool get_task_graph() const noexcept { return m_task_graph_enabled; }
+
+		// Grid attr
+		int get_size() const noexcept { return m_size; }
+		int get_scale() const noexcept { return m_scale; }
 
 	public:
-		inline static constexpr const int N = 120;    // Number of particles
-		inline static constexpr const int SCALE = 5;  // Size of particles (w,h) (the smaller the rect, the more realistic simulation, the more slower performance..)
+		inline static constexpr const int DEFAULT_SIZE = 120;  // Number of particles per row/column
+		inline static constexpr const int DEFAULT_SCALE = 5;   // Size of particles (w,h) (the smaller the rect, the more realistic simulation, the more slower performance..)
+		inline static constexpr const int MIN_SIZE = 8;
+		inline static constexpr const int DEFAULT_SPEED = 7;
+		inline static constexpr const float DEFAULT_VISCOSITY = 0.0000001f;
+		inline static constexpr const float DEFAULT_DIFFUSION = 0.000001f;
+		inline static constexpr const int DEFAULT_ITERATIONS = 32;
+		inline static constexpr const std::uint32_t STATE_VERSION = 3;
+		inline static constexpr const float TILE_DENSITY_EPSILON = 0.5f; // Drawn as alpha 0
+		inline static constexpr const float TILE_VELOCITY_EPSILON = 1e-4f; // Under a thousandth of a cell per step at the default size
+
+	private:
+		// Grid size, a compile time constant for the specialized kernels and the runtime size otherwise
+		template<int NC>
+		inline int Size() const noexcept
+		{
+			if constexpr (NC > 0) return NC;
+			else return m_size;
+		}
+
+		/**
+		*	Calls fn with the grid size as a std::integral_constant, so commonly used sizes
+		*	run kernels instantiated for that exact size (constant trip counts and strides),
+		*	and any other size runs the generic instantiation (0).
+		*/
+		template<typename Fn>
+		inline void DispatchSize(Fn&& fn) const
+		{
+			switch (m_size)
+			{
+				case DEFAULT_SIZE: fn(std::integral_constant<int, DEFAULT_SIZE>{}); break;
+				case 128: fn(std::integral_constant<int, 128>{}); break;
+				case 256: fn(std::integral_constant<int, 256>{}); break;
+				case 512: fn(std::integral_constant<int, 512>{}); break;
+				default: fn(std::integral_constant<int, 0>{}); break;
+			}
+		}
+
+		/**
+		*	What one stage of a graph step works in, so stages running at once never share a buffer or a counter:
+		*	lane 0 is the velocity chain (and every stage when the graph is off), lane 1 the y diffusion and advection
+		*	running beside their x twins, lane 2 the density. The Jacobi scratch is shared, Jacobi stages run alone.
+		*/
+		struct Lane {
+			int index = 0;
+			float* rowScratch = nullptr; // One row, for the Gauss-Seidel kernels
+			AlignedBuffer<float> ownRowScratch; // Lanes 1 and 2, lane 0 uses m_row_scratch
+			std::vector<SolveReport> solveReports; // Of the running stage
+			std::int64_t traffic = 0; // Bytes counted by the running stage
+		};
+		inline static constexpr const int LANES = 3;
+
+		// The solid cells for the kernels, nullptr when there are none
+		inline const ObstacleMap* Obstacles() const noexcept { return m_obstacles.IsEmpty() ? nullptr : &m_obstacles; }
+
+		// Lane k of a graph step, lane 0 when the stages run in order
+		inline Lane& GetLane(const int k) noexcept { return m_task_graph_enabled ? m_lanes[k] : m_lanes[0]; }
+
+		// Allocates the scratch of lanes 1 and 2, when the graph is on
+		void AllocateLanes();
+
+		// Runs one Update stage in lane, timed into m_frame_sample along with the solver iterations it ran
+		template<typename Fn>
+		inline void RunStage(const Stage stage, Lane& lane, Fn&& fn) noexcept
+		{
+			lane.solveReports.clear();
+			lane.traffic = 0;
+#if FLUID_PROFILING
+			{
+				FLUID_PROFILE_STAGE(m_frame_sample, stage);
+				fn();
+			}
+			int iterations = 0;
+			for (const SolveReport& report : lane.solveReports)
+				iterations += report.iterations;
+			StageSample& sample = m_frame_sample[stage];
+			sample.iterations = iterations;
+			sample.bytes = lane.traffic;
+			sample.lane = lane.index;
+#else
+			fn();
+#endif
+			m_stage_reports[static_cast<int>(stage)].assign(lane.solveReports.begin(), lane.solveReports.end());
+		}
+
+		// Solve reports of the public Diffuse, LinearSolve and Project (run in lane 0) appended to get_solve_reports
+		inline void KeepSolveReports() noexcept
+		{
+			m_solve_reports.insert(m_solve_reports.end(), m_lanes[0].solveReports.begin(), m_lanes[0].solveReports.end());
+			m_lanes[0].solveReports.clear();
+		}
+
+		/**
+		*	Adds fieldPasses streams of an n*n float field and walls passes over its boundary to the stage traffic (see get_frame_sample).
+		*	A pass over a 16-bit field counts as half a pass.
+		*/
+		inline void CountTraffic(Lane& lane, const int n, const float fieldPasses, const int walls = 0) noexcept
+		{
+#if FLUID_PROFILING
+			// A wall pass rewrites the top and bottom rows and touches a cache line per row on each side
+			const std::int64_t wallBytes = 2 * 2 * static_cast<std::int64_t>(n) * sizeof(float) + 2 * static_cast<std::int64_t>(n) * 64;
+			lane.traffic += static_cast<std::int64_t>(fieldPasses * n * n * sizeof(float)) + walls * wallBytes;
+#else
+			(void)lane; (void)n; (void)fieldPasses; (void)walls;
+#endif
+		}
+		// Of a lane 0 stage
+		inline void CountTraffic(const int n, const float fieldPasses, const int walls = 0) noexcept { CountTraffic(m_lanes[0], n, fieldPasses, walls); }
+
+		// One pass over a field of type T for CountTraffic, half a pass for the 16-bit formats
+		template<typename T>
+		inline static constexpr float FieldPass() noexcept { return sizeof(T) / static_cast<float>(sizeof(float)); }
+
+		// fn(bandBegin, bandEnd) over row bands of [begin, end), shared with the idle threads inside a graph step (see TaskGraph::ParallelFor)
+		template<typename Fn>
+		inline void ForRowBands(const int begin, const int end, Fn&& fn)
+		{
+			m_task_graph.ParallelFor(begin, end, fn);
+		}
+
+		// Calls fn with a pointer type tag (float*, Float16* or BFloat16*) for m_field_precision
+		template<typename Fn>
+		inline void DispatchPrecision(Fn&& fn)
+		{
+			switch (m_field_precision)
+			{
+				case FieldPrecision::Float16: fn(static_cast<Float16*>(nullptr)); break;
+				case FieldPrecision::BFloat16: fn(static_cast<BFloat16*>(nullptr)); break;
+				default: fn(static_cast<float*>(nullptr)); break;
+			}
+		}
+
+		// A stored field as its storage type: the float buffer, or the 16-bit one viewed as Float16 / BFloat16 (same size and layout)
+		template<typename T>
+		inline T* Field(AlignedBuffer<float>& field32, AlignedBuffer<std::uint16_t>& field16) noexcept
+		{
+			if constexpr (std::is_same_v<T, float>) return field32.data();
+			else return reinterpret_cast<T*>(field16.data());
+		}
+
+		// Converts a whole n*n stored field to and from float, with the SIMD converters when there are some
+		template<typename T> void DecodeField(const T* in, float* out) const noexcept;
+		template<typename T> void EncodeField(const float* in, T* out) const noexcept;
+
+		template<int NC, typename T> void UpdateN() noexcept;
+		template<typename T> void InjectN(T* density) noexcept;
+		template<int NC, typename T, typename S> void DiffuseN(Lane& lane, int b, T* x, const S* x0, float diff, float dt) noexcept;
+		template<int NC, typename T, typename S> void LinearSolveN(Lane& lane, Solver solver, int b, T* x, const S* x0, float a, float c) noexcept;
+		template<int NC, typename T, typename S> void RelaxN(Lane& lane, Solver solver, int n, int b, T* x, const S* x0, float a, float c, int sweeps) noexcept;
+		template<int NC, typename T> void SetBoundaryN(int b, T* x) noexcept;
+		template<int NC> void SolvePressureN(float* p, float* div) noexcept;
+		template<int NC, typename T> void ProjectN(T* velocX, T* velocY, float* p, float* div, bool warmStart) noexcept;
+		template<int NC, typename T, typename S, typename V> void AdvectN(Lane& lane, int b, T* d, const S* d0, const V* velocX, const V* velocY, float dt) noexcept;
+		template<int NC, typename T> void ProjectSpansN(T* velocX, T* velocY, float* p, float* div, bool warmStart) noexcept;
+		template<int NC, typename T> void RetireQuietTilesN(T* density, T* prevVx, T* prevVy) noexcept;
+		template<int NC, typename T> void AdvectVelocityN(const T* prevVx, const T* prevVy, float dt) noexcept;
+		template<int NC, typename T, typename S, typename V> void AdvectMacCormackN(Lane& lane, int b, T* d, const S* d0, const V* velocX, const V* velocY, float dt) noexcept;
+		template<int NC, typename T> void AdvectVelocityMacCormackN(const T* prevVx, const T* prevVy, float dt) noexcept;
 
+	private:
+		int m_size; // Number of particles per row/column (N)
+		int m_scale; // Size of a particle on screen
 
-	private: // No stack over flow please OS!
-		std::array<float, N * N> m_fluid_particles; // Fluid particles
-		std::array<float, N * N> m_density; // Density (aka amount of dye)
+		// Fields are N*N floats each, on the heap and cache line aligned
+		AlignedBuffer<float> m_fluid_particles; // Fluid particles
+		AlignedBuffer<float> m_density; // Density (aka amount of dye)
 		
-		std::array<float, N * N> m_velocity_x; // velocity X for each fluid particle
-		std::array<float, N * N> m_velocity_y; // velocity Y for each fluid particle
+		AlignedBuffer<float> m_velocity_x; // velocity X for each fluid particle
+		AlignedBuffer<float> m_velocity_y; // velocity Y for each fluid particle
 		
-		std::array<float, N * N> m_prev_velocity_x; // previous velocity X
-		std::array<float, N * N> m_prev_velocity_y; // previous velocity Y
+		AlignedBuffer<float> m_prev_velocity_x; // previous velocity X
+		AlignedBuffer<float> m_prev_velocity_y; // previous velocity Y
 
-		int m_speed = 7; // Speed of fluid
+		// The same three fields when stored in 16 bits, only one of each pair is allocated (see set_field_precision)
+		FieldPrecision m_field_precision = FieldPrecision::Float32;
+		AlignedBuffer<std::uint16_t> m_density_16;
+		AlignedBuffer<std::uint16_t> m_prev_velocity_x_16;
+		AlignedBuffer<std::uint16_t> m_prev_velocity_y_16;
+
+		AlignedBuffer<float> m_pressure; // Pressure, kept across steps to warm start the next solve
+		AlignedBuffer<float> m_divergence; // Velocity divergence (Project right hand side)
+
+		AlignedBuffer<float> m_row_scratch; // One row of LinearSolve right hand side
+		AlignedBuffer<float> m_jacobi_scratch; // Jacobi ping-pong iterate
+		AlignedBuffer<std::uint16_t> m_jacobi_scratch_16; // Of the 16-bit previous velocities, only with the 16-bit formats
+
+		Advection m_advection = Advection::SemiLagrangian;
+		AlignedBuffer<float> m_advect_scratch_x; // MacCormack's semi-Lagrangian pass of vx (and of the density), empty otherwise
+		AlignedBuffer<float> m_advect_scratch_y; // Of vy
+
+		Solver m_diffuse_solver = Solver::GaussSeidel;
+		Solver m_project_solver = Solver::GaussSeidel;
+		float m_jacobi_weight = 0.8f;
+		std::unique_ptr<ThreadPool> m_thread_pool;
+
+		PressureSolver m_pressure_solver = PressureSolver::Relaxation;
+		std::unique_ptr<Multigrid> m_multigrid;
+		int m_multigrid_cycles = 2;
+
+		SimdLevel m_simd_level = SimdLevel::Scalar;
+		// SIMD field conversions for m_simd_level, nullptr runs the scalar ones (the stage kernels are looked up per field type, see simd_kernels.hpp)
+		void (*m_decode_kernel)(const std::uint16_t*, float*, std::size_t) noexcept = nullptr; // For m_field_precision too
+		void (*m_encode_kernel)(const float*, std::uint16_t*, std::size_t) noexcept = nullptr;
+
+		float m_tolerance = 0.0f;
+		int m_residual_interval = 4;
+		bool m_warm_start = false;
+		std::vector<SolveReport> m_solve_reports;
+		std::array<std::vector<SolveReport>, STAGE_COUNT> m_stage_reports; // Of the last Update, m_solve_reports is them in stage order
+		FrameSample m_frame_sample;
+		bool m_fused_passes = true;
+
+		TaskGraph m_task_graph; // Rebuilt by every Update
+		bool m_task_graph_enabled = true;
+		std::array<Lane, LANES> m_lanes;
+
+		std::vector<Brush> m_brushes; // Queued for the next Update
+		float m_force_x = 0.0f;
+		float m_force_y = 0.0f;
+
+		ActiveTiles m_active_tiles;
+		bool m_sparse_tiles = false;
+		ObstacleMap m_obstacles;
+		bool m_sparse_step = false; // Kernels run on m_active_tiles' spans, only set during Update
+		float m_active_fraction = 1.0f; // Of the tiles, for the traffic model
+
+		int m_speed = DEFAULT_SPEED; // Speed of fluid
 		float m_motion_speed = 0.2f; // Motion speed of fluid (speed * delta_time)
-		float m_vescosity = 0.0000001f; // Thickness of fluid
-		float m_diffusion = 0.000001f; // Diffusion of fluid (the more value, the longer the fluid will keep difussing around)
-		int m_iterations = 32; // Number of iterations (the more iterations, the more realistic fluid behavior we get. although frame rate reduces with more iterations...)
-		
-		xtd::drawing::color m_fluid_color = xtd::drawing::color::cyan;
+		float m_vescosity = DEFAULT_VISCOSITY; // Thickness of fluid
+		float m_diffusion = DEFAULT_DIFFUSION; // Diffusion of fluid (the more value, the longer the fluid will keep difussing around)
+		int m_iterations = DEFAULT_ITERATIONS; // Number of iterations (the more iterations, the more realistic fluid behavior we get. although frame rate reduces with more iterations...)
 	};
 }
@@ -0,0 +1,224 @@
+#include "fluid3d.hpp"
+#include "fluid_kernels.hpp"
+#include <algorithm>	// std::copy_n, std::min, std::max
+using namespace xtd_fluid_simulation;
+
+Fluid3D::Fluid3D(int size)
+	:
+	m_size(std::max(size, MIN_SIZE)),
+	m_fluid_particles(kernels::Cells<3>(m_size)),
+	m_density(kernels::Cells<3>(m_size)),
+	m_velocity_x(kernels::Cells<3>(m_size)),
+	m_velocity_y(kernels::Cells<3>(m_size)),
+	m_velocity_z(kernels::Cells<3>(m_size)),
+	m_prev_velocity_x(kernels::Cells<3>(m_size)),
+	m_prev_velocity_y(kernels::Cells<3>(m_size)),
+	m_prev_velocity_z(kernels::Cells<3>(m_size)),
+	m_pressure(kernels::Cells<3>(m_size)),
+	m_divergence(kernels::Cells<3>(m_size)),
+	m_row_scratch(static_cast<std::size_t>(m_size)),
+	m_jacobi_scratch(kernels::Cells<3>(m_size)),
+	m_thread_pool(new ThreadPool())
+{
+}
+
+void Fluid3D::set_thread_count(const int threads)
+{
+	m_thread_pool.reset(new ThreadPool(threads));
+}
+
+void Fluid3D::set_advection(const Fluid::Advection advection)
+{
+	m_advection = advection;
+	const std::size_t cells = advection == Fluid::Advection::MacCormack ? kernels::Cells<3>(m_size) : 0;
+	if (m_advect_scratch.size() != cells)
+		m_advect_scratch = AlignedBuffer<float>(cells);
+}
+
+void Fluid3D::Update(const float dt) noexcept
+{
+	m_motion_speed = m_speed * dt;
+	DispatchSize([this](auto n) { UpdateN<decltype(n)::value>(); });
+}
+
+// Fluid::UpdateN's stages in its sequential order, with the z velocity alongside x and y
+template<int NC>
+void Fluid3D::UpdateN() noexcept
+{
+	float* vx = m_velocity_x.data();
+	float* vy = m_velocity_y.data();
+	float* vz = m_velocity_z.data();
+	float* prevVx = m_prev_velocity_x.data();
+	float* prevVy = m_prev_velocity_y.data();
+	float* prevVz = m_prev_velocity_z.data();
+
+	DiffuseN<NC>(1, prevVx, vx, m_vescosity, m_motion_speed);
+	DiffuseN<NC>(2, prevVy, vy, m_vescosity, m_motion_speed);
+	DiffuseN<NC>(3, prevVz, vz, m_vescosity, m_motion_speed);
+	ProjectN<NC>(prevVx, prevVy, prevVz, m_pressure.data(), m_divergence.data());
+
+	const std::array<const float*, 3> previous = { prevVx, prevVy, prevVz };
+	AdvectN<NC>(1, vx, prevVx, previous, m_motion_speed);
+	AdvectN<NC>(2, vy, prevVy, previous, m_motion_speed);
+	AdvectN<NC>(3, vz, prevVz, previous, m_motion_speed);
+	ProjectN<NC>(vx, vy, vz, m_pressure.data(), m_divergence.data());
+
+	DiffuseN<NC>(0, m_fluid_particles.data(), m_density.data(), m_diffusion, m_motion_speed);
+	AdvectN<NC>(0, m_density.data(), m_fluid_particles.data(), { vx, vy, vz }, m_motion_speed);
+}
+
+template<int NC>
+void Fluid3D::DiffuseN(int b, float* x, const float* x0, float diff, float dt) noexcept
+{
+	const int N = Size<NC>();
+	const float a = dt * diff * (N - 2) * (N - 2);
+	// Six neighbours, the tutorial's 3D diffusion
+	LinearSolveN<NC>(m_diffuse_solver, b, x, x0, a, 1.0f + 6.0f * a);
+}
+
+template<int NC>
+void Fluid3D::LinearSolveN(Fluid::Solver solver, int b, float* x, const float* x0, float a, float c) noexcept
+{
+	const int N = Size<NC>();
+	switch (solver)
+	{
+		case Fluid::Solver::GaussSeidel:
+			kernels::GaussSeidelWavefront<NC, 3>(N, b, x, x0, a, c, m_iterations, m_row_scratch.data());
+			break;
+		case Fluid::Solver::RedBlackGaussSeidel:
+			kernels::RedBlackGaussSeidel<NC, 3>(*m_thread_pool, N, b, x, x0, a, c, m_iterations);
+			break;
+		case Fluid::Solver::Jacobi:
+			kernels::Jacobi<NC, 3>(*m_thread_pool, N, b, x, x0, a, c, m_jacobi_weight, m_iterations, m_jacobi_scratch.data(), nullptr);
+			break;
+	}
+}
+
+template<int NC, typename Fn>
+void Fluid3D::ForEachPlane(Fn&& fn) noexcept
+{
+	const int N = Size<NC>();
+	m_thread_pool->ParallelFor(1, N - 1, [&](int planeBegin, int planeEnd) {
+		for (int k = planeBegin; k < planeEnd; k++)
+			fn(k);
+	});
+}
+
+// See Fluid::ProjectN, a plane's walls only take values from that plane so they are set right after it
+template<int NC>
+void Fluid3D::ProjectN(float* velocX, float* velocY, float* velocZ, float* p, float* div) noexcept
+{
+	const int N = Size<NC>();
+	ForEachPlane<NC>([&](int k) {
+		kernels::Divergence<NC, 3, float>(N, { velocX, velocY, velocZ }, div, p, false, k, k + 1, 1, N - 1);
+		kernels::SetRowBoundary<NC, 3>(N, 0, div, k);
+		kernels::SetRowBoundary<NC, 3>(N, 0, p, k);
+	});
+	kernels::SetCorners<NC, 3>(N, div);
+	kernels::SetCorners<NC, 3>(N, p);
+
+	LinearSolveN<NC>(m_project_solver, 0, p, div, 1, 6);
+
+	ForEachPlane<NC>([&](int k) {
+		kernels::SubtractGradient<NC, 3, float>(N, { velocX, velocY, velocZ }, p, k, k + 1, 1, N - 1);
+		kernels::SetRowBoundary<NC, 3>(N, 1, velocX, k);
+		kernels::SetRowBoundary<NC, 3>(N, 2, velocY, k);
+		kernels::SetRowBoundary<NC, 3>(N, 3, velocZ, k);
+	});
+	kernels::SetCorners<NC, 3>(N, velocX);
+	kernels::SetCorners<NC, 3>(N, velocY);
+	kernels::SetCorners<NC, 3>(N, velocZ);
+}
+
+template<int NC>
+void Fluid3D::AdvectN(int b, float* d, const float* d0, const std::array<const float*, 3>& velocity, float dt) noexcept
+{
+	const int N = Size<NC>();
+	if (m_advection == Fluid::Advection::MacCormack)
+	{
+		// Every wall of the semi-Lagrangian pass is set before the correction samples it
+		float* advected = m_advect_scratch.data();
+		ForEachPlane<NC>([&](int k) {
+			kernels::Advect<NC>(N, advected, d0, velocity, dt, k, k + 1, 1, N - 1);
+			kernels::SetRowBoundary<NC, 3>(N, b, advected, k);
+		});
+		kernels::SetCorners<NC, 3>(N, advected);
+		ForEachPlane<NC>([&](int k) {
+			kernels::MacCormack<NC>(N, d, d0, advected, velocity, dt, k, k + 1, 1, N - 1);
+			kernels::SetRowBoundary<NC, 3>(N, b, d, k);
+		});
+		kernels::SetCorners<NC, 3>(N, d);
+		return;
+	}
+
+	ForEachPlane<NC>([&](int k) {
+		kernels::Advect<NC>(N, d, d0, velocity, dt, k, k + 1, 1, N - 1);
+		kernels::SetRowBoundary<NC, 3>(N, b, d, k);
+	});
+	kernels::SetCorners<NC, 3>(N, d);
+}
+
+void Fluid3D::AddDensity(int x, int y, int z, float amount) noexcept
+{
+	m_density[IX(x, y, z)] += amount;
+}
+
+void Fluid3D::AddVelocity(int x, int y, int z, float amountX, float amountY, float amountZ) noexcept
+{
+	const std::size_t index = IX(x, y, z);
+	m_velocity_x[index] += amountX;
+	m_velocity_y[index] += amountY;
+	m_velocity_z[index] += amountZ;
+}
+
+void Fluid3D::AddBrush(const Brush& brush) noexcept
+{
+	const int N = m_size;
+	int xBegin, xEnd, yBegin, yEnd, zBegin, zEnd;
+	kernels::BrushExtent(N, brush.x, brush.radius, xBegin, xEnd);
+	kernels::BrushExtent(N, brush.y, brush.radius, yBegin, yEnd);
+	kernels::BrushExtent(N, brush.z, brush.radius, zBegin, zEnd);
+	const float invRadius2 = brush.radius < 1.0f ? 0.0f : 1.0f / (brush.radius * brush.radius);
+	for (int k = zBegin; k < zEnd; k++)
+	{
+		for (int j = yBegin; j < yEnd; j++)
+		{
+			const float dz = k - brush.z, dy = j - brush.y;
+			const float dyz2 = dy * dy + dz * dz;
+			const std::size_t row = static_cast<std::size_t>(N) * (j + static_cast<std::size_t>(N) * k);
+			for (int i = xBegin; i < xEnd; i++)
+			{
+				const float dx = i - brush.x;
+				const float weight = std::max(1.0f - (dx * dx + dyz2) * invRadius2, 0.0f);
+				m_density[row + i] += brush.density * weight;
+				m_velocity_x[row + i] += brush.velocityX * weight;
+				m_velocity_y[row + i] += brush.velocityY * weight;
+				m_velocity_z[row + i] += brush.velocityZ * weight;
+			}
+		}
+	}
+}
+
+void Fluid3D::ReadSlice(const SliceAxis axis, const int index, float* out) const noexcept
+{
+	const int N = m_size;
+	const std::size_t plane = static_cast<std::size_t>(std::min(std::max(index, 0), N - 1));
+	const float* density = m_density.data();
+	switch (axis)
+	{
+		case SliceAxis::Z:
+			std::copy_n(density + plane * N * N, static_cast<std::size_t>(N) * N, out);
+			break;
+		case SliceAxis::Y:
+			// x across, z down
+			for (int k = 0; k < N; k++)
+				std::copy_n(density + (plane + static_cast<std::size_t>(N) * k) * N, N, out + static_cast<std::size_t>(k) * N);
+			break;
+		case SliceAxis::X:
+			// y across, z down
+			for (int k = 0; k < N; k++)
+				for (int j = 0; j < N; j++)
+					out[static_cast<std::size_t>(k) * N + j] = density[plane + static_cast<std::size_t>(N) * (j + static_cast<std::size_t>(N) * k)];
+			break;
+	}
+}
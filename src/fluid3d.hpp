@@ -0,0 +1,147 @@
+#pragma once
+#include <algorithm>	// std::min, std::max
+#include <array>
+#include <cstddef>	// std::size_t
+#include <memory>	// std::unique_ptr
+#include <type_traits>	// std::integral_constant
+#include "aligned_buffer.hpp"
+#include "fluid.hpp"
+#include "thread_pool.hpp"
+
+namespace xtd_fluid_simulation {
+	/**
+	*	The tutorial's fluid in its original 3D form: Fluid's step on an N*N*N grid, run by the same dimension templated
+	*	kernels (fluid_kernels.hpp) instantiated for D = 3, so the stencils and index math are resolved at compile time.
+	*
+	*	The solvers are Fluid's (Gauss-Seidel pipelined plane by plane, red-black and Jacobi split by plane across the thread pool),
+	*	advection and both halves of the projection run in bands of planes, each plane's walls set while it is still in cache.
+	*	Fields are dense fp32: the SIMD row kernels, 16-bit storage, sparse tiles, multigrid and the task graph stay 2D only.
+	*/
+	class Fluid3D {
+	public:
+		// Which axis a slice is perpendicular to, see ReadSlice
+		enum class SliceAxis { X, Y, Z };
+
+		// Density and velocity splat, applied at once (see Fluid::Brush)
+		struct Brush {
+			float x, y, z; // Center, in cells
+			float radius; // In cells, below 1 only the cell (x, y, z), clamped onto the grid
+			float density;
+			float velocityX, velocityY, velocityZ;
+		};
+
+	public:
+		explicit Fluid3D(int size = DEFAULT_SIZE);
+
+	public:
+		// See Fluid::Update
+		void Update(const float dt) noexcept;
+
+		// Clamped onto the grid like Fluid::AddDensity
+		void AddDensity(int x, int y, int z, float amount) noexcept;
+		void AddVelocity(int x, int y, int z, float amountX, float amountY, float amountZ) noexcept;
+		// Weighted like Fluid's brushes: 1 at the center down to 0 at radius, quadratic in the distance
+		void AddBrush(const Brush& brush) noexcept;
+
+		// Copies the density of plane index perpendicular to axis into out, N*N values, row major (the other two axes in x, y, z order)
+		void ReadSlice(const SliceAxis axis, const int index, float* out) const noexcept;
+		const float* get_density() const noexcept { return m_density.data(); }
+
+		void set_speed(const int speed) noexcept { m_speed = speed; }
+		int get_speed() const noexcept { return m_speed; }
+		void set_viscosity(const float viscosity) noexcept { m_vescosity = std::max(viscosity, 0.0f); }
+		float get_viscosity() const noexcept { return m_vescosity; }
+		void set_diffusion(const float diffusion) noexcept { m_diffusion = std::max(diffusion, 0.0f); }
+		float get_diffusion() const noexcept { return m_diffusion; }
+		void set_iterations(const int iterations) noexcept { m_iterations = std::max(iterations, 1); }
+		int get_iterations() const noexcept { return m_iterations; }
+
+		void set_solver(const Fluid::Solver solver) noexcept { m_diffuse_solver = m_project_solver = solver; }
+		void set_diffuse_solver(const Fluid::Solver solver) noexcept { m_diffuse_solver = solver; }
+		Fluid::Solver get_diffuse_solver() const noexcept { return m_diffuse_solver; }
+		void set_project_solver(const Fluid::Solver solver) noexcept { m_project_solver = solver; }
+		Fluid::Solver get_project_solver() const noexcept { return m_project_solver; }
+		void set_jacobi_weight(const float weight) noexcept { m_jacobi_weight = std::min(std::max(weight, 0.1f), 1.0f); }
+
+		void set_advection(const Fluid::Advection advection);
+		Fluid::Advection get_advection() const noexcept { return m_advection; }
+
+		// Threads of the red-black and Jacobi solvers and of the banded passes, 0 uses every hardware thread
+		void set_thread_count(const int threads);
+		int get_thread_count() const noexcept { return m_thread_pool->GetThreadCount(); }
+
+		int get_size() const noexcept { return m_size; }
+		std::size_t get_cell_count() const noexcept { return m_density.size(); }
+
+	public:
+		inline static constexpr const int DEFAULT_SIZE = 64; // Cells per axis, 262144 cells
+		inline static constexpr const int MIN_SIZE = 8;
+
+	private:
+		template<int NC>
+		inline int Size() const noexcept
+		{
+			if constexpr (NC > 0) return NC;
+			else return m_size;
+		}
+
+		// See Fluid::DispatchSize, with the sizes a volume is commonly run at
+		template<typename Fn>
+		inline void DispatchSize(Fn&& fn) const
+		{
+			switch (m_size)
+			{
+				case 32: fn(std::integral_constant<int, 32>{}); break;
+				case 64: fn(std::integral_constant<int, 64>{}); break;
+				case 128: fn(std::integral_constant<int, 128>{}); break;
+				default: fn(std::integral_constant<int, 0>{}); break;
+			}
+		}
+
+		// Index of cell (x, y, z) clamped onto the grid
+		inline std::size_t IX(int x, int y, int z) const noexcept
+		{
+			const auto clamp = [this](int v) { return static_cast<std::size_t>(std::min(std::max(v, 0), m_size - 1)); };
+			return clamp(x) + m_size * (clamp(y) + m_size * clamp(z));
+		}
+
+		template<int NC> void UpdateN() noexcept;
+		template<int NC> void DiffuseN(int b, float* x, const float* x0, float diff, float dt) noexcept;
+		template<int NC> void LinearSolveN(Fluid::Solver solver, int b, float* x, const float* x0, float a, float c) noexcept;
+		template<int NC> void ProjectN(float* velocX, float* velocY, float* velocZ, float* p, float* div) noexcept;
+		template<int NC> void AdvectN(int b, float* d, const float* d0, const std::array<const float*, 3>& velocity, float dt) noexcept;
+
+		// Runs fn(plane) for every interior plane, in bands of planes across the thread pool
+		template<int NC, typename Fn>
+		void ForEachPlane(Fn&& fn) noexcept;
+
+	private:
+		int m_size; // Cells per axis (N)
+
+		AlignedBuffer<float> m_fluid_particles; // Diffused density, advected back into m_density
+		AlignedBuffer<float> m_density;
+		AlignedBuffer<float> m_velocity_x;
+		AlignedBuffer<float> m_velocity_y;
+		AlignedBuffer<float> m_velocity_z;
+		AlignedBuffer<float> m_prev_velocity_x;
+		AlignedBuffer<float> m_prev_velocity_y;
+		AlignedBuffer<float> m_prev_velocity_z;
+		AlignedBuffer<float> m_pressure;
+		AlignedBuffer<float> m_divergence;
+		AlignedBuffer<float> m_row_scratch; // One row of Gauss-Seidel right hand side
+		AlignedBuffer<float> m_jacobi_scratch; // Jacobi ping-pong iterate
+		AlignedBuffer<float> m_advect_scratch; // MacCormack's semi-Lagrangian pass, empty otherwise
+
+		Fluid::Solver m_diffuse_solver = Fluid::Solver::GaussSeidel;
+		Fluid::Solver m_project_solver = Fluid::Solver::GaussSeidel;
+		Fluid::Advection m_advection = Fluid::Advection::SemiLagrangian;
+		float m_jacobi_weight = 0.8f;
+		std::unique_ptr<ThreadPool> m_thread_pool;
+
+		int m_speed = Fluid::DEFAULT_SPEED;
+		float m_motion_speed = 0.2f; // speed * delta_time
+		float m_vescosity = Fluid::DEFAULT_VISCOSITY;
+		float m_diffusion = Fluid::DEFAULT_DIFFUSION;
+		int m_iterations = 16; // Each sweep relaxes N times the cells of a 2D one
+	};
+}
@@ -0,0 +1,480 @@
+#include "fluid_ensemble.hpp"
+#include "simd_kernels.hpp"
+#include <cmath>	// std::floor
+#include <algorithm>	// std::min, std::max, std::copy_n
+using namespace xtd_fluid_simulation;
+
+/**
+*	The interleaved kernels are Fluid's fp32 kernels (fluid_kernels.hpp) with every cell holding LANES values:
+*	the same arithmetic in the same order per lane, the innermost loop running over the lanes.
+*	The sweeps and the advection, where the time goes, have AVX2 kernels (simd_kernels.hpp) run one cell per instruction.
+*/
+namespace {
+	constexpr int L = FluidEnsemble::LANES;
+
+	// Lanes of cell (i, j)
+	inline float* Cell(float* x, int n, int i, int j) noexcept { return x + (static_cast<std::size_t>(j) * n + i) * L; }
+	inline const float* Cell(const float* x, int n, int i, int j) noexcept { return x + (static_cast<std::size_t>(j) * n + i) * L; }
+
+	// See kernels::SetBoundary
+	void SetBoundaryLanes(int n, int b, float* x) noexcept
+	{
+		const int N = n;
+		const float sy = b == 2 ? -1.0f : 1.0f;
+		for (int i = 1; i < N - 1; i++)
+		{
+			float* top = Cell(x, N, i, 0);
+			float* bottom = Cell(x, N, i, N - 1);
+			const float* first = Cell(x, N, i, 1);
+			const float* last = Cell(x, N, i, N - 2);
+			for (int l = 0; l < L; l++)
+			{
+				top[l] = sy * first[l];
+				bottom[l] = sy * last[l];
+			}
+		}
+		const float sx = b == 1 ? -1.0f : 1.0f;
+		for (int j = 1; j < N - 1; j++)
+		{
+			float* left = Cell(x, N, 0, j);
+			float* right = Cell(x, N, N - 1, j);
+			for (int l = 0; l < L; l++)
+			{
+				left[l] = sx * left[L + l];
+				right[l] = sx * right[l - L];
+			}
+		}
+
+		// Corners, the average of their two wall neighbours
+		const auto corner = [&](int i, int j, int di, int dj) {
+			float* c = Cell(x, N, i, j);
+			const float* horizontal = Cell(x, N, i + di, j);
+			const float* vertical = Cell(x, N, i, j + dj);
+			for (int l = 0; l < L; l++)
+				c[l] = 0.50f * (horizontal[l] + vertical[l]);
+		};
+		corner(0, 0, 1, 1);
+		corner(0, N - 1, 1, -1);
+		corner(N - 1, 0, -1, 1);
+		corner(N - 1, N - 1, -1, -1);
+	}
+
+	/**
+	*	kernels::GaussSeidel on every lane, lane l with its own a, c and number of iterations:
+	*	the sweeps past a lane's own count leave it as is (a blend, the sweep is run for the other lanes anyway).
+	*	sweep is the vectorized sweep (kernels::GetGaussSeidelLanesKernel), nullptr for the scalar loop.
+	*/
+	void GaussSeidelLanes(int n, int b, float* x, const float* x0, const float* a, const float* c, const int* iterations, kernels::GaussSeidelLanesFn sweep) noexcept
+	{
+		const int N = n;
+		float cRecip[L], aRecip[L];
+		int sweeps = 0;
+		for (int l = 0; l < L; l++)
+		{
+			cRecip[l] = 1.0f / c[l];
+			aRecip[l] = a[l] * cRecip[l];
+			sweeps = std::max(sweeps, iterations[l]);
+		}
+
+		for (int k = 0; k < sweeps; k++)
+		{
+			std::uint32_t relax[L];
+			for (int l = 0; l < L; l++)
+				relax[l] = k < iterations[l] ? ~0u : 0u;
+
+			if (sweep)
+			{
+				sweep(N, x, x0, a, cRecip, aRecip, relax);
+			}
+			else
+			{
+				for (int j = 1; j < N - 1; j++)
+				{
+					float* row = Cell(x, N, 0, j);
+					const float* src = Cell(x0, N, 0, j);
+					for (int i = L; i < (N - 1) * L; i += L)
+					{
+						for (int l = 0; l < L; l++)
+						{
+							const int cell = i + l;
+							const float rhs = (src[cell] + a[l] * (row[cell + L] + row[cell - N * L] + row[cell + N * L])) * cRecip[l];
+							const float relaxed = rhs + aRecip[l] * row[cell - L];
+							row[cell] = relax[l] ? relaxed : row[cell];
+						}
+					}
+				}
+			}
+			SetBoundaryLanes(N, b, x);
+		}
+	}
+
+	// kernels::Advect on every lane, lane l moving along its own velocity by its own dt (interior is kernels::GetAdvectLanesKernel, or nullptr)
+	void AdvectLanes(int n, int b, float* d, const float* d0, const float* velocX, const float* velocY, const float* dt, kernels::AdvectLanesFn interior) noexcept
+	{
+		const int N = n;
+		if (interior)
+		{
+			interior(N, d, d0, velocX, velocY, dt);
+			SetBoundaryLanes(N, b, d);
+			return;
+		}
+
+		const float Nfloat = static_cast<float>(N);
+		float dtx[L], dty[L];
+		for (int l = 0; l < L; l++)
+		{
+			dtx[l] = dt[l] * (N - 2);
+			dty[l] = dt[l] * (N - 2);
+		}
+
+		for (int j = 1; j < N - 1; j++)
+		{
+			for (int i = 1; i < N - 1; i++)
+			{
+				float* out = Cell(d, N, i, j);
+				const float* vx = Cell(velocX, N, i, j);
+				const float* vy = Cell(velocY, N, i, j);
+				for (int l = 0; l < L; l++)
+				{
+					const float x = std::min(std::max(static_cast<float>(i) - dtx[l] * vx[l], 0.5f), Nfloat + 0.5f);
+					const float y = std::min(std::max(static_cast<float>(j) - dty[l] * vy[l], 0.5f), Nfloat + 0.5f);
+					const float i0 = std::floor(x);
+					const float j0 = std::floor(y);
+					const float s1 = x - i0;
+					const float s0 = 1.0f - s1;
+					const float t1 = y - j0;
+					const float t0 = 1.0f - t1;
+					const int col0 = std::min(static_cast<int>(i0), N - 1);
+					const int col1 = std::min(static_cast<int>(i0) + 1, N - 1);
+					const int row0 = std::min(static_cast<int>(j0), N - 1) * N;
+					const int row1 = std::min(static_cast<int>(j0) + 1, N - 1) * N;
+					out[l] =
+						s0 * (t0 * d0[(col0 + row0) * L + l] + t1 * d0[(col0 + row1) * L + l]) +
+						s1 * (t0 * d0[(col1 + row0) * L + l] + t1 * d0[(col1 + row1) * L + l]);
+				}
+			}
+		}
+		SetBoundaryLanes(N, b, d);
+	}
+
+	// Fluid::Project on every lane (without warm start: the pressure starts from zero)
+	void ProjectLanes(int n, float* velocX, float* velocY, float* p, float* div, const int* iterations, kernels::GaussSeidelLanesFn sweep) noexcept
+	{
+		const int N = n;
+		const float divScale = -0.5f / N;
+		for (int j = 1; j < N - 1; j++)
+		{
+			for (int i = L; i < (N - 1) * L; i++)
+			{
+				const std::size_t cell = static_cast<std::size_t>(j) * N * L + i;
+				div[cell] = divScale * (velocX[cell + L] - velocX[cell - L] + velocY[cell + N * L] - velocY[cell - N * L]);
+				p[cell] = 0;
+			}
+		}
+		SetBoundaryLanes(N, 0, div);
+		SetBoundaryLanes(N, 0, p);
+
+		float a[L], c[L];
+		std::fill_n(a, L, 1.0f);
+		std::fill_n(c, L, 4.0f);
+		GaussSeidelLanes(N, 0, p, div, a, c, iterations, sweep);
+
+		const float gradScale = 0.5f * N;
+		for (int j = 1; j < N - 1; j++)
+		{
+			for (int i = L; i < (N - 1) * L; i++)
+			{
+				const std::size_t cell = static_cast<std::size_t>(j) * N * L + i;
+				velocX[cell] = velocX[cell] - gradScale * (p[cell + L] - p[cell - L]);
+				velocY[cell] = velocY[cell] - gradScale * (p[cell + N * L] - p[cell - N * L]);
+			}
+		}
+		SetBoundaryLanes(N, 1, velocX);
+		SetBoundaryLanes(N, 2, velocY);
+	}
+
+	// Fluid::Diffuse on every lane, with its own diffusion rate and dt
+	void DiffuseLanes(int n, int b, float* x, const float* x0, const float* diff, const float* dt, const int* iterations, kernels::GaussSeidelLanesFn sweep) noexcept
+	{
+		const int N = n;
+		float a[L], c[L];
+		for (int l = 0; l < L; l++)
+		{
+			a[l] = dt[l] * diff[l] * (N - 2) * (N - 2);
+			c[l] = 1.0f + Fluid::DEFAULT_SCALE * a[l];
+		}
+		GaussSeidelLanes(N, b, x, x0, a, c, iterations, sweep);
+	}
+}
+
+// LANES members sharing each field (see Layout::Interleaved), the lanes past count are left idle (zero iterations, zero fields)
+struct FluidEnsemble::Batch {
+	explicit Batch(int n)
+		:
+		density(static_cast<std::size_t>(n) * n * L),
+		particles(density.size()),
+		velocityX(density.size()),
+		velocityY(density.size()),
+		prevVelocityX(density.size()),
+		prevVelocityY(density.size()),
+		pressure(density.size()),
+		divergence(density.size())
+	{
+	}
+
+	int count = 0;
+	float viscosity[L] = {};
+	float diffusion[L] = {};
+	int speed[L] = {};
+	int iterations[L] = {};
+
+	AlignedBuffer<float> density;
+	AlignedBuffer<float> particles;
+	AlignedBuffer<float> velocityX;
+	AlignedBuffer<float> velocityY;
+	AlignedBuffer<float> prevVelocityX;
+	AlignedBuffer<float> prevVelocityY;
+	AlignedBuffer<float> pressure;
+	AlignedBuffer<float> divergence;
+};
+
+FluidEnsemble::FluidEnsemble(int size, int scale, const std::vector<Parameters>& members, Layout layout, int threads)
+	:
+	m_size(std::max(size, Fluid::MIN_SIZE)),
+	m_scale(std::max(scale, 1)),
+	m_layout(layout),
+	m_parameters(members),
+	m_thread_pool(new ThreadPool(threads))
+{
+	for (Parameters& parameters : m_parameters)
+	{
+		parameters.viscosity = std::max(parameters.viscosity, 0.0f);
+		parameters.diffusion = std::max(parameters.diffusion, 0.0f);
+		parameters.iterations = std::max(parameters.iterations, 1);
+	}
+
+	const int count = get_member_count();
+	if (m_layout == Layout::PerMember)
+	{
+		m_fluids.reserve(count);
+		for (const Parameters& parameters : m_parameters)
+		{
+			// Parallelism is across members, each one steps on the thread that claimed it
+			std::unique_ptr<Fluid> fluid(new Fluid(m_size, m_scale, 1));
+			fluid->set_task_graph(false);
+			fluid->set_viscosity(parameters.viscosity);
+			fluid->set_diffusion(parameters.diffusion);
+			fluid->set_speed(parameters.speed);
+			fluid->set_iterations(parameters.iterations);
+			m_fluids.push_back(std::move(fluid));
+		}
+	}
+	else
+	{
+		for (int first = 0; first < count; first += L)
+		{
+			std::unique_ptr<Batch> batch(new Batch(m_size));
+			batch->count = std::min(L, count - first);
+			for (int lane = 0; lane < batch->count; lane++)
+			{
+				const Parameters& parameters = m_parameters[first + lane];
+				batch->viscosity[lane] = parameters.viscosity;
+				batch->diffusion[lane] = parameters.diffusion;
+				batch->speed[lane] = parameters.speed;
+				batch->iterations[lane] = parameters.iterations;
+			}
+			m_batches.push_back(std::move(batch));
+		}
+	}
+
+	set_simd_level(DetectSimdLevel());
+	m_ranges.reset(new TaskRange[m_thread_pool->GetThreadCount()]);
+	m_stolen.assign(m_thread_pool->GetThreadCount(), 0);
+}
+
+FluidEnsemble::~FluidEnsemble() {}
+
+void FluidEnsemble::Update(float dt, int steps, const Injector& inject)
+{
+	const int tasks = static_cast<int>(m_layout == Layout::PerMember ? m_fluids.size() : m_batches.size());
+	const int threads = m_thread_pool->GetThreadCount();
+	for (int thread = 0; thread < threads; thread++)
+	{
+		const auto band = ThreadPool::Band(0, tasks, thread, threads);
+		m_ranges[thread].next.store(band.first, std::memory_order_relaxed);
+		m_ranges[thread].end = band.second;
+		m_stolen[thread] = 0;
+	}
+
+	const int firstStep = m_step;
+	const auto run = [&](int task) {
+		for (int step = firstStep; step < firstStep + steps; step++)
+		{
+			if (m_layout == Layout::PerMember)
+			{
+				if (inject)
+					inject(Member(*this, task), step);
+				m_fluids[task]->Update(dt);
+			}
+			else
+			{
+				Batch& batch = *m_batches[task];
+				if (inject)
+					for (int lane = 0; lane < batch.count; lane++)
+						inject(Member(*this, task * L + lane), step);
+				StepBatch(batch, dt);
+			}
+		}
+	};
+
+	m_thread_pool->Run([&](int thread, int threads) {
+		// Own band first, then whatever is left in the others', nearest thread first
+		for (int offset = 0; offset < threads; offset++)
+		{
+			TaskRange& range = m_ranges[(thread + offset) % threads];
+			for (int task = range.next.fetch_add(1, std::memory_order_relaxed); task < range.end; task = range.next.fetch_add(1, std::memory_order_relaxed))
+			{
+				run(task);
+				if (offset > 0)
+					m_stolen[thread]++;
+			}
+		}
+	});
+	m_step += steps;
+}
+
+// Fluid::Update's steps (fp32, non fused), on every lane of the batch
+void FluidEnsemble::StepBatch(Batch& batch, float dt) noexcept
+{
+	const int N = m_size;
+	float motion[L];
+	for (int l = 0; l < L; l++)
+		motion[l] = batch.speed[l] * dt;
+
+	DiffuseLanes(N, 1, batch.prevVelocityX.data(), batch.velocityX.data(), batch.viscosity, motion, batch.iterations, m_lanes_sweep);
+	DiffuseLanes(N, 2, batch.prevVelocityY.data(), batch.velocityY.data(), batch.viscosity, motion, batch.iterations, m_lanes_sweep);
+
+	ProjectLanes(N, batch.prevVelocityX.data(), batch.prevVelocityY.data(), batch.pressure.data(), batch.divergence.data(), batch.iterations, m_lanes_sweep);
+
+	AdvectLanes(N, 1, batch.velocityX.data(), batch.prevVelocityX.data(), batch.prevVelocityX.data(), batch.prevVelocityY.data(), motion, m_lanes_advect);
+	AdvectLanes(N, 2, batch.velocityY.data(), batch.prevVelocityY.data(), batch.prevVelocityX.data(), batch.prevVelocityY.data(), motion, m_lanes_advect);
+
+	ProjectLanes(N, batch.velocityX.data(), batch.velocityY.data(), batch.pressure.data(), batch.divergence.data(), batch.iterations, m_lanes_sweep);
+
+	DiffuseLanes(N, 0, batch.particles.data(), batch.density.data(), batch.diffusion, motion, batch.iterations, m_lanes_sweep);
+	AdvectLanes(N, 0, batch.density.data(), batch.particles.data(), batch.velocityX.data(), batch.velocityY.data(), motion, m_lanes_advect);
+}
+
+int FluidEnsemble::GetCellIndex(int x, int y) const noexcept
+{
+	// Clamped like Fluid::IX
+	x = std::min(std::max(x, 0), m_size - 1);
+	y = std::min(std::max(y, 0), m_size - 1);
+	return x + y * m_size;
+}
+
+void FluidEnsemble::AddDensity(int member, int x, int y, float amount) noexcept
+{
+	if (m_layout == Layout::PerMember)
+	{
+		m_fluids[member]->AddDensity(x, y, amount);
+		return;
+	}
+	Batch& batch = *m_batches[member / L];
+	batch.density[static_cast<std::size_t>(GetCellIndex(x, y)) * L + member % L] += amount;
+}
+
+void FluidEnsemble::AddVelocity(int member, int x, int y, float amountX, float amountY) noexcept
+{
+	if (m_layout == Layout::PerMember)
+	{
+		m_fluids[member]->AddVelocity(x, y, amountX, amountY);
+		return;
+	}
+	Batch& batch = *m_batches[member / L];
+	const std::size_t cell = static_cast<std::size_t>(GetCellIndex(x, y)) * L + member % L;
+	batch.velocityX[cell] += amountX;
+	batch.velocityY[cell] += amountY;
+}
+
+void FluidEnsemble::AddBrush(int member, const Fluid::Brush& brush)
+{
+	if (m_layout == Layout::PerMember)
+	{
+		m_fluids[member]->AddBrush(brush);
+		return;
+	}
+	Batch& batch = *m_batches[member / L];
+	const std::size_t lane = member % L;
+	int rowBegin, rowEnd;
+	kernels::BrushExtent(m_size, brush.y, brush.radius, rowBegin, rowEnd);
+	for (int j = rowBegin; j < rowEnd; j++)
+	{
+		int colBegin, colEnd;
+		if (!kernels::BrushSpan(m_size, brush.x, brush.y, brush.radius, j, colBegin, colEnd))
+			continue;
+		const std::size_t row = static_cast<std::size_t>(j) * m_size * L + lane;
+		kernels::SplatBrushRow(j, colBegin, colEnd, L, brush.x, brush.y, brush.radius, brush.density, brush.velocityX, brush.velocityY,
+			batch.density.data() + row, batch.velocityX.data() + row, batch.velocityY.data() + row);
+	}
+}
+
+void FluidEnsemble::AddForce(int member, float amountX, float amountY)
+{
+	if (m_layout == Layout::PerMember)
+	{
+		m_fluids[member]->AddForce(amountX, amountY);
+		return;
+	}
+	Batch& batch = *m_batches[member / L];
+	const std::size_t cells = static_cast<std::size_t>(m_size) * m_size;
+	for (std::size_t cell = member % L; cell < cells * L; cell += L)
+	{
+		batch.velocityX[cell] += amountX;
+		batch.velocityY[cell] += amountY;
+	}
+}
+
+void FluidEnsemble::ReadDensity(int member, float* out) const noexcept
+{
+	if (m_layout == Layout::PerMember)
+	{
+		m_fluids[member]->ReadDensity(out);
+		return;
+	}
+	const Batch& batch = *m_batches[member / L];
+	const std::size_t cells = static_cast<std::size_t>(m_size) * m_size;
+	for (std::size_t cell = 0; cell < cells; cell++)
+		out[cell] = batch.density[cell * L + member % L];
+}
+
+void FluidEnsemble::ReadVelocity(int member, float* outX, float* outY) const noexcept
+{
+	const std::size_t cells = static_cast<std::size_t>(m_size) * m_size;
+	if (m_layout == Layout::PerMember)
+	{
+		std::copy_n(m_fluids[member]->get_velocity_x(), cells, outX);
+		std::copy_n(m_fluids[member]->get_velocity_y(), cells, outY);
+		return;
+	}
+	const Batch& batch = *m_batches[member / L];
+	for (std::size_t cell = 0; cell < cells; cell++)
+	{
+		outX[cell] = batch.velocityX[cell * L + member % L];
+		outY[cell] = batch.velocityY[cell * L + member % L];
+	}
+}
+
+void FluidEnsemble::set_simd_level(const SimdLevel level) noexcept
+{
+	m_simd_level = std::min(level, DetectSimdLevel());
+	for (std::unique_ptr<Fluid>& fluid : m_fluids)
+		fluid->set_simd_level(m_simd_level);
+	m_lanes_sweep = kernels::GetGaussSeidelLanesKernel(m_simd_level);
+	m_lanes_advect = kernels::GetAdvectLanesKernel(m_simd_level);
+}
+
+Fluid* FluidEnsemble::GetFluid(int member) noexcept
+{
+	return m_layout == Layout::PerMember ? m_fluids[member].get() : nullptr;
+}
@@ -0,0 +1,138 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "aligned_buffer.hpp"
+#include "cpu_features.hpp"
+#include "fluid.hpp"
+#include "thread_pool.hpp"
+
+namespace xtd_fluid_simulation {
+	/**
+	*	K independent simulations of the same grid size, with their own parameters, stepped together:
+	*	a parameter sweep in one process, every core busy, instead of one single threaded process per configuration.
+	*
+	*	Members are scheduled as tasks (a member, or a batch of LANES members, advancing all the steps of an Update)
+	*	over a ThreadPool with work stealing: each thread starts on its own band of tasks and, once it runs dry,
+	*	takes the remaining ones from the other bands, so a member with more iterations does not hold everyone back.
+	*	A task runs all its steps in a row, so its fields stay in that core's cache between steps.
+	*
+	*	Layout::PerMember: every member is a full Fluid (single threaded), so every Fluid setting applies (see GetFluid).
+	*	Layout::Interleaved: LANES members share each field, cell by cell (the value of member m of a batch at [cell * LANES + m]),
+	*	so one SIMD lane steps one member, Gauss-Seidel included: its serial chain runs along a row, never across members.
+	*	It runs the reference pipeline only: fixed Gauss-Seidel iterations, relaxation pressure, fp32 storage, no warm start.
+	*/
+	class FluidEnsemble {
+	public:
+		enum class Layout {
+			PerMember, // One Fluid per member
+			Interleaved, // LANES members per set of fields
+		};
+
+		// The swept parameters, the others are Fluid's defaults
+		struct Parameters {
+			float viscosity = Fluid::DEFAULT_VISCOSITY;
+			float diffusion = Fluid::DEFAULT_DIFFUSION;
+			int speed = Fluid::DEFAULT_SPEED;
+			int iterations = Fluid::DEFAULT_ITERATIONS;
+		};
+
+		// Injection target of one member, the way Fluid::AddDensity / AddVelocity address cells
+		class Member {
+		public:
+			Member(FluidEnsemble& ensemble, int index) noexcept : m_ensemble(&ensemble), m_index(index) {}
+
+			void AddDensity(int x, int y, float amount) noexcept { m_ensemble->AddDensity(m_index, x, y, amount); }
+			void AddVelocity(int x, int y, float amountX, float amountY) noexcept { m_ensemble->AddVelocity(m_index, x, y, amountX, amountY); }
+			void AddBrush(const Fluid::Brush& brush) { m_ensemble->AddBrush(m_index, brush); }
+			void AddForce(float amountX, float amountY) { m_ensemble->AddForce(m_index, amountX, amountY); }
+			int get_size() const noexcept { return m_ensemble->get_size(); }
+			int get_scale() const noexcept { return m_ensemble->get_scale(); }
+			int get_index() const noexcept { return m_index; }
+
+		private:
+			FluidEnsemble* m_ensemble;
+			int m_index;
+		};
+
+		// Called before each step of each member, from the thread stepping it: it must only touch that member
+		using Injector = std::function<void(Member member, int step)>;
+
+		// One AVX2 register of floats
+		inline static constexpr const int LANES = 8;
+
+	public:
+		// threads 0 uses every hardware thread
+		FluidEnsemble(int size, int scale, const std::vector<Parameters>& members, Layout layout = Layout::PerMember, int threads = 0);
+		~FluidEnsemble();
+
+		FluidEnsemble(const FluidEnsemble&) = delete;
+		FluidEnsemble& operator=(const FluidEnsemble&) = delete;
+
+	public:
+		// Advances every member by steps steps of dt, inject (optional) feeding each member before each of its steps
+		void Update(float dt, int steps = 1, const Injector& inject = {});
+
+		// Same as Fluid's, between Updates or from the Injector of that member
+		void AddDensity(int member, int x, int y, float amount) noexcept;
+		void AddVelocity(int member, int x, int y, float amountX, float amountY) noexcept;
+		// Queued into the member's Fluid with Layout::PerMember (see Fluid::AddBrush), applied at once when interleaved
+		void AddBrush(int member, const Fluid::Brush& brush);
+		void AddForce(int member, float amountX, float amountY);
+
+		// N*N values of one member, row major
+		void ReadDensity(int member, float* out) const noexcept;
+		void ReadVelocity(int member, float* outX, float* outY) const noexcept;
+
+		// Kernel instruction set, of every member (capped to what the CPU supports, see Fluid::set_simd_level)
+		void set_simd_level(const SimdLevel level) noexcept;
+		SimdLevel get_simd_level() const noexcept { return m_simd_level; }
+
+		// The member's Fluid with Layout::PerMember (any setting can be changed between Updates), nullptr when interleaved
+		Fluid* GetFluid(int member) noexcept;
+
+		int get_member_count() const noexcept { return static_cast<int>(m_parameters.size()); }
+		const Parameters& get_parameters(int member) const noexcept { return m_parameters[member]; }
+		Layout get_layout() const noexcept { return m_layout; }
+		int get_size() const noexcept { return m_size; }
+		int get_scale() const noexcept { return m_scale; }
+		int get_thread_count() const noexcept { return m_thread_pool->GetThreadCount(); }
+		// Steps run by every member so far
+		int get_step() const noexcept { return m_step; }
+		// Per thread, tasks it ran from another thread's band during the last Update
+		const std::vector<int>& get_stolen_tasks() const noexcept { return m_stolen; }
+
+	private:
+		struct Batch;
+
+		void StepBatch(Batch& batch, float dt) noexcept;
+		int GetCellIndex(int x, int y) const noexcept;
+
+	private:
+		// A thread's band of tasks, claimed front to back by its owner and by thieves alike
+		struct alignas(64) TaskRange {
+			std::atomic<int> next{ 0 };
+			int end = 0;
+		};
+
+		int m_size;
+		int m_scale;
+		Layout m_layout;
+		std::vector<Parameters> m_parameters;
+		int m_step = 0;
+
+		std::vector<std::unique_ptr<Fluid>> m_fluids; // Layout::PerMember
+		std::vector<std::unique_ptr<Batch>> m_batches; // Layout::Interleaved, member m in lane m % LANES of batch m / LANES
+
+		SimdLevel m_simd_level = SimdLevel::Scalar;
+		// Interleaved sweep and advection kernels, nullptr for the scalar loops (see kernels::GetGaussSeidelLanesKernel)
+		void (*m_lanes_sweep)(int, float*, const float*, const float*, const float*, const float*, const std::uint32_t*) noexcept = nullptr;
+		void (*m_lanes_advect)(int, float*, const float*, const float*, const float*, const float*) noexcept = nullptr;
+
+		std::unique_ptr<ThreadPool> m_thread_pool;
+		std::unique_ptr<TaskRange[]> m_ranges;
+		std::vector<int> m_stolen;
+	};
+}
@@ -0,0 +1,1100 @@
+#pragma once
+#include "active_tiles.hpp"
+#include "obstacle_map.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>	// std::max, std::copy
+#include <array>
+#include <cstddef>	// std::size_t
+#include <type_traits>	// std::conditional_t
+#include <utility>	// std::swap
+#include <vector>
+#include <cmath>	// std::fabs, std::floor, std::ceil, std::sqrt
+
+/**
+*	Grid kernels shared by Fluid, Fluid3D and their solvers (Multigrid levels).
+*	Each one works on an n^D field (D = 2 by default, 3 for Fluid3D) whose outer layer is the wall, and is templated on NC,
+*	the grid size when known at compile time (0 reads n), like Fluid's own kernels.
+*	Cell (i, j, k) is at i + n * (j + n * k): rows of n cells along x, stacked into slabs along the outermost axis,
+*	a slab being a row in 2D and a plane of n rows in 3D. The D templated kernels band, pipeline and wall their work by slab,
+*	and relax row by row inside one, so both dimensions run the same loops with the stencil and index math picked at compile time.
+*	The wall, solver and advection kernels are also templated on their field types, so they run on 16-bit stored fields
+*	(half_float.hpp) directly: T is the type of the field a kernel writes, S of its source (x0, d0), converted per cell.
+*	The *Spans variants only visit the given rectangles of interior cells (ActiveTiles), the cells around them are read as they are (2D only).
+*	The solvers take the solid cells inside the grid (ObstacleMap, nullptr when there are none, always in 3D) and set them
+*	wherever they set the walls, their stencils run unchanged over every cell.
+*/
+namespace xtd_fluid_simulation::kernels {
+	template<int NC>
+	inline int Size(int n) noexcept
+	{
+		if constexpr (NC > 0) return NC;
+		else return n;
+	}
+
+	// Cells in one slab: a row of N in 2D, a plane of N*N in 3D
+	template<int D>
+	inline constexpr int SlabCells(int N) noexcept
+	{
+		static_assert(D == 2 || D == 3, "2D or 3D grids");
+		if constexpr (D == 2) return N;
+		else return N * N;
+	}
+
+	// Cells of a whole field, N^D
+	template<int D>
+	inline constexpr std::size_t Cells(int N) noexcept
+	{
+		return static_cast<std::size_t>(SlabCells<D>(N)) * N;
+	}
+
+	/**
+	*	Calls fn(row, j, k) for the interior rows of slabs [slabBegin, slabEnd), in memory order.
+	*	row is the row's index (its first cell is at row * N), k is 0 in 2D where the slab is the row.
+	*/
+	template<int D, typename Fn>
+	inline void ForInteriorRows(int N, int slabBegin, int slabEnd, Fn&& fn)
+	{
+		for (int k = slabBegin; k < slabEnd; k++)
+		{
+			if constexpr (D == 2)
+				fn(k, k, 0);
+			else
+				for (int j = 1; j < N - 1; j++)
+					fn(j + N * k, j, k);
+		}
+	}
+
+	// Sum of the 2 * D face neighbours of cell
+	template<int D, typename T = float>
+	inline float NeighbourSum(const T* cell, int N) noexcept
+	{
+		if constexpr (D == 2) return cell[-1] + cell[1] + cell[-N] + cell[N];
+		else return cell[-1] + cell[1] + cell[-N] + cell[N] + cell[-N * N] + cell[N * N];
+	}
+
+	/**
+	*	2D: corner cells, the average of their two wall neighbours.
+	*	3D: edge cells, the average of their two face neighbours, then corner cells, the average of their three edge neighbours.
+	*/
+	template<int NC, int D = 2, typename T>
+	inline void SetCorners(int n, T* x) noexcept
+	{
+		const int N = Size<NC>(n);
+		if constexpr (D == 3)
+		{
+			const auto at = [x, N](int i, int j, int k) -> T& { return x[i + N * (j + N * k)]; };
+			const int walls[2] = { 0, N - 1 };
+			for (const int a : walls)
+			{
+				const int na = a == 0 ? 1 : N - 2;
+				for (const int c : walls)
+				{
+					const int nc = c == 0 ? 1 : N - 2;
+					for (int t = 1; t < N - 1; t++)
+					{
+						at(t, a, c) = 0.50f * (at(t, na, c) + at(t, a, nc));
+						at(a, t, c) = 0.50f * (at(na, t, c) + at(a, t, nc));
+						at(a, c, t) = 0.50f * (at(na, c, t) + at(a, nc, t));
+					}
+				}
+			}
+			for (const int i : walls)
+				for (const int j : walls)
+					for (const int k : walls)
+						at(i, j, k) = (1.0f / 3.0f) * (at(i == 0 ? 1 : N - 2, j, k) + at(i, j == 0 ? 1 : N - 2, k) + at(i, j, k == 0 ? 1 : N - 2));
+			return;
+		}
+		T* top = x;
+		T* bottom = x + (N - 1) * N;
+		top[0] = 0.50f * (top[1] + top[N]);
+		bottom[0] = 0.50f * (bottom[1] + bottom[-N]);
+		top[N - 1] = 0.50f * (top[N - 2] + top[2 * N - 1]);
+		bottom[N - 1] = 0.50f * (bottom[N - 2] + bottom[-1]);
+	}
+
+	template<int NC, int D = 2, typename T>
+	inline void SetRowBoundary(int n, int b, T* x, int slab) noexcept;
+
+	// See Fluid::SetBoundary, b is 3 for the z velocity in 3D
+	template<int NC, int D = 2, typename T>
+	void SetBoundary(int n, int b, T* x) noexcept
+	{
+		const int N = Size<NC>(n);
+		if constexpr (D == 3)
+		{
+			// Every face cell is set from the interior slab it touches
+			for (int k = 1; k < N - 1; k++)
+				SetRowBoundary<NC, D>(n, b, x, k);
+			SetCorners<NC, D>(n, x);
+			return;
+		}
+		T* top = x;
+		T* bottom = x + (N - 1) * N;
+		const float sy = b == 2 ? -1.0f : 1.0f;
+		for (int i = 1; i < N - 1; i++)
+		{
+			top[i] = sy * top[i + N];
+			bottom[i] = sy * bottom[i - N];
+		}
+		const float sx = b == 1 ? -1.0f : 1.0f;
+		for (int j = 1; j < N - 1; j++)
+		{
+			T* row = x + j * N;
+			row[0] = sx * row[1];
+			row[N - 1] = sx * row[N - 2];
+		}
+		SetCorners<NC>(n, x);
+	}
+
+	/**
+	*	The wall cells that only depend on interior slab j: its two side cells (in 3D, the ring of face cells around the plane),
+	*	and the top (bottom) wall when j is the first (last) interior slab. Lets a pass set the walls while the slab is still in cache:
+	*	calling it for every interior slab and then SetCorners gives the same field as SetBoundary.
+	*/
+	template<int NC, int D, typename T>
+	inline void SetRowBoundary(int n, int b, T* x, int j) noexcept
+	{
+		const int N = Size<NC>(n);
+		if constexpr (D == 3)
+		{
+			T* plane = x + j * N * N;
+			const float sx = b == 1 ? -1.0f : 1.0f;
+			for (int row = 1; row < N - 1; row++)
+			{
+				T* cells = plane + row * N;
+				cells[0] = sx * cells[1];
+				cells[N - 1] = sx * cells[N - 2];
+			}
+			const float sy = b == 2 ? -1.0f : 1.0f;
+			T* lastRow = plane + (N - 1) * N;
+			for (int i = 1; i < N - 1; i++)
+			{
+				plane[i] = sy * plane[i + N];
+				lastRow[i] = sy * lastRow[i - N];
+			}
+			const float sz = b == 3 ? -1.0f : 1.0f;
+			T* wall = j == 1 ? plane - N * N : j == N - 2 ? plane + N * N : nullptr;
+			if (wall)
+				for (int row = 1; row < N - 1; row++)
+					for (int i = row * N + 1; i < row * N + N - 1; i++)
+						wall[i] = sz * plane[i];
+			return;
+		}
+		T* row = x + j * N;
+		const float sx = b == 1 ? -1.0f : 1.0f;
+		row[0] = sx * row[1];
+		row[N - 1] = sx * row[N - 2];
+
+		const float sy = b == 2 ? -1.0f : 1.0f;
+		T* wall = j == 1 ? row - N : j == N - 2 ? row + N : nullptr;
+		if (wall)
+			for (int i = 1; i < N - 1; i++)
+				wall[i] = sy * row[i];
+	}
+
+	// SetBoundary, then every solid cell (2D only)
+	template<int NC, int D = 2, typename T>
+	inline void SetWalls(int n, int b, T* x, const ObstacleMap* obstacles) noexcept
+	{
+		SetBoundary<NC, D>(n, b, x);
+		if constexpr (D == 2)
+			if (obstacles)
+				obstacles->Apply(b, x, 1, Size<NC>(n) - 1);
+	}
+
+	// The solid cells of row j, right after it was relaxed so the rows relaxed after it read them set (2D only)
+	template<int D, typename T>
+	inline void SetObstacleRow(const ObstacleMap* obstacles, int b, T* x, int j) noexcept
+	{
+		if constexpr (D == 2)
+			if (obstacles)
+				obstacles->Apply(b, x, j, j + 1);
+	}
+
+	// Whether cell (i, j) is fluid, for the measurements that skip solid cells
+	inline bool IsFluid(const ObstacleMap* obstacles, int i, int j) noexcept
+	{
+		return !obstacles || !obstacles->IsSolid(i, j);
+	}
+
+	// Copies count values of one field type into another through float (to and from the 16-bit storage formats)
+	template<typename From, typename To>
+	inline void ConvertField(const From* in, To* out, std::size_t count) noexcept
+	{
+		for (std::size_t index = 0; index < count; ++index)
+			out[index] = static_cast<float>(in[index]);
+	}
+
+	// Fields a row-streaming pass may keep cache resident at once, about half a typical L2 (the rest is left to the other fields and the stack)
+	inline constexpr const int L2_TILE_BYTES = 512 * 1024;
+
+	// Rows of n floats in a tile of fields fields that fits L2_TILE_BYTES
+	inline int TileRows(int n, int fields) noexcept
+	{
+		return std::max(L2_TILE_BYTES / (fields * n * static_cast<int>(sizeof(float))), 1);
+	}
+
+	// Gauss-Seidel relaxation of cells [colBegin, colEnd) of interior row j, the rows before it are already relaxed this sweep
+	// A GaussSeidelRow kernel for fields of types T and S (2D only), nested like JacobiRowsOf so nullptr deduces nothing
+	template<typename T, typename S>
+	struct GaussSeidelRowOfType {
+		using Fn = void (*)(int n, int j, T* x, const S* x0, float a, float cRecip, float aRecip, float* rhs, int colBegin, int colEnd) noexcept;
+	};
+	template<typename T = float, typename S = float>
+	using GaussSeidelRowOf = typename GaussSeidelRowOfType<T, S>::Fn;
+
+	template<int NC, int D = 2, typename T, typename S>
+	inline void GaussSeidelRow(int n, int j, T* x, const S* x0, float a, float cRecip, float aRecip, float* rhs, int colBegin, int colEnd) noexcept
+	{
+		const int N = Size<NC>(n);
+		T* row = x + j * N;
+		const T* up = row - N;
+		const T* down = row + N;
+		const S* src = x0 + j * N;
+
+		// Everything but the left neighbour is known before the row is relaxed, gather it in one vectorizable pass..
+		if constexpr (D == 2)
+		{
+			for (int i = colBegin; i < colEnd; i++)
+				rhs[i] = (src[i] + a * (row[i + 1] + up[i] + down[i])) * cRecip;
+		}
+		else
+		{
+			const T* front = row - N * N;
+			const T* back = row + N * N;
+			for (int i = colBegin; i < colEnd; i++)
+				rhs[i] = (src[i] + a * (row[i + 1] + up[i] + down[i] + front[i] + back[i])) * cRecip;
+		}
+		// ..leaving a single fma per cell on the serial Gauss-Seidel chain, the left neighbour carried in a register
+		float left = row[colBegin - 1];
+		for (int i = colBegin; i < colEnd; i++)
+		{
+			left = rhs[i] + aRecip * left;
+			row[i] = left;
+		}
+	}
+
+	// GaussSeidelRow, or rowKernel (see GetGaussSeidelRowKernel) when there is one
+	template<int NC, int D = 2, typename T, typename S>
+	inline void GaussSeidelRow(GaussSeidelRowOf<T, S> rowKernel, int n, int j, T* x, const S* x0, float a, float cRecip, float aRecip, float* rhs, int colBegin, int colEnd) noexcept
+	{
+		if (D == 2 && rowKernel)
+			rowKernel(n, j, x, x0, a, cRecip, aRecip, rhs, colBegin, colEnd);
+		else
+			GaussSeidelRow<NC, D>(n, j, x, x0, a, cRecip, aRecip, rhs, colBegin, colEnd);
+	}
+
+	/**
+	*	In place Gauss-Seidel relaxation of c*x - a*(neighbours) = x0, row by row (see Fluid::LinearSolve).
+	*	rowScratch holds at least n floats. rowKernel relaxes the rows of 2D grids when not nullptr.
+	*/
+	template<int NC, int D = 2, typename T, typename S>
+	void GaussSeidel(int n, int b, T* x, const S* x0, float a, float c, int iterations, float* rowScratch, const ObstacleMap* obstacles = nullptr, GaussSeidelRowOf<T, S> rowKernel = nullptr) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float cRecip = 1.0f / c;
+		const float aRecip = a * cRecip;
+		for (int k = 0; k < iterations; k++)
+		{
+			ForInteriorRows<D>(N, 1, N - 1, [&](int row, int, int) {
+				GaussSeidelRow<NC, D>(rowKernel, N, row, x, x0, a, cRecip, aRecip, rowScratch, 1, N - 1);
+				SetObstacleRow<D>(obstacles, b, x, row);
+			});
+
+			SetBoundary<NC, D>(n, b, x);
+		}
+	}
+
+	// GaussSeidel over spans only, in the same order as a full sweep. Solid cells are set once per sweep, a row's spans are not relaxed together
+	template<int NC, typename T, typename S>
+	void GaussSeidelSpans(int n, int b, T* x, const S* x0, float a, float c, int iterations, float* rowScratch, const std::vector<TileSpan>& spans, const ObstacleMap* obstacles = nullptr, GaussSeidelRowOf<T, S> rowKernel = nullptr) noexcept
+	{
+		const float cRecip = 1.0f / c;
+		const float aRecip = a * cRecip;
+		for (int k = 0; k < iterations; k++)
+		{
+			for (const TileSpan& span : spans)
+				for (int j = span.rowBegin; j < span.rowEnd; j++)
+					GaussSeidelRow<NC>(rowKernel, n, j, x, x0, a, cRecip, aRecip, rowScratch, span.colBegin, span.colEnd);
+
+			SetWalls<NC>(n, b, x, obstacles);
+		}
+	}
+
+	// Sweeps GaussSeidelWavefront keeps in flight, so their window of x and x0 slabs stays in L2
+	template<int D = 2>
+	inline int WavefrontDepth(int n) noexcept
+	{
+		// Sweep k trails sweep k - 1 by two slabs: 2 * depth + 2 slabs of x and 2 * depth slabs of x0
+		return std::max((TileRows(SlabCells<D>(n), 1) - 2) / 4, 1);
+	}
+
+	/**
+	*	Same arithmetic as GaussSeidel in the same order (bit identical unless fast-math reassociates), with the sweeps pipelined: sweep k relaxes slab j as soon as
+	*	sweep k - 1 is done with slab j + 1, so up to WavefrontDepth sweeps walk down the grid together two slabs apart.
+	*	x and x0 then stream through memory once per WavefrontDepth sweeps instead of once per sweep.
+	*	Each slab takes its walls from the previous sweep (SetRowBoundary) right before it is relaxed,
+	*	which is all the per sweep SetBoundary of GaussSeidel provides to the next sweep.
+	*/
+	template<int NC, int D = 2, typename T, typename S>
+	void GaussSeidelWavefront(int n, int b, T* x, const S* x0, float a, float c, int iterations, float* rowScratch, const ObstacleMap* obstacles = nullptr, GaussSeidelRowOf<T, S> rowKernel = nullptr) noexcept
+	{
+		if (iterations <= 0)
+			return;
+		const int N = Size<NC>(n);
+		const float cRecip = 1.0f / c;
+		const float aRecip = a * cRecip;
+		const int depth = WavefrontDepth<D>(N);
+		for (int first = 0; first < iterations; first += depth)
+		{
+			const int sweeps = std::min(depth, iterations - first);
+			for (int front = 1; front < N - 1 + 2 * (sweeps - 1); front++)
+			{
+				// Sweep k is at slab front - 2k, the leading sweep first
+				for (int k = std::max(0, (front - (N - 2) + 1) / 2); k < sweeps && front - 2 * k >= 1; k++)
+				{
+					const int j = front - 2 * k;
+					// The very first sweep uses the walls as given, like GaussSeidel
+					if (first + k > 0)
+						SetRowBoundary<NC, D>(N, b, x, j);
+					ForInteriorRows<D>(N, j, j + 1, [&](int row, int, int) {
+						GaussSeidelRow<NC, D>(rowKernel, N, row, x, x0, a, cRecip, aRecip, rowScratch, 1, N - 1);
+					});
+					SetObstacleRow<D>(obstacles, b, x, j);
+				}
+			}
+		}
+		SetBoundary<NC, D>(n, b, x);
+	}
+
+	// GaussSeidelWavefront over spans only, each row relaxed span by span in the order of GaussSeidelSpans
+	template<int NC, typename T, typename S>
+	void GaussSeidelWavefrontSpans(int n, int b, T* x, const S* x0, float a, float c, int iterations, float* rowScratch, const ActiveTiles& tiles, const ObstacleMap* obstacles = nullptr, GaussSeidelRowOf<T, S> rowKernel = nullptr) noexcept
+	{
+		if (iterations <= 0)
+			return;
+		const int N = Size<NC>(n);
+		const float cRecip = 1.0f / c;
+		const float aRecip = a * cRecip;
+		const int depth = WavefrontDepth<>(N);
+		const TileSpan* spans = tiles.GetSpans().data();
+		for (int first = 0; first < iterations; first += depth)
+		{
+			const int sweeps = std::min(depth, iterations - first);
+			for (int front = 1; front < N - 1 + 2 * (sweeps - 1); front++)
+			{
+				for (int k = std::max(0, (front - (N - 2) + 1) / 2); k < sweeps && front - 2 * k >= 1; k++)
+				{
+					const int j = front - 2 * k;
+					if (first + k > 0)
+						SetRowBoundary<NC>(N, b, x, j);
+					for (int span = tiles.GetRowSpanBegin(j); span < tiles.GetRowSpanEnd(j); span++)
+						GaussSeidelRow<NC>(rowKernel, N, j, x, x0, a, cRecip, aRecip, rowScratch, spans[span].colBegin, spans[span].colEnd);
+					SetObstacleRow<2>(obstacles, b, x, j);
+				}
+			}
+		}
+		SetBoundary<NC>(n, b, x);
+	}
+
+	/**
+	*	Same relaxation with the cells colored as a checkerboard: a red cell only has black neighbours,
+	*	so each half sweep has no dependency inside it and every thread relaxes its own band of slabs.
+	*	Threads meet after each half sweep, and thread 0 resets the boundaries once per iteration
+	*	(the solid cells after each half sweep).
+	*/
+	template<int NC, int D = 2, typename T, typename S>
+	void RedBlackGaussSeidel(ThreadPool& pool, int n, int b, T* x, const S* x0, float a, float c, int iterations, const ObstacleMap* obstacles = nullptr) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float cRecip = 1.0f / c;
+		pool.Run([&](int thread, int threads) {
+			const auto band = ThreadPool::Band(1, N - 1, thread, threads);
+			for (int k = 0; k < iterations; k++)
+			{
+				for (int color = 0; color < 2; color++)
+				{
+					ForInteriorRows<D>(N, band.first, band.second, [&](int r, int j, int l) {
+						T* row = x + r * N;
+						const S* src = x0 + r * N;
+						// First cell of this color on the row: (i + j + l) % 2 == color
+						for (int i = 1 + ((1 + j + l + color) & 1); i < N - 1; i += 2)
+							row[i] = (src[i] + a * NeighbourSum<D>(row + i, N)) * cRecip;
+					});
+					pool.Barrier();
+					// The solid red cells are set before the black ones read them
+					if (D == 2 && obstacles && color == 0)
+					{
+						if (thread == 0)
+							obstacles->Apply(b, x, 1, N - 1);
+						pool.Barrier();
+					}
+				}
+
+				if (thread == 0)
+					SetWalls<NC, D>(n, b, x, obstacles);
+				pool.Barrier();
+			}
+		});
+	}
+
+	// RedBlackGaussSeidel over spans only, the spans are shared out between the threads
+	template<int NC, typename T, typename S>
+	void RedBlackGaussSeidelSpans(ThreadPool& pool, int n, int b, T* x, const S* x0, float a, float c, int iterations, const std::vector<TileSpan>& spans, const ObstacleMap* obstacles = nullptr) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float cRecip = 1.0f / c;
+		pool.Run([&](int thread, int threads) {
+			const auto band = ThreadPool::Band(0, static_cast<int>(spans.size()), thread, threads);
+			for (int k = 0; k < iterations; k++)
+			{
+				for (int color = 0; color < 2; color++)
+				{
+					for (int s = band.first; s < band.second; s++)
+					{
+						const TileSpan& span = spans[s];
+						for (int j = span.rowBegin; j < span.rowEnd; j++)
+						{
+							T* row = x + j * N;
+							const T* up = row - N;
+							const T* down = row + N;
+							const S* src = x0 + j * N;
+							for (int i = span.colBegin + ((span.colBegin + j + color) & 1); i < span.colEnd; i += 2)
+								row[i] = (src[i] + a * (row[i - 1] + row[i + 1] + up[i] + down[i])) * cRecip;
+						}
+					}
+					pool.Barrier();
+					if (obstacles && color == 0)
+					{
+						if (thread == 0)
+							obstacles->Apply(b, x, 1, N - 1);
+						pool.Barrier();
+					}
+				}
+
+				if (thread == 0)
+					SetWalls<NC>(n, b, x, obstacles);
+				pool.Barrier();
+			}
+		});
+	}
+
+	/**
+	*	Relaxes the interior cells [colBegin, colEnd) of rows [rowBegin, rowEnd) of in into out: out = in + w * (jacobi(in) - in).
+	*	In 3D the rows are slabs, every interior row of them relaxed (the SIMD row kernels are 2D only).
+	*/
+	template<typename T, typename S>
+	struct JacobiRowsOfType {
+		using Fn = void (*)(int n, T* out, const T* in, const S* x0, float a, float cRecip, float w, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept;
+	};
+	// A JacobiRows kernel for iterates of type T and an x0 of type S (a nested type, so passing nullptr for one deduces nothing)
+	template<typename T = float, typename S = float>
+	using JacobiRowsOf = typename JacobiRowsOfType<T, S>::Fn;
+	using JacobiRowsFn = JacobiRowsOf<>;
+
+	template<int NC, int D = 2, typename T, typename S>
+	void JacobiRows(int n, T* out, const T* in, const S* x0, float a, float cRecip, float w, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = Size<NC>(n);
+		ForInteriorRows<D>(N, rowBegin, rowEnd, [&](int j, int, int) {
+			const T* row = in + j * N;
+			const S* src = x0 + j * N;
+			T* dst = out + j * N;
+			for (int i = colBegin; i < colEnd; i++)
+			{
+				const float center = row[i];
+				const float relaxed = (src[i] + a * NeighbourSum<D>(row + i, N)) * cRecip;
+				dst[i] = center + w * (relaxed - center);
+			}
+		});
+	}
+
+	/**
+	*	(Weighted) Jacobi relaxation: every cell only reads the previous iterate, so whole rows are relaxed at once
+	*	(rows, the SIMD row kernel or nullptr for JacobiRows, always JacobiRows in 3D) and split across the thread pool by slab.
+	*	Iterates ping-pong between x and scratch (n^D cells of x's type), the result always ends up in x.
+	*/
+	template<int NC, int D = 2, typename T, typename S>
+	void Jacobi(ThreadPool& pool, int n, int b, T* x, const S* x0, float a, float c, float w, int iterations, T* scratch, JacobiRowsOf<T, S> rows, const ObstacleMap* obstacles = nullptr) noexcept
+	{
+		const int N = Size<NC>(n);
+		const int slab = SlabCells<D>(N);
+		const float cRecip = 1.0f / c;
+		pool.Run([&](int thread, int threads) {
+			const auto band = ThreadPool::Band(1, N - 1, thread, threads);
+			T* in = x;
+			T* out = scratch;
+			for (int k = 0; k < iterations; k++)
+			{
+				if (band.first < band.second)
+				{
+					if (D == 2 && rows)
+						rows(N, out, in, x0, a, cRecip, w, band.first, band.second, 1, N - 1);
+					else
+						JacobiRows<NC, D>(N, out, in, x0, a, cRecip, w, band.first, band.second, 1, N - 1);
+				}
+				pool.Barrier();
+
+				if (thread == 0)
+					SetWalls<NC, D>(N, b, out, obstacles);
+				pool.Barrier();
+				std::swap(in, out);
+			}
+
+			// Odd iteration counts leave the result in scratch
+			if (in != x)
+			{
+				std::copy(in + band.first * slab, in + band.second * slab, x + band.first * slab);
+				if (thread == 0)
+				{
+					std::copy(in, in + slab, x);
+					std::copy(in + (N - 1) * slab, in + N * slab, x + (N - 1) * slab);
+				}
+			}
+		});
+	}
+
+	/**
+	*	Jacobi over spans only. scratch first takes x's spans and the ring of cells around them,
+	*	so both ping-pong buffers agree on every cell the spans read but never write. With obstacles the margin is two
+	*	cells: SetWalls sets a solid ring cell from its fluid neighbours, one further out.
+	*/
+	template<int NC, typename T, typename S>
+	void JacobiSpans(ThreadPool& pool, int n, int b, T* x, const S* x0, float a, float c, float w, int iterations, T* scratch, JacobiRowsOf<T, S> rows, const std::vector<TileSpan>& spans, const ObstacleMap* obstacles = nullptr) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float cRecip = 1.0f / c;
+		pool.Run([&](int thread, int threads) {
+			const auto band = ThreadPool::Band(0, static_cast<int>(spans.size()), thread, threads);
+			// The rings of vertically adjacent spans overlap, one thread copies them all
+			if (thread == 0)
+			{
+				const int margin = obstacles ? 2 : 1;
+				for (const TileSpan& span : spans)
+				{
+					const int colBegin = std::max(span.colBegin - margin, 0);
+					const int colEnd = std::min(span.colEnd + margin, N);
+					for (int j = std::max(span.rowBegin - margin, 0); j < std::min(span.rowEnd + margin, N); j++)
+						std::copy(x + j * N + colBegin, x + j * N + colEnd, scratch + j * N + colBegin);
+				}
+			}
+			pool.Barrier();
+
+			T* in = x;
+			T* out = scratch;
+			for (int k = 0; k < iterations; k++)
+			{
+				for (int s = band.first; s < band.second; s++)
+				{
+					const TileSpan& span = spans[s];
+					if (rows)
+						rows(N, out, in, x0, a, cRecip, w, span.rowBegin, span.rowEnd, span.colBegin, span.colEnd);
+					else
+						JacobiRows<NC>(N, out, in, x0, a, cRecip, w, span.rowBegin, span.rowEnd, span.colBegin, span.colEnd);
+				}
+				pool.Barrier();
+
+				if (thread == 0)
+					SetWalls<NC>(N, b, out, obstacles);
+				pool.Barrier();
+				std::swap(in, out);
+			}
+
+			// Odd iteration counts leave the result in scratch
+			if (in != x)
+			{
+				for (int s = band.first; s < band.second; s++)
+				{
+					const TileSpan& span = spans[s];
+					for (int j = span.rowBegin; j < span.rowEnd; j++)
+						std::copy(in + j * N + span.colBegin, in + j * N + span.colEnd, x + j * N + span.colBegin);
+				}
+				pool.Barrier();
+				if (thread == 0)
+					SetWalls<NC>(N, b, x, obstacles);
+			}
+		});
+	}
+
+	/**
+	*	Largest |x0 - (c * x - a * neighbours)| over the interior fluid cells, how far x is from solving LinearSolve's system
+	*	(solid cells are set from their neighbours instead, see ObstacleMap).
+	*/
+	template<int NC, int D = 2, typename T, typename S>
+	float Residual(int n, const T* x, const S* x0, float a, float c, const ObstacleMap* obstacles = nullptr) noexcept
+	{
+		const int N = Size<NC>(n);
+		float maxResidual = 0.0f;
+		ForInteriorRows<D>(N, 1, N - 1, [&](int j, int, int) {
+			const T* row = x + j * N;
+			const S* src = x0 + j * N;
+			for (int i = 1; i < N - 1; i++)
+				if (IsFluid(obstacles, i, j))
+					maxResidual = std::max(maxResidual, std::fabs(src[i] - (c * row[i] - a * NeighbourSum<D>(row + i, N))));
+		});
+		return maxResidual;
+	}
+
+	// Residual over spans only
+	template<int NC, typename T, typename S>
+	float Residual(int n, const T* x, const S* x0, float a, float c, const std::vector<TileSpan>& spans, const ObstacleMap* obstacles = nullptr) noexcept
+	{
+		const int N = Size<NC>(n);
+		float maxResidual = 0.0f;
+		for (const TileSpan& span : spans)
+		{
+			for (int j = span.rowBegin; j < span.rowEnd; j++)
+			{
+				const T* row = x + j * N;
+				const S* src = x0 + j * N;
+				for (int i = span.colBegin; i < span.colEnd; i++)
+					if (IsFluid(obstacles, i, j))
+						maxResidual = std::max(maxResidual, std::fabs(src[i] - (c * row[i] - a * (row[i - 1] + row[i + 1] + row[i - N] + row[i + N]))));
+			}
+		}
+		return maxResidual;
+	}
+
+	// Largest |x| over the interior fluid cells
+	template<int NC, int D = 2, typename T>
+	float MaxAbs(int n, const T* x, const ObstacleMap* obstacles = nullptr) noexcept
+	{
+		const int N = Size<NC>(n);
+		float maxAbs = 0.0f;
+		ForInteriorRows<D>(N, 1, N - 1, [&](int j, int, int) {
+			const T* row = x + j * N;
+			for (int i = 1; i < N - 1; i++)
+				if (IsFluid(obstacles, i, j))
+					maxAbs = std::max(maxAbs, std::fabs(row[i]));
+		});
+		return maxAbs;
+	}
+
+	// MaxAbs over spans only
+	template<int NC, typename T>
+	float MaxAbs(int n, const T* x, const std::vector<TileSpan>& spans, const ObstacleMap* obstacles = nullptr) noexcept
+	{
+		const int N = Size<NC>(n);
+		float maxAbs = 0.0f;
+		for (const TileSpan& span : spans)
+		{
+			for (int j = span.rowBegin; j < span.rowEnd; j++)
+			{
+				const T* row = x + j * N;
+				for (int i = span.colBegin; i < span.colEnd; i++)
+					if (IsFluid(obstacles, i, j))
+						maxAbs = std::max(maxAbs, std::fabs(row[i]));
+			}
+		}
+		return maxAbs;
+	}
+
+	// Where a cell's back-trace lands: the four cells around it (offsets into the field) and their bilinear weights
+	struct AdvectTaps {
+		int i0, i1, j0, j1;
+		float s0, s1, t0, t1;
+
+		template<typename T>
+		inline float Sample(const T* d0) const noexcept
+		{
+			return
+				s0 * (t0 * d0[i0 + j0] + t1 * d0[i0 + j1]) +
+				s1 * (t0 * d0[i1 + j0] + t1 * d0[i1 + j1]);
+		}
+
+		// value clamped between the smallest and largest of the four taps of d0
+		template<typename T>
+		inline float Clamp(float value, const T* d0) const noexcept
+		{
+			const float a = d0[i0 + j0], b = d0[i0 + j1], c = d0[i1 + j0], d = d0[i1 + j1];
+			const float low = std::min(std::min(a, b), std::min(c, d));
+			const float high = std::max(std::max(a, b), std::max(c, d));
+			return std::min(std::max(value, low), high);
+		}
+	};
+
+	/**
+	*	Semi-Lagrangian back-trace of interior cell (i, j): along the cell velocity (vx, vy) scaled by (dtx, dty).
+	*	The landing point may be outside the interior, so only these taps are clamped onto the grid.
+	*/
+	template<int NC>
+	inline AdvectTaps AdvectBackTrace(int n, int i, int j, float vx, float vy, float dtx, float dty) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float Nfloat = static_cast<float>(N);
+		const float x = std::min(std::max(static_cast<float>(i) - dtx * vx, 0.5f), Nfloat + 0.5f);
+		const float y = std::min(std::max(static_cast<float>(j) - dty * vy, 0.5f), Nfloat + 0.5f);
+		const float i0 = std::floor(x);
+		const float j0 = std::floor(y);
+
+		AdvectTaps taps;
+		taps.s1 = x - i0;
+		taps.s0 = 1.0f - taps.s1;
+		taps.t1 = y - j0;
+		taps.t0 = 1.0f - taps.t1;
+
+		// x, y >= 0.5 so only the upper side needs clamping
+		taps.i0 = std::min(static_cast<int>(i0), N - 1);
+		taps.i1 = std::min(static_cast<int>(i0) + 1, N - 1);
+		taps.j0 = std::min(static_cast<int>(j0), N - 1) * N;
+		taps.j1 = std::min(static_cast<int>(j0) + 1, N - 1) * N;
+		return taps;
+	}
+
+	// Semi-Lagrangian value of interior cell (i, j), d0 blended at its back-trace
+	template<int NC, typename S>
+	inline float AdvectCell(int n, int i, int j, const S* d0, float vx, float vy, float dtx, float dty) noexcept
+	{
+		return AdvectBackTrace<NC>(n, i, j, vx, vy, dtx, dty).Sample(d0);
+	}
+
+	/**
+	*	Advects the interior cells [colBegin, colEnd) of rows [rowBegin, rowEnd) of d from d0 (see Fluid::Advect), boundaries are left to the caller.
+	*	V is the type of the velocity fields.
+	*/
+	template<int NC, typename T, typename S, typename V>
+	void Advect(int n, T* d, const S* d0, const V* velocX, const V* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float dtx = dt * (N - 2);
+		const float dty = dt * (N - 2);
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const int row = j * N;
+			const V* vx = velocX + row;
+			const V* vy = velocY + row;
+			T* dRow = d + row;
+			for (int i = colBegin; i < colEnd; i++)
+				dRow[i] = AdvectCell<NC>(N, i, j, d0, vx[i], vy[i], dtx, dty);
+		}
+	}
+
+	// Advect of two fields along the same velocity (both velocity components): one back-trace per cell for both, into float fields
+	template<int NC, typename S, typename V>
+	void AdvectPair(int n, float* dx, float* dy, const S* d0x, const S* d0y, const V* velocX, const V* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float dtx = dt * (N - 2);
+		const float dty = dt * (N - 2);
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const int row = j * N;
+			const V* vx = velocX + row;
+			const V* vy = velocY + row;
+			float* dxRow = dx + row;
+			float* dyRow = dy + row;
+			for (int i = colBegin; i < colEnd; i++)
+			{
+				const AdvectTaps taps = AdvectBackTrace<NC>(N, i, j, vx[i], vy[i], dtx, dty);
+				dxRow[i] = taps.Sample(d0x);
+				dyRow[i] = taps.Sample(d0y);
+			}
+		}
+	}
+
+	/**
+	*	MacCormack correction of the interior cells [colBegin, colEnd) of rows [rowBegin, rowEnd) (see Fluid::Advection):
+	*	advected is d0 advected semi-Lagrangian (walls set), traced back the other way (AdvectBackTrace along -dt) it estimates
+	*	the round trip error, half of which is taken off: d = advected + (d0 - round trip) / 2. The result is clamped to the
+	*	four taps of d0 the cell's back-trace blends (the limiter), so it creates no new extrema. Boundaries are left to the caller.
+	*/
+	template<int NC, typename T, typename S, typename V>
+	void MacCormack(int n, T* d, const S* d0, const float* advected, const V* velocX, const V* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float dtx = dt * (N - 2);
+		const float dty = dt * (N - 2);
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const int row = j * N;
+			const V* vx = velocX + row;
+			const V* vy = velocY + row;
+			T* dRow = d + row;
+			for (int i = colBegin; i < colEnd; i++)
+			{
+				const AdvectTaps back = AdvectBackTrace<NC>(N, i, j, vx[i], vy[i], dtx, dty);
+				const AdvectTaps ahead = AdvectBackTrace<NC>(N, i, j, vx[i], vy[i], -dtx, -dty);
+				dRow[i] = back.Clamp(advected[row + i] + 0.5f * (d0[row + i] - ahead.Sample(advected)), d0);
+			}
+		}
+	}
+
+	// MacCormack of two fields along the same velocity (both velocity components), the traces shared like AdvectPair
+	template<int NC, typename S, typename V>
+	void MacCormackPair(int n, float* dx, float* dy, const S* d0x, const S* d0y, const float* advectedX, const float* advectedY,
+		const V* velocX, const V* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float dtx = dt * (N - 2);
+		const float dty = dt * (N - 2);
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const int row = j * N;
+			const V* vx = velocX + row;
+			const V* vy = velocY + row;
+			float* dxRow = dx + row;
+			float* dyRow = dy + row;
+			for (int i = colBegin; i < colEnd; i++)
+			{
+				const AdvectTaps back = AdvectBackTrace<NC>(N, i, j, vx[i], vy[i], dtx, dty);
+				const AdvectTaps ahead = AdvectBackTrace<NC>(N, i, j, vx[i], vy[i], -dtx, -dty);
+				dxRow[i] = back.Clamp(advectedX[row + i] + 0.5f * (d0x[row + i] - ahead.Sample(advectedX)), d0x);
+				dyRow[i] = back.Clamp(advectedY[row + i] + 0.5f * (d0y[row + i] - ahead.Sample(advectedY)), d0y);
+			}
+		}
+	}
+
+	// Bilinear taps around a point of an n*n grid in cell units (cell (i, j) centered on (i, j)), clamped onto the interior
+	inline AdvectTaps TracerTaps(int n, float& x, float& y) noexcept
+	{
+		const float last = static_cast<float>(n - 2);
+		x = std::min(std::max(x, 1.0f), last);
+		y = std::min(std::max(y, 1.0f), last);
+		const float i0 = std::floor(x);
+		const float j0 = std::floor(y);
+
+		AdvectTaps taps;
+		taps.s1 = x - i0;
+		taps.s0 = 1.0f - taps.s1;
+		taps.t1 = y - j0;
+		taps.t0 = 1.0f - taps.t1;
+		// On the interior, so the far taps are at most the wall
+		taps.i0 = static_cast<int>(i0);
+		taps.i1 = taps.i0 + 1;
+		taps.j0 = static_cast<int>(j0) * n;
+		taps.j1 = taps.j0 + n;
+		return taps;
+	}
+
+	/**
+	*	Moves tracers [begin, end) (positions in cell units) through the velocity field by dt, with the same scaling as Advect
+	*	(dt * (n - 2) cells per unit of velocity). Midpoint RK2: the velocity bilinearly sampled where the tracer is, then
+	*	half way along it. Positions stay on the interior.
+	*/
+	inline void AdvectTracers(int n, float* x, float* y, const float* velocX, const float* velocY, float dt, int begin, int end) noexcept
+	{
+		const float h = dt * (n - 2);
+		const float last = static_cast<float>(n - 2);
+		for (int k = begin; k < end; k++)
+		{
+			float px = x[k], py = y[k];
+			const AdvectTaps here = TracerTaps(n, px, py);
+			float mx = px + 0.5f * h * here.Sample(velocX);
+			float my = py + 0.5f * h * here.Sample(velocY);
+			const AdvectTaps mid = TracerTaps(n, mx, my);
+			x[k] = std::min(std::max(px + h * mid.Sample(velocX), 1.0f), last);
+			y[k] = std::min(std::max(py + h * mid.Sample(velocY), 1.0f), last);
+		}
+	}
+
+	// Trilinear AdvectTaps: the eight cells around a 3D back-trace, j and k offsets already multiplied by their stride
+	struct AdvectTaps3 {
+		int i0, i1, j0, j1, k0, k1;
+		float s0, s1, t0, t1, u0, u1;
+
+		inline float Sample(const float* d0) const noexcept
+		{
+			return
+				u0 * (s0 * (t0 * d0[i0 + j0 + k0] + t1 * d0[i0 + j1 + k0]) + s1 * (t0 * d0[i1 + j0 + k0] + t1 * d0[i1 + j1 + k0])) +
+				u1 * (s0 * (t0 * d0[i0 + j0 + k1] + t1 * d0[i0 + j1 + k1]) + s1 * (t0 * d0[i1 + j0 + k1] + t1 * d0[i1 + j1 + k1]));
+		}
+
+		inline float Clamp(float value, const float* d0) const noexcept
+		{
+			const float* corners[2] = { d0 + k0, d0 + k1 };
+			float low = corners[0][i0 + j0], high = low;
+			for (const float* plane : corners)
+			{
+				for (const float tap : { plane[i0 + j0], plane[i0 + j1], plane[i1 + j0], plane[i1 + j1] })
+				{
+					low = std::min(low, tap);
+					high = std::max(high, tap);
+				}
+			}
+			return std::min(std::max(value, low), high);
+		}
+	};
+
+	// 3D AdvectBackTrace of interior cell (i, j, k) along (vx, vy, vz) scaled by dt0
+	template<int NC>
+	inline AdvectTaps3 AdvectBackTrace(int n, int i, int j, int k, float vx, float vy, float vz, float dt0) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float Nfloat = static_cast<float>(N);
+		const float x = std::min(std::max(static_cast<float>(i) - dt0 * vx, 0.5f), Nfloat + 0.5f);
+		const float y = std::min(std::max(static_cast<float>(j) - dt0 * vy, 0.5f), Nfloat + 0.5f);
+		const float z = std::min(std::max(static_cast<float>(k) - dt0 * vz, 0.5f), Nfloat + 0.5f);
+		const float i0 = std::floor(x);
+		const float j0 = std::floor(y);
+		const float k0 = std::floor(z);
+
+		AdvectTaps3 taps;
+		taps.s1 = x - i0;
+		taps.s0 = 1.0f - taps.s1;
+		taps.t1 = y - j0;
+		taps.t0 = 1.0f - taps.t1;
+		taps.u1 = z - k0;
+		taps.u0 = 1.0f - taps.u1;
+
+		taps.i0 = std::min(static_cast<int>(i0), N - 1);
+		taps.i1 = std::min(static_cast<int>(i0) + 1, N - 1);
+		taps.j0 = std::min(static_cast<int>(j0), N - 1) * N;
+		taps.j1 = std::min(static_cast<int>(j0) + 1, N - 1) * N;
+		taps.k0 = std::min(static_cast<int>(k0), N - 1) * N * N;
+		taps.k1 = std::min(static_cast<int>(k0) + 1, N - 1) * N * N;
+		return taps;
+	}
+
+	/**
+	*	3D Advect of the interior cells [colBegin, colEnd) of slabs [slabBegin, slabEnd), along velocity (x first).
+	*	Fluid runs its own 2D row kernels above (or their SIMD twins), so the arithmetic is kept in step by hand.
+	*/
+	template<int NC>
+	void Advect(int n, float* d, const float* d0, const std::array<const float*, 3>& velocity, float dt, int slabBegin, int slabEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float dt0 = dt * (N - 2);
+		const float* vx = velocity[0];
+		const float* vy = velocity[1];
+		const float* vz = velocity[2];
+		ForInteriorRows<3>(N, slabBegin, slabEnd, [&](int row, int j, int k) {
+			const int first = row * N;
+			float* dRow = d + first;
+			for (int i = colBegin; i < colEnd; i++)
+				dRow[i] = AdvectBackTrace<NC>(N, i, j, k, vx[first + i], vy[first + i], vz[first + i], dt0).Sample(d0);
+		});
+	}
+
+	// 3D MacCormack of the interior cells [colBegin, colEnd) of slabs [slabBegin, slabEnd), see the 2D row kernel above
+	template<int NC>
+	void MacCormack(int n, float* d, const float* d0, const float* advected, const std::array<const float*, 3>& velocity, float dt, int slabBegin, int slabEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float dt0 = dt * (N - 2);
+		const float* vx = velocity[0];
+		const float* vy = velocity[1];
+		const float* vz = velocity[2];
+		ForInteriorRows<3>(N, slabBegin, slabEnd, [&](int row, int j, int k) {
+			const int first = row * N;
+			float* dRow = d + first;
+			for (int i = colBegin; i < colEnd; i++)
+			{
+				const int cell = first + i;
+				const AdvectTaps3 back = AdvectBackTrace<NC>(N, i, j, k, vx[cell], vy[cell], vz[cell], dt0);
+				const AdvectTaps3 ahead = AdvectBackTrace<NC>(N, i, j, k, vx[cell], vy[cell], vz[cell], -dt0);
+				dRow[i] = back.Clamp(advected[cell] + 0.5f * (d0[cell] - ahead.Sample(advected)), d0);
+			}
+		});
+	}
+
+	/**
+	*	First half of Fluid::Project over the interior cells [colBegin, colEnd) of slabs [slabBegin, slabEnd):
+	*	the divergence of the velocity into div, and p cleared to the initial guess unless warm started. T is the velocity storage type.
+	*/
+	template<int NC, int D, typename T>
+	void Divergence(int n, const std::array<const T*, D>& velocity, float* div, float* p, bool warmStart, int slabBegin, int slabEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float divScale = -0.5f / N;
+		ForInteriorRows<D>(N, slabBegin, slabEnd, [&](int row, int, int) {
+			const T* vx = velocity[0] + row * N;
+			const T* vy = velocity[1] + row * N;
+			float* divRow = div + row * N;
+			float* pRow = p + row * N;
+			for (int i = colBegin; i < colEnd; i++)
+			{
+				if constexpr (D == 2)
+					divRow[i] = divScale * (vx[i + 1] - vx[i - 1] + vy[i + N] - vy[i - N]);
+				else
+				{
+					const T* vz = velocity[2] + row * N;
+					divRow[i] = divScale * (vx[i + 1] - vx[i - 1] + vy[i + N] - vy[i - N] + vz[i + N * N] - vz[i - N * N]);
+				}
+				if (!warmStart)
+					pRow[i] = 0;
+			}
+		});
+	}
+
+	// Second half of Fluid::Project: the pressure gradient taken off the velocity, same cells as Divergence
+	template<int NC, int D, typename T>
+	void SubtractGradient(int n, const std::array<T*, D>& velocity, const float* p, int slabBegin, int slabEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = Size<NC>(n);
+		const float gradScale = 0.5f * N;
+		ForInteriorRows<D>(N, slabBegin, slabEnd, [&](int row, int, int) {
+			const float* pRow = p + row * N;
+			T* vx = velocity[0] + row * N;
+			T* vy = velocity[1] + row * N;
+			for (int i = colBegin; i < colEnd; i++)
+			{
+				vx[i] = vx[i] - gradScale * (pRow[i + 1] - pRow[i - 1]);
+				vy[i] = vy[i] - gradScale * (pRow[i + N] - pRow[i - N]);
+				if constexpr (D == 3)
+				{
+					T* vz = velocity[2] + row * N;
+					vz[i] = vz[i] - gradScale * (pRow[i + N * N] - pRow[i - N * N]);
+				}
+			}
+		});
+	}
+
+	/**
+	*	Columns [colBegin, colEnd) of row j covered by a brush of radius cells centered on (x, y), clipped to the grid,
+	*	false when the row is outside it. A radius under a cell covers the single cell (x, y), clamped onto the grid like Fluid::IX.
+	*/
+	inline bool BrushSpan(int n, float x, float y, float radius, int j, int& colBegin, int& colEnd) noexcept
+	{
+		if (radius < 1.0f)
+		{
+			if (j != std::min(std::max(static_cast<int>(y), 0), n - 1))
+				return false;
+			colBegin = std::min(std::max(static_cast<int>(x), 0), n - 1);
+			colEnd = colBegin + 1;
+			return true;
+		}
+		const float dy = j - y;
+		const float halfWidth2 = radius * radius - dy * dy;
+		if (halfWidth2 < 0.0f)
+			return false;
+		const float halfWidth = std::sqrt(halfWidth2);
+		colBegin = std::max(static_cast<int>(std::ceil(x - halfWidth)), 0);
+		colEnd = std::min(static_cast<int>(std::floor(x + halfWidth)) + 1, n);
+		return colBegin < colEnd;
+	}
+
+	// Cells [begin, end) a brush centered on center may cover along one axis (rows or columns, see BrushSpan)
+	inline void BrushExtent(int n, float center, float radius, int& begin, int& end) noexcept
+	{
+		if (radius < 1.0f)
+		{
+			begin = std::min(std::max(static_cast<int>(center), 0), n - 1);
+			end = begin + 1;
+			return;
+		}
+		begin = std::max(static_cast<int>(std::ceil(center - radius)), 0);
+		end = std::min(static_cast<int>(std::floor(center + radius)) + 1, n);
+	}
+
+	/**
+	*	Adds a brush's amounts to the cells [colBegin, colEnd) of row j (fields point at the row), weighted by its falloff:
+	*	1 at the center down to 0 at radius, quadratic in the distance (1 for the single cell under a radius of 1).
+	*	Stride is the distance between two cells of a field (FluidEnsemble's interleaved fields), T its storage type.
+	*/
+	template<typename T>
+	inline void SplatBrushRow(int j, int colBegin, int colEnd, int stride, float x, float y, float radius,
+		float density, float velocityX, float velocityY, T* densityRow, float* velocityXRow, float* velocityYRow) noexcept
+	{
+		const float invRadius2 = radius < 1.0f ? 0.0f : 1.0f / (radius * radius);
+		const float dy2 = (j - y) * (j - y);
+		for (int i = colBegin; i < colEnd; i++)
+		{
+			const float dx = i - x;
+			const float weight = std::max(1.0f - (dx * dx + dy2) * invRadius2, 0.0f);
+			const std::size_t cell = static_cast<std::size_t>(i) * stride;
+			densityRow[cell] = densityRow[cell] + density * weight;
+			velocityXRow[cell] += velocityX * weight;
+			velocityYRow[cell] += velocityY * weight;
+		}
+	}
+}
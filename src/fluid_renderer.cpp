@@ -0,0 +1,228 @@
+#include "fluid_renderer.hpp"
+#include <algorithm>
+#include <thread>
+
+using namespace xtd;
+using namespace xtd::drawing;
+using namespace xtd_fluid_simulation;
+
+fluid_renderer::fluid_renderer() :
+  upscaler_(static_cast<int>(std::max(1u, std::thread::hardware_concurrency() / 2))) {
+}
+
+void fluid_renderer::filter(UpscaleFilter value) noexcept {
+  if (value == filter_) return;
+  filter_ = value;
+  // The per cell pixels are not kept up to date while filtering
+  repaint_ = true;
+  resample_ = true;
+}
+
+void fluid_renderer::fluid_color(const color& value) {
+  if (value == fluid_color_) return;
+  fluid_color_ = value;
+  build_palette();
+}
+
+void fluid_renderer::back_color(const color& value) {
+  if (value == back_color_) return;
+  back_color_ = value;
+  build_palette();
+}
+
+void fluid_renderer::obstacles(const ObstacleMap& obstacles) {
+  if (obstacles.GetVersion() == obstacle_version_ && obstacles.GetSize() == obstacle_size_) return;
+  obstacle_version_ = obstacles.GetVersion();
+  obstacle_size_ = obstacles.GetSize();
+  obstacle_bits_ = obstacles.IsEmpty() ? std::vector<std::uint64_t>() : obstacles.GetBits();
+  build_obstacle_pixels();
+}
+
+void fluid_renderer::build_obstacle_pixels() {
+  obstacle_pixels_.clear();
+  if (obstacle_bits_.empty()) return;
+  // Drawn over the fluid with their alpha, so fluid cells are fully transparent
+  const std::uint32_t solid = 0xff000000u | static_cast<std::uint32_t>(obstacle_color_.r()) << 16 | static_cast<std::uint32_t>(obstacle_color_.g()) << 8 | static_cast<std::uint32_t>(obstacle_color_.b());
+  const int words_per_row = (obstacle_size_ + 63) / 64;
+  obstacle_pixels_.assign(static_cast<size_t>(obstacle_size_) * obstacle_size_, 0);
+  for (int row = 0; row < obstacle_size_; ++row) {
+    const std::uint64_t* words = obstacle_bits_.data() + static_cast<size_t>(row) * words_per_row;
+    std::uint32_t* pixels = obstacle_pixels_.data() + static_cast<size_t>(row) * obstacle_size_;
+    for (int column = 0; column < obstacle_size_; ++column)
+      if ((words[column >> 6] >> (column & 63)) & 1u)
+        pixels[column] = solid;
+  }
+}
+
+void fluid_renderer::resize(int size) {
+  if (size == size_) return;
+  size_ = size;
+  pixels_.assign(static_cast<size_t>(size) * size, 0);
+  drawn_pixels_ = nullptr;
+  density_.assign(static_cast<size_t>(size) * size, 0.0f);
+  build_palette();
+}
+
+void fluid_renderer::update(const float* density, int size) {
+  resize(size);
+  replay_frame_ = -1;
+  if (filter_ != UpscaleFilter::Nearest) {
+    std::copy_n(density, density_.size(), density_.data());
+    resample_ = true;
+    return;
+  }
+  update_rows(density, 0, size, 0, size);
+  drawn_tiles_.clear();
+  repaint_ = false;
+}
+
+void fluid_renderer::update(const float* density, int size, const std::vector<std::uint8_t>& active_tiles, int tile_size) {
+  if (filter_ != UpscaleFilter::Nearest) {
+    update(density, size);
+    return;
+  }
+  const int tiles = (size + tile_size - 1) / tile_size;
+  if (size != size_ || repaint_ || active_tiles.size() != static_cast<size_t>(tiles) * tiles || drawn_tiles_.size() != active_tiles.size()) {
+    update(density, size);
+    drawn_tiles_ = active_tiles;
+    return;
+  }
+
+  // A tile that just went inactive is converted once more, to the background its zero density maps to
+  for (int tile_y = 0; tile_y < tiles; ++tile_y) {
+    for (int tile_x = 0; tile_x < tiles; ++tile_x) {
+      const size_t tile = static_cast<size_t>(tile_y) * tiles + tile_x;
+      if (active_tiles[tile] || drawn_tiles_[tile])
+        update_rows(density, tile_y * tile_size, std::min((tile_y + 1) * tile_size, size), tile_x * tile_size, std::min((tile_x + 1) * tile_size, size));
+    }
+  }
+  drawn_tiles_ = active_tiles;
+  replay_frame_ = -1;
+}
+
+void fluid_renderer::update(const RecordingReader& recording, int frame) {
+  resize(recording.get_size());
+  if (frame == replay_frame_ && !repaint_) return;
+
+  // A delta frame only holds what changed since the frame before it
+  const int first = !repaint_ && frame == replay_frame_ + 1 && replay_frame_ >= 0 ? frame : recording.GetKeyFrame(frame);
+  for (int index = first; index <= frame; ++index) {
+    // Both the pixels and the density the filtered views sample, so the filter can change between frames
+    recording.ForEachRun(index, [this](size_t cell, const std::uint8_t* alpha, size_t count) {
+      std::uint32_t* pixels = pixels_.data() + cell;
+      float* density = density_.data() + cell;
+      for (size_t offset = 0; offset < count; ++offset) {
+        pixels[offset] = palette_[alpha[offset]];
+        density[offset] = alpha[offset];
+      }
+    });
+  }
+  drawn_tiles_.clear();
+  repaint_ = false;
+  resample_ = true;
+  replay_frame_ = frame;
+}
+
+void fluid_renderer::update_rows(const float* density, int first_row, int last_row, int first_column, int last_column) noexcept {
+  // Same mapping get_color_at used to do per cell: density is the fluid color alpha, clamped so too much dye does not wrap to black
+  for (int row = first_row; row < last_row; ++row) {
+    const float* densities = density + static_cast<size_t>(row) * size_;
+    std::uint32_t* pixels = pixels_.data() + static_cast<size_t>(row) * size_;
+    for (int column = first_column; column < last_column; ++column) {
+      const int alpha = static_cast<int>(std::min(std::max(densities[column], 0.0f), 255.0f));
+      pixels[column] = palette_[alpha];
+    }
+  }
+}
+
+void fluid_renderer::draw(graphics& graphics, const rectangle& bounds, TracerSystem* tracers) {
+  if (pixels_.empty()) return;
+  graphics.interpolation_mode(drawing2d::interpolation_mode::nearest_neighbor);
+  const bool splat = tracers && tracers->get_count() > 0;
+  if (filter_ == UpscaleFilter::Nearest && !splat) {
+    const bitmap frame(size_, size_, size_ * static_cast<int>(sizeof(std::uint32_t)), imaging::pixel_format::format_32bpp_argb, reinterpret_cast<intptr_t>(pixels_.data()));
+    graphics.draw_image(frame, bounds);
+    draw_obstacles(graphics, bounds);
+    drawn_pixels_ = pixels_.data();
+    drawn_width_ = drawn_height_ = size_;
+    return;
+  }
+
+  // One pixel per view pixel, drawn as is
+  const int width = std::max(bounds.width(), 1);
+  const int height = std::max(bounds.height(), 1);
+  const size_t area = static_cast<size_t>(width) * height;
+  if (filter_ == UpscaleFilter::Nearest) {
+    // Tracers land between cell centers, so the cells are scaled up here rather than by the draw call
+    frame_pixels_.resize(area);
+    scale_pixels(width, height);
+  }
+  else if (resample_ || width != view_width_ || height != view_height_) {
+    view_width_ = width;
+    view_height_ = height;
+    view_pixels_.resize(area);
+    upscaler_.Resample(density_.data(), size_, palette_.data(), view_pixels_.data(), width, height, filter_);
+    resample_ = false;
+  }
+  const std::uint32_t* pixels = view_pixels_.data();
+  if (splat) {
+    if (filter_ != UpscaleFilter::Nearest)
+      frame_pixels_.assign(view_pixels_.begin(), view_pixels_.end());
+    tracers->Splat(frame_pixels_.data(), width, height, size_, static_cast<std::uint32_t>(tracer_color_.r()) << 16 | static_cast<std::uint32_t>(tracer_color_.g()) << 8 | static_cast<std::uint32_t>(tracer_color_.b()));
+    pixels = frame_pixels_.data();
+  }
+  const bitmap frame(width, height, width * static_cast<int>(sizeof(std::uint32_t)), imaging::pixel_format::format_32bpp_argb, reinterpret_cast<intptr_t>(pixels));
+  graphics.draw_image(frame, bounds);
+  draw_obstacles(graphics, bounds);
+  drawn_pixels_ = pixels;
+  drawn_width_ = width;
+  drawn_height_ = height;
+}
+
+bool fluid_renderer::export_frame(FrameExporter& exporter) {
+  if (!drawn_pixels_) return false;
+  if (obstacle_pixels_.empty() || obstacle_size_ != size_)
+    return exporter.Append(drawn_pixels_, drawn_width_, drawn_height_);
+
+  // The overlay is its own draw call on screen, here the solid cells replace the pixels they cover (cell under each pixel center)
+  export_pixels_.assign(drawn_pixels_, drawn_pixels_ + static_cast<size_t>(drawn_width_) * drawn_height_);
+  for (int y = 0; y < drawn_height_; ++y) {
+    const std::uint32_t* cells = obstacle_pixels_.data() + static_cast<size_t>((2 * y + 1) * size_ / (2 * drawn_height_)) * size_;
+    std::uint32_t* row = export_pixels_.data() + static_cast<size_t>(y) * drawn_width_;
+    for (int x = 0; x < drawn_width_; ++x) {
+      const std::uint32_t cell = cells[(2 * x + 1) * size_ / (2 * drawn_width_)];
+      if (cell != 0) row[x] = cell;
+    }
+  }
+  return exporter.Append(export_pixels_.data(), drawn_width_, drawn_height_);
+}
+
+void fluid_renderer::scale_pixels(int width, int height) noexcept {
+  // The cell under each pixel center, as the draw call would have picked it
+  for (int y = 0; y < height; ++y) {
+    const std::uint32_t* cells = pixels_.data() + static_cast<size_t>((2 * y + 1) * size_ / (2 * height)) * size_;
+    std::uint32_t* row = frame_pixels_.data() + static_cast<size_t>(y) * width;
+    for (int x = 0; x < width; ++x)
+      row[x] = cells[(2 * x + 1) * size_ / (2 * width)];
+  }
+}
+
+void fluid_renderer::draw_obstacles(graphics& graphics, const rectangle& bounds) {
+  // One pixel per cell whatever the filter, solid cells stay sharp
+  if (obstacle_pixels_.empty()) return;
+  const bitmap overlay(obstacle_size_, obstacle_size_, obstacle_size_ * static_cast<int>(sizeof(std::uint32_t)), imaging::pixel_format::format_32bpp_argb, reinterpret_cast<intptr_t>(obstacle_pixels_.data()));
+  graphics.draw_image(overlay, bounds);
+}
+
+void fluid_renderer::build_palette() noexcept {
+  repaint_ = true;
+  resample_ = true;
+  // Pixels are opaque: the fluid color alpha blended over the background, so the frame needs no clear
+  for (int alpha = 0; alpha < 256; ++alpha) {
+    const auto blend = [alpha](int back, int fluid) {return static_cast<std::uint32_t>((back * (255 - alpha) + fluid * alpha + 127) / 255);};
+    palette_[alpha] = 0xff000000u
+      | blend(back_color_.r(), fluid_color_.r()) << 16
+      | blend(back_color_.g(), fluid_color_.g()) << 8
+      | blend(back_color_.b(), fluid_color_.b());
+  }
+}
@@ -0,0 +1,103 @@
+/// @file
+/// @brief Contains fluid_renderer class.
+#pragma once
+#include <xtd/xtd.h>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include "frame_exporter.hpp"
+#include "obstacle_map.hpp"
+#include "recording.hpp"
+#include "tracer_system.hpp"
+#include "upscaler.hpp"
+
+/// @brief Represents the namespace that contains application objects.
+namespace xtd_fluid_simulation {
+
+  /// @brief Renders a fluid density field into a pixel buffer and draws it with a single image draw call.
+  /// @remarks Each density (0 -> 255, clamped) picks a color from a 256 entry table blending the background and fluid colors, the table is only rebuilt when one of them changes.
+  /// @remarks With UpscaleFilter::Nearest the buffer holds one pixel per cell, scaled up by the draw call. The other filters sample the density at the resolution it is drawn at (Upscaler), so the view size is independent of the grid size.
+  class fluid_renderer {
+  public:
+    /// @brief Initializes a new instance of the fluid_renderer class, its upscaler on half the hardware threads (the simulation has the others).
+    fluid_renderer();
+
+    /// @brief Gets the fluid color (full density).
+    const xtd::drawing::color& fluid_color() const noexcept {return fluid_color_;}
+    /// @brief Sets the fluid color (full density).
+    void fluid_color(const xtd::drawing::color& value);
+
+    /// @brief Gets the background color (zero density).
+    const xtd::drawing::color& back_color() const noexcept {return back_color_;}
+    /// @brief Sets the background color (zero density).
+    void back_color(const xtd::drawing::color& value);
+
+    /// @brief Gets how the density is sampled between cell centers.
+    UpscaleFilter filter() const noexcept {return filter_;}
+    /// @brief Sets how the density is sampled between cell centers.
+    void filter(UpscaleFilter value) noexcept;
+
+    /// @brief Takes a size * size density field, converted into the pixel buffer (one pixel per cell) or kept for draw to sample.
+    void update(const float* density, int size);
+    /// @brief Same, only converting the tiles that are active now or were last update (see Fluid::set_sparse_tiles), filtered views are always sampled whole.
+    /// @param active_tiles Row major, one byte per tile_size * tile_size tile, 1 when active; empty converts every tile.
+    /// @remarks The density of inactive tiles is zero, so a tile left inactive still holds the background color it was last drawn with.
+    void update(const float* density, int size, const std::vector<std::uint8_t>& active_tiles, int tile_size);
+
+    /// @brief Converts a frame of a recording into the pixel buffer, reading its alphas straight from the mapped file (no density, no copy).
+    /// @remarks Only the cells a delta frame changed are converted when it follows the frame converted last, any other frame is rebuilt from its key frame.
+    void update(const RecordingReader& recording, int frame);
+
+    /// @brief Takes the solid cells to draw over the fluid, the overlay is only rebuilt when the mask changed (ObstacleMap::GetVersion).
+    void obstacles(const ObstacleMap& obstacles);
+
+    /// @brief Draws the pixel buffer scaled into bounds, or the density sampled at the size of bounds (resampled only when the field, the colors or the size changed).
+    /// @param tracers Splatted over the density at the size of bounds when not null (see TracerSystem::Splat), still one image draw.
+    void draw(xtd::drawing::graphics& graphics, const xtd::drawing::rectangle& bounds, TracerSystem* tracers = nullptr);
+
+    /// @brief Gets the size of the pixels drawn last: a pixel per cell for UpscaleFilter::Nearest without tracers, the view size otherwise (empty before the first draw).
+    xtd::drawing::size frame_size() const noexcept {return {drawn_width_, drawn_height_};}
+    /// @brief Queues the pixels drawn last, the solid cells over them, to exporter without waiting (see FrameExporter::Append).
+    /// @return false when the frame was dropped, or nothing was drawn yet.
+    bool export_frame(FrameExporter& exporter);
+
+  private:
+    void build_palette() noexcept;
+    void resize(int size);
+    void update_rows(const float* density, int first_row, int last_row, int first_column, int last_column) noexcept;
+    void build_obstacle_pixels();
+    void draw_obstacles(xtd::drawing::graphics& graphics, const xtd::drawing::rectangle& bounds);
+    void scale_pixels(int width, int height) noexcept;
+
+    xtd::drawing::color fluid_color_ = xtd::drawing::color::cyan;
+    xtd::drawing::color back_color_ = xtd::drawing::color::black;
+    UpscaleFilter filter_ = UpscaleFilter::Nearest;
+
+    std::array<std::uint32_t, 256> palette_ {}; // 0xAARRGGBB, see build_palette
+    std::vector<std::uint32_t> pixels_; // One per cell, UpscaleFilter::Nearest
+    int size_ = 0;
+    std::vector<float> density_; // Of the last update, what the filtered views sample
+    Upscaler upscaler_;
+    std::vector<std::uint32_t> view_pixels_; // view_width_ * view_height_, reused across frames
+    int view_width_ = 0;
+    int view_height_ = 0;
+    bool resample_ = true; // The view must be sampled again (density, palette or filter changed)
+    std::vector<std::uint8_t> drawn_tiles_; // Tiles converted last update, empty after a full one
+    bool repaint_ = true; // Every pixel must be converted again (palette or size changed)
+    int replay_frame_ = -1; // Recording frame the pixels hold, -1 after a density update
+
+    xtd::drawing::color obstacle_color_ = xtd::drawing::color::light_gray; // Solid cells, opaque over any filter
+    std::vector<std::uint32_t> obstacle_pixels_; // One per cell, transparent over fluid, empty without obstacles
+    int obstacle_size_ = 0;
+    std::vector<std::uint64_t> obstacle_bits_; // Of the last mask taken, what obstacle_pixels_ is rebuilt from
+    std::uint64_t obstacle_version_ = ~std::uint64_t(0);
+
+    xtd::drawing::color tracer_color_ = xtd::drawing::color::white;
+    std::vector<std::uint32_t> frame_pixels_; // The view with the tracers splatted, a copy so view_pixels_ stays cached
+
+    const std::uint32_t* drawn_pixels_ = nullptr; // What draw drew last, drawn_width_ * drawn_height_
+    int drawn_width_ = 0;
+    int drawn_height_ = 0;
+    std::vector<std::uint32_t> export_pixels_; // The drawn pixels with the obstacles over them, only used with obstacles
+  };
+}
@@ -0,0 +1,292 @@
+#include "frame_exporter.hpp"
+#include <algorithm>	// std::max, std::min
+#include <array>
+#include <cstdio>	// std::snprintf
+#include <stdexcept>
+using namespace xtd_fluid_simulation;
+
+namespace {
+	// Stored deflate blocks hold at most 64 KiB - 1
+	constexpr std::size_t MAX_STORED_BLOCK = 0xffff;
+
+	bool EndsWith(const std::string& text, const char* suffix)
+	{
+		const std::string ending(suffix);
+		if (text.size() < ending.size())
+			return false;
+		for (std::size_t index = 0; index < ending.size(); ++index)
+		{
+			const char c = text[text.size() - ending.size() + index];
+			if ((c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c) != ending[index])
+				return false;
+		}
+		return true;
+	}
+
+	// CRC-32 of PNG chunks (ISO 3309), continued from crc
+	std::uint32_t Crc32(std::uint32_t crc, const std::uint8_t* data, std::size_t count) noexcept
+	{
+		static const std::array<std::uint32_t, 256> table = [] {
+			std::array<std::uint32_t, 256> entries{};
+			for (std::uint32_t index = 0; index < 256; ++index)
+			{
+				std::uint32_t value = index;
+				for (int bit = 0; bit < 8; ++bit)
+					value = value & 1 ? 0xedb88320u ^ (value >> 1) : value >> 1;
+				entries[index] = value;
+			}
+			return entries;
+		}();
+		crc = ~crc;
+		for (std::size_t index = 0; index < count; ++index)
+			crc = table[(crc ^ data[index]) & 0xff] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	// Adler-32 of the zlib stream
+	std::uint32_t Adler32(const std::uint8_t* data, std::size_t count) noexcept
+	{
+		std::uint32_t a = 1, b = 0;
+		while (count > 0)
+		{
+			// 5552 bytes is the most that cannot overflow b before the modulo
+			const std::size_t chunk = std::min<std::size_t>(count, 5552);
+			for (std::size_t index = 0; index < chunk; ++index)
+			{
+				a += data[index];
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+			data += chunk;
+			count -= chunk;
+		}
+		return b << 16 | a;
+	}
+
+	void PutBigEndian(std::vector<std::uint8_t>& out, std::uint32_t value)
+	{
+		out.push_back(static_cast<std::uint8_t>(value >> 24));
+		out.push_back(static_cast<std::uint8_t>(value >> 16));
+		out.push_back(static_cast<std::uint8_t>(value >> 8));
+		out.push_back(static_cast<std::uint8_t>(value));
+	}
+
+	// Appends a PNG chunk: length, type, the payload written by fill, CRC of type and payload
+	template<typename Fill>
+	void PutChunk(std::vector<std::uint8_t>& out, const char* type, Fill&& fill)
+	{
+		const std::size_t at = out.size();
+		PutBigEndian(out, 0);
+		out.insert(out.end(), type, type + 4);
+		fill(out);
+		const std::size_t length = out.size() - at - 8;
+		for (int byte = 0; byte < 4; ++byte)
+			out[at + byte] = static_cast<std::uint8_t>(length >> (24 - 8 * byte));
+		PutBigEndian(out, Crc32(0, out.data() + at + 4, length + 4));
+	}
+
+	// BT.601 limited range, the integer approximation most converters use
+	inline std::uint8_t Luma(int r, int g, int b) noexcept { return static_cast<std::uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16); }
+	inline std::uint8_t ChromaU(int r, int g, int b) noexcept { return static_cast<std::uint8_t>(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128); }
+	inline std::uint8_t ChromaV(int r, int g, int b) noexcept { return static_cast<std::uint8_t>(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128); }
+}
+
+const char* xtd_fluid_simulation::ToString(ExportFormat format) noexcept
+{
+	switch (format)
+	{
+		case ExportFormat::Y4m: return "y4m";
+		case ExportFormat::PngSequence: return "png";
+		default: return "unknown";
+	}
+}
+
+ExportFormat FrameExporter::FormatFor(const std::string& path) noexcept
+{
+	return EndsWith(path, ".y4m") ? ExportFormat::Y4m : ExportFormat::PngSequence;
+}
+
+FrameExporter::FrameExporter(const std::string& path, ExportFormat format, int width, int height, int frameRate)
+	:
+	m_format(format),
+	m_path(format == ExportFormat::PngSequence && EndsWith(path, ".png") ? path.substr(0, path.size() - 4) : path),
+	m_width(std::max(width, 1)),
+	m_height(std::max(height, 1)),
+	m_writer(static_cast<std::size_t>(m_width) * m_height)
+{
+	const std::size_t pixels = static_cast<std::size_t>(m_width) * m_height;
+	if (m_format == ExportFormat::Y4m)
+	{
+		m_file.open(m_path, std::ios::binary | std::ios::trunc);
+		char header[96];
+		const int length = std::snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C420jpeg\n", m_width, m_height, std::max(frameRate, 1));
+		if (!m_file.write(header, length))
+			throw std::runtime_error("cannot write " + m_path);
+		m_bytes.store(length, std::memory_order_relaxed);
+		const std::size_t chroma = static_cast<std::size_t>((m_width + 1) / 2) * ((m_height + 1) / 2);
+		m_encoded.reserve(6 + pixels + 2 * chroma);
+	}
+	else
+	{
+		// Fail now rather than on the first frame
+		char first[32];
+		std::snprintf(first, sizeof(first), "_%06d.png", 0);
+		if (!std::ofstream(m_path + first, std::ios::binary | std::ios::trunc))
+			throw std::runtime_error("cannot write " + m_path + first);
+		const std::size_t rows = static_cast<std::size_t>(m_height) * (1 + 3 * static_cast<std::size_t>(m_width));
+		m_rows.reserve(rows);
+		m_encoded.reserve(64 + rows + 5 * (rows / MAX_STORED_BLOCK + 1));
+	}
+
+	m_writer.Start([this](const std::uint32_t* pixels) { WriteFrame(pixels); });
+}
+
+FrameExporter::~FrameExporter()
+{
+	Close();
+}
+
+bool FrameExporter::Append(const std::uint32_t* pixels, int width, int height, bool wait) noexcept
+{
+	if (width != m_width || height != m_height)
+	{
+		m_writer.CountDropped();
+		return false;
+	}
+	const std::size_t count = static_cast<std::size_t>(width) * height;
+	return m_writer.Append([pixels, count](std::uint32_t* frame) { std::copy_n(pixels, count, frame); }, wait);
+}
+
+bool FrameExporter::Close()
+{
+	if (!m_writer.IsRunning())
+		return !m_failed.load(std::memory_order_relaxed);
+	m_writer.Stop();
+
+	if (m_file.is_open())
+	{
+		m_file.close();
+		if (!m_file)
+			m_failed.store(true, std::memory_order_relaxed);
+	}
+	return !m_failed.load(std::memory_order_relaxed);
+}
+
+void FrameExporter::WriteFrame(const std::uint32_t* pixels)
+{
+	if (m_failed.load(std::memory_order_relaxed))
+		return;
+
+	m_encoded.clear();
+	if (m_format == ExportFormat::Y4m)
+	{
+		EncodeY4m(pixels);
+		m_file.write(reinterpret_cast<const char*>(m_encoded.data()), m_encoded.size());
+		if (!m_file)
+			m_failed.store(true, std::memory_order_relaxed);
+	}
+	else
+	{
+		EncodePng(pixels);
+		char name[32];
+		std::snprintf(name, sizeof(name), "_%06d.png", m_written);
+		std::ofstream file(m_path + name, std::ios::binary | std::ios::trunc);
+		if (!file.write(reinterpret_cast<const char*>(m_encoded.data()), m_encoded.size()))
+			m_failed.store(true, std::memory_order_relaxed);
+	}
+	if (m_failed.load(std::memory_order_relaxed))
+		return;
+	++m_written;
+	m_bytes.fetch_add(static_cast<std::int64_t>(m_encoded.size()), std::memory_order_relaxed);
+}
+
+void FrameExporter::EncodeY4m(const std::uint32_t* pixels)
+{
+	const int width = m_width, height = m_height;
+	const int chromaWidth = (width + 1) / 2, chromaHeight = (height + 1) / 2;
+	const std::size_t lumaSize = static_cast<std::size_t>(width) * height;
+	const std::size_t chromaSize = static_cast<std::size_t>(chromaWidth) * chromaHeight;
+	static const char FRAME[] = "FRAME\n";
+	m_encoded.insert(m_encoded.end(), FRAME, FRAME + 6);
+	const std::size_t lumaAt = m_encoded.size();
+	m_encoded.resize(lumaAt + lumaSize + 2 * chromaSize);
+	std::uint8_t* luma = m_encoded.data() + lumaAt;
+	std::uint8_t* u = luma + lumaSize;
+	std::uint8_t* v = u + chromaSize;
+
+	for (std::size_t index = 0; index < lumaSize; ++index)
+	{
+		const std::uint32_t pixel = pixels[index];
+		luma[index] = Luma(pixel >> 16 & 0xff, pixel >> 8 & 0xff, pixel & 0xff);
+	}
+	// Chroma of the 2x2 block averaged, the last row and column repeated for odd sizes
+	for (int y = 0; y < chromaHeight; ++y)
+	{
+		const std::uint32_t* row0 = pixels + static_cast<std::size_t>(2 * y) * width;
+		const std::uint32_t* row1 = pixels + static_cast<std::size_t>(std::min(2 * y + 1, height - 1)) * width;
+		for (int x = 0; x < chromaWidth; ++x)
+		{
+			const int x0 = 2 * x, x1 = std::min(2 * x + 1, width - 1);
+			const std::uint32_t block[4] = { row0[x0], row0[x1], row1[x0], row1[x1] };
+			int r = 0, g = 0, b = 0;
+			for (const std::uint32_t pixel : block)
+			{
+				r += pixel >> 16 & 0xff;
+				g += pixel >> 8 & 0xff;
+				b += pixel & 0xff;
+			}
+			r = (r + 2) >> 2;
+			g = (g + 2) >> 2;
+			b = (b + 2) >> 2;
+			u[static_cast<std::size_t>(y) * chromaWidth + x] = ChromaU(r, g, b);
+			v[static_cast<std::size_t>(y) * chromaWidth + x] = ChromaV(r, g, b);
+		}
+	}
+}
+
+void FrameExporter::EncodePng(const std::uint32_t* pixels)
+{
+	// Scanlines, filter 0 (none): the data is stored, not compressed, so filtering would not make it smaller
+	m_rows.clear();
+	for (int y = 0; y < m_height; ++y)
+	{
+		m_rows.push_back(0);
+		const std::uint32_t* row = pixels + static_cast<std::size_t>(y) * m_width;
+		for (int x = 0; x < m_width; ++x)
+		{
+			m_rows.push_back(static_cast<std::uint8_t>(row[x] >> 16));
+			m_rows.push_back(static_cast<std::uint8_t>(row[x] >> 8));
+			m_rows.push_back(static_cast<std::uint8_t>(row[x]));
+		}
+	}
+
+	static const std::uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	m_encoded.insert(m_encoded.end(), SIGNATURE, SIGNATURE + 8);
+	PutChunk(m_encoded, "IHDR", [this](std::vector<std::uint8_t>& out) {
+		PutBigEndian(out, static_cast<std::uint32_t>(m_width));
+		PutBigEndian(out, static_cast<std::uint32_t>(m_height));
+		const std::uint8_t format[5] = { 8, 2, 0, 0, 0 }; // 8 bits, RGB, deflate, adaptive filters, not interlaced
+		out.insert(out.end(), format, format + 5);
+	});
+	PutChunk(m_encoded, "IDAT", [this](std::vector<std::uint8_t>& out) {
+		// zlib stream of stored deflate blocks
+		out.push_back(0x78);
+		out.push_back(0x01);
+		std::size_t at = 0;
+		do
+		{
+			const std::size_t length = std::min(m_rows.size() - at, MAX_STORED_BLOCK);
+			const bool last = at + length == m_rows.size();
+			out.push_back(last ? 1 : 0);
+			out.push_back(static_cast<std::uint8_t>(length));
+			out.push_back(static_cast<std::uint8_t>(length >> 8));
+			out.push_back(static_cast<std::uint8_t>(~length));
+			out.push_back(static_cast<std::uint8_t>(~length >> 8));
+			out.insert(out.end(), m_rows.begin() + at, m_rows.begin() + at + length);
+			at += length;
+		} while (at < m_rows.size());
+		PutBigEndian(out, Adler32(m_rows.data(), m_rows.size()));
+	});
+	PutChunk(m_encoded, "IEND", [](std::vector<std::uint8_t>&) {});
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <atomic>
+#include <cstddef>	// std::size_t
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "background_writer.hpp"
+
+namespace xtd_fluid_simulation {
+	// What FrameExporter writes
+	enum class ExportFormat {
+		Y4m, // One raw YUV4MPEG2 file, 4:2:0 (BT.601, limited range), what ffmpeg and most encoders read as is
+		PngSequence, // A numbered 8-bit RGB PNG per frame, lossless, stored uncompressed (no zlib dependency)
+	};
+
+	const char* ToString(ExportFormat format) noexcept;
+
+	/**
+	*	Exports rendered frames (0xAARRGGBB pixels, the alpha ignored) for clips, off the thread that draws them.
+	*
+	*	Append only copies the pixels into one of POOL preallocated frames, a BackgroundWriter thread converts and writes
+	*	them, so nothing is allocated once exporting. When the disk falls POOL frames behind, Append either drops the
+	*	frame (counted, for an interactive caller that must not stall) or waits for a free one (backpressure, for an
+	*	offline run that wants every frame).
+	*/
+	class FrameExporter {
+	public:
+		inline static constexpr const std::size_t POOL = 8;
+		inline static constexpr const int DEFAULT_FRAME_RATE = 60;
+
+	public:
+		/**
+		*	Y4M writes path itself, a PNG sequence path_000000.png, path_000001.png, ... (a .png extension of path is left out).
+		*	Frames are width * height, odd sizes included. Throws std::runtime_error naming path when it cannot be written.
+		*/
+		FrameExporter(const std::string& path, ExportFormat format, int width, int height, int frameRate = DEFAULT_FRAME_RATE);
+		~FrameExporter();
+
+		FrameExporter(const FrameExporter&) = delete;
+		FrameExporter& operator=(const FrameExporter&) = delete;
+
+		// Y4M for a .y4m path, a PNG sequence otherwise
+		static ExportFormat FormatFor(const std::string& path) noexcept;
+
+	public:
+		/**
+		*	Queues width * height pixels (row major, stride width) as the next frame, false when it was dropped (the writer is
+		*	POOL frames behind, the size is not the exporter's, or it is closed). wait blocks for a free frame instead.
+		*/
+		bool Append(const std::uint32_t* pixels, int width, int height, bool wait = false) noexcept;
+
+		// Writes what is queued and closes the file, false if anything could not be written. Called by the destructor
+		bool Close();
+
+		ExportFormat get_format() const noexcept { return m_format; }
+		int get_width() const noexcept { return m_width; }
+		int get_height() const noexcept { return m_height; }
+		// Frames queued so far
+		int get_frame_count() const noexcept { return m_writer.get_appended(); }
+		int get_dropped_frames() const noexcept { return m_writer.get_dropped(); }
+		std::int64_t get_bytes_written() const noexcept { return m_bytes.load(std::memory_order_relaxed); }
+		// Time Append spent waiting for a free frame, how far the disk held the producer back
+		double get_wait_milliseconds() const noexcept { return m_writer.get_wait_nanoseconds() / 1.0e6; }
+
+	private:
+		void WriteFrame(const std::uint32_t* pixels);
+		void EncodeY4m(const std::uint32_t* pixels);
+		void EncodePng(const std::uint32_t* pixels);
+
+	private:
+		ExportFormat m_format;
+		std::string m_path; // Y4M file, or PNG prefix
+		int m_width;
+		int m_height;
+		std::ofstream m_file; // Y4M only
+		BackgroundWriter<std::uint32_t, POOL> m_writer;
+
+		// Writer thread
+		std::vector<std::uint8_t> m_rows; // PNG scanlines, each a filter byte then RGB
+		std::vector<std::uint8_t> m_encoded; // The frame being written
+		int m_written = 0;
+		std::atomic<std::int64_t> m_bytes{ 0 };
+		std::atomic<bool> m_failed{ false };
+	};
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <cmath>	// std::nearbyint
+#include <cstdint>
+#include <cstring>	// std::memcpy
+#include <algorithm>	// std::min, std::max
+#if defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+namespace xtd_fluid_simulation {
+	// How a field is stored, arithmetic is always done in float
+	enum class FieldPrecision {
+		Float32,
+		Float16, // IEEE half: 11 significant bits, saturated to +-65504
+		BFloat16, // Upper half of a float: float's range, 8 significant bits
+	};
+
+	inline const char* ToString(FieldPrecision precision) noexcept
+	{
+		switch (precision)
+		{
+			case FieldPrecision::Float16: return "fp16";
+			case FieldPrecision::BFloat16: return "bf16";
+			default: return "fp32";
+		}
+	}
+
+	/**
+	*	16-bit storage formats: a float converts in on every store (rounded to nearest even) and out on every load,
+	*	so kernels templated on their field type run unchanged on them (x[i] = x[i] + v).
+	*	Fields of these types live in AlignedBuffer<std::uint16_t> storage, same size and layout.
+	*/
+	struct Float16 {
+		std::uint16_t bits;
+
+		inline static constexpr const float MAX = 65504.0f;
+
+		Float16() noexcept = default;
+		Float16(float value) noexcept : bits(Encode(value)) {}
+		operator float() const noexcept { return Decode(bits); }
+
+		static std::uint16_t Encode(float value) noexcept
+		{
+			// Saturate rather than overflow to infinity, a dense dye spot is still a dense dye spot
+			value = std::min(std::max(value, -MAX), MAX);
+#if defined(__F16C__)
+			return static_cast<std::uint16_t>(_cvtss_sh(value, _MM_FROUND_TO_NEAREST_INT));
+#else
+			std::uint32_t u;
+			std::memcpy(&u, &value, sizeof(u));
+			const std::uint16_t sign = static_cast<std::uint16_t>((u >> 16) & 0x8000u);
+			u &= 0x7fffffffu;
+			if (u > 0x7f800000u)
+				return sign | 0x7e00u; // NaN
+			if (u >= 0x38800000u)
+			{
+				// Normal: rebias the exponent (127 -> 15) and round the mantissa to 10 bits
+				u += 0x0fffu + ((u >> 13) & 1u);
+				return static_cast<std::uint16_t>(sign | ((u - 0x38000000u) >> 13));
+			}
+			// Subnormal (or zero): multiples of 2^-24, 1024 rounds up to the smallest normal
+			float magnitude;
+			std::memcpy(&magnitude, &u, sizeof(magnitude));
+			return static_cast<std::uint16_t>(sign | static_cast<std::uint16_t>(std::nearbyint(magnitude * 16777216.0f)));
+#endif
+		}
+
+		static float Decode(std::uint16_t bits) noexcept
+		{
+#if defined(__F16C__)
+			return _cvtsh_ss(bits);
+#else
+			const std::uint32_t sign = static_cast<std::uint32_t>(bits & 0x8000u) << 16;
+			const std::uint32_t exponent = (bits >> 10) & 0x1fu;
+			const std::uint32_t mantissa = bits & 0x3ffu;
+			if (exponent == 0)
+			{
+				const float magnitude = mantissa * 5.9604644775390625e-8f; // 2^-24
+				return sign ? -magnitude : magnitude;
+			}
+			const std::uint32_t u = sign | (exponent == 31 ? 0x7f800000u : (exponent + 112) << 23) | (mantissa << 13);
+			float value;
+			std::memcpy(&value, &u, sizeof(value));
+			return value;
+#endif
+		}
+	};
+
+	struct BFloat16 {
+		std::uint16_t bits;
+
+		BFloat16() noexcept = default;
+		BFloat16(float value) noexcept : bits(Encode(value)) {}
+		operator float() const noexcept { return Decode(bits); }
+
+		static std::uint16_t Encode(float value) noexcept
+		{
+			std::uint32_t u;
+			std::memcpy(&u, &value, sizeof(u));
+			if ((u & 0x7fffffffu) > 0x7f800000u)
+				return static_cast<std::uint16_t>((u >> 16) | 0x40u); // Keep NaNs quiet NaNs
+			u += 0x7fffu + ((u >> 16) & 1u);
+			return static_cast<std::uint16_t>(u >> 16);
+		}
+
+		static float Decode(std::uint16_t bits) noexcept
+		{
+			const std::uint32_t u = static_cast<std::uint32_t>(bits) << 16;
+			float value;
+			std::memcpy(&value, &u, sizeof(value));
+			return value;
+		}
+	};
+
+	static_assert(sizeof(Float16) == 2 && sizeof(BFloat16) == 2, "16-bit storage types must stay 16 bits");
+}
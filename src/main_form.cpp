@@ -1,29 +1,53 @@
 #include "main_form.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <exception>
+#include <thread>
 
 using namespace xtd;
 using namespace xtd::drawing;
 using namespace xtd::forms;
 using namespace xtd_fluid_simulation;
 
-main_form::main_form() :
+namespace {
+  constexpr const char* RECORDING_PATH = "fluid_recording.bin";
+  constexpr const char* STATE_PATH = "fluid_state.bin";
+  // Export paths by m_cb_export index, the PNG one a prefix (fluid_export_000000.png, ...)
+  constexpr const char* EXPORT_PATHS[] = {"", "fluid_export.y4m", "fluid_export"};
+  // Emitted by each brush every frame, for a lifetime of 8s at 60 steps/s: about a million alive with the automatic density on
+  constexpr int TRACERS_PER_BRUSH = 2048;
+  constexpr int TRACER_LIFETIME = 480;
+}
+
+main_form::main_form(int grid_size, std::unique_ptr<RecordingReader> replay, std::unique_ptr<Fluid3D> volume) :
   m_animation(new animation()),
-  m_fluid(new Fluid()),
+  // The 2D fluid is clamped to its minimum size, a recording or a volume is shown at its own
+  m_grid_size(replay || volume ? std::max(grid_size, 1) : std::max(grid_size, Fluid::MIN_SIZE)),
+  // Keep the default view size (600px) whatever the grid size, down to 1px per particle
+  m_scale(std::max(1, Fluid::DEFAULT_SIZE * Fluid::DEFAULT_SCALE / m_grid_size)),
+  // Replaying or stepping a volume, there is no 2D fluid to step
+  m_fluid(replay || volume ? nullptr : new Fluid(m_grid_size, m_scale)),
+  m_worker(m_fluid ? new SimulationWorker(*m_fluid) : nullptr),
   m_previous_mouse_position(0, 0),
-  m_velocity(0.0f, 0.0f)
+  m_velocity(0.0f, 0.0f),
+  m_replay(std::move(replay)),
+  m_volume(std::move(volume)),
+  m_obstacles(m_grid_size)
 {
+  // Initial view size only, the window can be resized whatever the grid size (see fluid_renderer::filter)
+  const int view_size = m_grid_size * m_scale;
   text("Fluid Simulation");
-  client_size({ Fluid::N * Fluid::SCALE + 200, Fluid::N * Fluid::SCALE });
-  minimum_client_size(client_size());
-  maximum_client_size(client_size());
-  maximize_box(false);
+  client_size({ view_size + 200, view_size });
+  minimum_client_size({ 200 + 200, 200 });
 
   //back_color(xtd::drawing::color::light_gray);
   //fore_color(color::cyan);
 
   m_animation->parent(*this);
   m_animation->location({ 0, 0 });
-  m_animation->size({ Fluid::N * Fluid::SCALE, Fluid::N * Fluid::SCALE });
-  m_animation->dock(dock_style::left);
+  m_animation->size({ view_size, view_size });
+  m_animation->dock(dock_style::fill);
   m_animation->back_color(color::black);
   m_animation->frames_per_second(60);
   m_animation->start();
@@ -43,27 +67,60 @@ main_form::main_form() :
   m_cp_background_color.color(m_animation->back_color());
   m_cp_background_color.color_picker_changed += [&](object& sender, const color_picker_event_args& e){
     m_animation->back_color(e.color());
+    m_renderer.back_color(e.color());
   };
 
   m_cp_label.parent(m_vlayout);
   m_cp_label.text("Fluid Color:");
   m_cp_fluid_color.parent(m_vlayout);
   m_cp_fluid_color.width(180);
-  m_cp_fluid_color.color(m_fluid->get_color());
+  m_cp_fluid_color.color(m_renderer.fluid_color());
   m_cp_fluid_color.color_picker_changed += [&](object& sender, const color_picker_event_args& e) {
-    m_fluid->set_color(e.color());
+    m_renderer.fluid_color(e.color());
+  };
+
+  m_scaling_label.parent(m_vlayout);
+  m_scaling_label.text("Scaling:");
+  m_cb_scaling.parent(m_vlayout);
+  m_cb_scaling.width(180);
+  m_cb_scaling.drop_down_style(combo_box_style::drop_down_list);
+  m_cb_scaling.items().push_back_range({ "Nearest (cells)", "Bilinear", "Bicubic" });
+  m_cb_scaling.selected_index(static_cast<size_t>(m_renderer.filter()));
+  m_cb_scaling.selected_index_changed += [&] {
+    m_renderer.filter(static_cast<UpscaleFilter>(m_cb_scaling.selected_index()));
   };
 
+  // Volume mode: which plane of the volume is drawn, and painted by the mouse
+  if (m_volume) {
+    m_slice.resize(static_cast<size_t>(m_volume->get_size()) * m_volume->get_size());
+    m_slice_axis_label.parent(m_vlayout);
+    m_slice_axis_label.text("Slice Plane:");
+    m_cb_slice_axis.parent(m_vlayout);
+    m_cb_slice_axis.width(180);
+    m_cb_slice_axis.drop_down_style(combo_box_style::drop_down_list);
+    // Same order as Fluid3D::SliceAxis
+    m_cb_slice_axis.items().push_back_range({ "YZ (across x)", "XZ (across y)", "XY (across z)" });
+    m_cb_slice_axis.selected_index(static_cast<size_t>(Fluid3D::SliceAxis::Z));
+
+    m_slice_label.parent(m_vlayout);
+    m_slice_label.text("Slice Position:");
+    m_tb_slice.parent(m_vlayout);
+    m_tb_slice.width(180);
+    m_tb_slice.minimum(0);
+    m_tb_slice.maximum(m_volume->get_size() - 1);
+    m_tb_slice.value(m_volume->get_size() / 2);
+  }
 
   m_tb_label.parent(m_vlayout);
   m_tb_label.text("Motion Speed:");
   m_tb_speed.parent(m_vlayout);
   m_tb_speed.width(180);
-  m_tb_speed.value(m_fluid->get_speed());
-  m_tb_speed.minimum(m_fluid->get_min_speed());
-  m_tb_speed.maximum(m_fluid->get_max_speed());
+  m_tb_speed.value(m_fluid ? m_fluid->get_speed() : m_volume ? m_volume->get_speed() : Fluid::DEFAULT_SPEED);
+  m_tb_speed.minimum(Fluid::get_min_speed());
+  m_tb_speed.maximum(Fluid::get_max_speed());
   m_tb_speed.value_changed += [&] {
-    m_fluid->set_speed(m_tb_speed.value());
+    if (m_worker) m_worker->Post([speed = m_tb_speed.value()](Fluid& fluid) { fluid.set_speed(speed); });
+    if (m_volume) m_volume->set_speed(m_tb_speed.value());
   };
   
   m_vlx_label.parent(m_vlayout);
@@ -88,6 +145,201 @@ main_form::main_form() :
     m_velocity.y(m_tb_velocity_y.value() * 0.05f);
   }; 
   
+  // Same order as Fluid::Solver
+  const std::vector<xtd::ustring> solver_names = { "Gauss-Seidel", "Red-Black Gauss-Seidel (multithreaded)", "Jacobi (SIMD, multithreaded)" };
+  m_diffuse_solver_label.parent(m_vlayout);
+  m_diffuse_solver_label.text("Diffuse Solver:");
+  m_cb_diffuse_solver.parent(m_vlayout);
+  m_cb_diffuse_solver.width(180);
+  m_cb_diffuse_solver.drop_down_style(combo_box_style::drop_down_list);
+  m_cb_diffuse_solver.items().push_back_range(solver_names);
+  m_cb_diffuse_solver.selected_index(static_cast<size_t>(m_fluid ? m_fluid->get_diffuse_solver() : m_volume ? m_volume->get_diffuse_solver() : Fluid::Solver::GaussSeidel));
+  m_cb_diffuse_solver.selected_index_changed += [&] {
+    if (m_worker) m_worker->Post([solver = static_cast<Fluid::Solver>(m_cb_diffuse_solver.selected_index())](Fluid& fluid) { fluid.set_diffuse_solver(solver); });
+    if (m_volume) m_volume->set_diffuse_solver(static_cast<Fluid::Solver>(m_cb_diffuse_solver.selected_index()));
+  };
+
+  m_project_solver_label.parent(m_vlayout);
+  m_project_solver_label.text("Project Solver:");
+  m_cb_project_solver.parent(m_vlayout);
+  m_cb_project_solver.width(180);
+  m_cb_project_solver.drop_down_style(combo_box_style::drop_down_list);
+  m_cb_project_solver.items().push_back_range(solver_names);
+  m_cb_project_solver.selected_index(static_cast<size_t>(m_fluid ? m_fluid->get_project_solver() : m_volume ? m_volume->get_project_solver() : Fluid::Solver::GaussSeidel));
+  m_cb_project_solver.selected_index_changed += [&] {
+    if (m_worker) m_worker->Post([solver = static_cast<Fluid::Solver>(m_cb_project_solver.selected_index())](Fluid& fluid) { fluid.set_project_solver(solver); });
+    if (m_volume) m_volume->set_project_solver(static_cast<Fluid::Solver>(m_cb_project_solver.selected_index()));
+  };
+
+  m_pressure_solver_label.parent(m_vlayout);
+  m_pressure_solver_label.text("Pressure Solver:");
+  m_cb_pressure_solver.parent(m_vlayout);
+  m_cb_pressure_solver.width(180);
+  m_cb_pressure_solver.drop_down_style(combo_box_style::drop_down_list);
+  m_cb_pressure_solver.items().push_back_range({ "Relaxation", "Multigrid" });
+  m_cb_pressure_solver.selected_index(static_cast<size_t>(m_fluid ? m_fluid->get_pressure_solver() : Fluid::PressureSolver::Relaxation));
+  m_cb_pressure_solver.enabled(m_worker != nullptr);
+  m_cb_pressure_solver.selected_index_changed += [&] {
+    if (m_worker) m_worker->Post([solver = static_cast<Fluid::PressureSolver>(m_cb_pressure_solver.selected_index())](Fluid& fluid) { fluid.set_pressure_solver(solver); });
+  };
+
+  m_advection_label.parent(m_vlayout);
+  m_advection_label.text("Advection:");
+  m_cb_advection.parent(m_vlayout);
+  m_cb_advection.width(180);
+  m_cb_advection.drop_down_style(combo_box_style::drop_down_list);
+  m_cb_advection.items().push_back_range({ "Semi-Lagrangian", "MacCormack (sharper)" });
+  m_cb_advection.selected_index(static_cast<size_t>(m_fluid ? m_fluid->get_advection() : m_volume ? m_volume->get_advection() : Fluid::Advection::SemiLagrangian));
+  m_cb_advection.selected_index_changed += [&] {
+    if (m_worker) m_worker->Post([advection = static_cast<Fluid::Advection>(m_cb_advection.selected_index())](Fluid& fluid) { fluid.set_advection(advection); });
+    if (m_volume) m_volume->set_advection(static_cast<Fluid::Advection>(m_cb_advection.selected_index()));
+  };
+
+  m_field_precision_label.parent(m_vlayout);
+  m_field_precision_label.text("Field Storage:");
+  m_cb_field_precision.parent(m_vlayout);
+  m_cb_field_precision.width(180);
+  m_cb_field_precision.drop_down_style(combo_box_style::drop_down_list);
+  m_cb_field_precision.items().push_back_range({ "32-bit float", "16-bit float", "bfloat16" });
+  m_cb_field_precision.selected_index(static_cast<size_t>(m_fluid ? m_fluid->get_field_precision() : FieldPrecision::Float32));
+  m_cb_field_precision.enabled(m_worker != nullptr);
+  m_cb_field_precision.selected_index_changed += [&] {
+    if (m_worker) m_worker->Post([precision = static_cast<FieldPrecision>(m_cb_field_precision.selected_index())](Fluid& fluid) { fluid.set_field_precision(precision); });
+  };
+
+  m_sparse_tiles_label.parent(m_vlayout);
+  m_sparse_tiles_label.text("Sparse Tiles (skip still areas):");
+  m_sparse_tiles_label.width(180);
+  m_sb_sparse_tiles.parent(m_vlayout);
+  m_sb_sparse_tiles.auto_check(true);
+  m_sb_sparse_tiles.checked(m_fluid && m_fluid->get_sparse_tiles());
+  m_sb_sparse_tiles.enabled(m_worker != nullptr);
+  m_sb_sparse_tiles.checked_changed += [&] {
+    if (m_worker) m_worker->Post([sparse = m_sb_sparse_tiles.checked()](Fluid& fluid) { fluid.set_sparse_tiles(sparse); });
+  };
+
+  m_task_graph_label.parent(m_vlayout);
+  m_task_graph_label.text("Task Graph (stages in parallel):");
+  m_task_graph_label.width(180);
+  m_sb_task_graph.parent(m_vlayout);
+  m_sb_task_graph.auto_check(true);
+  m_sb_task_graph.checked(m_fluid && m_fluid->get_task_graph());
+  m_sb_task_graph.enabled(m_worker != nullptr);
+  m_sb_task_graph.checked_changed += [&] {
+    if (m_worker) m_worker->Post([enabled = m_sb_task_graph.checked()](Fluid& fluid) { fluid.set_task_graph(enabled); });
+  };
+
+  m_adaptive_solver_label.parent(m_vlayout);
+  m_adaptive_solver_label.text("Adaptive Solver (tolerance, warm start):");
+  m_adaptive_solver_label.width(180);
+  m_sb_adaptive_solver.parent(m_vlayout);
+  m_sb_adaptive_solver.auto_check(true);
+  m_sb_adaptive_solver.checked(false);
+  m_sb_adaptive_solver.enabled(m_worker != nullptr);
+  m_sb_adaptive_solver.checked_changed += [&] {
+    if (m_worker) m_worker->Post([adaptive = m_sb_adaptive_solver.checked()](Fluid& fluid) {
+      fluid.set_tolerance(adaptive ? 1e-2f : 0.0f);
+      fluid.set_warm_start(adaptive);
+    });
+  };
+  m_solve_iterations_label.parent(m_vlayout);
+  m_solve_iterations_label.width(180);
+
+  m_profile_label.parent(m_vlayout);
+  m_profile_label.text("Stage p50 / p99 (ms):");
+  m_profile_label.width(180);
+  m_profile_stats_label.parent(m_vlayout);
+  m_profile_stats_label.width(180);
+  m_profile_stats_label.height(11 * 14);
+  m_btn_dump_trace.parent(m_vlayout);
+  m_btn_dump_trace.width(180);
+  m_btn_dump_trace.text("Dump Chrome trace");
+  m_btn_dump_trace.enabled(FLUID_PROFILING != 0);
+  m_btn_dump_trace.click += [&] {
+    // Open in chrome://tracing or ui.perfetto.dev
+    const bool written = m_profiler.WriteChromeTrace("fluid_trace.json");
+    m_btn_dump_trace.text(written ? "Saved fluid_trace.json" : "Could not write fluid_trace.json");
+  };
+#if !FLUID_PROFILING
+  m_profile_stats_label.text("Built without profiling");
+#endif
+
+  m_record_label.parent(m_vlayout);
+  m_record_label.text(ustring("Record (") + RECORDING_PATH + "):");
+  m_record_label.width(180);
+  m_sb_record.parent(m_vlayout);
+  m_sb_record.auto_check(true);
+  m_sb_record.checked(false);
+  m_sb_record.enabled(m_worker != nullptr);
+  m_sb_record.checked_changed += [&] {
+    if (!m_worker) return;
+    if (!m_sb_record.checked()) {
+      m_worker->Record(nullptr);
+      m_recording.reset();
+      return;
+    }
+    try {
+      m_recording = std::make_shared<RecordingWriter>(RECORDING_PATH, m_grid_size);
+    }
+    catch (const std::exception&) {
+      m_record_label.text(ustring("Could not write ") + RECORDING_PATH);
+      m_sb_record.checked(false);
+      return;
+    }
+    m_worker->Record(m_recording);
+  };
+
+  m_export_label.parent(m_vlayout);
+  m_export_label.text("Export frames:");
+  m_export_label.width(180);
+  m_cb_export.parent(m_vlayout);
+  m_cb_export.width(180);
+  m_cb_export.drop_down_style(combo_box_style::drop_down_list);
+  m_cb_export.items().push_back_range({"Off", ustring("Y4M (") + EXPORT_PATHS[1] + ")", ustring("PNG (") + EXPORT_PATHS[2] + "_*.png)"});
+  m_cb_export.selected_index(0);
+  m_cb_export.selected_index_changed += [&] {
+    // Writes what is still queued, then the next frame drawn starts the new export
+    m_exporter.reset();
+    m_export_label.text("Export frames:");
+  };
+  m_cb_export.enabled(m_worker != nullptr);
+
+  m_state_label.parent(m_vlayout);
+  m_state_label.text(ustring("Checkpoint (") + STATE_PATH + "):");
+  m_state_label.width(180);
+  m_btn_save_state.parent(m_vlayout);
+  m_btn_save_state.width(180);
+  m_btn_save_state.text("Save State");
+  m_btn_save_state.enabled(m_worker != nullptr);
+  m_btn_save_state.click += [&] {
+    if (m_worker) m_worker->Post([this](Fluid& fluid) {
+      try {
+        fluid.SaveState(STATE_PATH);
+        m_state_result = state_result::saved;
+      }
+      catch (const std::exception&) {
+        m_state_result = state_result::failed;
+      }
+    });
+  };
+  m_btn_load_state.parent(m_vlayout);
+  m_btn_load_state.width(180);
+  m_btn_load_state.text("Load State");
+  m_btn_load_state.enabled(m_worker != nullptr);
+  m_btn_load_state.click += [&] {
+    // The settings come with the checkpoint, the controls above keep showing theirs until changed
+    if (m_worker) m_worker->Post([this](Fluid& fluid) {
+      try {
+        fluid.LoadState(STATE_PATH);
+        std::atomic_store(&m_loaded_obstacles, std::make_shared<ObstacleMap>(fluid.get_obstacles()));
+        m_state_result = state_result::loaded;
+      }
+      catch (const std::exception&) {
+        m_state_result = state_result::failed;
+      }
+    });
+  };
+
   m_density_label.parent(m_vlayout);
   m_density_label.text("Density (dye amount):");
   m_density_label.width(180);
@@ -98,6 +350,58 @@ main_form::main_form() :
   m_tb_density.value(1000);
 
 
+  m_brush_radius_label.parent(m_vlayout);
+  m_brush_radius_label.text("Brush Radius (cells):");
+  m_brush_radius_label.width(180);
+  m_tb_brush_radius.parent(m_vlayout);
+  m_tb_brush_radius.width(180);
+  m_tb_brush_radius.minimum(0);
+  m_tb_brush_radius.maximum(16);
+  m_tb_brush_radius.value(0);
+
+  m_obstacles_label.parent(m_vlayout);
+  m_obstacles_label.text("Obstacles (right mouse, Shift erases):");
+  m_obstacles_label.width(180);
+  m_btn_load_obstacles.parent(m_vlayout);
+  m_btn_load_obstacles.width(180);
+  m_btn_load_obstacles.text("Load Obstacle Image");
+  m_btn_load_obstacles.enabled(m_worker != nullptr);
+  m_btn_load_obstacles.click += [&] {
+    if (!m_worker) return;
+    open_file_dialog dialog;
+    dialog.filter("Images (*.png;*.bmp;*.jpg;*.gif)|*.png;*.bmp;*.jpg;*.gif|All files (*.*)|*.*");
+    if (dialog.show_dialog(*this) != dialog_result::ok) return;
+    try {
+      // Dark opaque pixels are solid, stretched over the whole grid (see ObstacleMap::SetFromImage)
+      const bitmap image(dialog.file_name());
+      const int width = image.width();
+      const int height = image.height();
+      std::vector<std::uint8_t> luminance(static_cast<size_t>(width) * height);
+      for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+          const color pixel = image.get_pixel(x, y);
+          luminance[static_cast<size_t>(y) * width + x] = pixel.a() < 128 ? 255 : static_cast<std::uint8_t>((pixel.r() * 299 + pixel.g() * 587 + pixel.b() * 114) / 1000);
+        }
+      }
+      m_obstacles.SetFromImage(luminance.data(), width, height);
+    }
+    catch (const std::exception&) {
+      m_obstacles_label.text("Could not read " + dialog.file_name());
+      return;
+    }
+    m_obstacles_label.text("Obstacles: " + std::to_string(m_obstacles.GetSolidCount()) + " solid cells");
+    m_worker->Post([obstacles = m_obstacles](Fluid& fluid) {fluid.SetObstacles(obstacles);});
+  };
+  m_btn_clear_obstacles.parent(m_vlayout);
+  m_btn_clear_obstacles.width(180);
+  m_btn_clear_obstacles.text("Clear Obstacles");
+  m_btn_clear_obstacles.enabled(m_worker != nullptr);
+  m_btn_clear_obstacles.click += [&] {
+    if (!m_worker) return;
+    m_obstacles.Clear();
+    m_worker->Post([obstacles = m_obstacles](Fluid& fluid) {fluid.SetObstacles(obstacles);});
+  };
+
   m_auto_density_label.parent(m_vlayout);
   m_auto_density_label.text("Automatic Density:");
   m_auto_density_label.width(180);
@@ -105,6 +409,21 @@ main_form::main_form() :
   m_sb_auto_density.auto_check(true);
   m_sb_auto_density.checked(true);
 
+  m_tracers_label.parent(m_vlayout);
+  m_tracers_label.text("Tracers (emitted with the dye):");
+  m_tracers_label.width(180);
+  m_sb_tracers.parent(m_vlayout);
+  m_sb_tracers.auto_check(true);
+  m_sb_tracers.enabled(m_worker != nullptr);
+  m_sb_tracers.checked_changed += [&] {
+    if (!m_worker) return;
+    // Their own threads, like the renderer's upscaler: they run on the UI side, between the worker's steps
+    if (m_sb_tracers.checked() && !m_tracers)
+      m_tracers.reset(new TracerSystem(TracerSystem::DEFAULT_CAPACITY, static_cast<int>(std::max(1u, std::thread::hardware_concurrency() / 2))));
+    if (m_tracers) m_tracers->Clear();
+    m_worker->set_velocity_snapshots(m_sb_tracers.checked());
+  };
+
 
   m_btn_reset.parent(m_vlayout);
   m_btn_reset.width(180);
@@ -116,79 +435,273 @@ main_form::main_form() :
     m_tb_velocity_x.value(0);
     m_tb_velocity_y.value(0);
     m_tb_density.value(1000);
+    m_tb_brush_radius.value(0);
     m_sb_auto_density.checked(false);
+    m_cb_scaling.selected_index(static_cast<size_t>(UpscaleFilter::Nearest));
+    m_cb_diffuse_solver.selected_index(static_cast<size_t>(Fluid::Solver::GaussSeidel));
+    m_cb_project_solver.selected_index(static_cast<size_t>(Fluid::Solver::GaussSeidel));
+    m_cb_pressure_solver.selected_index(static_cast<size_t>(Fluid::PressureSolver::Relaxation));
+    m_cb_advection.selected_index(static_cast<size_t>(Fluid::Advection::SemiLagrangian));
+    m_cb_field_precision.selected_index(static_cast<size_t>(FieldPrecision::Float32));
+    m_sb_sparse_tiles.checked(false);
+    m_sb_task_graph.checked(true);
+    m_sb_adaptive_solver.checked(false);
   };
 
+  if (m_worker)
+    m_worker->Start();
 }
 
 void main_form::on_animation_update(object& sender, const animation_updated_event_args& e) {
+  if (m_replay) return;
   const float delta_time = e.elapsed_milliseconds() / 1000.0f;
+  const int size = m_grid_size;
+  const rectangle view = view_bounds();
+  const float cells_per_pixel = static_cast<float>(size) / std::max(view.width(), 1);
+  if (m_volume) {
+    update_volume(delta_time, view, cells_per_pixel);
+    return;
+  }
+  // Neither replaying nor in volume mode: m_fluid and m_worker exist from here on
 
   // If left mouse button is pressed (over the animation), add some of dye at that location
   if (m_animation->mouse_buttons() == mouse_buttons::left)
   {
-    // Add some of dye in held location
-    m_fluid->AddDensity(static_cast<int>(m_mouse_position.x() / Fluid::SCALE), static_cast<int>(m_mouse_position.y() / Fluid::SCALE), static_cast<float>(m_tb_density.value()));
     // note that the position bellow is from m_animation not the main form; equiv: m_animation->mouse_position()
-    // Apply Mouse Drag Velocity to simulate fluid movement
-    const float amount_x = static_cast<float>(m_mouse_position.x()) - m_previous_mouse_position.x();
-    const float amount_y = static_cast<float>(m_mouse_position.y()) - m_previous_mouse_position.y();
-    m_fluid->AddVelocity(static_cast<int>(m_mouse_position.x() / Fluid::SCALE), static_cast<int>(m_mouse_position.y() / Fluid::SCALE), amount_x, amount_y);
+    // Dye and mouse drag velocity in one brush, to simulate fluid movement. The drag is measured in pixels of the
+    // initial view (get_scale per cell), so resizing the window does not change how hard a drag pushes
+    const float drag_scale = cells_per_pixel * m_scale;
+    const float amount_x = (static_cast<float>(m_mouse_position.x()) - m_previous_mouse_position.x()) * drag_scale;
+    const float amount_y = (static_cast<float>(m_mouse_position.y()) - m_previous_mouse_position.y()) * drag_scale;
+    const float x = (m_mouse_position.x() - view.x()) * cells_per_pixel;
+    const float y = (m_mouse_position.y() - view.y()) * cells_per_pixel;
+    m_worker->AddBrush({x, y, static_cast<float>(m_tb_brush_radius.value()), static_cast<float>(m_tb_density.value()), amount_x, amount_y});
+    if (m_tracers && m_sb_tracers.checked())
+      m_tracers->Emit(size, x, y, std::max(static_cast<float>(m_tb_brush_radius.value()), 1.0f), TRACERS_PER_BRUSH, TRACER_LIFETIME);
     m_previous_mouse_position = m_mouse_position;
   }
 
-  // Apply user input velocity 
+  // Right mouse button paints solid cells with the brush radius (erases them with Shift held), on the copy drawn then on the worker's
+  if (m_animation->mouse_buttons() == mouse_buttons::right) {
+    const float x = (m_mouse_position.x() - view.x()) * cells_per_pixel;
+    const float y = (m_mouse_position.y() - view.y()) * cells_per_pixel;
+    const float radius = static_cast<float>(m_tb_brush_radius.value());
+    const bool solid = control::modifier_keys() != keys::shift;
+    m_obstacles.Paint(x, y, radius, solid);
+    m_worker->Post([x, y, radius, solid](Fluid& fluid) {fluid.PaintObstacle(x, y, radius, solid);});
+  }
+
+  // Apply user input velocity, a uniform force over the whole grid
   if(m_velocity != m_velocity.empty)
-    for (int j = 0; j < Fluid::N; ++j)
-    {
-      for (int i = 0; i < Fluid::N; ++i)
-      {
-        const int x = i * Fluid::SCALE;
-        const int y = j * Fluid::SCALE;
-        m_fluid->AddVelocity(x, y, m_velocity.x() * delta_time , m_velocity.y() * delta_time);
-      }
-    }
+    m_worker->AddForce(m_velocity.x() * delta_time, m_velocity.y() * delta_time);
 
   // Add automatic density at center if switch_button is on
   if (m_sb_auto_density.checked()) {
-    const int center_x = (m_animation->width() / 2) / Fluid::SCALE;
-    const int center_y = (m_animation->height() / 2) / Fluid::SCALE;
-    m_fluid->AddDensity(center_x, center_y, static_cast<float>(m_tb_density.value()));
-    m_fluid->AddVelocity(center_x, center_y, random(-3.0f, 3.0f), random(-3.0f, 3.0f));
+    const int center = size / 2;
+    m_worker->AddBrush({static_cast<float>(center), static_cast<float>(center), 0.0f, static_cast<float>(m_tb_density.value()), random(-3.0f, 3.0f), random(-3.0f, 3.0f)});
+    if (m_tracers && m_sb_tracers.checked())
+      m_tracers->Emit(size, static_cast<float>(center), static_cast<float>(center), 1.0f, TRACERS_PER_BRUSH, TRACER_LIFETIME);
   }
 
-  // Update Fluid
-  m_fluid->Update(delta_time);
+  // Fluid is updated by the worker at its own fixed timestep
 }
 
 void main_form::on_animation_draw(object& sender, paint_event_args& e) {
-  graphics& gfx = e.graphics();
-  // TODO: graphics settings to enhance performance
-  //gfx.page_unit(graphics_unit::pixel); // using pixel mode
-  //gfx.pixel_offset_mode(drawing2d::pixel_offset_mode::high_speed); // as fast as possible
-  //gfx.smoothing_mode(drawing2d::smoothing_mode::high_speed); // as fast as possible
-  gfx.clear(m_animation->back_color());
-
-  // Draw fluid particles (as small rectangles, with different alpha color)
-  static drawing::solid_brush particle_brush(m_fluid->get_color());
-  for (int j = 0; j < Fluid::N; ++j)
+  const int size = m_grid_size;
+  const rectangle view = view_bounds();
+
+  // Replay mode: a recorded frame per paint, straight from the mapped file
+  if (m_replay) {
+    m_renderer.update(*m_replay, m_replay_frame);
+    m_renderer.draw(e.graphics(), view);
+    m_solve_iterations_label.text("Replay: frame " + std::to_string(m_replay_frame + 1) + " / " + std::to_string(m_replay->get_frame_count()));
+    m_replay_frame = (m_replay_frame + 1) % m_replay->get_frame_count();
+    return;
+  }
+
+  // Volume mode: the slice chosen, drawn like the 2D density
+  if (m_volume) {
+    m_volume->ReadSlice(static_cast<Fluid3D::SliceAxis>(m_cb_slice_axis.selected_index()), m_tb_slice.value(), m_slice.data());
+    m_renderer.update(m_slice.data(), size);
+    m_renderer.draw(e.graphics(), view);
+    m_solve_iterations_label.text("Volume " + std::to_string(size) + "^3 (" + std::to_string(static_cast<int>(m_volume_step_milliseconds)) + " ms/step)");
+    return;
+  }
+
+  // Latest step published by the worker
+  const SimulationWorker::Snapshot& snapshot = m_worker->AcquireSnapshot();
+
+  // Draw fluid particles (one pixel per particle scaled up, or sampled at the view size, by a single image draw)
   {
-    for (int i = 0; i < Fluid::N; ++i)
-    {
-      const int x = i * Fluid::SCALE;
-      const int y = j * Fluid::SCALE;
-      particle_brush.color(m_fluid->get_color_at(i, j));
-      gfx.fill_rectangle(particle_brush, x, y, Fluid::SCALE, Fluid::SCALE);
+    FLUID_PROFILE_STAGE(m_draw_sample, Stage::Draw);
+    if (snapshot.activeTiles.empty())
+      m_renderer.update(snapshot.density.data(), size);
+    else
+      m_renderer.update(snapshot.density.data(), size, snapshot.activeTiles, ActiveTiles::TILE);
+    m_renderer.obstacles(m_obstacles);
+    // Tracers move once per step drawn, the steps the UI missed (up to 4) along the same velocity
+    TracerSystem* tracers = m_sb_tracers.checked() ? m_tracers.get() : nullptr;
+    if (tracers && !snapshot.velocityX.empty() && snapshot.step != m_tracer_step) {
+      const int steps = static_cast<int>(std::min<std::uint64_t>(snapshot.step - m_tracer_step, 4));
+      for (int step = 0; step < steps; ++step)
+        tracers->Advect(snapshot.velocityX.data(), snapshot.velocityY.data(), size, snapshot.motionStep);
+      m_tracer_step = snapshot.step;
     }
+    m_renderer.draw(e.graphics(), view, tracers);
+  }
+
+  // A frame per step drawn, queued as drawn (tracers and obstacles included) and written by the exporter's thread: dropped, never waited for, when the disk falls behind
+  const size_t export_index = m_cb_export.selected_index();
+  if (export_index > 0 && snapshot.step != m_exported_step && m_renderer.frame_size().width() > 0) {
+    m_exported_step = snapshot.step;
+    if (!m_exporter) {
+      const auto frame = m_renderer.frame_size();
+      const int frame_rate = static_cast<int>(1.0f / m_worker->get_timestep() + 0.5f);
+      try {
+        m_exporter.reset(new FrameExporter(EXPORT_PATHS[export_index], export_index == 1 ? ExportFormat::Y4m : ExportFormat::PngSequence, frame.width(), frame.height(), frame_rate));
+      }
+      catch (const std::exception&) {
+        m_cb_export.selected_index(0);
+        m_export_label.text(ustring("Could not write ") + EXPORT_PATHS[export_index]);
+      }
+    }
+    if (m_exporter)
+      m_renderer.export_frame(*m_exporter);
+  }
+
+#if FLUID_PROFILING
+  // One sample per step drawn: its Update stages plus the time it took to draw; steps the UI never saw are not sampled
+  if (snapshot.step != m_profiled_step) {
+    m_profiled_step = snapshot.step;
+    FrameSample frame = snapshot.profile;
+    frame[Stage::Draw] = m_draw_sample[Stage::Draw];
+    m_profiler.Record(frame);
+
+    // Twice a second is plenty for rolling percentiles
+    if (--m_profile_refresh <= 0) {
+      m_profile_refresh = 30;
+      std::string stats;
+      char line[64];
+      for (int index = 0; index < STAGE_COUNT; ++index) {
+        const Stage stage = static_cast<Stage>(index);
+        const float p50 = m_profiler.Percentile(stage, 0.5f);
+        if (p50 < 0.0f) continue; // Not part of this pipeline (fused passes)
+        std::snprintf(line, sizeof(line), "%s%s: %.2f / %.2f", stats.empty() ? "" : "\n", ToString(stage), p50, m_profiler.Percentile(stage, 0.99f));
+        stats += line;
+      }
+      m_profile_stats_label.text(stats);
+    }
+  }
+#endif
+
+  // Show how many iterations each solve of that step actually needed
+  std::string iterations = "Iterations:";
+  for (const Fluid::SolveReport& report : snapshot.solveReports)
+    iterations += " " + std::to_string(report.iterations);
+  iterations += " (" + std::to_string(static_cast<int>(snapshot.stepMilliseconds)) + " ms/step";
+  if (!snapshot.activeTiles.empty()) {
+    const auto active = std::count(snapshot.activeTiles.begin(), snapshot.activeTiles.end(), 1);
+    iterations += ", " + std::to_string(100 * active / static_cast<std::ptrdiff_t>(snapshot.activeTiles.size())) + "% of tiles";
   }
+  if (m_tracers && m_sb_tracers.checked())
+    iterations += ", " + std::to_string(m_tracers->get_count()) + " tracers";
+  if (m_recording)
+    iterations += ", recorded " + std::to_string(m_recording->get_frame_count()) + " frames, " + std::to_string(m_recording->get_dropped_frames()) + " dropped";
+  if (m_exporter)
+    iterations += ", exported " + std::to_string(m_exporter->get_frame_count()) + " frames, " + std::to_string(m_exporter->get_dropped_frames()) + " dropped";
+  iterations += ")";
+  m_solve_iterations_label.text(iterations);
 
+  switch (m_state_result.exchange(state_result::none)) {
+    case state_result::saved: m_state_label.text(ustring("Saved ") + STATE_PATH); break;
+    case state_result::loaded:
+      m_state_label.text(ustring("Loaded ") + STATE_PATH);
+      if (const auto obstacles = std::atomic_exchange(&m_loaded_obstacles, std::shared_ptr<ObstacleMap>()))
+        m_obstacles = *obstacles;
+      break;
+    case state_result::failed: m_state_label.text(ustring("Could not use ") + STATE_PATH); break;
+    default: break;
+  }
 }
 
 void main_form::on_animation_mouse_move(object& sender, const mouse_event_args& e) {
   m_mouse_position = e.location();
 }
 
+void main_form::update_volume(float delta_time, const rectangle& view, float cells_per_pixel) {
+  const int size = m_volume->get_size();
+  const auto axis = static_cast<Fluid3D::SliceAxis>(m_cb_slice_axis.selected_index());
+  const float slice = static_cast<float>(m_tb_slice.value());
+  const float radius = static_cast<float>(m_tb_brush_radius.value());
+  // A brush at (u, v) of the slice drawn, u across and v down (see Fluid3D::ReadSlice), pushing along (du, dv) in its plane
+  const auto slice_brush = [&](float u, float v, float density, float du, float dv) -> Fluid3D::Brush {
+    switch (axis) {
+      case Fluid3D::SliceAxis::X: return {slice, u, v, radius, density, 0.0f, du, dv};
+      case Fluid3D::SliceAxis::Y: return {u, slice, v, radius, density, du, 0.0f, dv};
+      default: return {u, v, slice, radius, density, du, dv, 0.0f};
+    }
+  };
+
+  if (m_animation->mouse_buttons() == mouse_buttons::left) {
+    const float drag_scale = cells_per_pixel * m_scale;
+    const float amount_u = (static_cast<float>(m_mouse_position.x()) - m_previous_mouse_position.x()) * drag_scale;
+    const float amount_v = (static_cast<float>(m_mouse_position.y()) - m_previous_mouse_position.y()) * drag_scale;
+    m_volume->AddBrush(slice_brush((m_mouse_position.x() - view.x()) * cells_per_pixel, (m_mouse_position.y() - view.y()) * cells_per_pixel,
+      static_cast<float>(m_tb_density.value()), amount_u, amount_v));
+    m_previous_mouse_position = m_mouse_position;
+  }
+
+  // Automatic density at the center of the volume, whatever the slice
+  if (m_sb_auto_density.checked()) {
+    const float center = 0.5f * size;
+    m_volume->AddBrush({center, center, center, 0.0f, static_cast<float>(m_tb_density.value()), random(-3.0f, 3.0f), random(-3.0f, 3.0f), random(-3.0f, 3.0f)});
+  }
+
+  // No worker in volume mode, a frame that came late is not simulated as one large step
+  const auto start = std::chrono::steady_clock::now();
+  m_volume->Update(std::min(delta_time, 1.0f / 30.0f));
+  m_volume_step_milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+rectangle main_form::view_bounds() const {
+  const int side = std::max(std::min(m_animation->width(), m_animation->height()), 1);
+  return {(m_animation->width() - side) / 2, (m_animation->height() - side) / 2, side, side};
+}
+
 void main_form::main() {
-  const std::unique_ptr<main_form> main_form_ptr(new main_form());
+  // Grid size can be chosen at startup: xtd_fluid_simulation --grid-size 256
+  int grid_size = Fluid::DEFAULT_SIZE;
+  const auto args = environment::get_command_line_args();
+  for (size_t i = 1; i + 1 < args.size(); ++i)
+    if (args[i] == "--grid-size")
+      grid_size = std::max(std::atoi(args[i + 1].c_str()), Fluid::MIN_SIZE);
+
+  // Or a recording played back: xtd_fluid_simulation --replay fluid_recording.bin
+  std::unique_ptr<RecordingReader> replay;
+  for (size_t i = 1; i + 1 < args.size(); ++i) {
+    if (args[i] != "--replay") continue;
+    try {
+      replay.reset(new RecordingReader(args[i + 1]));
+    }
+    catch (const std::exception& e) {
+      std::fprintf(stderr, "%s\n", e.what());
+      return;
+    }
+    if (replay->get_frame_count() == 0) {
+      std::fprintf(stderr, "%s: no frames\n", args[i + 1].c_str());
+      return;
+    }
+    grid_size = replay->get_size();
+  }
+
+  // Or a 3D fluid of N^3 cells, drawn a slice at a time: xtd_fluid_simulation --volume 64
+  std::unique_ptr<Fluid3D> volume;
+  for (size_t i = 1; i + 1 < args.size() && !replay; ++i) {
+    if (args[i] != "--volume") continue;
+    volume.reset(new Fluid3D(std::atoi(args[i + 1].c_str())));
+    grid_size = volume->get_size();
+  }
+
+  const std::unique_ptr<main_form> main_form_ptr(new main_form(grid_size, std::move(replay), std::move(volume)));
   xtd::forms::application::run(*main_form_ptr);
 }
\ No newline at end of file
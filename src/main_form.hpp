@@ -2,7 +2,16 @@
 /// @brief Contains form1 class.
 #pragma once
 #include <xtd/xtd.h>
+#include <atomic>
+#include <memory>
 #include "fluid.hpp"
+#include "fluid3d.hpp"
+#include "fluid_renderer.hpp"
+#include "frame_exporter.hpp"
+#include "profiler.hpp"
+#include "recording.hpp"
+#include "simulation_worker.hpp"
+#include "tracer_system.hpp"
 
 /// @brief Represents the namespace that contains application objects.
 namespace xtd_fluid_simulation {
@@ -11,7 +20,10 @@ namespace xtd_fluid_simulation {
   class main_form : public xtd::forms::form {
   public:
     /// @brief Initializes a new instance of the form1 class.
-    main_form();
+    /// @param grid_size Number of fluid cells per row/column.
+    /// @param replay Recording to play back in a loop instead of simulating, its grid size must be grid_size.
+    /// @param volume 3D fluid to step and show a slice of instead of the 2D one, its size must be grid_size.
+    explicit main_form(int grid_size = Fluid::DEFAULT_SIZE, std::unique_ptr<RecordingReader> replay = nullptr, std::unique_ptr<Fluid3D> volume = nullptr);
 
     /// @brief The main entry point for the application.
     static void main();
@@ -23,14 +35,27 @@ namespace xtd_fluid_simulation {
   private: // Events
     void on_animation_mouse_move(xtd::object& sender, const xtd::forms::mouse_event_args& e);
 
+  private:
+    /// @brief Gets the square the fluid is drawn in: as large as the animation allows, centered in it.
+    xtd::drawing::rectangle view_bounds() const;
+    /// @brief Steps the volume and feeds it the mouse and automatic brushes, in the plane of the slice shown.
+    void update_volume(float delta_time, const xtd::drawing::rectangle& view, float cells_per_pixel);
+
   private:
     std::unique_ptr<xtd::forms::animation> m_animation;
-    std::unique_ptr<Fluid> m_fluid;
+    int m_grid_size; // Cells per row/column of what is shown: the 2D fluid, the recording or the volume
+    int m_scale; // Pixels per cell of the initial view
+    std::unique_ptr<Fluid> m_fluid; // Only when neither replaying nor in volume mode, as m_worker
+    std::unique_ptr<SimulationWorker> m_worker; // Owns m_fluid's thread, declared after it so it stops first
+    fluid_renderer m_renderer;
     xtd::drawing::point m_mouse_position;
     xtd::drawing::point m_previous_mouse_position;
     xtd::drawing::point_f m_velocity;
 
     xtd::forms::vertical_layout_panel m_vlayout;
+    xtd::forms::label m_scaling_label;
+    xtd::forms::combo_box m_cb_scaling;
+
     xtd::forms::label m_tb_label;
     xtd::forms::track_bar m_tb_speed;
 
@@ -45,12 +70,80 @@ namespace xtd_fluid_simulation {
     xtd::forms::label m_vly_label;
     xtd::forms::track_bar m_tb_velocity_y;
 
+    xtd::forms::label m_diffuse_solver_label;
+    xtd::forms::combo_box m_cb_diffuse_solver;
+    xtd::forms::label m_project_solver_label;
+    xtd::forms::combo_box m_cb_project_solver;
+    xtd::forms::label m_pressure_solver_label;
+    xtd::forms::combo_box m_cb_pressure_solver;
+    xtd::forms::label m_advection_label;
+    xtd::forms::combo_box m_cb_advection;
+    xtd::forms::label m_field_precision_label;
+    xtd::forms::combo_box m_cb_field_precision;
+    xtd::forms::label m_sparse_tiles_label;
+    xtd::forms::switch_button m_sb_sparse_tiles;
+    xtd::forms::label m_task_graph_label;
+    xtd::forms::switch_button m_sb_task_graph;
+
+    xtd::forms::label m_adaptive_solver_label;
+    xtd::forms::switch_button m_sb_adaptive_solver;
+    xtd::forms::label m_solve_iterations_label;
+
+    xtd::forms::label m_profile_label;
+    xtd::forms::label m_profile_stats_label;
+    xtd::forms::button m_btn_dump_trace;
+    Profiler m_profiler; // UI thread only, one sample per step drawn
+    FrameSample m_draw_sample;
+    std::uint64_t m_profiled_step = 0;
+    int m_profile_refresh = 0; // Samples until the stats label is refreshed
+
+    xtd::forms::label m_record_label;
+    xtd::forms::switch_button m_sb_record;
+    std::shared_ptr<RecordingWriter> m_recording; // Shared with the worker while recording
+
+    xtd::forms::label m_export_label;
+    xtd::forms::combo_box m_cb_export; // Off, Y4M or PNG sequence
+    std::unique_ptr<FrameExporter> m_exporter; // Created at the first frame drawn once chosen, at the size drawn (fluid_renderer::frame_size)
+    std::uint64_t m_exported_step = 0;
+
+    // Checkpoints are saved and loaded by the worker, which reports back through m_state_result
+    enum class state_result {none, saved, loaded, failed};
+    xtd::forms::label m_state_label;
+    xtd::forms::button m_btn_save_state;
+    xtd::forms::button m_btn_load_state;
+    std::atomic<state_result> m_state_result {state_result::none};
+
+    std::unique_ptr<RecordingReader> m_replay; // Replay mode when set, the worker is not started
+    int m_replay_frame = 0;
+
+    std::unique_ptr<Fluid3D> m_volume; // Volume mode when set, stepped by the UI thread, the worker is not started
+    std::vector<float> m_slice; // The slice drawn, N*N
+    float m_volume_step_milliseconds = 0.0f;
+    xtd::forms::label m_slice_axis_label;
+    xtd::forms::combo_box m_cb_slice_axis;
+    xtd::forms::label m_slice_label;
+    xtd::forms::track_bar m_tb_slice;
+
     xtd::forms::label m_density_label;
     xtd::forms::track_bar m_tb_density;
 
+    xtd::forms::label m_brush_radius_label;
+    xtd::forms::track_bar m_tb_brush_radius;
+
+    xtd::forms::label m_obstacles_label;
+    xtd::forms::button m_btn_load_obstacles;
+    xtd::forms::button m_btn_clear_obstacles;
+    ObstacleMap m_obstacles; // The UI's copy of the worker's mask, changed here first then posted, what is drawn
+    std::shared_ptr<ObstacleMap> m_loaded_obstacles; // The mask of the last checkpoint loaded, handed over by the worker (atomic_store)
+
     xtd::forms::label m_auto_density_label;
     xtd::forms::switch_button m_sb_auto_density;
 
+    xtd::forms::label m_tracers_label;
+    xtd::forms::switch_button m_sb_tracers;
+    std::unique_ptr<TracerSystem> m_tracers; // Created when first switched on, advected from the worker's velocity snapshots
+    std::uint64_t m_tracer_step = 0; // Last step the tracers moved along
+
     xtd::forms::button m_btn_reset;
 
 
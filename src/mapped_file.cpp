@@ -0,0 +1,85 @@
+#include "mapped_file.hpp"
+#include <stdexcept>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+using namespace xtd_fluid_simulation;
+
+#if defined(_WIN32)
+MappedFile::MappedFile(const std::string& path)
+{
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (m_file == INVALID_HANDLE_VALUE)
+	{
+		m_file = nullptr;
+		throw std::runtime_error("cannot open " + path);
+	}
+	LARGE_INTEGER size{};
+	GetFileSizeEx(m_file, &size);
+	m_size = static_cast<std::size_t>(size.QuadPart);
+	if (m_size == 0)
+		return;
+
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (m_mapping)
+		m_data = static_cast<const std::uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!m_data)
+	{
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		CloseHandle(m_file);
+		throw std::runtime_error("cannot map " + path);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_data)
+		UnmapViewOfFile(m_data);
+	if (m_mapping)
+		CloseHandle(m_mapping);
+	if (m_file)
+		CloseHandle(m_file);
+}
+#else
+MappedFile::MappedFile(const std::string& path)
+{
+	const int file = open(path.c_str(), O_RDONLY);
+	if (file < 0)
+		throw std::runtime_error("cannot open " + path);
+	struct stat status{};
+	if (fstat(file, &status) != 0)
+	{
+		close(file);
+		throw std::runtime_error("cannot read " + path);
+	}
+	m_size = static_cast<std::size_t>(status.st_size);
+	if (m_size == 0)
+	{
+		close(file);
+		return;
+	}
+
+	// The mapping keeps its own reference to the file
+	void* data = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, file, 0);
+	close(file);
+	if (data == MAP_FAILED)
+		throw std::runtime_error("cannot map " + path);
+	// Replays read front to back
+	madvise(data, m_size, MADV_SEQUENTIAL);
+	m_data = static_cast<const std::uint8_t*>(data);
+}
+
+MappedFile::~MappedFile()
+{
+	if (m_data)
+		munmap(const_cast<std::uint8_t*>(m_data), m_size);
+}
+#endif
@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>	// std::size_t
+#include <cstdint>	// std::uint8_t
+#include <string>
+
+namespace xtd_fluid_simulation {
+	/**
+	*	A whole file mapped read only into memory, pages are read from disk (or the page cache) as they are touched,
+	*	so a reader can hand out pointers into the file instead of copying it.
+	*/
+	class MappedFile {
+	public:
+		MappedFile() noexcept = default;
+		// Maps path, throws std::runtime_error naming it when it cannot be opened or mapped
+		explicit MappedFile(const std::string& path);
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+	public:
+		const std::uint8_t* data() const noexcept { return m_data; }
+		std::size_t size() const noexcept { return m_size; }
+
+	private:
+		const std::uint8_t* m_data = nullptr;
+		std::size_t m_size = 0;
+#if defined(_WIN32)
+		void* m_file = nullptr;
+		void* m_mapping = nullptr;
+#endif
+	};
+}
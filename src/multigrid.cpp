@@ -0,0 +1,108 @@
+#include "multigrid.hpp"
+#include "fluid_kernels.hpp"
+#include <algorithm>	// std::max
+using namespace xtd_fluid_simulation;
+
+namespace {
+	constexpr int COARSEST_INTERIOR = 4;
+	// Sweeps before restricting and after correcting on every level but the coarsest, and on the coarsest
+	constexpr int PRE_SWEEPS = 2;
+	constexpr int POST_SWEEPS = 2;
+	constexpr int COARSE_SWEEPS = 32;
+}
+
+Multigrid::Multigrid(int size)
+{
+	// The finest level works on the caller's fields, it only needs a residual
+	m_levels.push_back(Level{ size, AlignedBuffer<float>(), AlignedBuffer<float>(), AlignedBuffer<float>(static_cast<std::size_t>(size) * size) });
+
+	int interior = size - 2;
+	while (interior > COARSEST_INTERIOR)
+	{
+		interior = (interior + 1) / 2;
+		const int n = interior + 2;
+		const std::size_t cells = static_cast<std::size_t>(n) * n;
+		m_levels.push_back(Level{ n, AlignedBuffer<float>(cells), AlignedBuffer<float>(cells), AlignedBuffer<float>(cells) });
+	}
+}
+
+void Multigrid::Solve(float* p, const float* div, int cycles, const Smoother& smooth)
+{
+	for (int cycle = 0; cycle < cycles; cycle++)
+		VCycle(0, p, div, smooth);
+}
+
+void Multigrid::VCycle(int level, float* x, const float* rhs, const Smoother& smooth)
+{
+	Level& fine = m_levels[level];
+	if (level + 1 == GetLevelCount())
+	{
+		smooth(fine.n, x, rhs, COARSE_SWEEPS);
+		return;
+	}
+
+	smooth(fine.n, x, rhs, PRE_SWEEPS);
+	ComputeResidual(fine.n, x, rhs, fine.residual.data());
+
+	Level& coarse = m_levels[level + 1];
+	Restrict(fine.n, fine.residual.data(), coarse.n, coarse.rhs.data());
+	coarse.x.Clear();
+	VCycle(level + 1, coarse.x.data(), coarse.rhs.data(), smooth);
+
+	ProlongAndCorrect(coarse.n, coarse.x.data(), fine.n, x);
+	kernels::SetBoundary<0>(fine.n, 0, x);
+	smooth(fine.n, x, rhs, POST_SWEEPS);
+}
+
+void Multigrid::ComputeResidual(int n, const float* x, const float* rhs, float* residual) noexcept
+{
+	const int N = n;
+	std::fill_n(residual, N, 0.0f);
+	std::fill_n(residual + (N - 1) * N, N, 0.0f);
+	for (int j = 1; j < N - 1; j++)
+	{
+		const float* row = x + j * N;
+		const float* src = rhs + j * N;
+		float* dst = residual + j * N;
+		dst[0] = dst[N - 1] = 0.0f;
+		for (int i = 1; i < N - 1; i++)
+			dst[i] = src[i] - (4.0f * row[i] - row[i - 1] - row[i + 1] - row[i - N] - row[i + N]);
+	}
+}
+
+void Multigrid::Restrict(int fineN, const float* fine, int coarseN, float* coarse) noexcept
+{
+	// The coarse cell is twice as wide, so its equation (scaled by h²) takes 4 times the average residual, the sum.
+	// Odd fine interiors make the last coarse cell overlap the wall ring, whose residual is zero.
+	for (int J = 1; J < coarseN - 1; J++)
+	{
+		const float* fineRow0 = fine + (2 * J - 1) * fineN;
+		const float* fineRow1 = fineRow0 + fineN;
+		float* dst = coarse + J * coarseN;
+		for (int I = 1; I < coarseN - 1; I++)
+		{
+			const int i = 2 * I - 1;
+			dst[I] = fineRow0[i] + fineRow0[i + 1] + fineRow1[i] + fineRow1[i + 1];
+		}
+	}
+}
+
+void Multigrid::ProlongAndCorrect(int coarseN, const float* coarse, int fineN, float* fine) noexcept
+{
+	// Fine cell centers sit a quarter of a coarse cell from their parent's center:
+	// 3/4 of the parent and 1/4 of the next coarse cell on that side, per axis (the wall ring included).
+	for (int j = 1; j < fineN - 1; j++)
+	{
+		const int J = (j + 1) / 2;
+		const int Jn = (j & 1) ? J - 1 : J + 1;
+		const float* c0 = coarse + J * coarseN;
+		const float* c1 = coarse + Jn * coarseN;
+		float* dst = fine + j * fineN;
+		for (int i = 1; i < fineN - 1; i++)
+		{
+			const int I = (i + 1) / 2;
+			const int In = (i & 1) ? I - 1 : I + 1;
+			dst[i] += 0.5625f * c0[I] + 0.1875f * (c0[In] + c1[I]) + 0.0625f * c1[In];
+		}
+	}
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <functional>
+#include <vector>
+#include "aligned_buffer.hpp"
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Geometric multigrid V-cycle for the pressure equation Project solves:
+	*	4 * p - (p left + p right + p up + p down) = div, with the walls mirroring p (SetBoundary 0).
+	*
+	*	Relaxation alone (LinearSolve) only damps the error a few cells wide, the smooth part of it
+	*	takes a number of sweeps that grows with N². Each level here halves the grid, so the same smoothing
+	*	removes ever wider error on ever cheaper grids, and a V-cycle costs about 4/3 of its finest level sweeps.
+	*
+	*	Levels are cell centered: coarse cell (I, J) covers fine cells (2I-1..2I, 2J-1..2J),
+	*	residuals are summed onto it (restriction) and corrections are spread back bilinearly (prolongation).
+	*/
+	class Multigrid {
+	public:
+		/**
+		*	Relaxes sweeps times x toward 4 * x - neighbours = rhs on an n*n level, boundaries included.
+		*	This is the LinearSolve kernel of the owning Fluid (a = 1, c = 4).
+		*/
+		using Smoother = std::function<void(int n, float* x, const float* rhs, int sweeps)>;
+
+	public:
+		// size is the finest grid size (N), levels go down until the interior is a few cells wide
+		explicit Multigrid(int size);
+
+	public:
+		// Runs cycles V-cycles on p, using its current values as the initial guess
+		void Solve(float* p, const float* div, int cycles, const Smoother& smooth);
+
+		// Runs one V-cycle on p
+		void Cycle(float* p, const float* div, const Smoother& smooth) { VCycle(0, p, div, smooth); }
+
+		int GetLevelCount() const noexcept { return static_cast<int>(m_levels.size()); }
+
+	private:
+		struct Level {
+			int n; // Grid size, interior is n - 2
+			AlignedBuffer<float> x; // Solution (error correction on coarse levels)
+			AlignedBuffer<float> rhs;
+			AlignedBuffer<float> residual;
+		};
+
+		void VCycle(int level, float* x, const float* rhs, const Smoother& smooth);
+		static void ComputeResidual(int n, const float* x, const float* rhs, float* residual) noexcept;
+		static void Restrict(int fineN, const float* fine, int coarseN, float* coarse) noexcept;
+		static void ProlongAndCorrect(int coarseN, const float* coarse, int fineN, float* fine) noexcept;
+
+	private:
+		std::vector<Level> m_levels; // [0] is the finest, its x and rhs are the caller's p and div
+	};
+}
@@ -0,0 +1,109 @@
+#include "obstacle_map.hpp"
+#include <algorithm>	// std::min, std::max, std::fill, std::copy_n
+#include <cmath>	// std::ceil, std::floor
+using namespace xtd_fluid_simulation;
+
+ObstacleMap::ObstacleMap(int n)
+	:
+	m_size(n),
+	m_words_per_row((n + 63) / 64),
+	m_bits(static_cast<std::size_t>(m_words_per_row) * n, 0),
+	m_row_cells(n + 1, 0)
+{
+}
+
+void ObstacleMap::SetSolid(int x, int y, bool solid) noexcept
+{
+	std::uint64_t& word = m_bits[static_cast<std::size_t>(y) * m_words_per_row + (x >> 6)];
+	const std::uint64_t bit = std::uint64_t(1) << (x & 63);
+	word = solid ? word | bit : word & ~bit;
+}
+
+void ObstacleMap::Paint(float x, float y, float radius, bool solid)
+{
+	const int N = m_size;
+	const auto interior = [N](int v) { return std::min(std::max(v, 1), N - 2); };
+	if (radius < 1.0f)
+	{
+		SetSolid(interior(static_cast<int>(x)), interior(static_cast<int>(y)), solid);
+	}
+	else
+	{
+		const int rowBegin = std::max(static_cast<int>(std::ceil(y - radius)), 1);
+		const int rowEnd = std::min(static_cast<int>(std::floor(y + radius)) + 1, N - 1);
+		const int colBegin = std::max(static_cast<int>(std::ceil(x - radius)), 1);
+		const int colEnd = std::min(static_cast<int>(std::floor(x + radius)) + 1, N - 1);
+		for (int j = rowBegin; j < rowEnd; j++)
+			for (int i = colBegin; i < colEnd; i++)
+				if ((i - x) * (i - x) + (j - y) * (j - y) <= radius * radius)
+					SetSolid(i, j, solid);
+	}
+	BuildCells();
+}
+
+void ObstacleMap::SetFromImage(const std::uint8_t* luminance, int width, int height)
+{
+	const int N = m_size;
+	std::fill(m_bits.begin(), m_bits.end(), 0);
+	// The image is stretched over the whole grid, walls included, each cell sampling the pixel under its center
+	for (int j = 1; j < N - 1; j++)
+	{
+		const int py = std::min(static_cast<int>((j + 0.5f) * height / N), height - 1);
+		for (int i = 1; i < N - 1; i++)
+		{
+			const int px = std::min(static_cast<int>((i + 0.5f) * width / N), width - 1);
+			SetSolid(i, j, luminance[static_cast<std::size_t>(py) * width + px] < 128);
+		}
+	}
+	BuildCells();
+}
+
+void ObstacleMap::SetBits(const std::uint64_t* bits)
+{
+	std::copy_n(bits, m_bits.size(), m_bits.begin());
+	// The outer ring is the wall
+	for (int j = 0; j < m_size; j++)
+	{
+		const bool wallRow = j == 0 || j == m_size - 1;
+		for (int i = 0; i < m_size; i++)
+			if (wallRow || i == 0 || i == m_size - 1)
+				SetSolid(i, j, false);
+	}
+	BuildCells();
+}
+
+void ObstacleMap::Clear()
+{
+	std::fill(m_bits.begin(), m_bits.end(), 0);
+	BuildCells();
+}
+
+void ObstacleMap::BuildCells()
+{
+	const int N = m_size;
+	// A neighbour counts when it is a fluid interior cell
+	const auto fluid = [this, N](int x, int y) { return x >= 1 && x < N - 1 && y >= 1 && y < N - 1 && !IsSolid(x, y); };
+	m_cells.clear();
+	for (int j = 0; j < N; j++)
+	{
+		m_row_cells[j] = static_cast<int>(m_cells.size());
+		const std::uint64_t* row = m_bits.data() + static_cast<std::size_t>(j) * m_words_per_row;
+		// Word by word, a row without obstacles costs a few empty words
+		for (int w = 0; w < m_words_per_row; w++)
+		{
+			for (std::uint64_t word = row[w]; word != 0; word &= word - 1)
+			{
+				int bit = 0;
+				while (!((word >> bit) & 1u))
+					bit++;
+				const int i = w * 64 + bit;
+				const float left = fluid(i - 1, j), right = fluid(i + 1, j), up = fluid(i, j - 1), down = fluid(i, j + 1);
+				const float count = left + right + up + down;
+				const float weight = count > 0.0f ? 1.0f / count : 0.0f;
+				m_cells.push_back({ i + N * j, left * weight, right * weight, up * weight, down * weight });
+			}
+		}
+	}
+	m_row_cells[N] = static_cast<int>(m_cells.size());
+	m_version++;
+}
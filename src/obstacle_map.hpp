@@ -0,0 +1,94 @@
+#pragma once
+#include <cstddef>	// std::size_t
+#include <cstdint>
+#include <vector>
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Solid cells inside an n*n grid (see Fluid::PaintObstacle), as a packed bitmask: one bit per cell, rows of whole 64-bit words.
+	*
+	*	The stencils never look at it: they relax, advect and project solid cells like any other, and Apply then overwrites
+	*	every solid cell the way SetBoundary overwrites the outer wall, from its fluid neighbours. It walks a compact list of
+	*	the solid cells, in row major order, each with the weight of its four neighbours precomputed (1 / its fluid neighbours
+	*	for a fluid one, 0 for a solid one or the wall), so the pass is the same multiply-add for every cell whatever its shape.
+	*	A solid cell with no fluid neighbour ends up 0. The list is rebuilt by every change of the mask.
+	*
+	*	Only interior cells can be solid, the outer ring stays SetBoundary's.
+	*/
+	class ObstacleMap {
+	public:
+		// A solid cell: its index and the weights of its left (x - 1), right (x + 1), up (y - 1) and down (y + 1) neighbours
+		struct Cell {
+			int index;
+			float left, right, up, down;
+		};
+
+	public:
+		explicit ObstacleMap(int n);
+
+		// Makes the cells within radius of (x, y) solid (or fluid again), the single cell (x, y) below a radius of 1, clamped onto the interior
+		void Paint(float x, float y, float radius, bool solid);
+		// Every interior cell solid where the cell's center falls on a dark pixel (below 128) of a width * height, row major luminance image
+		void SetFromImage(const std::uint8_t* luminance, int width, int height);
+		// Replaces the whole mask (as GetBits lays it out, from a checkpoint), bits outside the interior are ignored
+		void SetBits(const std::uint64_t* bits);
+		void Clear();
+
+		bool IsSolid(int x, int y) const noexcept { return (m_bits[static_cast<std::size_t>(y) * m_words_per_row + (x >> 6)] >> (x & 63)) & 1u; }
+		bool IsEmpty() const noexcept { return m_cells.empty(); }
+		int GetSize() const noexcept { return m_size; }
+		int GetSolidCount() const noexcept { return static_cast<int>(m_cells.size()); }
+		// Row major, GetWordsPerRow() words per row, bit x % 64 of word x / 64 is cell x
+		const std::vector<std::uint64_t>& GetBits() const noexcept { return m_bits; }
+		int GetWordsPerRow() const noexcept { return m_words_per_row; }
+		const std::vector<Cell>& GetCells() const noexcept { return m_cells; }
+		// Incremented by every change, so a copy of the mask knows when it is stale
+		std::uint64_t GetVersion() const noexcept { return m_version; }
+
+		/**
+		*	Sets the solid cells of rows [rowBegin, rowEnd) of x from their fluid neighbours, mirrored like SetBoundary's walls:
+		*	b = 1 (x velocity) negates the left and right neighbours, b = 2 (y velocity) the up and down ones.
+		*	Only reads fluid cells, so the solid cells of a row can be set while other threads work on other rows.
+		*/
+		template<typename T>
+		void Apply(int b, T* x, int rowBegin, int rowEnd) const noexcept
+		{
+			const int N = m_size;
+			const float sx = b == 1 ? -1.0f : 1.0f;
+			const float sy = b == 2 ? -1.0f : 1.0f;
+			const Cell* end = m_cells.data() + m_row_cells[rowEnd];
+			for (const Cell* cell = m_cells.data() + m_row_cells[rowBegin]; cell != end; ++cell)
+			{
+				T* at = x + cell->index;
+				*at = sx * (cell->left * at[-1] + cell->right * at[1]) + sy * (cell->up * at[-N] + cell->down * at[N]);
+			}
+		}
+
+		// Apply to both velocity components in one pass over the list
+		template<typename T>
+		void ApplyVelocity(T* velocX, T* velocY, int rowBegin, int rowEnd) const noexcept
+		{
+			const int N = m_size;
+			const Cell* end = m_cells.data() + m_row_cells[rowEnd];
+			for (const Cell* cell = m_cells.data() + m_row_cells[rowBegin]; cell != end; ++cell)
+			{
+				T* vx = velocX + cell->index;
+				T* vy = velocY + cell->index;
+				*vx = -(cell->left * vx[-1] + cell->right * vx[1]) + (cell->up * vx[-N] + cell->down * vx[N]);
+				*vy = (cell->left * vy[-1] + cell->right * vy[1]) - (cell->up * vy[-N] + cell->down * vy[N]);
+			}
+		}
+
+	private:
+		void SetSolid(int x, int y, bool solid) noexcept;
+		void BuildCells();
+
+	private:
+		int m_size;
+		int m_words_per_row;
+		std::vector<std::uint64_t> m_bits;
+		std::vector<Cell> m_cells;
+		std::vector<int> m_row_cells; // Per row, index of its first cell in m_cells (plus the end)
+		std::uint64_t m_version = 0;
+	};
+}
@@ -0,0 +1,85 @@
+#include "profiler.hpp"
+#include <algorithm>	// std::nth_element
+#include <cstdio>
+using namespace xtd_fluid_simulation;
+
+const char* xtd_fluid_simulation::ToString(Stage stage) noexcept
+{
+	switch (stage)
+	{
+		case Stage::Inject: return "Inject";
+		case Stage::DiffuseVelocityX: return "Diffuse vx";
+		case Stage::DiffuseVelocityY: return "Diffuse vy";
+		case Stage::ProjectDiffused: return "Project 1";
+		case Stage::AdvectVelocityX: return "Advect vx";
+		case Stage::AdvectVelocityY: return "Advect vy";
+		case Stage::AdvectVelocity: return "Advect vx+vy";
+		case Stage::ProjectAdvected: return "Project 2";
+		case Stage::DiffuseDensity: return "Diffuse density";
+		case Stage::AdvectDensity: return "Advect density";
+		case Stage::RetireTiles: return "Retire tiles";
+		case Stage::Draw: return "Draw";
+		default: return "?";
+	}
+}
+
+void Profiler::Record(const FrameSample& frame) noexcept
+{
+	m_frames[m_next] = frame;
+	m_next = (m_next + 1) % CAPACITY;
+	m_count = std::min(m_count + 1, CAPACITY);
+}
+
+const FrameSample& Profiler::GetFrame(int age) const noexcept
+{
+	return m_frames[(m_next - 1 - age + 2 * CAPACITY) % CAPACITY];
+}
+
+float Profiler::Percentile(Stage stage, float p) const noexcept
+{
+	std::array<std::int64_t, CAPACITY> durations;
+	int count = 0;
+	for (int age = 0; age < m_count; ++age)
+	{
+		const std::int64_t nanoseconds = GetFrame(age)[stage].nanoseconds;
+		if (nanoseconds >= 0)
+			durations[count++] = nanoseconds;
+	}
+	if (count == 0)
+		return -1.0f;
+
+	const int rank = std::min(static_cast<int>(std::max(p, 0.0f) * count), count - 1);
+	std::nth_element(durations.begin(), durations.begin() + rank, durations.begin() + count);
+	return durations[rank] / 1.0e6f;
+}
+
+bool Profiler::WriteChromeTrace(const std::string& path) const
+{
+	std::FILE* file = std::fopen(path.c_str(), "w");
+	if (!file)
+		return false;
+
+	// Complete ("X") events in microseconds, simulation stages on a track per lane (tids 1, 3, 4) and drawing on another
+	std::fputs("{\"traceEvents\":[\n", file);
+	std::fputs("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Simulation\"}},\n", file);
+	std::fputs("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"Draw\"}},\n", file);
+	std::fputs("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":3,\"args\":{\"name\":\"Simulation vy\"}},\n", file);
+	std::fputs("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":4,\"args\":{\"name\":\"Simulation density\"}}", file);
+	for (int age = m_count - 1; age >= 0; --age)
+	{
+		const FrameSample& frame = GetFrame(age);
+		for (int index = 0; index < STAGE_COUNT; ++index)
+		{
+			const Stage stage = static_cast<Stage>(index);
+			const StageSample& sample = frame[stage];
+			if (sample.nanoseconds < 0)
+				continue;
+			std::fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"frame\":%llu,\"iterations\":%d,\"bytes\":%lld}}",
+				ToString(stage), stage == Stage::Draw ? 2 : sample.lane == 0 ? 1 : 2 + sample.lane,
+				sample.start / 1.0e3, sample.nanoseconds / 1.0e3,
+				static_cast<unsigned long long>(frame.frame), sample.iterations, static_cast<long long>(sample.bytes));
+		}
+	}
+	std::fputs("\n],\"displayTimeUnit\":\"ms\"}\n", file);
+	return std::fclose(file) == 0;
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Stage timers cost two clock reads per stage, build with FLUID_PROFILING=0 to compile them out
+#ifndef FLUID_PROFILING
+#define FLUID_PROFILING 1
+#endif
+
+namespace xtd_fluid_simulation {
+	// Timed parts of a frame, the Fluid::Update stages in the order they run, then drawing
+	enum class Stage {
+		Inject, // Queued brushes and forces (Fluid::AddBrush, Fluid::AddForce)
+		DiffuseVelocityX,
+		DiffuseVelocityY,
+		ProjectDiffused, // Project of the diffused velocity
+		AdvectVelocityX,
+		AdvectVelocityY,
+		AdvectVelocity, // Both components in one pass, instead of the two above (Fluid::set_fused_passes)
+		ProjectAdvected, // Project of the advected velocity
+		DiffuseDensity,
+		AdvectDensity,
+		RetireTiles, // Quiet tiles dropped from the active set (Fluid::set_sparse_tiles)
+		Draw, // main_form::on_animation_draw, UI thread
+		Count
+	};
+	inline constexpr const int STAGE_COUNT = static_cast<int>(Stage::Count);
+
+	const char* ToString(Stage stage) noexcept;
+
+	struct StageSample {
+		std::int64_t start = 0; // ProfileClock() when the stage began
+		std::int64_t nanoseconds = -1; // -1 when the stage did not run (or profiling is compiled out)
+		int iterations = 0; // LinearSolve sweeps (multigrid V-cycles) run by the stage
+		std::int64_t bytes = 0; // Modeled memory traffic of the stage, see Fluid::get_frame_sample
+		int lane = 0; // Stages of different lanes may run at the same time (Fluid::set_task_graph)
+	};
+
+	struct FrameSample {
+		std::uint64_t frame = 0;
+		std::array<StageSample, STAGE_COUNT> stages{};
+
+		StageSample& operator[](Stage stage) noexcept { return stages[static_cast<int>(stage)]; }
+		const StageSample& operator[](Stage stage) const noexcept { return stages[static_cast<int>(stage)]; }
+	};
+
+	// Nanoseconds on a steady clock shared by every thread, so stages timed on different threads line up in a trace
+	inline std::int64_t ProfileClock() noexcept
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+
+	// Times the enclosing scope into one stage of a frame sample
+	class ScopedStageTimer {
+	public:
+		ScopedStageTimer(FrameSample& frame, Stage stage) noexcept : m_sample(frame[stage]) { m_sample.start = ProfileClock(); }
+		~ScopedStageTimer() { m_sample.nanoseconds = ProfileClock() - m_sample.start; }
+
+		ScopedStageTimer(const ScopedStageTimer&) = delete;
+		ScopedStageTimer& operator=(const ScopedStageTimer&) = delete;
+
+	private:
+		StageSample& m_sample;
+	};
+
+	/**
+	*	Fixed-size ring of the latest frame samples, no allocation once constructed.
+	*	Not thread safe: record and read it on one thread.
+	*/
+	class Profiler {
+	public:
+		inline static constexpr const int CAPACITY = 512;
+
+	public:
+		void Record(const FrameSample& frame) noexcept;
+		void Clear() noexcept { m_count = 0; m_next = 0; }
+
+		// Recorded frames, at most CAPACITY, age 0 is the latest
+		int GetCount() const noexcept { return m_count; }
+		const FrameSample& GetFrame(int age) const noexcept;
+
+		// p-th percentile (0 to 1) of a stage's milliseconds over the frames it ran in, -1 when it never ran
+		float Percentile(Stage stage, float p) const noexcept;
+
+		// Writes the recorded frames in Chrome trace event format (chrome://tracing, Perfetto), false when the file cannot be written
+		bool WriteChromeTrace(const std::string& path) const;
+
+	private:
+		std::array<FrameSample, CAPACITY> m_frames{};
+		int m_count = 0;
+		int m_next = 0;
+	};
+}
+
+#define FLUID_PROFILE_CONCAT_(a, b) a##b
+#define FLUID_PROFILE_CONCAT(a, b) FLUID_PROFILE_CONCAT_(a, b)
+#if FLUID_PROFILING
+#define FLUID_PROFILE_STAGE(frame, stage) ::xtd_fluid_simulation::ScopedStageTimer FLUID_PROFILE_CONCAT(stageTimer, __LINE__)(frame, stage)
+#else
+#define FLUID_PROFILE_STAGE(frame, stage) ((void)0)
+#endif
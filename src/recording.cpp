@@ -0,0 +1,198 @@
+#include "recording.hpp"
+#include <stdexcept>
+#include <type_traits>	// std::is_trivially_copyable_v
+using namespace xtd_fluid_simulation;
+
+namespace {
+	constexpr char RECORDING_MAGIC[8] = { 'X', 'F', 'L', 'U', 'I', 'D', 'R', 'C' };
+
+	struct RecordingHeader {
+		char magic[8];
+		std::uint32_t version;
+		std::int32_t size;
+		std::uint32_t frameCount; // Written by Close, 0 while recording
+		std::uint32_t keyInterval;
+	};
+
+	struct FrameHeader {
+		std::uint32_t kind; // FrameKind
+		std::uint32_t bytes; // Of the payload that follows
+	};
+	static_assert(std::is_trivially_copyable_v<RecordingHeader> && sizeof(RecordingHeader) == 24, "RecordingHeader is written as is");
+	static_assert(std::is_trivially_copyable_v<FrameHeader> && sizeof(FrameHeader) == 8, "FrameHeader is written as is");
+
+	enum FrameKind : std::uint32_t { KEY_FRAME = 0, DELTA_FRAME = 1 };
+
+	// A run header costs 4 bytes, unchanged gaps shorter than that are cheaper as literals
+	constexpr std::size_t MIN_GAP = 4;
+	constexpr std::size_t MAX_RUN = 0xffff;
+
+	// Runs of alpha against previous (see the format in recording.hpp), appended to out
+	void EncodeDelta(const std::uint8_t* alpha, const std::uint8_t* previous, std::size_t cells, std::vector<std::uint8_t>& out)
+	{
+		std::size_t cell = 0;
+		while (cell < cells)
+		{
+			const std::size_t unchangedBegin = cell;
+			while (cell < cells && cell - unchangedBegin < MAX_RUN && alpha[cell] == previous[cell])
+				++cell;
+			if (cell == cells)
+				break;
+
+			// Up to the last changed cell before a long enough unchanged gap
+			const std::size_t changedBegin = cell;
+			std::size_t changedEnd = cell;
+			while (cell < cells && cell - changedBegin < MAX_RUN)
+			{
+				if (alpha[cell] != previous[cell])
+					changedEnd = ++cell;
+				else if (cell - changedEnd >= MIN_GAP)
+					break;
+				else
+					++cell;
+			}
+			cell = changedEnd;
+
+			const std::uint16_t run[2] = { static_cast<std::uint16_t>(changedBegin - unchangedBegin), static_cast<std::uint16_t>(changedEnd - changedBegin) };
+			const std::size_t at = out.size();
+			out.resize(at + sizeof(run) + run[1]);
+			std::memcpy(out.data() + at, run, sizeof(run));
+			std::memcpy(out.data() + at + sizeof(run), alpha + changedBegin, run[1]);
+		}
+	}
+}
+
+void xtd_fluid_simulation::QuantizeDensity(const float* density, std::uint8_t* alpha, std::size_t cells) noexcept
+{
+	for (std::size_t cell = 0; cell < cells; ++cell)
+		alpha[cell] = static_cast<std::uint8_t>(std::min(std::max(density[cell], 0.0f), 255.0f));
+}
+
+RecordingWriter::RecordingWriter(const std::string& path, int size, int keyInterval)
+	:
+	m_size(size),
+	m_key_interval(std::max(keyInterval, 1)),
+	m_file(path, std::ios::binary | std::ios::trunc),
+	m_writer(static_cast<std::size_t>(size) * size),
+	m_previous(static_cast<std::size_t>(size) * size)
+{
+	RecordingHeader header{};
+	std::memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+	header.version = RECORDING_VERSION;
+	header.size = size;
+	header.keyInterval = static_cast<std::uint32_t>(m_key_interval);
+	if (!m_file.write(reinterpret_cast<const char*>(&header), sizeof(header)))
+		throw std::runtime_error("cannot write recording " + path);
+	m_bytes.store(sizeof(header), std::memory_order_relaxed);
+
+	m_encoded.reserve(m_previous.size());
+	m_writer.Start([this](const std::uint8_t* alpha) { WriteFrame(alpha); });
+}
+
+RecordingWriter::~RecordingWriter()
+{
+	Close();
+}
+
+bool RecordingWriter::Append(const float* density, bool wait) noexcept
+{
+	const std::size_t cells = m_previous.size();
+	return m_writer.Append([density, cells](std::uint8_t* alpha) { QuantizeDensity(density, alpha, cells); }, wait);
+}
+
+bool RecordingWriter::Close()
+{
+	if (!m_writer.IsRunning())
+		return !m_failed.load(std::memory_order_relaxed);
+	m_writer.Stop();
+
+	// Readers index the frames whatever this says, it tells tools the file is complete
+	const std::uint32_t frameCount = static_cast<std::uint32_t>(m_written);
+	m_file.seekp(offsetof(RecordingHeader, frameCount));
+	m_file.write(reinterpret_cast<const char*>(&frameCount), sizeof(frameCount));
+	m_file.close();
+	if (!m_file)
+		m_failed.store(true, std::memory_order_relaxed);
+	return !m_failed.load(std::memory_order_relaxed);
+}
+
+void RecordingWriter::WriteFrame(const std::uint8_t* alpha)
+{
+	if (m_failed.load(std::memory_order_relaxed))
+		return;
+
+	const std::size_t cells = m_previous.size();
+	FrameHeader header{ KEY_FRAME, static_cast<std::uint32_t>(cells) };
+	const std::uint8_t* payload = alpha;
+	if (m_written % m_key_interval != 0)
+	{
+		m_encoded.clear();
+		EncodeDelta(alpha, m_previous.data(), cells, m_encoded);
+		// A frame that changed almost everywhere is smaller as a key frame
+		if (m_encoded.size() < cells)
+		{
+			header = { DELTA_FRAME, static_cast<std::uint32_t>(m_encoded.size()) };
+			payload = m_encoded.data();
+		}
+	}
+
+	m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_file.write(reinterpret_cast<const char*>(payload), header.bytes);
+	if (!m_file)
+	{
+		m_failed.store(true, std::memory_order_relaxed);
+		return;
+	}
+	std::copy_n(alpha, cells, m_previous.data());
+	++m_written;
+	m_bytes.fetch_add(static_cast<std::int64_t>(sizeof(header) + header.bytes), std::memory_order_relaxed);
+}
+
+RecordingReader::RecordingReader(const std::string& path)
+	:
+	m_file(path)
+{
+	RecordingHeader header{};
+	if (m_file.size() < sizeof(header))
+		throw std::runtime_error(path + ": not a recording");
+	std::memcpy(&header, m_file.data(), sizeof(header));
+	if (std::memcmp(header.magic, RECORDING_MAGIC, sizeof(header.magic)) != 0)
+		throw std::runtime_error(path + ": not a recording");
+	if (header.version != RECORDING_VERSION)
+		throw std::runtime_error(path + ": recording version " + std::to_string(header.version) + ", expected " + std::to_string(RECORDING_VERSION));
+	if (header.size < 1)
+		throw std::runtime_error(path + ": bad grid size " + std::to_string(header.size));
+	m_size = header.size;
+	m_key_interval = static_cast<int>(header.keyInterval);
+
+	// Up to the last complete frame, the first one must be a key frame
+	const std::size_t cells = static_cast<std::size_t>(m_size) * m_size;
+	std::size_t offset = sizeof(header);
+	m_frames.reserve(header.frameCount);
+	while (m_file.size() - offset >= sizeof(FrameHeader))
+	{
+		FrameHeader frame;
+		std::memcpy(&frame, m_file.data() + offset, sizeof(frame));
+		offset += sizeof(frame);
+		if (m_file.size() - offset < frame.bytes)
+			break;
+		const bool key = frame.kind == KEY_FRAME;
+		if ((key && frame.bytes != cells) || (!key && (frame.kind != DELTA_FRAME || m_frames.empty())))
+			throw std::runtime_error(path + ": damaged frame " + std::to_string(m_frames.size()));
+		m_frames.push_back({ offset, frame.bytes, key });
+		offset += frame.bytes;
+	}
+}
+
+int RecordingReader::GetKeyFrame(int frame) const noexcept
+{
+	while (frame > 0 && !m_frames[frame].key)
+		--frame;
+	return frame;
+}
+
+void RecordingReader::ReadFrame(int frame, std::uint8_t* alpha) const
+{
+	for (int index = GetKeyFrame(frame); index <= frame; ++index)
+		ForEachRun(index, [alpha](std::size_t cell, const std::uint8_t* values, std::size_t count) { std::memcpy(alpha + cell, values, count); });
+}
@@ -0,0 +1,144 @@
+#pragma once
+#include <algorithm>	// std::min
+#include <atomic>
+#include <cstddef>	// std::size_t
+#include <cstdint>
+#include <cstring>	// std::memcpy
+#include <fstream>
+#include <string>
+#include <vector>
+#include "background_writer.hpp"
+#include "mapped_file.hpp"
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Recordings hold the density of every step as the 8-bit alpha fluid_renderer draws it (clamped to 0..255, truncated),
+	*	so a replay shows exactly what was on screen without stepping anything.
+	*	File (native byte order): a header (magic, RECORDING_VERSION, grid size, frame count, key frame interval), then frames,
+	*	each a kind, a payload size and the payload:
+	*	- key frames, the n*n alphas
+	*	- delta frames, runs against the frame before: cells left as they were (u16), then cells changed (u16) and their alphas
+	*	A key frame every key frame interval bounds how many frames a seek decodes.
+	*/
+	inline constexpr const std::uint32_t RECORDING_VERSION = 1;
+
+	// Density to alpha, the mapping fluid_renderer draws with
+	void QuantizeDensity(const float* density, std::uint8_t* alpha, std::size_t cells) noexcept;
+
+	/**
+	*	Streams frames to a recording file: Append only quantizes the density into a pooled frame and queues it,
+	*	a BackgroundWriter thread delta encodes and writes them, so the stepping thread never waits on the disk.
+	*	When the writer falls POOL frames behind, frames are dropped (counted) instead (unless Append is asked to wait):
+	*	a replay then skips a step, the next delta is still against the last frame written.
+	*/
+	class RecordingWriter {
+	public:
+		inline static constexpr const int DEFAULT_KEY_INTERVAL = 60;
+		inline static constexpr const std::size_t POOL = 8;
+
+	public:
+		// Creates path, throws std::runtime_error naming it when it cannot be written
+		RecordingWriter(const std::string& path, int size, int keyInterval = DEFAULT_KEY_INTERVAL);
+		~RecordingWriter();
+
+		RecordingWriter(const RecordingWriter&) = delete;
+		RecordingWriter& operator=(const RecordingWriter&) = delete;
+
+	public:
+		// Queues density (n*n) as the next frame, false when it was dropped (or the writer is closed). wait blocks for a free frame instead
+		bool Append(const float* density, bool wait = false) noexcept;
+
+		// Writes what is queued, completes the header and closes the file, false if anything could not be written. Called by the destructor
+		bool Close();
+
+		int get_size() const noexcept { return m_size; }
+		// Frames queued so far
+		int get_frame_count() const noexcept { return m_writer.get_appended(); }
+		int get_dropped_frames() const noexcept { return m_writer.get_dropped(); }
+		std::int64_t get_bytes_written() const noexcept { return m_bytes.load(std::memory_order_relaxed); }
+
+	private:
+		void WriteFrame(const std::uint8_t* alpha);
+
+	private:
+		int m_size;
+		int m_key_interval;
+		std::ofstream m_file;
+		BackgroundWriter<std::uint8_t, POOL> m_writer;
+
+		// Writer thread
+		std::vector<std::uint8_t> m_previous; // Last frame written
+		std::vector<std::uint8_t> m_encoded; // Delta of the frame being written
+		int m_written = 0;
+		std::atomic<std::int64_t> m_bytes{ 0 };
+		std::atomic<bool> m_failed{ false };
+	};
+
+	/**
+	*	Memory maps a recording and hands out its frames straight from the mapping, nothing is copied or decoded up front.
+	*	Frames of a recording that was not closed (crash, still being written) are read up to the last complete one.
+	*/
+	class RecordingReader {
+	public:
+		// Maps and indexes path, throws std::runtime_error naming it when it is not a recording of this version
+		explicit RecordingReader(const std::string& path);
+
+	public:
+		int get_size() const noexcept { return m_size; }
+		int get_frame_count() const noexcept { return static_cast<int>(m_frames.size()); }
+		int get_key_interval() const noexcept { return m_key_interval; }
+		bool IsKeyFrame(int frame) const noexcept { return m_frames[frame].key; }
+		// The key frame decoding frame starts from (frame itself when it is one)
+		int GetKeyFrame(int frame) const noexcept;
+
+		/**
+		*	Calls fn(std::size_t cell, const std::uint8_t* alpha, std::size_t count) for each run of cells frame sets, row major,
+		*	alpha pointing into the mapping: the whole grid for a key frame, the cells that changed since frame - 1 for a delta frame.
+		*	Applied from GetKeyFrame(frame) up to frame, they give frame.
+		*/
+		template<typename Fn>
+		void ForEachRun(int frame, Fn&& fn) const
+		{
+			const Frame& header = m_frames[frame];
+			const std::uint8_t* payload = m_file.data() + header.offset;
+			const std::size_t cells = static_cast<std::size_t>(m_size) * m_size;
+			if (header.key)
+			{
+				fn(std::size_t{ 0 }, payload, cells);
+				return;
+			}
+
+			const std::uint8_t* const end = payload + header.bytes;
+			std::size_t cell = 0;
+			while (end - payload >= 4)
+			{
+				std::uint16_t run[2]; // Unchanged, changed
+				std::memcpy(run, payload, sizeof(run));
+				payload += sizeof(run);
+				cell += run[0];
+				// A damaged run is cut at the end of the frame and of the grid
+				const std::size_t literals = std::min<std::size_t>(run[1], static_cast<std::size_t>(end - payload));
+				const std::size_t count = std::min(literals, cells - std::min(cell, cells));
+				if (count > 0)
+					fn(cell, payload, count);
+				payload += literals;
+				cell += literals;
+			}
+		}
+
+		// Decodes frame into alpha (n*n), from its key frame
+		void ReadFrame(int frame, std::uint8_t* alpha) const;
+
+	private:
+		struct Frame {
+			std::size_t offset; // Of the payload
+			std::uint32_t bytes;
+			bool key;
+		};
+
+		MappedFile m_file;
+		int m_size = 0;
+		int m_key_interval = 0;
+		std::vector<Frame> m_frames;
+	};
+}
@@ -0,0 +1,1019 @@
+#include "simd_kernels.hpp"
+#include <type_traits>	// std::is_same_v
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define FLUID_X86 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FLUID_TARGET(isa) __attribute__((target(isa)))
+#else
+#define FLUID_TARGET(isa) // MSVC lets every intrinsic through
+#endif
+
+using namespace xtd_fluid_simulation;
+
+#ifdef FLUID_X86
+namespace {
+	// Whether every field type is float, the AVX-512 kernels take float fields only
+	template<typename... T>
+	inline constexpr bool ALL_FLOAT = (std::is_same_v<T, float> && ...);
+
+	// 8 cells of a field as floats, whatever it is stored as: F16C converts a Float16, a BFloat16 is the upper half of its float
+	FLUID_TARGET("avx2,fma")
+	inline __m256 LoadAvx2(const float* x) noexcept
+	{
+		return _mm256_loadu_ps(x);
+	}
+
+	FLUID_TARGET("avx2,fma,f16c")
+	inline __m256 LoadAvx2(const Float16* x) noexcept
+	{
+		return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x)));
+	}
+
+	FLUID_TARGET("avx2,fma")
+	inline __m256 LoadAvx2(const BFloat16* x) noexcept
+	{
+		const __m256i wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(x)));
+		return _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16));
+	}
+
+	FLUID_TARGET("avx2,fma")
+	inline void StoreAvx2(float* x, __m256 value) noexcept
+	{
+		_mm256_storeu_ps(x, value);
+	}
+
+	// Saturated and rounded to nearest even like Float16::Encode
+	FLUID_TARGET("avx2,fma,f16c")
+	inline void StoreAvx2(Float16* x, __m256 value) noexcept
+	{
+		const __m256 saturated = _mm256_min_ps(_mm256_max_ps(value, _mm256_set1_ps(-Float16::MAX)), _mm256_set1_ps(Float16::MAX));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(x), _mm256_cvtps_ph(saturated, _MM_FROUND_TO_NEAREST_INT));
+	}
+
+	// Rounds to nearest even by adding 0x7fff plus the lowest kept bit, NaNs are not kept quiet like BFloat16::Encode does (fields hold none)
+	FLUID_TARGET("avx2,fma")
+	inline void StoreAvx2(BFloat16* x, __m256 value) noexcept
+	{
+		const __m256i bits = _mm256_castps_si256(value);
+		const __m256i odd = _mm256_and_si256(_mm256_srli_epi32(bits, 16), _mm256_set1_epi32(1));
+		const __m256i rounded = _mm256_srli_epi32(_mm256_add_epi32(bits, _mm256_add_epi32(_mm256_set1_epi32(0x7fff), odd)), 16);
+		// Pack per 128-bit lane, then gather the two lanes' low halves
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(rounded, rounded), 0x08);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(x), _mm256_castsi256_si128(packed));
+	}
+
+	// 8 cells of a field at index (cell offsets) as floats, lastWord only matters to the 16-bit fields
+	FLUID_TARGET("avx2,fma")
+	inline __m256 GatherAvx2(const float* d0, __m256i index, __m256i /*lastWord*/) noexcept
+	{
+		return _mm256_i32gather_ps(d0, index, 4);
+	}
+
+	/**
+	*	The 16-bit cells at index, in the low half of each lane: gathered as the 32-bit word starting at each.
+	*	The last cell's word would end past the field, so an index past lastWord (the field's cells - 2) is read
+	*	as the upper half of the word before it.
+	*/
+	FLUID_TARGET("avx2,fma")
+	inline __m256i GatherHalvesAvx2(const void* d0, __m256i index, __m256i lastWord) noexcept
+	{
+		const __m256i word = _mm256_min_epi32(index, lastWord);
+		const __m256i shift = _mm256_slli_epi32(_mm256_sub_epi32(index, word), 4);
+		return _mm256_srlv_epi32(_mm256_i32gather_epi32(static_cast<const int*>(d0), word, 2), shift);
+	}
+
+	FLUID_TARGET("avx2,fma,f16c")
+	inline __m256 GatherAvx2(const Float16* d0, __m256i index, __m256i lastWord) noexcept
+	{
+		const __m256i halves = _mm256_and_si256(GatherHalvesAvx2(d0, index, lastWord), _mm256_set1_epi32(0xffff));
+		const __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi32(halves, halves), 0x08);
+		return _mm256_cvtph_ps(_mm256_castsi256_si128(packed));
+	}
+
+	FLUID_TARGET("avx2,fma")
+	inline __m256 GatherAvx2(const BFloat16* d0, __m256i index, __m256i lastWord) noexcept
+	{
+		return _mm256_castsi256_ps(_mm256_slli_epi32(GatherHalvesAvx2(d0, index, lastWord), 16));
+	}
+
+	// Bilinear taps of 8 back-traces (kernels::AdvectBackTrace per lane)
+	struct TapsAvx2 {
+		__m256i tap00, tap01, tap10, tap11;
+		__m256 s0, s1, t0, t1;
+		__m256i lastWord{}; // See GatherHalvesAvx2, set by BackTraceAvx2
+
+		template<typename T>
+		FLUID_TARGET("avx2,fma,f16c")
+		inline __m256 Sample(const T* d0) const noexcept
+		{
+			const __m256 d00 = GatherAvx2(d0, tap00, lastWord);
+			const __m256 d01 = GatherAvx2(d0, tap01, lastWord);
+			const __m256 d10 = GatherAvx2(d0, tap10, lastWord);
+			const __m256 d11 = GatherAvx2(d0, tap11, lastWord);
+
+			const __m256 left = _mm256_fmadd_ps(t0, d00, _mm256_mul_ps(t1, d01));
+			const __m256 right = _mm256_fmadd_ps(t0, d10, _mm256_mul_ps(t1, d11));
+			return _mm256_fmadd_ps(s0, left, _mm256_mul_ps(s1, right));
+		}
+
+		// value clamped to the smallest and largest of the four taps of d0, per lane
+		template<typename T>
+		FLUID_TARGET("avx2,fma,f16c")
+		inline __m256 Clamp(__m256 value, const T* d0) const noexcept
+		{
+			const __m256 d00 = GatherAvx2(d0, tap00, lastWord);
+			const __m256 d01 = GatherAvx2(d0, tap01, lastWord);
+			const __m256 d10 = GatherAvx2(d0, tap10, lastWord);
+			const __m256 d11 = GatherAvx2(d0, tap11, lastWord);
+			const __m256 low = _mm256_min_ps(_mm256_min_ps(d00, d01), _mm256_min_ps(d10, d11));
+			const __m256 high = _mm256_max_ps(_mm256_max_ps(d00, d01), _mm256_max_ps(d10, d11));
+			return _mm256_min_ps(_mm256_max_ps(value, low), high);
+		}
+	};
+
+	// Vector kernels::AdvectBackTrace along dtx, dty (negated, it traces forward)
+	struct BackTraceAvx2 {
+		__m256 dtx, dty, lo, hi, one, lanes;
+		__m256i last, oneI, stride, lastWord;
+
+		FLUID_TARGET("avx2,fma")
+		BackTraceAvx2(int N, float dtxs, float dtys) noexcept
+			:
+			dtx(_mm256_set1_ps(dtxs)),
+			dty(_mm256_set1_ps(dtys)),
+			lo(_mm256_set1_ps(0.5f)),
+			hi(_mm256_set1_ps(N + 0.5f)),
+			one(_mm256_set1_ps(1.0f)),
+			lanes(_mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)),
+			last(_mm256_set1_epi32(N - 1)),
+			oneI(_mm256_set1_epi32(1)),
+			stride(_mm256_set1_epi32(N)),
+			lastWord(_mm256_set1_epi32(N * N - 2))
+		{
+		}
+
+		// Cells i to i + 7 of row j (jf), vx and vy their velocities
+		FLUID_TARGET("avx2,fma")
+		inline TapsAvx2 operator()(int i, __m256 jf, __m256 vx, __m256 vy) const noexcept
+		{
+			const __m256 fi = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lanes);
+			const __m256 x = _mm256_min_ps(_mm256_max_ps(_mm256_fnmadd_ps(dtx, vx, fi), lo), hi);
+			const __m256 y = _mm256_min_ps(_mm256_max_ps(_mm256_fnmadd_ps(dty, vy, jf), lo), hi);
+			const __m256 i0 = _mm256_floor_ps(x);
+			const __m256 j0 = _mm256_floor_ps(y);
+
+			TapsAvx2 taps;
+			taps.s1 = _mm256_sub_ps(x, i0);
+			taps.s0 = _mm256_sub_ps(one, taps.s1);
+			taps.t1 = _mm256_sub_ps(y, j0);
+			taps.t0 = _mm256_sub_ps(one, taps.t1);
+
+			const __m256i i0i = _mm256_cvttps_epi32(i0);
+			const __m256i j0i = _mm256_cvttps_epi32(j0);
+			const __m256i col0 = _mm256_min_epi32(i0i, last);
+			const __m256i col1 = _mm256_min_epi32(_mm256_add_epi32(i0i, oneI), last);
+			const __m256i row0 = _mm256_mullo_epi32(_mm256_min_epi32(j0i, last), stride);
+			const __m256i row1 = _mm256_mullo_epi32(_mm256_min_epi32(_mm256_add_epi32(j0i, oneI), last), stride);
+
+			taps.tap00 = _mm256_add_epi32(col0, row0);
+			taps.tap01 = _mm256_add_epi32(col0, row1);
+			taps.tap10 = _mm256_add_epi32(col1, row0);
+			taps.tap11 = _mm256_add_epi32(col1, row1);
+			taps.lastWord = lastWord;
+			return taps;
+		}
+	};
+
+	// Fields fields advected along the same velocity, sharing the back-trace (d[f] from d0[f])
+	template<int Fields, typename T, typename S, typename V>
+	FLUID_TARGET("avx2,fma,f16c")
+	inline void AdvectFieldsAvx2(int n, T* const* d, const S* const* d0, const V* velocX, const V* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = n;
+		const float dtxs = dt * (N - 2);
+		const float dtys = dt * (N - 2);
+		const BackTraceAvx2 backTrace(N, dtxs, dtys);
+
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const int row = j * N;
+			const V* vx = velocX + row;
+			const V* vy = velocY + row;
+			const __m256 jf = _mm256_set1_ps(static_cast<float>(j));
+
+			int i = colBegin;
+			for (; i + 8 <= colEnd; i += 8)
+			{
+				const TapsAvx2 taps = backTrace(i, jf, LoadAvx2(vx + i), LoadAvx2(vy + i));
+				for (int f = 0; f < Fields; f++)
+					StoreAvx2(d[f] + row + i, taps.Sample(d0[f]));
+			}
+			for (; i < colEnd; i++)
+			{
+				const kernels::AdvectTaps taps = kernels::AdvectBackTrace<0>(N, i, j, vx[i], vy[i], dtxs, dtys);
+				for (int f = 0; f < Fields; f++)
+					d[f][row + i] = taps.Sample(d0[f]);
+			}
+		}
+	}
+
+	template<typename T, typename S, typename V>
+	FLUID_TARGET("avx2,fma,f16c")
+	void AdvectAvx2(int n, T* d, const S* d0, const V* velocX, const V* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		AdvectFieldsAvx2<1>(n, &d, &d0, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+	}
+
+	template<typename S>
+	FLUID_TARGET("avx2,fma,f16c")
+	void AdvectPairAvx2(int n, float* dx, float* dy, const S* d0x, const S* d0y, const S* velocX, const S* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		float* const d[2] = { dx, dy };
+		const S* const d0[2] = { d0x, d0y };
+		AdvectFieldsAvx2<2>(n, d, d0, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+	}
+
+	// kernels::MacCormack of Fields fields along the same velocity, both traces shared
+	template<int Fields, typename T, typename S, typename V>
+	FLUID_TARGET("avx2,fma,f16c")
+	inline void MacCormackFieldsAvx2(int n, T* const* d, const S* const* d0, const float* const* advected, const V* velocX, const V* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = n;
+		const float dtxs = dt * (N - 2);
+		const float dtys = dt * (N - 2);
+		const BackTraceAvx2 backTrace(N, dtxs, dtys);
+		const BackTraceAvx2 aheadTrace(N, -dtxs, -dtys);
+		const __m256 half = _mm256_set1_ps(0.5f);
+
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const int row = j * N;
+			const V* vx = velocX + row;
+			const V* vy = velocY + row;
+			const __m256 jf = _mm256_set1_ps(static_cast<float>(j));
+
+			int i = colBegin;
+			for (; i + 8 <= colEnd; i += 8)
+			{
+				const __m256 vxi = LoadAvx2(vx + i);
+				const __m256 vyi = LoadAvx2(vy + i);
+				const TapsAvx2 back = backTrace(i, jf, vxi, vyi);
+				const TapsAvx2 ahead = aheadTrace(i, jf, vxi, vyi);
+				for (int f = 0; f < Fields; f++)
+				{
+					const __m256 roundTrip = ahead.Sample(advected[f]);
+					const __m256 corrected = _mm256_fmadd_ps(half, _mm256_sub_ps(LoadAvx2(d0[f] + row + i), roundTrip), _mm256_loadu_ps(advected[f] + row + i));
+					StoreAvx2(d[f] + row + i, back.Clamp(corrected, d0[f]));
+				}
+			}
+			for (; i < colEnd; i++)
+			{
+				const kernels::AdvectTaps back = kernels::AdvectBackTrace<0>(N, i, j, vx[i], vy[i], dtxs, dtys);
+				const kernels::AdvectTaps ahead = kernels::AdvectBackTrace<0>(N, i, j, vx[i], vy[i], -dtxs, -dtys);
+				for (int f = 0; f < Fields; f++)
+					d[f][row + i] = back.Clamp(advected[f][row + i] + 0.5f * (d0[f][row + i] - ahead.Sample(advected[f])), d0[f]);
+			}
+		}
+	}
+
+	template<typename T, typename S, typename V>
+	FLUID_TARGET("avx2,fma,f16c")
+	void MacCormackAvx2(int n, T* d, const S* d0, const float* advected, const V* velocX, const V* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		MacCormackFieldsAvx2<1>(n, &d, &d0, &advected, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+	}
+
+	template<typename S>
+	FLUID_TARGET("avx2,fma,f16c")
+	void MacCormackPairAvx2(int n, float* dx, float* dy, const S* d0x, const S* d0y, const float* advectedX, const float* advectedY,
+		const S* velocX, const S* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		float* const d[2] = { dx, dy };
+		const S* const d0[2] = { d0x, d0y };
+		const float* const advected[2] = { advectedX, advectedY };
+		MacCormackFieldsAvx2<2>(n, d, d0, advected, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+	}
+
+	// Vector kernels::TracerTaps of 8 points, clamped in place onto [first, last]
+	FLUID_TARGET("avx2,fma")
+	inline TapsAvx2 TracerTapsAvx2(__m256& x, __m256& y, __m256 first, __m256 last, __m256i stride) noexcept
+	{
+		x = _mm256_min_ps(_mm256_max_ps(x, first), last);
+		y = _mm256_min_ps(_mm256_max_ps(y, first), last);
+		const __m256 i0 = _mm256_floor_ps(x);
+		const __m256 j0 = _mm256_floor_ps(y);
+
+		TapsAvx2 taps;
+		taps.s1 = _mm256_sub_ps(x, i0);
+		taps.s0 = _mm256_sub_ps(_mm256_set1_ps(1.0f), taps.s1);
+		taps.t1 = _mm256_sub_ps(y, j0);
+		taps.t0 = _mm256_sub_ps(_mm256_set1_ps(1.0f), taps.t1);
+
+		const __m256i col0 = _mm256_cvttps_epi32(i0);
+		const __m256i row0 = _mm256_mullo_epi32(_mm256_cvttps_epi32(j0), stride);
+		taps.tap00 = _mm256_add_epi32(col0, row0);
+		taps.tap01 = _mm256_add_epi32(taps.tap00, stride);
+		taps.tap10 = _mm256_add_epi32(taps.tap00, _mm256_set1_epi32(1));
+		taps.tap11 = _mm256_add_epi32(taps.tap10, stride);
+		return taps;
+	}
+
+	FLUID_TARGET("avx2,fma")
+	void AdvectTracersAvx2(int n, float* x, float* y, const float* velocX, const float* velocY, float dt, int begin, int end) noexcept
+	{
+		const __m256 h = _mm256_set1_ps(dt * (n - 2));
+		const __m256 halfH = _mm256_set1_ps(0.5f * dt * (n - 2));
+		const __m256 first = _mm256_set1_ps(1.0f);
+		const __m256 last = _mm256_set1_ps(static_cast<float>(n - 2));
+		const __m256i stride = _mm256_set1_epi32(n);
+
+		int k = begin;
+		for (; k + 8 <= end; k += 8)
+		{
+			__m256 px = _mm256_loadu_ps(x + k);
+			__m256 py = _mm256_loadu_ps(y + k);
+			const TapsAvx2 here = TracerTapsAvx2(px, py, first, last, stride);
+			__m256 mx = _mm256_fmadd_ps(halfH, here.Sample(velocX), px);
+			__m256 my = _mm256_fmadd_ps(halfH, here.Sample(velocY), py);
+			const TapsAvx2 mid = TracerTapsAvx2(mx, my, first, last, stride);
+			_mm256_storeu_ps(x + k, _mm256_min_ps(_mm256_max_ps(_mm256_fmadd_ps(h, mid.Sample(velocX), px), first), last));
+			_mm256_storeu_ps(y + k, _mm256_min_ps(_mm256_max_ps(_mm256_fmadd_ps(h, mid.Sample(velocY), py), first), last));
+		}
+		kernels::AdvectTracers(n, x, y, velocX, velocY, dt, k, end);
+	}
+
+	/**
+	*	The unmasked AVX-512 intrinsics below merge into an undefined vector, which GCC 12 reports under -Wall as maybe
+	*	uninitialized. The AVX-512 rows use their zero-masked forms (gathers: a zero passthrough) over all lanes instead,
+	*	the same instructions.
+	*/
+	constexpr __mmask16 ALL_LANES = 0xffff;
+
+	// Bilinear taps of 16 back-traces, like TapsAvx2
+	struct TapsAvx512 {
+		__m512i tap00, tap01, tap10, tap11;
+		__m512 s0, s1, t0, t1;
+
+		FLUID_TARGET("avx512f")
+		inline __m512 Sample(const float* d0) const noexcept
+		{
+			const __m512 d00 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), ALL_LANES, tap00, d0, 4);
+			const __m512 d01 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), ALL_LANES, tap01, d0, 4);
+			const __m512 d10 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), ALL_LANES, tap10, d0, 4);
+			const __m512 d11 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), ALL_LANES, tap11, d0, 4);
+
+			const __m512 left = _mm512_fmadd_ps(t0, d00, _mm512_mul_ps(t1, d01));
+			const __m512 right = _mm512_fmadd_ps(t0, d10, _mm512_mul_ps(t1, d11));
+			return _mm512_fmadd_ps(s0, left, _mm512_mul_ps(s1, right));
+		}
+
+		FLUID_TARGET("avx512f")
+		inline __m512 Clamp(__m512 value, const float* d0) const noexcept
+		{
+			const __m512 d00 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), ALL_LANES, tap00, d0, 4);
+			const __m512 d01 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), ALL_LANES, tap01, d0, 4);
+			const __m512 d10 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), ALL_LANES, tap10, d0, 4);
+			const __m512 d11 = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), ALL_LANES, tap11, d0, 4);
+			const __m512 low = _mm512_maskz_min_ps(ALL_LANES, _mm512_maskz_min_ps(ALL_LANES, d00, d01), _mm512_maskz_min_ps(ALL_LANES, d10, d11));
+			const __m512 high = _mm512_maskz_max_ps(ALL_LANES, _mm512_maskz_max_ps(ALL_LANES, d00, d01), _mm512_maskz_max_ps(ALL_LANES, d10, d11));
+			return _mm512_maskz_min_ps(ALL_LANES, _mm512_maskz_max_ps(ALL_LANES, value, low), high);
+		}
+	};
+
+	// Vector kernels::AdvectBackTrace like BackTraceAvx2, the masked lanes (past the row) trace from a zero velocity
+	struct BackTraceAvx512 {
+		__m512 dtx, dty, lo, hi, one, lanes;
+		__m512i last, oneI, stride;
+
+		FLUID_TARGET("avx512f")
+		BackTraceAvx512(int N, float dtxs, float dtys) noexcept
+			:
+			dtx(_mm512_set1_ps(dtxs)),
+			dty(_mm512_set1_ps(dtys)),
+			lo(_mm512_set1_ps(0.5f)),
+			hi(_mm512_set1_ps(N + 0.5f)),
+			one(_mm512_set1_ps(1.0f)),
+			lanes(_mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)),
+			last(_mm512_set1_epi32(N - 1)),
+			oneI(_mm512_set1_epi32(1)),
+			stride(_mm512_set1_epi32(N))
+		{
+		}
+
+		FLUID_TARGET("avx512f")
+		inline TapsAvx512 operator()(int i, __m512 jf, __m512 vx, __m512 vy) const noexcept
+		{
+			const __m512 fi = _mm512_add_ps(_mm512_set1_ps(static_cast<float>(i)), lanes);
+			const __m512 x = _mm512_maskz_min_ps(ALL_LANES, _mm512_maskz_max_ps(ALL_LANES, _mm512_fnmadd_ps(dtx, vx, fi), lo), hi);
+			const __m512 y = _mm512_maskz_min_ps(ALL_LANES, _mm512_maskz_max_ps(ALL_LANES, _mm512_fnmadd_ps(dty, vy, jf), lo), hi);
+			const __m512 i0 = _mm512_maskz_roundscale_ps(ALL_LANES, x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+			const __m512 j0 = _mm512_maskz_roundscale_ps(ALL_LANES, y, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+
+			TapsAvx512 taps;
+			taps.s1 = _mm512_sub_ps(x, i0);
+			taps.s0 = _mm512_sub_ps(one, taps.s1);
+			taps.t1 = _mm512_sub_ps(y, j0);
+			taps.t0 = _mm512_sub_ps(one, taps.t1);
+
+			const __m512i i0i = _mm512_maskz_cvttps_epi32(ALL_LANES, i0);
+			const __m512i j0i = _mm512_maskz_cvttps_epi32(ALL_LANES, j0);
+			const __m512i col0 = _mm512_maskz_min_epi32(ALL_LANES, i0i, last);
+			const __m512i col1 = _mm512_maskz_min_epi32(ALL_LANES, _mm512_add_epi32(i0i, oneI), last);
+			const __m512i row0 = _mm512_mullo_epi32(_mm512_maskz_min_epi32(ALL_LANES, j0i, last), stride);
+			const __m512i row1 = _mm512_mullo_epi32(_mm512_maskz_min_epi32(ALL_LANES, _mm512_add_epi32(j0i, oneI), last), stride);
+
+			taps.tap00 = _mm512_add_epi32(col0, row0);
+			taps.tap01 = _mm512_add_epi32(col0, row1);
+			taps.tap10 = _mm512_add_epi32(col1, row0);
+			taps.tap11 = _mm512_add_epi32(col1, row1);
+			return taps;
+		}
+	};
+
+	template<int Fields>
+	FLUID_TARGET("avx512f")
+	inline void AdvectFieldsAvx512(int n, float* const* d, const float* const* d0, const float* velocX, const float* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = n;
+		const BackTraceAvx512 backTrace(N, dt * (N - 2), dt * (N - 2));
+
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const int row = j * N;
+			const float* vx = velocX + row;
+			const float* vy = velocY + row;
+			const __m512 jf = _mm512_set1_ps(static_cast<float>(j));
+
+			// The row tail runs masked, no scalar remainder
+			for (int i = colBegin; i < colEnd; i += 16)
+			{
+				const int count = colEnd - i;
+				const __mmask16 mask = count >= 16 ? static_cast<__mmask16>(0xffff) : static_cast<__mmask16>((1u << count) - 1);
+				const TapsAvx512 taps = backTrace(i, jf, _mm512_maskz_loadu_ps(mask, vx + i), _mm512_maskz_loadu_ps(mask, vy + i));
+				for (int f = 0; f < Fields; f++)
+					_mm512_mask_storeu_ps(d[f] + row + i, mask, taps.Sample(d0[f]));
+			}
+		}
+	}
+
+	FLUID_TARGET("avx512f")
+	void AdvectAvx512(int n, float* d, const float* d0, const float* velocX, const float* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		AdvectFieldsAvx512<1>(n, &d, &d0, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+	}
+
+	FLUID_TARGET("avx512f")
+	void AdvectPairAvx512(int n, float* dx, float* dy, const float* d0x, const float* d0y, const float* velocX, const float* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		float* const d[2] = { dx, dy };
+		const float* const d0[2] = { d0x, d0y };
+		AdvectFieldsAvx512<2>(n, d, d0, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+	}
+
+	template<int Fields>
+	FLUID_TARGET("avx512f")
+	inline void MacCormackFieldsAvx512(int n, float* const* d, const float* const* d0, const float* const* advected, const float* velocX, const float* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = n;
+		const BackTraceAvx512 backTrace(N, dt * (N - 2), dt * (N - 2));
+		const BackTraceAvx512 aheadTrace(N, -dt * (N - 2), -dt * (N - 2));
+		const __m512 half = _mm512_set1_ps(0.5f);
+
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const int row = j * N;
+			const float* vx = velocX + row;
+			const float* vy = velocY + row;
+			const __m512 jf = _mm512_set1_ps(static_cast<float>(j));
+
+			for (int i = colBegin; i < colEnd; i += 16)
+			{
+				const int count = colEnd - i;
+				const __mmask16 mask = count >= 16 ? static_cast<__mmask16>(0xffff) : static_cast<__mmask16>((1u << count) - 1);
+				const __m512 vxi = _mm512_maskz_loadu_ps(mask, vx + i);
+				const __m512 vyi = _mm512_maskz_loadu_ps(mask, vy + i);
+				const TapsAvx512 back = backTrace(i, jf, vxi, vyi);
+				const TapsAvx512 ahead = aheadTrace(i, jf, vxi, vyi);
+				for (int f = 0; f < Fields; f++)
+				{
+					const __m512 roundTrip = ahead.Sample(advected[f]);
+					const __m512 corrected = _mm512_fmadd_ps(half, _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, d0[f] + row + i), roundTrip), _mm512_maskz_loadu_ps(mask, advected[f] + row + i));
+					_mm512_mask_storeu_ps(d[f] + row + i, mask, back.Clamp(corrected, d0[f]));
+				}
+			}
+		}
+	}
+
+	FLUID_TARGET("avx512f")
+	void MacCormackAvx512(int n, float* d, const float* d0, const float* advected, const float* velocX, const float* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		MacCormackFieldsAvx512<1>(n, &d, &d0, &advected, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+	}
+
+	FLUID_TARGET("avx512f")
+	void MacCormackPairAvx512(int n, float* dx, float* dy, const float* d0x, const float* d0y, const float* advectedX, const float* advectedY,
+		const float* velocX, const float* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		float* const d[2] = { dx, dy };
+		const float* const d0[2] = { d0x, d0y };
+		const float* const advected[2] = { advectedX, advectedY };
+		MacCormackFieldsAvx512<2>(n, d, d0, advected, velocX, velocY, dt, rowBegin, rowEnd, colBegin, colEnd);
+	}
+
+	// TracerTapsAvx2 of 16 points
+	FLUID_TARGET("avx512f")
+	inline TapsAvx512 TracerTapsAvx512(__m512& x, __m512& y, __m512 first, __m512 last, __m512i stride) noexcept
+	{
+		x = _mm512_maskz_min_ps(ALL_LANES, _mm512_maskz_max_ps(ALL_LANES, x, first), last);
+		y = _mm512_maskz_min_ps(ALL_LANES, _mm512_maskz_max_ps(ALL_LANES, y, first), last);
+		const __m512 i0 = _mm512_maskz_roundscale_ps(ALL_LANES, x, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+		const __m512 j0 = _mm512_maskz_roundscale_ps(ALL_LANES, y, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+
+		TapsAvx512 taps;
+		taps.s1 = _mm512_sub_ps(x, i0);
+		taps.s0 = _mm512_sub_ps(_mm512_set1_ps(1.0f), taps.s1);
+		taps.t1 = _mm512_sub_ps(y, j0);
+		taps.t0 = _mm512_sub_ps(_mm512_set1_ps(1.0f), taps.t1);
+
+		const __m512i col0 = _mm512_maskz_cvttps_epi32(ALL_LANES, i0);
+		const __m512i row0 = _mm512_mullo_epi32(_mm512_maskz_cvttps_epi32(ALL_LANES, j0), stride);
+		taps.tap00 = _mm512_add_epi32(col0, row0);
+		taps.tap01 = _mm512_add_epi32(taps.tap00, stride);
+		taps.tap10 = _mm512_add_epi32(taps.tap00, _mm512_set1_epi32(1));
+		taps.tap11 = _mm512_add_epi32(taps.tap10, stride);
+		return taps;
+	}
+
+	FLUID_TARGET("avx512f")
+	void AdvectTracersAvx512(int n, float* x, float* y, const float* velocX, const float* velocY, float dt, int begin, int end) noexcept
+	{
+		const __m512 h = _mm512_set1_ps(dt * (n - 2));
+		const __m512 halfH = _mm512_set1_ps(0.5f * dt * (n - 2));
+		const __m512 first = _mm512_set1_ps(1.0f);
+		const __m512 last = _mm512_set1_ps(static_cast<float>(n - 2));
+		const __m512i stride = _mm512_set1_epi32(n);
+
+		int k = begin;
+		for (; k + 16 <= end; k += 16)
+		{
+			__m512 px = _mm512_loadu_ps(x + k);
+			__m512 py = _mm512_loadu_ps(y + k);
+			const TapsAvx512 here = TracerTapsAvx512(px, py, first, last, stride);
+			__m512 mx = _mm512_fmadd_ps(halfH, here.Sample(velocX), px);
+			__m512 my = _mm512_fmadd_ps(halfH, here.Sample(velocY), py);
+			const TapsAvx512 mid = TracerTapsAvx512(mx, my, first, last, stride);
+			_mm512_storeu_ps(x + k, _mm512_maskz_min_ps(ALL_LANES, _mm512_maskz_max_ps(ALL_LANES, _mm512_fmadd_ps(h, mid.Sample(velocX), px), first), last));
+			_mm512_storeu_ps(y + k, _mm512_maskz_min_ps(ALL_LANES, _mm512_maskz_max_ps(ALL_LANES, _mm512_fmadd_ps(h, mid.Sample(velocY), py), first), last));
+		}
+		kernels::AdvectTracers(n, x, y, velocX, velocY, dt, k, end);
+	}
+
+	template<typename T, typename S>
+	FLUID_TARGET("avx2,fma,f16c")
+	void JacobiAvx2(int n, T* out, const T* in, const S* x0, float a, float cRecip, float w, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = n;
+		const __m256 va = _mm256_set1_ps(a);
+		const __m256 vc = _mm256_set1_ps(cRecip);
+		const __m256 vw = _mm256_set1_ps(w);
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const T* row = in + j * N;
+			const S* src = x0 + j * N;
+			T* dst = out + j * N;
+			int i = colBegin;
+			for (; i + 8 <= colEnd; i += 8)
+			{
+				const __m256 center = LoadAvx2(row + i);
+				const __m256 sum = _mm256_add_ps(
+					_mm256_add_ps(LoadAvx2(row + i - 1), LoadAvx2(row + i + 1)),
+					_mm256_add_ps(LoadAvx2(row + i - N), LoadAvx2(row + i + N)));
+				const __m256 relaxed = _mm256_mul_ps(_mm256_fmadd_ps(va, sum, LoadAvx2(src + i)), vc);
+				StoreAvx2(dst + i, _mm256_fmadd_ps(vw, _mm256_sub_ps(relaxed, center), center));
+			}
+			kernels::JacobiRows<0>(N, out, in, x0, a, cRecip, w, j, j + 1, i, colEnd);
+		}
+	}
+
+	// GaussSeidelRow: the right hand sides and the chain's results go through rhs, so the row is loaded and stored 8 cells at a time
+	template<typename T, typename S>
+	FLUID_TARGET("avx2,fma,f16c")
+	void GaussSeidelRowAvx2(int n, int j, T* x, const S* x0, float a, float cRecip, float aRecip, float* rhs, int colBegin, int colEnd) noexcept
+	{
+		const int N = n;
+		T* row = x + j * N;
+		const T* up = row - N;
+		const T* down = row + N;
+		const S* src = x0 + j * N;
+		const __m256 va = _mm256_set1_ps(a);
+		const __m256 vc = _mm256_set1_ps(cRecip);
+		int i = colBegin;
+		for (; i + 8 <= colEnd; i += 8)
+		{
+			const __m256 sum = _mm256_add_ps(_mm256_add_ps(LoadAvx2(row + i + 1), LoadAvx2(up + i)), LoadAvx2(down + i));
+			_mm256_storeu_ps(rhs + i, _mm256_mul_ps(_mm256_fmadd_ps(va, sum, LoadAvx2(src + i)), vc));
+		}
+		for (; i < colEnd; i++)
+			rhs[i] = (src[i] + a * (row[i + 1] + up[i] + down[i])) * cRecip;
+
+		float left = row[colBegin - 1];
+		for (i = colBegin; i < colEnd; i++)
+		{
+			left = rhs[i] + aRecip * left;
+			rhs[i] = left;
+		}
+
+		for (i = colBegin; i + 8 <= colEnd; i += 8)
+			StoreAvx2(row + i, _mm256_loadu_ps(rhs + i));
+		for (; i < colEnd; i++)
+			row[i] = rhs[i];
+	}
+
+	FLUID_TARGET("avx512f")
+	void JacobiAvx512(int n, float* out, const float* in, const float* x0, float a, float cRecip, float w, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept
+	{
+		const int N = n;
+		const __m512 va = _mm512_set1_ps(a);
+		const __m512 vc = _mm512_set1_ps(cRecip);
+		const __m512 vw = _mm512_set1_ps(w);
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const float* row = in + j * N;
+			const float* src = x0 + j * N;
+			float* dst = out + j * N;
+			for (int i = colBegin; i < colEnd; i += 16)
+			{
+				const int count = colEnd - i;
+				const __mmask16 mask = count >= 16 ? static_cast<__mmask16>(0xffff) : static_cast<__mmask16>((1u << count) - 1);
+				const __m512 center = _mm512_maskz_loadu_ps(mask, row + i);
+				const __m512 sum = _mm512_add_ps(
+					_mm512_add_ps(_mm512_maskz_loadu_ps(mask, row + i - 1), _mm512_maskz_loadu_ps(mask, row + i + 1)),
+					_mm512_add_ps(_mm512_maskz_loadu_ps(mask, row + i - N), _mm512_maskz_loadu_ps(mask, row + i + N)));
+				const __m512 relaxed = _mm512_mul_ps(_mm512_fmadd_ps(va, sum, _mm512_maskz_loadu_ps(mask, src + i)), vc);
+				_mm512_mask_storeu_ps(dst + i, mask, _mm512_fmadd_ps(vw, _mm512_sub_ps(relaxed, center), center));
+			}
+		}
+	}
+
+	// T is Float16 or BFloat16
+	template<typename T>
+	FLUID_TARGET("avx2,fma,f16c")
+	void DecodeFieldAvx2(const std::uint16_t* in, float* out, std::size_t count) noexcept
+	{
+		const T* field = reinterpret_cast<const T*>(in);
+		std::size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+			StoreAvx2(out + i, LoadAvx2(field + i));
+		for (; i < count; i++)
+			out[i] = field[i];
+	}
+
+	template<typename T>
+	FLUID_TARGET("avx2,fma,f16c")
+	void EncodeFieldAvx2(const float* in, std::uint16_t* out, std::size_t count) noexcept
+	{
+		T* field = reinterpret_cast<T*>(out);
+		std::size_t i = 0;
+		for (; i + 8 <= count; i += 8)
+			StoreAvx2(field + i, LoadAvx2(in + i));
+		for (; i < count; i++)
+			field[i] = in[i];
+	}
+
+	FLUID_TARGET("avx512f")
+	void DecodeFloat16Avx512(const std::uint16_t* in, float* out, std::size_t count) noexcept
+	{
+		std::size_t i = 0;
+		for (; i + 16 <= count; i += 16)
+			_mm512_storeu_ps(out + i, _mm512_maskz_cvtph_ps(ALL_LANES, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i))));
+		for (; i < count; i++)
+			out[i] = Float16::Decode(in[i]);
+	}
+
+	FLUID_TARGET("avx512f")
+	void EncodeFloat16Avx512(const float* in, std::uint16_t* out, std::size_t count) noexcept
+	{
+		const __m512 max = _mm512_set1_ps(Float16::MAX);
+		const __m512 min = _mm512_set1_ps(-Float16::MAX);
+		std::size_t i = 0;
+		for (; i + 16 <= count; i += 16)
+		{
+			const __m512 saturated = _mm512_maskz_min_ps(ALL_LANES, _mm512_maskz_max_ps(ALL_LANES, _mm512_loadu_ps(in + i), min), max);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm512_maskz_cvtps_ph(ALL_LANES, saturated, _MM_FROUND_TO_NEAREST_INT));
+		}
+		for (; i < count; i++)
+			out[i] = Float16::Encode(in[i]);
+	}
+
+	FLUID_TARGET("avx512f")
+	void DecodeBFloat16Avx512(const std::uint16_t* in, float* out, std::size_t count) noexcept
+	{
+		std::size_t i = 0;
+		for (; i + 16 <= count; i += 16)
+		{
+			const __m512i wide = _mm512_maskz_cvtepu16_epi32(ALL_LANES, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)));
+			_mm512_storeu_ps(out + i, _mm512_castsi512_ps(_mm512_maskz_slli_epi32(ALL_LANES, wide, 16)));
+		}
+		for (; i < count; i++)
+			out[i] = BFloat16::Decode(in[i]);
+	}
+
+	FLUID_TARGET("avx512f")
+	void EncodeBFloat16Avx512(const float* in, std::uint16_t* out, std::size_t count) noexcept
+	{
+		const __m512i one = _mm512_set1_epi32(1);
+		const __m512i bias = _mm512_set1_epi32(0x7fff);
+		std::size_t i = 0;
+		for (; i + 16 <= count; i += 16)
+		{
+			const __m512i bits = _mm512_castps_si512(_mm512_loadu_ps(in + i));
+			const __m512i odd = _mm512_and_si512(_mm512_maskz_srli_epi32(ALL_LANES, bits, 16), one);
+			const __m512i rounded = _mm512_maskz_srli_epi32(ALL_LANES, _mm512_add_epi32(bits, _mm512_add_epi32(bias, odd)), 16);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm512_maskz_cvtepi32_epi16(ALL_LANES, rounded));
+		}
+		for (; i < count; i++)
+			out[i] = BFloat16::Encode(in[i]);
+	}
+
+	// One Gauss-Seidel sweep of an interleaved field (8 lanes per cell, a cell per register)
+	FLUID_TARGET("avx2,fma")
+	void GaussSeidelLanesAvx2(int n, float* x, const float* x0, const float* a, const float* cRecip, const float* aRecip, const std::uint32_t* relax) noexcept
+	{
+		constexpr int L = 8;
+		const int N = n;
+		const __m256 va = _mm256_loadu_ps(a);
+		const __m256 vc = _mm256_loadu_ps(cRecip);
+		const __m256 var = _mm256_loadu_ps(aRecip);
+		const __m256 mask = _mm256_castsi256_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(relax)));
+		for (int j = 1; j < N - 1; j++)
+		{
+			float* row = x + static_cast<std::size_t>(j) * N * L;
+			const float* up = row - N * L;
+			const float* down = row + N * L;
+			const float* src = x0 + static_cast<std::size_t>(j) * N * L;
+			// The serial chain stays in registers: the left neighbour is the value just stored
+			__m256 left = _mm256_loadu_ps(row);
+			__m256 center = _mm256_loadu_ps(row + L);
+			for (int i = 1; i < N - 1; i++)
+			{
+				const __m256 right = _mm256_loadu_ps(row + (i + 1) * L);
+				const __m256 sum = _mm256_add_ps(_mm256_add_ps(right, _mm256_loadu_ps(up + i * L)), _mm256_loadu_ps(down + i * L));
+				const __m256 rhs = _mm256_mul_ps(_mm256_fmadd_ps(va, sum, _mm256_loadu_ps(src + i * L)), vc);
+				left = _mm256_blendv_ps(center, _mm256_fmadd_ps(var, left, rhs), mask);
+				_mm256_storeu_ps(row + i * L, left);
+				center = right;
+			}
+		}
+	}
+
+	// Lane l of cell col + row of an interleaved field, at (col + row) * 8 + l
+	FLUID_TARGET("avx2")
+	inline __m256 GatherLanesAvx2(const float* d0, __m256i col, __m256i row, __m256i lanes) noexcept
+	{
+		return _mm256_i32gather_ps(d0, _mm256_add_epi32(_mm256_slli_epi32(_mm256_add_epi32(col, row), 3), lanes), 4);
+	}
+
+	// Interior of an interleaved field advected lane by lane, the four taps gathered
+	FLUID_TARGET("avx2,fma")
+	void AdvectLanesAvx2(int n, float* d, const float* d0, const float* velocX, const float* velocY, const float* dt) noexcept
+	{
+		constexpr int L = 8;
+		const int N = n;
+		const __m256 scale = _mm256_set1_ps(static_cast<float>(N - 2));
+		const __m256 dtx = _mm256_mul_ps(_mm256_loadu_ps(dt), scale);
+		const __m256 dty = dtx;
+		const __m256 lo = _mm256_set1_ps(0.5f);
+		const __m256 hi = _mm256_set1_ps(N + 0.5f);
+		const __m256 one = _mm256_set1_ps(1.0f);
+		const __m256i last = _mm256_set1_epi32(N - 1);
+		const __m256i oneI = _mm256_set1_epi32(1);
+		const __m256i stride = _mm256_set1_epi32(N);
+		const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+		for (int j = 1; j < N - 1; j++)
+		{
+			const __m256 jf = _mm256_set1_ps(static_cast<float>(j));
+			for (int i = 1; i < N - 1; i++)
+			{
+				const std::size_t cell = (static_cast<std::size_t>(j) * N + i) * L;
+				const __m256 fi = _mm256_set1_ps(static_cast<float>(i));
+				const __m256 px = _mm256_min_ps(_mm256_max_ps(_mm256_fnmadd_ps(dtx, _mm256_loadu_ps(velocX + cell), fi), lo), hi);
+				const __m256 py = _mm256_min_ps(_mm256_max_ps(_mm256_fnmadd_ps(dty, _mm256_loadu_ps(velocY + cell), jf), lo), hi);
+				const __m256 i0 = _mm256_floor_ps(px);
+				const __m256 j0 = _mm256_floor_ps(py);
+				const __m256 s1 = _mm256_sub_ps(px, i0);
+				const __m256 s0 = _mm256_sub_ps(one, s1);
+				const __m256 t1 = _mm256_sub_ps(py, j0);
+				const __m256 t0 = _mm256_sub_ps(one, t1);
+
+				const __m256i i0i = _mm256_cvttps_epi32(i0);
+				const __m256i j0i = _mm256_cvttps_epi32(j0);
+				const __m256i col0 = _mm256_min_epi32(i0i, last);
+				const __m256i col1 = _mm256_min_epi32(_mm256_add_epi32(i0i, oneI), last);
+				const __m256i row0 = _mm256_mullo_epi32(_mm256_min_epi32(j0i, last), stride);
+				const __m256i row1 = _mm256_mullo_epi32(_mm256_min_epi32(_mm256_add_epi32(j0i, oneI), last), stride);
+				const __m256 left = _mm256_fmadd_ps(t0, GatherLanesAvx2(d0, col0, row0, lanes), _mm256_mul_ps(t1, GatherLanesAvx2(d0, col0, row1, lanes)));
+				const __m256 right = _mm256_fmadd_ps(t0, GatherLanesAvx2(d0, col1, row0, lanes), _mm256_mul_ps(t1, GatherLanesAvx2(d0, col1, row1, lanes)));
+				_mm256_storeu_ps(d + cell, _mm256_fmadd_ps(s0, left, _mm256_mul_ps(s1, right)));
+			}
+		}
+	}
+}
+#endif
+
+template<typename T, typename S, typename V>
+kernels::AdvectRowsOf<T, S, V> kernels::GetAdvectKernel(SimdLevel level) noexcept
+{
+#ifdef FLUID_X86
+	switch (level)
+	{
+		case SimdLevel::Avx512:
+			if constexpr (ALL_FLOAT<T, S, V>)
+				return &AdvectAvx512;
+			[[fallthrough]];
+		case SimdLevel::Avx2: return &AdvectAvx2<T, S, V>;
+		default: break;
+	}
+#endif
+	(void)level;
+	return nullptr;
+}
+
+template<typename S>
+kernels::AdvectPairRowsOf<S> kernels::GetAdvectPairKernel(SimdLevel level) noexcept
+{
+#ifdef FLUID_X86
+	switch (level)
+	{
+		case SimdLevel::Avx512:
+			if constexpr (ALL_FLOAT<S>)
+				return &AdvectPairAvx512;
+			[[fallthrough]];
+		case SimdLevel::Avx2: return &AdvectPairAvx2<S>;
+		default: break;
+	}
+#endif
+	(void)level;
+	return nullptr;
+}
+
+template<typename T, typename S, typename V>
+kernels::MacCormackRowsOf<T, S, V> kernels::GetMacCormackKernel(SimdLevel level) noexcept
+{
+#ifdef FLUID_X86
+	switch (level)
+	{
+		case SimdLevel::Avx512:
+			if constexpr (ALL_FLOAT<T, S, V>)
+				return &MacCormackAvx512;
+			[[fallthrough]];
+		case SimdLevel::Avx2: return &MacCormackAvx2<T, S, V>;
+		default: break;
+	}
+#endif
+	(void)level;
+	return nullptr;
+}
+
+template<typename S>
+kernels::MacCormackPairRowsOf<S> kernels::GetMacCormackPairKernel(SimdLevel level) noexcept
+{
+#ifdef FLUID_X86
+	switch (level)
+	{
+		case SimdLevel::Avx512:
+			if constexpr (ALL_FLOAT<S>)
+				return &MacCormackPairAvx512;
+			[[fallthrough]];
+		case SimdLevel::Avx2: return &MacCormackPairAvx2<S>;
+		default: break;
+	}
+#endif
+	(void)level;
+	return nullptr;
+}
+
+template<typename T, typename S>
+kernels::JacobiRowsOf<T, S> kernels::GetJacobiKernel(SimdLevel level) noexcept
+{
+#ifdef FLUID_X86
+	switch (level)
+	{
+		case SimdLevel::Avx512:
+			if constexpr (ALL_FLOAT<T, S>)
+				return &JacobiAvx512;
+			[[fallthrough]];
+		case SimdLevel::Avx2: return &JacobiAvx2<T, S>;
+		default: break;
+	}
+#endif
+	(void)level;
+	return nullptr;
+}
+
+template<typename T, typename S>
+kernels::GaussSeidelRowOf<T, S> kernels::GetGaussSeidelRowKernel(SimdLevel level) noexcept
+{
+#ifdef FLUID_X86
+	if constexpr (!ALL_FLOAT<T, S>)
+		if (level >= SimdLevel::Avx2)
+			return &GaussSeidelRowAvx2<T, S>;
+#endif
+	(void)level;
+	return nullptr;
+}
+
+// The field types Fluid runs (see GetAdvectKernel): all float, float from Float16 / BFloat16 and Float16 / BFloat16 from float
+template kernels::AdvectRowsOf<float, float, float> kernels::GetAdvectKernel<float, float, float>(SimdLevel) noexcept;
+template kernels::AdvectRowsOf<float, Float16, Float16> kernels::GetAdvectKernel<float, Float16, Float16>(SimdLevel) noexcept;
+template kernels::AdvectRowsOf<float, BFloat16, BFloat16> kernels::GetAdvectKernel<float, BFloat16, BFloat16>(SimdLevel) noexcept;
+template kernels::AdvectRowsOf<Float16, float, float> kernels::GetAdvectKernel<Float16, float, float>(SimdLevel) noexcept;
+template kernels::AdvectRowsOf<BFloat16, float, float> kernels::GetAdvectKernel<BFloat16, float, float>(SimdLevel) noexcept;
+template kernels::AdvectPairRowsOf<float> kernels::GetAdvectPairKernel<float>(SimdLevel) noexcept;
+template kernels::AdvectPairRowsOf<Float16> kernels::GetAdvectPairKernel<Float16>(SimdLevel) noexcept;
+template kernels::AdvectPairRowsOf<BFloat16> kernels::GetAdvectPairKernel<BFloat16>(SimdLevel) noexcept;
+template kernels::MacCormackRowsOf<float, float, float> kernels::GetMacCormackKernel<float, float, float>(SimdLevel) noexcept;
+template kernels::MacCormackRowsOf<float, Float16, Float16> kernels::GetMacCormackKernel<float, Float16, Float16>(SimdLevel) noexcept;
+template kernels::MacCormackRowsOf<float, BFloat16, BFloat16> kernels::GetMacCormackKernel<float, BFloat16, BFloat16>(SimdLevel) noexcept;
+template kernels::MacCormackRowsOf<Float16, float, float> kernels::GetMacCormackKernel<Float16, float, float>(SimdLevel) noexcept;
+template kernels::MacCormackRowsOf<BFloat16, float, float> kernels::GetMacCormackKernel<BFloat16, float, float>(SimdLevel) noexcept;
+template kernels::MacCormackPairRowsOf<float> kernels::GetMacCormackPairKernel<float>(SimdLevel) noexcept;
+template kernels::MacCormackPairRowsOf<Float16> kernels::GetMacCormackPairKernel<Float16>(SimdLevel) noexcept;
+template kernels::MacCormackPairRowsOf<BFloat16> kernels::GetMacCormackPairKernel<BFloat16>(SimdLevel) noexcept;
+template kernels::JacobiRowsOf<float, float> kernels::GetJacobiKernel<float, float>(SimdLevel) noexcept;
+template kernels::JacobiRowsOf<Float16, float> kernels::GetJacobiKernel<Float16, float>(SimdLevel) noexcept;
+template kernels::JacobiRowsOf<BFloat16, float> kernels::GetJacobiKernel<BFloat16, float>(SimdLevel) noexcept;
+template kernels::JacobiRowsOf<float, Float16> kernels::GetJacobiKernel<float, Float16>(SimdLevel) noexcept;
+template kernels::JacobiRowsOf<float, BFloat16> kernels::GetJacobiKernel<float, BFloat16>(SimdLevel) noexcept;
+template kernels::GaussSeidelRowOf<float, float> kernels::GetGaussSeidelRowKernel<float, float>(SimdLevel) noexcept;
+template kernels::GaussSeidelRowOf<Float16, float> kernels::GetGaussSeidelRowKernel<Float16, float>(SimdLevel) noexcept;
+template kernels::GaussSeidelRowOf<BFloat16, float> kernels::GetGaussSeidelRowKernel<BFloat16, float>(SimdLevel) noexcept;
+template kernels::GaussSeidelRowOf<float, Float16> kernels::GetGaussSeidelRowKernel<float, Float16>(SimdLevel) noexcept;
+template kernels::GaussSeidelRowOf<float, BFloat16> kernels::GetGaussSeidelRowKernel<float, BFloat16>(SimdLevel) noexcept;
+
+kernels::DecodeFieldFn kernels::GetDecodeFieldKernel(SimdLevel level, FieldPrecision precision) noexcept
+{
+#ifdef FLUID_X86
+	const bool half = precision == FieldPrecision::Float16;
+	switch (precision == FieldPrecision::Float32 ? SimdLevel::Scalar : level)
+	{
+		case SimdLevel::Avx512: return half ? &DecodeFloat16Avx512 : &DecodeBFloat16Avx512;
+		case SimdLevel::Avx2: return half ? &DecodeFieldAvx2<Float16> : &DecodeFieldAvx2<BFloat16>;
+		default: break;
+	}
+#endif
+	(void)level; (void)precision;
+	return nullptr;
+}
+
+kernels::EncodeFieldFn kernels::GetEncodeFieldKernel(SimdLevel level, FieldPrecision precision) noexcept
+{
+#ifdef FLUID_X86
+	const bool half = precision == FieldPrecision::Float16;
+	switch (precision == FieldPrecision::Float32 ? SimdLevel::Scalar : level)
+	{
+		case SimdLevel::Avx512: return half ? &EncodeFloat16Avx512 : &EncodeBFloat16Avx512;
+		case SimdLevel::Avx2: return half ? &EncodeFieldAvx2<Float16> : &EncodeFieldAvx2<BFloat16>;
+		default: break;
+	}
+#endif
+	(void)level; (void)precision;
+	return nullptr;
+}
+
+kernels::GaussSeidelLanesFn kernels::GetGaussSeidelLanesKernel(SimdLevel level) noexcept
+{
+#ifdef FLUID_X86
+	if (level >= SimdLevel::Avx2)
+		return &GaussSeidelLanesAvx2;
+#endif
+	(void)level;
+	return nullptr;
+}
+
+kernels::AdvectLanesFn kernels::GetAdvectLanesKernel(SimdLevel level) noexcept
+{
+#ifdef FLUID_X86
+	if (level >= SimdLevel::Avx2)
+		return &AdvectLanesAvx2;
+#endif
+	(void)level;
+	return nullptr;
+}
+
+kernels::AdvectTracersFn kernels::GetAdvectTracersKernel(SimdLevel level) noexcept
+{
+#ifdef FLUID_X86
+	switch (level)
+	{
+		case SimdLevel::Avx512: return &AdvectTracersAvx512;
+		case SimdLevel::Avx2: return &AdvectTracersAvx2;
+		default: break;
+	}
+#endif
+	(void)level;
+	return nullptr;
+}
@@ -0,0 +1,97 @@
+#pragma once
+#include <cstddef>	// std::size_t
+#include <cstdint>	// std::uint16_t
+#include "cpu_features.hpp"
+#include "fluid_kernels.hpp"
+#include "half_float.hpp"
+
+namespace xtd_fluid_simulation::kernels {
+	// Same contract as kernels::Advect, for any grid size
+	template<typename T = float, typename S = float, typename V = float>
+	using AdvectRowsOf = void (*)(int n, T* d, const S* d0, const V* velocX, const V* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept;
+	using AdvectRowsFn = AdvectRowsOf<>;
+
+	/**
+	*	Vectorized Advect for level, 8 (AVX2) or 16 (AVX-512) cells per iteration:
+	*	vector back-trace, floor and clamps, then the four bilinear taps gathered per lane.
+	*	Returns nullptr for SimdLevel::Scalar (or when not built for x86), callers keep their scalar loop then.
+	*	The kernels are compiled for their own instruction set, so they are safe to select at runtime
+	*	whatever flags the rest of the program is built with.
+	*
+	*	The kernels of the 16-bit field types load, gather and store them as they are stored, converted in registers
+	*	(F16C for Float16, a 16-bit shift for BFloat16). They are AVX2 only, AVX-512 runs them too, and are defined for the
+	*	combinations Fluid runs: float fields, float fields from 16-bit ones (the velocity) and a 16-bit field from float ones (the density).
+	*/
+	template<typename T = float, typename S = float, typename V = float>
+	AdvectRowsOf<T, S, V> GetAdvectKernel(SimdLevel level) noexcept;
+
+	// Same contract as kernels::AdvectPair, the fields and the velocity they move along of the same type S
+	template<typename S = float>
+	using AdvectPairRowsOf = void (*)(int n, float* dx, float* dy, const S* d0x, const S* d0y, const S* velocX, const S* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept;
+	using AdvectPairRowsFn = AdvectPairRowsOf<>;
+
+	// Vectorized AdvectPair for level (one back-trace, gathers from both fields), nullptr for SimdLevel::Scalar like GetAdvectKernel
+	template<typename S = float>
+	AdvectPairRowsOf<S> GetAdvectPairKernel(SimdLevel level) noexcept;
+
+	// Same contracts as kernels::MacCormack and kernels::MacCormackPair
+	template<typename T = float, typename S = float, typename V = float>
+	using MacCormackRowsOf = void (*)(int n, T* d, const S* d0, const float* advected, const V* velocX, const V* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept;
+	template<typename S = float>
+	using MacCormackPairRowsOf = void (*)(int n, float* dx, float* dy, const S* d0x, const S* d0y, const float* advectedX, const float* advectedY,
+		const S* velocX, const S* velocY, float dt, int rowBegin, int rowEnd, int colBegin, int colEnd) noexcept;
+	using MacCormackRowsFn = MacCormackRowsOf<>;
+	using MacCormackPairRowsFn = MacCormackPairRowsOf<>;
+
+	// Vectorized MacCormack corrections for level (both traces vectorized like GetAdvectKernel's), nullptr for SimdLevel::Scalar
+	template<typename T = float, typename S = float, typename V = float>
+	MacCormackRowsOf<T, S, V> GetMacCormackKernel(SimdLevel level) noexcept;
+	template<typename S = float>
+	MacCormackPairRowsOf<S> GetMacCormackPairKernel(SimdLevel level) noexcept;
+
+	// Same contract as kernels::AdvectTracers
+	using AdvectTracersFn = void (*)(int n, float* x, float* y, const float* velocX, const float* velocY, float dt, int begin, int end) noexcept;
+
+	// Vectorized AdvectTracers for level, 8 or 16 tracers per iteration (both RK2 stages gathered per lane), nullptr for SimdLevel::Scalar
+	AdvectTracersFn GetAdvectTracersKernel(SimdLevel level) noexcept;
+
+	/**
+	*	Vectorized JacobiRows for level, the 5 point stencil over 8 or 16 cells of a row per instruction.
+	*	Returns nullptr for SimdLevel::Scalar, and runs 16-bit fields, like GetAdvectKernel.
+	*/
+	template<typename T = float, typename S = float>
+	JacobiRowsOf<T, S> GetJacobiKernel(SimdLevel level) noexcept;
+
+	/**
+	*	GaussSeidelRow for 16-bit fields: the right hand sides gathered and the relaxed row stored 8 cells at a time,
+	*	converting in registers, only the serial chain left scalar. nullptr for all float fields (the generic row already
+	*	vectorizes) and for SimdLevel::Scalar.
+	*/
+	template<typename T = float, typename S = float>
+	GaussSeidelRowOf<T, S> GetGaussSeidelRowKernel(SimdLevel level) noexcept;
+
+	// Same contract as kernels::ConvertField, between float and the bits of a 16-bit storage format
+	using DecodeFieldFn = void (*)(const std::uint16_t* in, float* out, std::size_t count) noexcept;
+	using EncodeFieldFn = void (*)(const float* in, std::uint16_t* out, std::size_t count) noexcept;
+
+	/**
+	*	Vectorized 16-bit field conversions for level, 8 or 16 values per instruction (F16C / AVX-512 conversions for
+	*	FieldPrecision::Float16, shifts for BFloat16), rounded to nearest even like Float16 and BFloat16 themselves.
+	*	Returns nullptr for FieldPrecision::Float32 and SimdLevel::Scalar like GetAdvectKernel.
+	*/
+	DecodeFieldFn GetDecodeFieldKernel(SimdLevel level, FieldPrecision precision) noexcept;
+	EncodeFieldFn GetEncodeFieldKernel(SimdLevel level, FieldPrecision precision) noexcept;
+
+	/**
+	*	Kernels of FluidEnsemble's interleaved layout: fields of 8 members, the 8 values of a cell side by side.
+	*	One Gauss-Seidel sweep over the interior rows, lane l with its own a, 1 / c, a / c, left as is where relax[l] is 0
+	*	(all bits set otherwise). The serial chain runs along the row, one cell (8 members) per instruction.
+	*	Returns nullptr below SimdLevel::Avx2 like GetAdvectKernel (AVX-512 runs the AVX2 kernel, a cell is 8 lanes).
+	*/
+	using GaussSeidelLanesFn = void (*)(int n, float* x, const float* x0, const float* a, const float* cRecip, const float* aRecip, const std::uint32_t* relax) noexcept;
+	GaussSeidelLanesFn GetGaussSeidelLanesKernel(SimdLevel level) noexcept;
+
+	// Advect of the interior cells of an interleaved field, lane l along its own velocity by dt[l], boundaries left to the caller
+	using AdvectLanesFn = void (*)(int n, float* d, const float* d0, const float* velocX, const float* velocY, const float* dt) noexcept;
+	AdvectLanesFn GetAdvectLanesKernel(SimdLevel level) noexcept;
+}
@@ -0,0 +1,146 @@
+#include "simulation_worker.hpp"
+#include <algorithm>	// std::max
+#include <chrono>
+#include <utility>	// std::move
+using namespace xtd_fluid_simulation;
+
+namespace {
+	// Steps more than this late are skipped rather than caught up, a slow grid then just runs slower than real time
+	constexpr int MAX_LAG_STEPS = 4;
+
+	SimulationWorker::Snapshot EmptySnapshot(int size)
+	{
+		SimulationWorker::Snapshot snapshot;
+		snapshot.density.assign(static_cast<std::size_t>(size) * size, 0.0f);
+		snapshot.solveReports.reserve(8);
+		return snapshot;
+	}
+}
+
+SimulationWorker::SimulationWorker(Fluid& fluid, float stepsPerSecond)
+	:
+	m_fluid(fluid),
+	m_timestep(1.0f / std::max(stepsPerSecond, 1.0f)),
+	m_snapshots(EmptySnapshot(fluid.get_size()))
+{
+}
+
+SimulationWorker::~SimulationWorker()
+{
+	Stop();
+}
+
+void SimulationWorker::Start()
+{
+	if (m_thread.joinable())
+		return;
+	m_stop.store(false, std::memory_order_relaxed);
+	m_thread = std::thread(&SimulationWorker::Run, this);
+}
+
+void SimulationWorker::Stop()
+{
+	if (!m_thread.joinable())
+		return;
+	m_stop.store(true, std::memory_order_relaxed);
+	m_thread.join();
+}
+
+bool SimulationWorker::Push(const Input& input) noexcept
+{
+	if (m_inputs.TryPush(input))
+		return true;
+	m_dropped_inputs.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+void SimulationWorker::Post(std::function<void(Fluid&)> fn)
+{
+	std::lock_guard<std::mutex> lock(m_posted_mutex);
+	m_posted.push_back(std::move(fn));
+}
+
+void SimulationWorker::Record(std::shared_ptr<RecordingWriter> recorder)
+{
+	Post([this, recorder = std::move(recorder)](Fluid&) { m_recorder = recorder; });
+}
+
+const SimulationWorker::Snapshot& SimulationWorker::AcquireSnapshot() noexcept
+{
+	m_snapshots.Acquire();
+	return m_snapshots.Front();
+}
+
+void SimulationWorker::Run()
+{
+	using clock = std::chrono::steady_clock;
+	const auto period = std::chrono::duration_cast<clock::duration>(std::chrono::duration<float>(m_timestep));
+	auto next = clock::now();
+	while (!m_stop.load(std::memory_order_relaxed))
+	{
+		Step();
+
+		if (m_unthrottled.load(std::memory_order_relaxed))
+		{
+			next = clock::now();
+			continue;
+		}
+		next += period;
+		const auto now = clock::now();
+		if (now - next > period * MAX_LAG_STEPS)
+			next = now;
+		std::this_thread::sleep_until(next);
+	}
+}
+
+void SimulationWorker::Step()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_posted_mutex);
+		m_running_posted.swap(m_posted);
+	}
+	for (auto& fn : m_running_posted)
+		fn(m_fluid);
+	m_running_posted.clear();
+
+	// Applied by Update, in one pass
+	Input input;
+	while (m_inputs.TryPop(input))
+	{
+		if (input.kind == Input::Kind::Brush)
+			m_fluid.AddBrush(input.brush);
+		else
+			m_fluid.AddForce(input.brush.velocityX, input.brush.velocityY);
+	}
+
+	const auto start = std::chrono::steady_clock::now();
+	m_fluid.Update(m_timestep);
+	const auto end = std::chrono::steady_clock::now();
+
+	Snapshot& snapshot = m_snapshots.Back();
+	m_fluid.ReadDensity(snapshot.density.data());
+	// Dropped rather than waited for when the disk falls behind, the step rate comes first
+	if (m_recorder)
+		m_recorder->Append(snapshot.density.data());
+	if (m_fluid.get_sparse_tiles())
+		snapshot.activeTiles.assign(m_fluid.get_active_tiles().GetMask().begin(), m_fluid.get_active_tiles().GetMask().end());
+	else
+		snapshot.activeTiles.clear();
+	if (m_velocity_snapshots.load(std::memory_order_relaxed))
+	{
+		const std::size_t cells = static_cast<std::size_t>(m_fluid.get_size()) * m_fluid.get_size();
+		snapshot.velocityX.assign(m_fluid.get_velocity_x(), m_fluid.get_velocity_x() + cells);
+		snapshot.velocityY.assign(m_fluid.get_velocity_y(), m_fluid.get_velocity_y() + cells);
+	}
+	else
+	{
+		snapshot.velocityX.clear();
+		snapshot.velocityY.clear();
+	}
+	snapshot.motionStep = m_fluid.get_speed() * m_timestep;
+	snapshot.solveReports.assign(m_fluid.get_solve_reports().begin(), m_fluid.get_solve_reports().end());
+	snapshot.step = ++m_step;
+	snapshot.stepMilliseconds = std::chrono::duration<float, std::milli>(end - start).count();
+	snapshot.profile = m_fluid.get_frame_sample();
+	m_snapshots.Publish();
+}
@@ -0,0 +1,103 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>	// std::shared_ptr
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "fluid.hpp"
+#include "recording.hpp"
+#include "spsc_queue.hpp"
+#include "triple_buffer.hpp"
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Steps a Fluid on its own thread at a fixed timestep, so a heavy step never stalls the UI
+	*	and the simulation rate is not tied to the frame rate.
+	*
+	*	The UI thread only talks to it through:
+	*	- Push: brushes and forces, a lock-free single producer queue drained into the Fluid's own queue before each step
+	*	- Post: rare changes (solver settings...), run on the worker between steps
+	*	- AcquireSnapshot: the density (and stats, optionally the velocity) of the latest step, triple buffered so neither side waits
+	*	Once started, the Fluid must not be touched directly by any other thread.
+	*/
+	class SimulationWorker {
+	public:
+		struct Input {
+			enum class Kind { Brush, Force } kind;
+			Fluid::Brush brush; // A force in brush.velocityX, velocityY
+		};
+
+		struct Snapshot {
+			std::vector<float> density; // N*N
+			std::vector<std::uint8_t> activeTiles; // Fluid::get_active_tiles' mask with sparse tiles on, empty otherwise
+			std::vector<float> velocityX, velocityY; // N*N each with velocity snapshots on, empty otherwise
+			float motionStep = 0.0f; // The dt the step advected with (speed * timestep), what moves along the velocity
+			std::vector<Fluid::SolveReport> solveReports;
+			std::uint64_t step = 0; // Steps run so far
+			float stepMilliseconds = 0.0f; // Wall time of that step
+			FrameSample profile; // Stage timings of that step
+		};
+
+	public:
+		// stepsPerSecond is both the simulated timestep (1 / stepsPerSecond) and the pace the worker keeps
+		explicit SimulationWorker(Fluid& fluid, float stepsPerSecond = 60.0f);
+		~SimulationWorker();
+
+		SimulationWorker(const SimulationWorker&) = delete;
+		SimulationWorker& operator=(const SimulationWorker&) = delete;
+
+	public:
+		void Start();
+		void Stop();
+
+		// Queues an injection for the next step, false (dropped) when the queue is full
+		bool Push(const Input& input) noexcept;
+		bool AddBrush(const Fluid::Brush& brush) noexcept { return Push({ Input::Kind::Brush, brush }); }
+		bool AddForce(float amountX, float amountY) noexcept { return Push({ Input::Kind::Force, { 0.0f, 0.0f, 0.0f, 0.0f, amountX, amountY } }); }
+		// Single cell brushes
+		bool AddDensity(int x, int y, float amount) noexcept { return AddBrush({ static_cast<float>(x), static_cast<float>(y), 0.0f, amount, 0.0f, 0.0f }); }
+		bool AddVelocity(int x, int y, float amountX, float amountY) noexcept { return AddBrush({ static_cast<float>(x), static_cast<float>(y), 0.0f, 0.0f, amountX, amountY }); }
+
+		// Runs fn(fluid) on the worker before its next step
+		void Post(std::function<void(Fluid&)> fn);
+
+		// Appends the density of every step from the next one on to recorder, nullptr stops. The worker keeps a reference until then
+		void Record(std::shared_ptr<RecordingWriter> recorder);
+
+		// Latest published step, the reference stays valid until the next call (consumer thread only)
+		const Snapshot& AcquireSnapshot() noexcept;
+
+		// Runs steps back to back instead of keeping real time pace
+		void set_unthrottled(const bool unthrottled) noexcept { m_unthrottled.store(unthrottled, std::memory_order_relaxed); }
+		// Copies the velocity fields into every snapshot (tracers), off by default
+		void set_velocity_snapshots(const bool enabled) noexcept { m_velocity_snapshots.store(enabled, std::memory_order_relaxed); }
+		float get_timestep() const noexcept { return m_timestep; }
+		std::uint64_t get_dropped_inputs() const noexcept { return m_dropped_inputs.load(std::memory_order_relaxed); }
+
+	private:
+		void Run();
+		void Step();
+
+	private:
+		Fluid& m_fluid;
+		const float m_timestep;
+
+		std::thread m_thread;
+		std::atomic<bool> m_stop{ false };
+		std::atomic<bool> m_unthrottled{ false };
+		std::atomic<bool> m_velocity_snapshots{ false };
+
+		SpscQueue<Input, 4096> m_inputs;
+		std::atomic<std::uint64_t> m_dropped_inputs{ 0 };
+
+		std::mutex m_posted_mutex;
+		std::vector<std::function<void(Fluid&)>> m_posted;
+		std::vector<std::function<void(Fluid&)>> m_running_posted; // Worker only, swapped with m_posted
+
+		TripleBuffer<Snapshot> m_snapshots;
+		std::uint64_t m_step = 0;
+		std::shared_ptr<RecordingWriter> m_recorder; // Worker only, set through Post
+	};
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>	// std::size_t
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Bounded lock-free queue for exactly one producer thread and one consumer thread.
+	*	Capacity must be a power of two, a full queue rejects pushes instead of blocking.
+	*/
+	template<typename T, std::size_t Capacity>
+	class SpscQueue {
+		static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+	public:
+		// Producer side, false when full
+		bool TryPush(const T& value) noexcept
+		{
+			const std::size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail - m_head.load(std::memory_order_acquire) == Capacity)
+				return false;
+			m_items[tail & (Capacity - 1)] = value;
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		// Consumer side, false when empty
+		bool TryPop(T& value) noexcept
+		{
+			const std::size_t head = m_head.load(std::memory_order_relaxed);
+			if (head == m_tail.load(std::memory_order_acquire))
+				return false;
+			value = m_items[head & (Capacity - 1)];
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+	private:
+		// Each index on its own cache line so producer and consumer do not false share
+		alignas(64) std::atomic<std::size_t> m_head{ 0 };
+		alignas(64) std::atomic<std::size_t> m_tail{ 0 };
+		alignas(64) std::array<T, Capacity> m_items{};
+	};
+}
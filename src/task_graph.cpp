@@ -0,0 +1,287 @@
+#include "task_graph.hpp"
+#include <algorithm>	// std::min, std::max
+#include <thread>
+using namespace xtd_fluid_simulation;
+
+namespace {
+	// Spin a little before giving the core away, tasks are short and readied in bursts
+	void Backoff(int& spin) noexcept
+	{
+		if (++spin > 64)
+			std::this_thread::yield();
+	}
+}
+
+int TaskGraph::Add(Task task, std::initializer_list<int> after, bool exclusive)
+{
+	const int id = static_cast<int>(m_nodes.size());
+	Node node;
+	node.task = std::move(task);
+	node.exclusive = exclusive;
+	for (const int dependency : after)
+	{
+		if (dependency < 0)
+			continue;
+		m_edges.emplace_back(dependency, id);
+		node.dependencies++;
+	}
+	m_nodes.push_back(std::move(node));
+	return id;
+}
+
+void TaskGraph::Clear() noexcept
+{
+	m_nodes.clear();
+	m_edges.clear();
+}
+
+void TaskGraph::RunInline()
+{
+	for (Node& node : m_nodes)
+		node.task();
+}
+
+void TaskGraph::Run(ThreadPool& pool)
+{
+	const int threads = pool.GetThreadCount();
+	const int tasks = static_cast<int>(m_nodes.size());
+	if (threads == 1 || tasks == 0)
+	{
+		RunInline();
+		return;
+	}
+
+	// Successor lists, counting sort of the edges by dependency
+	for (Node& node : m_nodes)
+		node.successorCount = 0;
+	for (const auto& edge : m_edges)
+		m_nodes[edge.first].successorCount++;
+	int first = 0;
+	for (Node& node : m_nodes)
+	{
+		node.firstSuccessor = first;
+		first += node.successorCount;
+		node.successorCount = 0;
+	}
+	m_successors.resize(m_edges.size());
+	for (const auto& edge : m_edges)
+	{
+		Node& node = m_nodes[edge.first];
+		m_successors[node.firstSuccessor + node.successorCount++] = edge.second;
+	}
+
+	if (m_pending_capacity < static_cast<std::size_t>(tasks))
+	{
+		m_pending.reset(new std::atomic<int>[tasks]);
+		m_pending_capacity = tasks;
+	}
+	if (m_deque_count != threads)
+	{
+		m_deques.reset(new Deque[threads]);
+		m_deque_count = threads;
+	}
+	for (int thread = 0; thread < threads; thread++)
+	{
+		m_deques[thread].tasks.clear();
+		m_deques[thread].head = 0;
+	}
+	m_stolen.assign(threads, 0);
+	m_exclusive.clear();
+	m_active.store(0, std::memory_order_relaxed);
+
+	for (int task = 0; task < tasks; task++)
+		m_pending[task].store(m_nodes[task].dependencies, std::memory_order_relaxed);
+	for (int task = 0; task < tasks; task++)
+		if (m_nodes[task].dependencies == 0)
+			Ready(task, 0);
+
+	// Parallel phases until nothing runs, then an exclusive task alone, until both run dry
+	m_pool = &pool;
+	for (;;)
+	{
+		if (m_active.load(std::memory_order_acquire) > 0)
+		{
+			m_parallel = true;
+			pool.Run([this](int thread, int) { WorkLoop(thread); });
+			m_parallel = false;
+		}
+
+		int task;
+		{
+			std::lock_guard<std::mutex> lock(m_exclusive_mutex);
+			if (m_exclusive.empty())
+				break;
+			const auto lowest = std::min_element(m_exclusive.begin(), m_exclusive.end());
+			task = *lowest;
+			m_exclusive.erase(lowest);
+		}
+		m_nodes[task].task();
+		Complete(task, 0);
+	}
+	m_pool = nullptr;
+}
+
+void TaskGraph::WorkLoop(int thread)
+{
+	for (int spin = 0;;)
+	{
+		if (HelpBands())
+		{
+			spin = 0;
+			continue;
+		}
+
+		int task;
+		if (Pop(thread, task) || Steal(thread, task))
+		{
+			m_nodes[task].task();
+			Complete(task, thread);
+			// After Complete, so the tasks it readied are counted before this one stops being
+			m_active.fetch_sub(1, std::memory_order_acq_rel);
+			spin = 0;
+			continue;
+		}
+
+		if (m_active.load(std::memory_order_acquire) == 0)
+			return;
+		Backoff(spin);
+	}
+}
+
+void TaskGraph::Ready(int task, int thread)
+{
+	if (m_nodes[task].exclusive)
+	{
+		std::lock_guard<std::mutex> lock(m_exclusive_mutex);
+		m_exclusive.push_back(task);
+		return;
+	}
+	m_active.fetch_add(1, std::memory_order_acq_rel);
+	Deque& deque = m_deques[thread];
+	std::lock_guard<std::mutex> lock(deque.mutex);
+	deque.tasks.push_back(task);
+}
+
+void TaskGraph::Complete(int task, int thread)
+{
+	const Node& node = m_nodes[task];
+	for (int index = node.firstSuccessor; index < node.firstSuccessor + node.successorCount; index++)
+	{
+		const int successor = m_successors[index];
+		if (m_pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1)
+			Ready(successor, thread);
+	}
+}
+
+bool TaskGraph::Pop(int thread, int& task)
+{
+	Deque& deque = m_deques[thread];
+	std::lock_guard<std::mutex> lock(deque.mutex);
+	if (deque.tasks.size() == deque.head)
+		return false;
+	task = deque.tasks.back();
+	deque.tasks.pop_back();
+	return true;
+}
+
+bool TaskGraph::Steal(int thread, int& task)
+{
+	for (int offset = 1; offset < m_deque_count; offset++)
+	{
+		Deque& deque = m_deques[(thread + offset) % m_deque_count];
+		std::lock_guard<std::mutex> lock(deque.mutex);
+		if (deque.tasks.size() == deque.head)
+			continue;
+		task = deque.tasks[deque.head++];
+		if (deque.head == deque.tasks.size())
+		{
+			deque.tasks.clear();
+			deque.head = 0;
+		}
+		m_stolen[thread]++;
+		return true;
+	}
+	return false;
+}
+
+bool TaskGraph::HelpBands()
+{
+	bool helped = false;
+	for (BandJob& job : m_band_jobs)
+	{
+		if (!job.open.load())
+			continue;
+		job.users.fetch_add(1);
+		if (job.open.load())
+		{
+			for (int band; (band = job.next.fetch_add(1)) < job.bands; helped = true)
+			{
+				const auto range = ThreadPool::Band(job.begin, job.end, band, job.bands);
+				job.fn(job.body, range.first, range.second);
+				job.done.fetch_add(1, std::memory_order_release);
+			}
+		}
+		job.users.fetch_sub(1);
+	}
+	return helped;
+}
+
+void TaskGraph::Share(int begin, int end, BandFn fn, void* body)
+{
+	if (begin >= end)
+		return;
+	if (!m_parallel)
+	{
+		// An exclusive task has the pool to itself
+		if (m_pool)
+			m_pool->ParallelFor(begin, end, [&](int bandBegin, int bandEnd) { fn(body, bandBegin, bandEnd); });
+		else
+			fn(body, begin, end);
+		return;
+	}
+
+	const int bands = std::min(2 * m_pool->GetThreadCount(), std::max((end - begin) / MIN_BAND, 1));
+	BandJob* job = nullptr;
+	for (BandJob& slot : m_band_jobs)
+	{
+		bool expected = false;
+		if (slot.busy.compare_exchange_strong(expected, true, std::memory_order_acquire))
+		{
+			job = &slot;
+			break;
+		}
+	}
+	if (!job || bands == 1)
+	{
+		if (job)
+			job->busy.store(false, std::memory_order_release);
+		fn(body, begin, end);
+		return;
+	}
+
+	job->begin = begin;
+	job->end = end;
+	job->bands = bands;
+	job->fn = fn;
+	job->body = body;
+	job->next.store(0);
+	job->done.store(0);
+	job->users.fetch_add(1);
+	job->open.store(true);
+
+	// The owner claims bands like any helper, then waits for the ones still running elsewhere
+	for (int band; (band = job->next.fetch_add(1)) < bands; )
+	{
+		const auto range = ThreadPool::Band(begin, end, band, bands);
+		fn(body, range.first, range.second);
+		job->done.fetch_add(1, std::memory_order_release);
+	}
+	for (int spin = 0; job->done.load(std::memory_order_acquire) < bands; )
+		Backoff(spin);
+
+	job->open.store(false);
+	job->users.fetch_sub(1);
+	for (int spin = 0; job->users.load() != 0; )
+		Backoff(spin);
+	job->busy.store(false, std::memory_order_release);
+}
@@ -0,0 +1,126 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "thread_pool.hpp"
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Small DAG of tasks run to completion over a ThreadPool, each task once every task it was added after is done.
+	*
+	*	A task made ready goes to the deque of the thread that finished its last dependency, which takes its own tasks
+	*	newest first (their inputs are still in its cache), while idle threads steal the oldest ones of the other deques.
+	*	Inside a task, ParallelFor shares a loop out in bands that idle threads help with, so stage level and
+	*	row band parallelism run on the same threads. Exclusive tasks fork/join on the pool themselves: they run on the
+	*	calling thread once nothing else is running, with the pool to themselves.
+	*
+	*	With a pool of one thread (or RunInline) the tasks run on the calling thread in the order they were added,
+	*	which is a valid order since a task can only be added after its dependencies.
+	*	Clear keeps the storage, so a graph rebuilt every step stops allocating once it has its size (except std::function).
+	*/
+	class TaskGraph {
+	public:
+		using Task = std::function<void()>;
+
+	public:
+		TaskGraph() = default;
+		TaskGraph(const TaskGraph&) = delete;
+		TaskGraph& operator=(const TaskGraph&) = delete;
+
+		/**
+		*	Adds task, to run once every task of after is done (negative ids are ignored, for optional dependencies).
+		*	Returns its id, to name it in the after list of later tasks.
+		*/
+		int Add(Task task, std::initializer_list<int> after = {}, bool exclusive = false);
+		void Clear() noexcept;
+
+		// Runs every task and returns once they are all done
+		void Run(ThreadPool& pool);
+		// Same on the calling thread only, in the order they were added, ParallelFor running its loop in one piece
+		void RunInline();
+
+		/**
+		*	fn(bandBegin, bandEnd) over bands of [begin, end), returns once they are all done.
+		*	From a task of a running graph the bands go to the idle threads (the caller runs some too);
+		*	from an exclusive task they are split over the pool; otherwise fn(begin, end) runs on the caller.
+		*	Bands must be independent: the result cannot depend on how the range was split.
+		*/
+		template<typename Fn>
+		void ParallelFor(int begin, int end, Fn&& fn)
+		{
+			using Body = std::remove_reference_t<Fn>;
+			Share(begin, end, [](void* body, int bandBegin, int bandEnd) { (*static_cast<Body*>(body))(bandBegin, bandEnd); }, const_cast<void*>(static_cast<const void*>(&fn)));
+		}
+
+		int GetTaskCount() const noexcept { return static_cast<int>(m_nodes.size()); }
+		// Per thread, tasks it took from another thread's deque during the last Run
+		const std::vector<int>& get_stolen_tasks() const noexcept { return m_stolen; }
+
+	public:
+		inline static constexpr const int MIN_BAND = 8; // Smallest band ParallelFor hands out, in loop iterations (rows)
+
+	private:
+		using BandFn = void (*)(void* body, int bandBegin, int bandEnd);
+
+		void Share(int begin, int end, BandFn fn, void* body);
+		void WorkLoop(int thread);
+		void Ready(int task, int thread);
+		void Complete(int task, int thread);
+		bool Pop(int thread, int& task);
+		bool Steal(int thread, int& task);
+		bool HelpBands();
+
+	private:
+		struct Node {
+			Task task;
+			bool exclusive = false;
+			int dependencies = 0;
+			int firstSuccessor = 0; // In m_successors, filled by Run
+			int successorCount = 0;
+		};
+
+		// A thread's ready tasks: the owner pops the back, thieves take the front
+		struct alignas(64) Deque {
+			std::mutex mutex;
+			std::vector<int> tasks;
+			std::size_t head = 0;
+		};
+
+		/**
+		*	One ParallelFor open to the idle threads. Helpers register in users before looking at open,
+		*	and the owner only releases the slot once users is back to zero, so no helper ever sees the next job's bands half set up.
+		*/
+		struct alignas(64) BandJob {
+			std::atomic<bool> busy{ false }; // Taken by an owner
+			std::atomic<bool> open{ false }; // Bands may be claimed
+			std::atomic<int> users{ 0 };
+			std::atomic<int> next{ 0 }; // Next band to claim
+			std::atomic<int> done{ 0 }; // Bands finished
+			int begin = 0, end = 0, bands = 0;
+			BandFn fn = nullptr;
+			void* body = nullptr;
+		};
+		inline static constexpr const int MAX_BAND_JOBS = 4; // More ParallelFor at once run inline
+
+		std::vector<Node> m_nodes;
+		std::vector<std::pair<int, int>> m_edges; // (dependency, task)
+		std::vector<int> m_successors;
+		std::unique_ptr<std::atomic<int>[]> m_pending; // Per task, dependencies not done yet
+		std::size_t m_pending_capacity = 0;
+
+		ThreadPool* m_pool = nullptr; // Of the running Run, for the exclusive tasks' ParallelFor
+		bool m_parallel = false; // The pool's threads are in WorkLoop
+		std::unique_ptr<Deque[]> m_deques;
+		int m_deque_count = 0;
+		std::atomic<int> m_active{ 0 }; // Tasks queued or running, the work loops stop at zero
+		std::mutex m_exclusive_mutex;
+		std::vector<int> m_exclusive; // Ready exclusive tasks
+		BandJob m_band_jobs[MAX_BAND_JOBS];
+		std::vector<int> m_stolen;
+	};
+}
@@ -0,0 +1,96 @@
+#include "thread_pool.hpp"
+#include <algorithm>	// std::max
+using namespace xtd_fluid_simulation;
+
+namespace {
+	// Spin a little before giving the core away, solver phases are short and frequent
+	template<typename Predicate>
+	void SpinWait(Predicate&& done) noexcept
+	{
+		for (int spin = 0; !done(); ++spin)
+			if (spin > 64)
+				std::this_thread::yield();
+	}
+}
+
+ThreadPool::ThreadPool(int threadCount)
+{
+	if (threadCount <= 0)
+		threadCount = std::max(1u, std::thread::hardware_concurrency());
+
+	m_workers.reserve(threadCount - 1);
+	for (int i = 1; i < threadCount; i++)
+		m_workers.emplace_back(&ThreadPool::WorkerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (std::thread& worker : m_workers)
+		worker.join();
+}
+
+void ThreadPool::Run(const std::function<void(int, int)>& task)
+{
+	const int threads = GetThreadCount();
+	if (threads == 1)
+	{
+		task(0, 1);
+		return;
+	}
+
+	m_pending.store(threads - 1, std::memory_order_relaxed);
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_task = &task;
+		m_generation++;
+	}
+	m_wake.notify_all();
+
+	task(0, threads);
+
+	SpinWait([this] { return m_pending.load(std::memory_order_acquire) == 0; });
+}
+
+void ThreadPool::Barrier() noexcept
+{
+	const int threads = GetThreadCount();
+	if (threads == 1)
+		return;
+
+	const std::uint32_t sense = m_barrier_sense.load(std::memory_order_relaxed);
+	if (m_barrier_count.fetch_add(1, std::memory_order_acq_rel) == threads - 1)
+	{
+		// Last one in releases the others
+		m_barrier_count.store(0, std::memory_order_relaxed);
+		m_barrier_sense.store(sense + 1, std::memory_order_release);
+	}
+	else
+	{
+		SpinWait([&] { return m_barrier_sense.load(std::memory_order_acquire) != sense; });
+	}
+}
+
+void ThreadPool::WorkerLoop(int threadIndex)
+{
+	std::uint64_t seen = 0;
+	for (;;)
+	{
+		const std::function<void(int, int)>* task;
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+			if (m_stop)
+				return;
+			seen = m_generation;
+			task = m_task;
+		}
+
+		(*task)(threadIndex, GetThreadCount());
+		m_pending.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
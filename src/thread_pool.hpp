@@ -0,0 +1,71 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Fixed set of worker threads that all run the same task together (fork/join),
+	*	with a barrier so a task can sync its threads between phases without returning.
+	*	The calling thread takes part as thread 0, so a pool of 1 thread runs everything inline.
+	*/
+	class ThreadPool {
+	public:
+		// threadCount 0 uses every hardware thread
+		explicit ThreadPool(int threadCount = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+	public:
+		// Runs task(threadIndex, threadCount) once on every thread and returns when all of them are done
+		void Run(const std::function<void(int, int)>& task);
+
+		// Splits [begin, end) into one contiguous band per thread and runs fn(bandBegin, bandEnd) on each
+		template<typename Fn>
+		void ParallelFor(int begin, int end, Fn&& fn)
+		{
+			Run([&](int thread, int threads) {
+				const auto band = Band(begin, end, thread, threads);
+				if (band.first < band.second)
+					fn(band.first, band.second);
+			});
+		}
+
+		// Blocks until every thread of the running task reached it, must only be called from inside Run
+		void Barrier() noexcept;
+
+		// The [first, second) part of [begin, end) handled by thread out of threads
+		static std::pair<int, int> Band(int begin, int end, int thread, int threads) noexcept
+		{
+			const int count = end - begin;
+			return { begin + count * thread / threads, begin + count * (thread + 1) / threads };
+		}
+
+		int GetThreadCount() const noexcept { return static_cast<int>(m_workers.size()) + 1; }
+
+	private:
+		void WorkerLoop(int threadIndex);
+
+	private:
+		std::vector<std::thread> m_workers;
+
+		std::mutex m_mutex;
+		std::condition_variable m_wake;
+		const std::function<void(int, int)>* m_task = nullptr;
+		std::uint64_t m_generation = 0; // Bumped for every Run, guarded by m_mutex
+		bool m_stop = false;
+
+		std::atomic<int> m_pending{ 0 }; // Workers still running the current task
+
+		// Sense reversing barrier
+		std::atomic<int> m_barrier_count{ 0 };
+		std::atomic<std::uint32_t> m_barrier_sense{ 0 };
+	};
+}
@@ -0,0 +1,165 @@
+#include "tracer_system.hpp"
+#include <algorithm>	// std::min, std::max, std::fill_n
+#include <cmath>	// std::sqrt, std::cos, std::sin, std::exp
+using namespace xtd_fluid_simulation;
+
+namespace {
+	// Tracers integrated per band boundary, a whole AVX-512 vector
+	constexpr int VECTOR = 16;
+}
+
+TracerSystem::TracerSystem(int capacity, int threads)
+	:
+	m_thread_pool(new ThreadPool(threads)),
+	m_capacity(std::max(capacity, 0)),
+	m_x(m_capacity),
+	m_y(m_capacity),
+	m_steps_left(m_capacity),
+	m_expired(m_capacity),
+	m_expired_bands(m_thread_pool->GetThreadCount())
+{
+	m_free.reserve(m_capacity);
+	// A lone tracer shows faintly, a handful on the same pixel saturate it
+	for (int count = 0; count < 256; count++)
+		m_coverage_alpha[count] = static_cast<std::uint8_t>(255.0f * (1.0f - std::exp(-0.5f * count)) + 0.5f);
+	set_simd_level(DetectSimdLevel());
+}
+
+void TracerSystem::set_simd_level(SimdLevel level) noexcept
+{
+	m_simd_level = std::min(level, DetectSimdLevel());
+	m_advect_kernel = kernels::GetAdvectTracersKernel(m_simd_level);
+}
+
+float TracerSystem::NextRandom() noexcept
+{
+	m_random ^= m_random << 13;
+	m_random ^= m_random >> 17;
+	m_random ^= m_random << 5;
+	return (m_random >> 8) * (1.0f / 16777216.0f);
+}
+
+int TracerSystem::Emit(int n, float x, float y, float radius, int count, int lifetime) noexcept
+{
+	// The interior cells [1, n - 2], where Advect keeps them: a brush at the edge would otherwise emit off the grid
+	const float last = static_cast<float>(std::max(n - 2, 1));
+	int emitted = 0;
+	for (; emitted < count; emitted++)
+	{
+		int slot;
+		if (!m_free.empty())
+		{
+			slot = m_free.back();
+			m_free.pop_back();
+		}
+		else if (m_end < m_capacity)
+			slot = m_end++;
+		else
+			break;
+
+		// sqrt so the disc is evenly covered, not crowded at its center
+		const float distance = radius * std::sqrt(NextRandom());
+		const float angle = 6.28318531f * NextRandom();
+		m_x[slot] = std::min(std::max(x + distance * std::cos(angle), 1.0f), last);
+		m_y[slot] = std::min(std::max(y + distance * std::sin(angle), 1.0f), last);
+		m_steps_left[slot] = std::max(lifetime, 1);
+	}
+	m_count += emitted;
+	return emitted;
+}
+
+void TracerSystem::Advect(const float* velocX, const float* velocY, int n, float dt)
+{
+	if (m_count == 0)
+		return;
+	const int end = m_end;
+	m_thread_pool->Run([&](int thread, int threads) {
+		// Bands of whole vectors, so only the last one has a scalar tail
+		const auto band = ThreadPool::Band(0, (end + VECTOR - 1) / VECTOR, thread, threads);
+		const int begin = band.first * VECTOR;
+		const int stop = std::min(band.second * VECTOR, end);
+		if (begin < stop)
+		{
+			if (m_advect_kernel)
+				m_advect_kernel(n, m_x.data(), m_y.data(), velocX, velocY, dt, begin, stop);
+			else
+				kernels::AdvectTracers(n, m_x.data(), m_y.data(), velocX, velocY, dt, begin, stop);
+		}
+
+		int expired = 0;
+		std::int32_t* stepsLeft = m_steps_left.data();
+		for (int slot = begin; slot < stop; slot++)
+			if (stepsLeft[slot] > 0 && --stepsLeft[slot] == 0)
+				m_expired[begin + expired++] = slot;
+		m_expired_bands[thread] = { std::min(begin, end), expired };
+	});
+
+	for (const std::pair<int, int>& band : m_expired_bands)
+	{
+		m_free.insert(m_free.end(), m_expired.data() + band.first, m_expired.data() + band.first + band.second);
+		m_count -= band.second;
+	}
+}
+
+void TracerSystem::Splat(std::uint32_t* pixels, int width, int height, int n, std::uint32_t color)
+{
+	if (m_count == 0 || width <= 0 || height <= 0)
+		return;
+	const std::size_t area = static_cast<std::size_t>(width) * height;
+	const std::size_t stride = area + 1;
+	const int threadCount = m_thread_pool->GetThreadCount();
+	// Only reallocated when the view size changes
+	if (m_coverage.size() != stride * threadCount)
+		m_coverage.assign(stride * threadCount, 0);
+
+	const float scaleX = static_cast<float>(width) / n;
+	const float scaleY = static_cast<float>(height) / n;
+	const int end = m_end;
+	m_thread_pool->Run([&](int thread, int threads) {
+		// Each thread counts its band of tracers on its own copy of the frame, no atomics
+		std::uint8_t* counts = m_coverage.data() + stride * thread;
+		std::fill_n(counts, area, 0);
+		const auto band = ThreadPool::Band(0, end, thread, threads);
+		for (int slot = band.first; slot < band.second; slot++)
+		{
+			// Cell centers at (i + 0.5) / n of the frame, as the density is drawn
+			const int x = std::min(std::max(static_cast<int>((m_x[slot] + 0.5f) * scaleX), 0), width - 1);
+			const int y = std::min(std::max(static_cast<int>((m_y[slot] + 0.5f) * scaleY), 0), height - 1);
+			const std::size_t pixel = m_steps_left[slot] > 0 ? static_cast<std::size_t>(y) * width + x : area;
+			counts[pixel] += counts[pixel] != 255;
+		}
+		m_thread_pool->Barrier();
+
+		// Then the frame in row bands, the counts of every thread summed
+		const auto rows = ThreadPool::Band(0, height, thread, threads);
+		for (int y = rows.first; y < rows.second; y++)
+		{
+			std::uint32_t* row = pixels + static_cast<std::size_t>(y) * width;
+			for (int x = 0; x < width; x++)
+			{
+				const std::size_t pixel = static_cast<std::size_t>(y) * width + x;
+				int count = 0;
+				for (int other = 0; other < threads; other++)
+					count += m_coverage[stride * other + pixel];
+				if (count == 0)
+					continue;
+				const std::uint32_t alpha = m_coverage_alpha[std::min(count, 255)];
+				const auto blend = [alpha](std::uint32_t back, std::uint32_t front) { return (back * (255 - alpha) + front * alpha + 127) / 255; };
+				const std::uint32_t back = row[x];
+				row[x] = (back & 0xff000000u)
+					| blend(back >> 16 & 0xff, color >> 16 & 0xff) << 16
+					| blend(back >> 8 & 0xff, color >> 8 & 0xff) << 8
+					| blend(back & 0xff, color & 0xff);
+			}
+		}
+	});
+}
+
+void TracerSystem::Clear() noexcept
+{
+	m_steps_left.Clear();
+	m_free.clear();
+	m_end = 0;
+	m_count = 0;
+	m_random = 0x9e3779b9u;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "aligned_buffer.hpp"
+#include "cpu_features.hpp"
+#include "simd_kernels.hpp"
+#include "thread_pool.hpp"
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Passive tracers carried by a fluid's velocity field, drawn as points over the density.
+	*
+	*	A fixed pool of capacity tracers stored as structure of arrays (x, y and steps left, each contiguous and aligned),
+	*	so the integration streams whole vectors of tracers. Emit takes slots from a free list, refilled with the slots of
+	*	the tracers that expire, and past its capacity stops emitting: once running, nothing is allocated. Slots [0, end)
+	*	are integrated whether alive or not, the free ones are cheaper to move than to skip.
+	*
+	*	Advect is midpoint RK2 with bilinear velocity sampling (kernels::AdvectTracers, vectorized for the SIMD level),
+	*	and Splat counts the tracers per pixel and blends a color over the frame by coverage, a single pass over the pool
+	*	instead of a draw call per tracer. Both are split into bands over the system's own thread pool.
+	*/
+	class TracerSystem {
+	public:
+		inline static constexpr const int DEFAULT_CAPACITY = 1 << 20;
+
+	public:
+		// threads 0 uses every hardware thread
+		explicit TracerSystem(int capacity = DEFAULT_CAPACITY, int threads = 0);
+
+		TracerSystem(const TracerSystem&) = delete;
+		TracerSystem& operator=(const TracerSystem&) = delete;
+
+	public:
+		/**
+		*	Emits up to count tracers spread evenly over the disc of radius around (x, y), in cells of an n*n grid, each living
+		*	for lifetime calls to Advect. They are clamped into the interior as Advect keeps them. Returns how many were emitted,
+		*	fewer once the pool is full.
+		*/
+		int Emit(int n, float x, float y, float radius, int count, int lifetime) noexcept;
+
+		// Moves every tracer through an n*n velocity field by dt (the dt the fluid advects with), then ages them by one step
+		void Advect(const float* velocX, const float* velocY, int n, float dt);
+
+		/**
+		*	Blends color (0xAARRGGBB, its alpha ignored) over width * height pixels (row major, an n*n grid stretched over them)
+		*	wherever tracers are, more opaque the more tracers share a pixel.
+		*/
+		void Splat(std::uint32_t* pixels, int width, int height, int n, std::uint32_t color);
+
+		// Frees every tracer, the emission sequence restarts
+		void Clear() noexcept;
+
+		int get_capacity() const noexcept { return m_capacity; }
+		// Tracers alive
+		int get_count() const noexcept { return m_count; }
+		int get_thread_count() const noexcept { return m_thread_pool->GetThreadCount(); }
+
+		// Clamped to what the CPU supports, like Fluid::set_simd_level
+		void set_simd_level(SimdLevel level) noexcept;
+		SimdLevel get_simd_level() const noexcept { return m_simd_level; }
+
+	private:
+		// Uniform in [0, 1), xorshift: emission only needs to look random
+		float NextRandom() noexcept;
+
+	private:
+		std::unique_ptr<ThreadPool> m_thread_pool;
+		int m_capacity;
+		int m_end = 0; // Slots [0, m_end) have been used
+		int m_count = 0;
+
+		AlignedBuffer<float> m_x;
+		AlignedBuffer<float> m_y;
+		AlignedBuffer<std::int32_t> m_steps_left; // 0 for a free slot
+		std::vector<int> m_free; // Reserved to the capacity
+		AlignedBuffer<int> m_expired; // Slots expired during Advect, each thread's listed from its band's first slot
+		std::vector<std::pair<int, int>> m_expired_bands; // Per thread, first slot and count in m_expired
+
+		std::vector<std::uint8_t> m_coverage; // Per thread, tracers per pixel (saturated) plus a slot the free tracers land in
+		std::array<std::uint8_t, 256> m_coverage_alpha; // Tracers per pixel to blend alpha
+
+		std::uint32_t m_random = 0x9e3779b9u;
+		SimdLevel m_simd_level = SimdLevel::Scalar;
+		kernels::AdvectTracersFn m_advect_kernel = nullptr; // nullptr: scalar
+	};
+}
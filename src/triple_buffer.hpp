@@ -0,0 +1,45 @@
+#pragma once
+#include <atomic>
+
+namespace xtd_fluid_simulation {
+	/**
+	*	Lock-free hand-off of whole values from one producer thread to one consumer thread.
+	*	The producer fills Back() and publishes it, the consumer reads Front() after Acquire().
+	*	The third (middle) slot holds the latest published value, so neither side ever waits
+	*	for the other and the consumer always gets the newest complete value.
+	*/
+	template<typename T>
+	class TripleBuffer {
+	public:
+		TripleBuffer() = default;
+		// Starts all three slots from value (e.g. preallocated buffers)
+		explicit TripleBuffer(const T& value) : m_slots{ value, value, value } {}
+
+	public:
+		// Producer side
+		T& Back() noexcept { return m_slots[m_back]; }
+		void Publish() noexcept
+		{
+			m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel) & INDEX;
+		}
+
+		// Consumer side, swaps in the latest published value if any, returns whether Front() changed
+		bool Acquire() noexcept
+		{
+			if (!(m_middle.load(std::memory_order_relaxed) & FRESH))
+				return false;
+			m_front = m_middle.exchange(m_front, std::memory_order_acq_rel) & INDEX;
+			return true;
+		}
+		const T& Front() const noexcept { return m_slots[m_front]; }
+
+	private:
+		inline static constexpr const int INDEX = 3;
+		inline static constexpr const int FRESH = 4;
+
+		T m_slots[3];
+		int m_back = 0; // Producer only
+		std::atomic<int> m_middle{ 1 };
+		int m_front = 2; // Consumer only
+	};
+}
@@ -0,0 +1,140 @@
+#include "upscaler.hpp"
+#include <algorithm>	// std::min, std::max
+#include <cmath>	// std::floor
+#include <type_traits>	// std::integral_constant
+using namespace xtd_fluid_simulation;
+
+namespace {
+	/**
+	*	Taps of count output coordinates over n cells, pixel centers on cell centers. Taps falling off the grid
+	*	are folded into the edge cell (clamp to edge), and the first tap shifted so all of them are on the grid.
+	*/
+	template<typename Taps>
+	void AxisTaps(int n, int count, int tapCount, UpscaleFilter filter, std::vector<Taps>& taps)
+	{
+		taps.resize(count);
+		const float scale = static_cast<float>(n) / count;
+		for (int index = 0; index < count; index++)
+		{
+			const float u = (index + 0.5f) * scale - 0.5f;
+			float raw[4] = { 1.0f, 0.0f, 0.0f, 0.0f };
+			int rawFirst;
+			if (filter == UpscaleFilter::Nearest)
+				rawFirst = static_cast<int>(std::floor(u + 0.5f));
+			else
+			{
+				const float cell = std::floor(u);
+				const float t = u - cell;
+				rawFirst = static_cast<int>(cell) - (tapCount / 2 - 1);
+				if (filter == UpscaleFilter::Bilinear)
+				{
+					raw[0] = 1.0f - t;
+					raw[1] = t;
+				}
+				else
+				{
+					// Catmull-Rom
+					const float t2 = t * t, t3 = t2 * t;
+					raw[0] = 0.5f * (-t3 + 2.0f * t2 - t);
+					raw[1] = 0.5f * (3.0f * t3 - 5.0f * t2 + 2.0f);
+					raw[2] = 0.5f * (-3.0f * t3 + 4.0f * t2 + t);
+					raw[3] = 0.5f * (t3 - t2);
+				}
+			}
+
+			Taps& tap = taps[index];
+			tap.first = std::min(std::max(rawFirst, 0), n - tapCount);
+			std::fill_n(tap.weights, 4, 0.0f);
+			for (int k = 0; k < tapCount; k++)
+			{
+				const int cell = std::min(std::max(rawFirst + k, 0), n - 1);
+				tap.weights[cell - tap.first] += raw[k];
+			}
+		}
+	}
+
+	// Column pass of grid rows [rowBegin, rowEnd): out[j * width + x] = sum of weights * row j at the taps of column x
+	template<int TAPS, typename Taps>
+	void FilterColumns(const float* density, int n, const Taps* columns, int width, float* out, int rowBegin, int rowEnd) noexcept
+	{
+		for (int j = rowBegin; j < rowEnd; j++)
+		{
+			const float* row = density + static_cast<std::size_t>(j) * n;
+			float* filtered = out + static_cast<std::size_t>(j) * width;
+			for (int x = 0; x < width; x++)
+			{
+				const float* cells = row + columns[x].first;
+				float value = 0.0f;
+				for (int k = 0; k < TAPS; k++)
+					value += columns[x].weights[k] * cells[k];
+				filtered[x] = value;
+			}
+		}
+	}
+
+	// Row pass of output rows [rowBegin, rowEnd), through the palette
+	template<int TAPS, typename Taps>
+	void FilterRows(const float* filtered, const Taps* rows, const std::uint32_t* palette, std::uint32_t* pixels, int width, int rowBegin, int rowEnd) noexcept
+	{
+		for (int y = rowBegin; y < rowEnd; y++)
+		{
+			const Taps& tap = rows[y];
+			const float* in[TAPS];
+			for (int k = 0; k < TAPS; k++)
+				in[k] = filtered + static_cast<std::size_t>(tap.first + k) * width;
+			std::uint32_t* out = pixels + static_cast<std::size_t>(y) * width;
+			for (int x = 0; x < width; x++)
+			{
+				float value = 0.0f;
+				for (int k = 0; k < TAPS; k++)
+					value += tap.weights[k] * in[k][x];
+				// Clamped like fluid_renderer's one pixel per cell path, bicubic overshoot included
+				out[x] = palette[static_cast<int>(std::min(std::max(value, 0.0f), 255.0f))];
+			}
+		}
+	}
+}
+
+Upscaler::Upscaler(int threads)
+	:
+	m_thread_pool(new ThreadPool(threads))
+{
+}
+
+void Upscaler::BuildTaps(int n, int width, int height, UpscaleFilter filter)
+{
+	if (n == m_n && width == m_width && height == m_height && filter == m_filter)
+		return;
+	m_n = n;
+	m_width = width;
+	m_height = height;
+	m_filter = filter;
+	m_tap_count = filter == UpscaleFilter::Bicubic ? 4 : filter == UpscaleFilter::Bilinear ? 2 : 1;
+	AxisTaps(n, width, m_tap_count, filter, m_columns);
+	AxisTaps(n, height, m_tap_count, filter, m_rows);
+	if (m_filtered.size() != static_cast<std::size_t>(n) * width)
+		m_filtered = AlignedBuffer<float>(static_cast<std::size_t>(n) * width);
+}
+
+void Upscaler::Resample(const float* density, int n, const std::uint32_t* palette, std::uint32_t* pixels, int width, int height, UpscaleFilter filter)
+{
+	if (n < 4 || width <= 0 || height <= 0)
+		return;
+	BuildTaps(n, width, height, filter);
+
+	const auto run = [&](auto taps) {
+		constexpr int TAPS = decltype(taps)::value;
+		m_thread_pool->ParallelFor(0, n, [&](int rowBegin, int rowEnd) {
+			FilterColumns<TAPS>(density, n, m_columns.data(), width, m_filtered.data(), rowBegin, rowEnd);
+		});
+		m_thread_pool->ParallelFor(0, height, [&](int rowBegin, int rowEnd) {
+			FilterRows<TAPS>(m_filtered.data(), m_rows.data(), palette, pixels, width, rowBegin, rowEnd);
+		});
+	};
+	switch (m_tap_count)
+	{
+		case 4: run(std::integral_constant<int, 4>{}); break;
+		case 2: run(std::integral_constant<int, 2>{}); break;
+		default: run(std::integral_constant<int, 1>{}); break;
+	}
+}
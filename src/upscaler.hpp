@@ -0,0 +1,61 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "aligned_buffer.hpp"
+#include "thread_pool.hpp"
+
+namespace xtd_fluid_simulation {
+	// How Upscaler samples the density between cell centers
+	enum class UpscaleFilter {
+		Nearest, // The cell under the pixel, blocky
+		Bilinear, // 2x2 cells, smooth but the cell grid still shows as creases
+		Bicubic, // 4x4 cells, Catmull-Rom: smooth gradients, a little overshoot at sharp edges (clamped)
+	};
+
+	/**
+	*	Samples an n*n density field at any output resolution into 0xAARRGGBB pixels, through a 256 entry palette
+	*	indexed by the density clamped to [0, 255], so the view size no longer follows the grid size.
+	*
+	*	Filters are separable: the columns are filtered first, one row of width values per grid row, then each output row
+	*	is a weighted sum of 2 or 4 of those rows, contiguous and branch free. Both passes are split into row bands over
+	*	its own thread pool (the simulation keeps its own). Taps and weights are cached per (n, width, height, filter),
+	*	so resampling the same view every frame does not allocate.
+	*/
+	class Upscaler {
+	public:
+		// threads 0 uses every hardware thread
+		explicit Upscaler(int threads = 0);
+
+		Upscaler(const Upscaler&) = delete;
+		Upscaler& operator=(const Upscaler&) = delete;
+
+	public:
+		/**
+		*	Fills width * height pixels (row major, stride width) from density (n * n, row major).
+		*	Pixel centers map onto cell centers, so the field covers the whole output edge to edge.
+		*/
+		void Resample(const float* density, int n, const std::uint32_t* palette, std::uint32_t* pixels, int width, int height, UpscaleFilter filter);
+
+		int get_thread_count() const noexcept { return m_thread_pool->GetThreadCount(); }
+
+	private:
+		// First tap and weights of one output coordinate along an axis
+		struct Taps {
+			int first;
+			float weights[4];
+		};
+
+		void BuildTaps(int n, int width, int height, UpscaleFilter filter);
+
+	private:
+		std::unique_ptr<ThreadPool> m_thread_pool;
+
+		int m_n = 0, m_width = 0, m_height = 0;
+		UpscaleFilter m_filter = UpscaleFilter::Nearest;
+		int m_tap_count = 0; // 1, 2 or 4
+		std::vector<Taps> m_columns; // Per output column, first tap clamped so every tap is on the grid
+		std::vector<Taps> m_rows; // Per output row
+		AlignedBuffer<float> m_filtered; // n rows of width column filtered values
+	};
+}